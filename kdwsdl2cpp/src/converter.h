@@ -60,6 +60,11 @@ private:
 
     void convertComplexType(const XSD::ComplexType *);
     void createComplexTypeSerializer(KODE::Class &, const XSD::ComplexType *);
+    void createComplexTypeStreamDeserializer(KODE::Class &, const XSD::ComplexType *, const XSD::Element::List &elements);
+    void createComplexTypeStreamSerializer(KODE::Class &, const XSD::ComplexType *, const XSD::Element::List &elements);
+    bool complexTypeQualifiesElement(const QName &typeName) const;
+    bool complexTypeReadsQNames(const QName &typeName) const;
+    bool complexTypeReadsQNames(const QName &typeName, QSet<QName> &visited) const;
 
     void convertSimpleType(const XSD::SimpleType *, const XSD::SimpleType::List &simpleTypeList);
     void createSimpleTypeSerializer(KODE::Class &, const XSD::SimpleType *, const XSD::SimpleType::List &simpleTypeList);
@@ -90,12 +95,18 @@ private:
 
     QString listTypeFor(const QString &itemTypeName, KODE::Class &newClass);
     KODE::Code deserializeRetVal(const KWSDL::Part &part, const QString &replyMsgName, const QString &qtRetType, const QString &varName) const;
+    bool canStreamDeserializeRetVal(const KWSDL::Part &part) const;
+    KODE::Code streamDeserializeRetVal(const QString &qtRetType, const QString &varName, bool rpcStyle) const;
+    bool canStreamSerializeParts(const Part::List &parts, SoapBinding::Style bindingStyle) const;
+    KODE::Code streamSerializeParts(const Part::List &parts, const QStringList &varNames, SoapBinding::Style bindingStyle,
+                                    const QString &messageVarName, const QString &capture) const;
     QName elementNameForPart(const Part &part, bool *qualified, bool *nillable) const;
     bool isQualifiedPart(const Part &part) const;
 
     // Server Stub
     void convertServerService();
     void generateServerMethod(KODE::Code &code, const Binding &binding, const Operation &operation, KODE::Class &newClass, bool first);
+    KODE::Code serializeResponse(const Part &retPart, const Binding &binding, const Message &outputMessage, const QString &responseVarName);
     void generateDelayedReponseMethod(const QString &methodName, const QString &retInputType, const Part &retPart, KODE::Class &newClass,
                                       const Binding &binding, const Message &outputMessage);
 
@@ -11,6 +11,8 @@
 #include <QDebug>
 #include <code_generation/style.h>
 
+#include <algorithm>
+
 using namespace KWSDL;
 
 SoapBinding::Style Converter::soapStyle(const Binding &binding) const
@@ -124,6 +126,12 @@ bool Converter::convertClientService()
             newClass.addInclude(QLatin1String("KDSoapClient/KDSoapValue.h"), QLatin1String("KDSoapValue"));
             newClass.addInclude(QLatin1String("KDSoapClient/KDSoapPendingCallWatcher.h"), QLatin1String("KDSoapPendingCallWatcher"));
             newClass.addInclude(QLatin1String("KDSoapClient/KDSoapNamespaceManager.h"));
+            if (Settings::self()->generateStreamDeserializers()) {
+                newClass.addInclude(QLatin1String("QtCore/QXmlStreamReader"));
+            }
+            if (Settings::self()->generateStreamSerializers()) {
+                newClass.addInclude(QLatin1String("QtCore/QXmlStreamWriter"));
+            }
 
             // Variables (which will go into the d pointer)
             KODE::MemberVariable clientInterfaceVar(QLatin1String("m_clientInterface"), QLatin1String("KDSoapClientInterface*"));
@@ -471,9 +479,20 @@ bool Converter::convertClientService()
                     slot.addArgument(QLatin1String("KDSoapPendingCallWatcher* watcher"));
                     KODE::Code slotCode;
                     slotCode += QLatin1String("watcher->deleteLater();");
-                    slotCode += QLatin1String("KDSoapMessage _reply = watcher->returnMessage();");
                     const Part::List outputParts = selectedParts(binding, outputMsg, operation, false /*input*/);
                     const SoapBinding::Headers outputHeaders = getOutputHeaders(binding, operationName);
+                    // With -stream-deserializers, a single result of a complex type is read directly from the response
+                    const bool streamResult = outputParts.count() == 1 && canStreamDeserializeRetVal(outputParts.first());
+                    if (streamResult) {
+                        const Part &part = outputParts.first();
+                        const KODE::MemberVariable member(mNameMapper.escape(QLatin1String("result") + upperlize(part.name())), QString());
+                        jobClass.addInclude(QLatin1String("QtCore/QXmlStreamReader"));
+                        slotCode.addBlock(streamDeserializeRetVal(mTypeMap.localType(part.type(), part.element()), member.name(),
+                                                                  soapStyle(binding) == SoapBinding::RPCStyle));
+                        slotCode += QLatin1String("KDSoapMessage _reply = watcher->returnMessage(_bodyReader);");
+                    } else {
+                        slotCode += QLatin1String("KDSoapMessage _reply = watcher->returnMessage();");
+                    }
 
                     if (!outputParts.isEmpty() || !outputHeaders.isEmpty()) {
                         slotCode += QLatin1String("if (!_reply.isFault()) {") + COMMENT;
@@ -483,7 +502,7 @@ bool Converter::convertClientService()
                             if (soapStyle(binding) == SoapBinding::RPCStyle /*adds a wrapper*/) {
                                 Q_ASSERT(outputParts.count() == 1);
                                 // Protect the call to .at(0) below
-                                slotCode += "if (_reply.childValues().isEmpty()) {";
+                                slotCode += streamResult ? "if (!_hasReturnValue) {" : "if (_reply.childValues().isEmpty()) {";
                                 slotCode.indent();
                                 slotCode += "_reply.setFault(true);" + COMMENT;
                                 slotCode += "_reply.addArgument(QString::fromLatin1(\"faultcode\"), QString::fromLatin1(\"Server.EmptyResponse\"));";
@@ -491,14 +510,18 @@ bool Converter::convertClientService()
                                 slotCode.unindent();
                                 slotCode += "}";
 
-                                slotCode += QLatin1String("_reply = _reply.childValues().at(0);") + COMMENT;
+                                if (!streamResult) {
+                                    slotCode += QLatin1String("_reply = _reply.childValues().at(0);") + COMMENT;
+                                }
                             }
 
                             for (const Part &part : qAsConst(outputParts)) {
                                 const QString varName = mNameMapper.escape(QLatin1String("result") + upperlize(part.name()));
                                 const KODE::MemberVariable member(varName, QString());
-                                slotCode.addBlock(
-                                    deserializeRetVal(part, QLatin1String("_reply"), mTypeMap.localType(part.type(), part.element()), member.name()));
+                                if (!streamResult) { // otherwise read by _bodyReader
+                                    slotCode.addBlock(deserializeRetVal(part, QLatin1String("_reply"), mTypeMap.localType(part.type(), part.element()),
+                                                                        member.name()));
+                                }
 
                                 addJobResultMember(jobClass, part, varName, inputGetters);
                             }
@@ -631,10 +654,12 @@ void Converter::clientGenerateMessage(KODE::Code &code, const Binding &binding,
 {
     code += "KDSoapMessage message;";
 
+    bool isEncoded = false;
     if (binding.type() == Binding::SOAPBinding) {
         const SoapBinding soapBinding = binding.soapBinding();
         const SoapBinding::Operation op = soapBinding.operations().value(operation.name());
         if (op.input().use() == SoapBinding::EncodedUse) {
+            isEncoded = true;
             code += "message.setUse(KDSoapMessage::EncodedUse);";
         } else {
             code += "message.setUse(KDSoapMessage::LiteralUse);";
@@ -646,9 +671,27 @@ void Converter::clientGenerateMessage(KODE::Code &code, const Binding &binding,
         }
     }
 
+    const Part::List parts = selectedParts(binding, message, operation, true /*input*/);
+
+    // With -stream-serializers, the parts of literal messages are written directly to the XML stream when the message is sent
+    if (!isEncoded && canStreamSerializeParts(parts, soapStyle(binding))) {
+        Part::List streamedParts;
+        QStringList varNames;
+        for (const Part &part : parts) {
+            if (mTypeMap.localType(part.type(), part.element()) != QLatin1String("void")) {
+                streamedParts.append(part);
+                varNames.append(varsAreMembers ? KODE::MemberVariable::memberVariableName(part.name()) : mNameMapper.escape(lowerlize(part.name())));
+            }
+        }
+        // The message is sent before the job's doStart() or the call returns, so the job's members don't need to be copied
+        const QString capture = varsAreMembers ? QString::fromLatin1("this") : varNames.join(QLatin1String(", "));
+        code.addBlock(streamSerializeParts(streamedParts, varNames, soapStyle(binding), QLatin1String("message"), capture));
+        return;
+    }
+
     bool isBuiltin = false;
 
-    for (const Part &part : selectedParts(binding, message, operation, true /*input*/)) {
+    for (const Part &part : parts) {
         isBuiltin = isBuiltin || mTypeMap.isBuiltinType(part.type(), part.element());
         addMessageArgument(code, soapStyle(binding), part, part.name(), "message", varsAreMembers);
     }
@@ -683,6 +726,99 @@ KODE::Code Converter::deserializeRetVal(const KWSDL::Part &part, const QString &
     return code;
 }
 
+bool Converter::canStreamDeserializeRetVal(const KWSDL::Part &part) const
+{
+    if (!Settings::self()->generateStreamDeserializers() || !mTypeMap.isComplexType(part.type(), part.element())
+        || mTypeMap.isPolymorphic(part.type(), part.element())) {
+        return false;
+    }
+    // Types with QNames have no stream deserializer, see complexTypeReadsQNames
+    const QName typeName = part.type().isEmpty() ? mWSDL.findElement(part.element()).type() : part.type();
+    return !complexTypeReadsQNames(typeName);
+}
+
+// The KDSoapBodyReader for a single return value, to read it directly from the XML stream (-stream-deserializers)
+// In RPC style, the return value is the first child of the wrapper, and _hasReturnValue tells whether there is one.
+KODE::Code Converter::streamDeserializeRetVal(const QString &qtRetType, const QString &varName, bool rpcStyle) const
+{
+    KODE::Code code;
+    if (rpcStyle) {
+        code += "bool _hasReturnValue = false;";
+    }
+    code += "const KDSoapBodyReader _bodyReader = [&](QXmlStreamReader &reader) {";
+    code.indent();
+    code += varName + QLatin1String(" = ") + qtRetType + QLatin1String("();") + COMMENT; // in case the response is read twice
+    if (rpcStyle) {
+        code += "_hasReturnValue = reader.readNextStartElement();";
+        code += "if (_hasReturnValue) {";
+        code.indent();
+        code += varName + QLatin1String(".deserialize(reader);") + COMMENT;
+        code += "reader.skipCurrentElement(); // the other children of the wrapper";
+        code.unindent();
+        code += "}";
+    } else {
+        code += varName + QLatin1String(".deserialize(reader);") + COMMENT;
+    }
+    code.unindent();
+    code += "};";
+    return code;
+}
+
+bool Converter::canStreamSerializeParts(const Part::List &parts, SoapBinding::Style bindingStyle) const
+{
+    if (!Settings::self()->generateStreamSerializers()) {
+        return false;
+    }
+    auto canStream = [this](const Part &part) {
+        return mTypeMap.isComplexType(part.type(), part.element()) && !mTypeMap.isPolymorphic(part.type(), part.element());
+    };
+    if (bindingStyle == SoapBinding::DocumentStyle) {
+        // The part is the message itself
+        return parts.count() == 1 && canStream(parts.first());
+    }
+    // RPC: all the parts are written by the body writer, worth it if one of them is a complex type
+    return std::any_of(parts.begin(), parts.end(), canStream);
+}
+
+// The KDSoapBodyWriter for the parts of a literal message (-stream-serializers), which captures the variables of the parts
+// In document style, the message element is the element of the part, in RPC style it's the wrapper set by the caller.
+KODE::Code Converter::streamSerializeParts(const Part::List &parts, const QStringList &varNames, SoapBinding::Style bindingStyle,
+                                           const QString &messageVarName, const QString &capture) const
+{
+    KODE::Code code;
+    if (bindingStyle == SoapBinding::DocumentStyle) {
+        Q_ASSERT(parts.count() == 1);
+        bool qualified, nillable;
+        const QName elemName = elementNameForPart(parts.first(), &qualified, &nillable);
+        code += messageVarName + QLatin1String(" = KDSoapValue(QString::fromLatin1(\"") + elemName.localName() + QLatin1String("\"), QVariant());");
+        code += messageVarName + QLatin1String(".setNamespaceUri(") + namespaceString(elemName.nameSpace()) + QLatin1String(");");
+        if (qualified) {
+            code += messageVarName + QLatin1String(".setQualified(true);");
+        }
+    }
+    code += messageVarName + QLatin1String(".setBodyWriter([") + capture + QLatin1String("](QXmlStreamWriter &writer, const QString &messageNamespace) {");
+    code.indent();
+    if (bindingStyle == SoapBinding::DocumentStyle) {
+        code += varNames.first() + QLatin1String(".writeTo(writer, messageNamespace);") + COMMENT;
+    } else {
+        for (int i = 0; i < parts.count(); ++i) {
+            const Part &part = parts.at(i);
+            bool qualified, nillable;
+            const QName elemName = elementNameForPart(part, &qualified, &nillable);
+            ElementArgumentSerializer serializer(mTypeMap, part.type(), part.element(), varNames.at(i), varNames.at(i) + QLatin1String("_nil"));
+            serializer.setElementName(elemName);
+            serializer.setIsQualified(qualified);
+            serializer.setQualifiedByType(complexTypeQualifiesElement(part.type()));
+            serializer.setNillable(nillable);
+            serializer.setOptional(false); // Don't omit entire parts, like serializePart
+            code.addBlock(serializer.generateStreamWriterCode(QLatin1String("writer"), QLatin1String("messageNamespace")));
+        }
+    }
+    code.unindent();
+    code += "});";
+    return code;
+}
+
 // Generate synchronous call
 bool Converter::convertClientCall(const Operation &operation, const Binding &binding, KODE::Class &newClass)
 {
@@ -698,18 +834,31 @@ bool Converter::convertClientCall(const Operation &operation, const Binding &bin
     KODE::Code code;
     const bool hasAction = clientAddAction(code, binding, operation.name());
     clientGenerateMessage(code, binding, inputMessage, operation);
+
+    // Return value(s) :
+    const Part::List outParts = selectedParts(binding, outputMessage, operation, false /*output*/);
+    const int numReturnValues = outParts.count();
+
+    // With -stream-deserializers, a single return value of a complex type is read directly from the response
+    const bool streamRetVal = numReturnValues == 1 && canStreamDeserializeRetVal(outParts.first());
+    if (streamRetVal) {
+        const Part &retPart = outParts.first();
+        const QString retType = mTypeMap.localType(retPart.type(), retPart.element());
+        code += retType + QLatin1String(" ret;"); // local var
+        code.addBlock(streamDeserializeRetVal(retType, QLatin1String("ret"), soapStyle(binding) == SoapBinding::RPCStyle));
+    }
+
     QString callLine =
         QLatin1String("d_ptr->m_lastReply = clientInterface()->call(QLatin1String(\"") + operation.name() + QLatin1String("\"), message");
-    if (hasAction) {
+    if (streamRetVal) {
+        callLine += hasAction ? QLatin1String(", action") : QLatin1String(", QString()");
+        callLine += QLatin1String(", KDSoapHeaders(), _bodyReader");
+    } else if (hasAction) {
         callLine += QLatin1String(", action");
     }
     callLine += QLatin1String(");");
     code += callLine;
 
-    // Return value(s) :
-    const Part::List outParts = selectedParts(binding, outputMessage, operation, false /*output*/);
-    const int numReturnValues = outParts.count();
-
     if (numReturnValues == 1) {
         const Part &retPart = outParts.first();
         const QString retType = mTypeMap.localType(retPart.type(), retPart.element());
@@ -727,7 +876,18 @@ bool Converter::convertClientCall(const Operation &operation, const Binding &bin
 
         // WARNING: if you change the logic below, also adapt the result parsing for async calls
 
-        if (retType != QLatin1String("void")) {
+        if (streamRetVal) {
+            if (soapStyle(binding) == SoapBinding::RPCStyle) {
+                code += "if (!_hasReturnValue) {";
+                code.indent();
+                code += "d_ptr->m_lastReply.setFault(true);";
+                code += "d_ptr->m_lastReply.addArgument(QString::fromLatin1(\"faultcode\"), QString::fromLatin1(\"Server.EmptyResponse\"));";
+                code += QLatin1String("return ") + retType + QLatin1String("();"); // default-constructed value
+                code.unindent();
+                code += "}";
+            }
+            code += QLatin1String("return ret;") + COMMENT;
+        } else if (retType != QLatin1String("void")) {
             if (soapStyle(binding) == SoapBinding::DocumentStyle /*no wrapper*/) {
                 code += retType + QLatin1String(" ret;"); // local var
                 code.addBlock(deserializeRetVal(retPart, QLatin1String("d_ptr->m_lastReply"), retType, QLatin1String("ret")));
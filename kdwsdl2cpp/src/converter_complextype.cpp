@@ -730,4 +730,359 @@ void Converter::createComplexTypeSerializer(KODE::Class &newClass, const XSD::Co
 
     deserializeFunc.setBody(demarshalCode);
     newClass.addFunction(deserializeFunc);
+
+    if (Settings::self()->generateStreamDeserializers() && !complexTypeReadsQNames(type->qualifiedName())) {
+        createComplexTypeStreamDeserializer(newClass, type, elements);
+    }
+    if (Settings::self()->generateStreamSerializers()) {
+        createComplexTypeStreamSerializer(newClass, type, elements);
+    }
+}
+
+// Generates deserialize(QXmlStreamReader&), the same as deserialize(const KDSoapValue&) but reading from the stream,
+// for the elements which it can read directly; the others are read into a KDSoapValue first.
+void Converter::createComplexTypeStreamDeserializer(KODE::Class &newClass, const XSD::ComplexType *type, const XSD::Element::List &elements)
+{
+    newClass.addHeaderInclude(QLatin1String("QtCore/QXmlStreamReader"));
+
+    KODE::Function deserializeFunc(QLatin1String("deserialize"), QLatin1String("void"));
+    deserializeFunc.addArgument(QLatin1String("QXmlStreamReader& reader"));
+    if (!type->derivedTypes().isEmpty()) {
+        deserializeFunc.setVirtualMode(KODE::Function::Virtual);
+    }
+    if (!newClass.baseClasses().isEmpty()) {
+        deserializeFunc.setVirtualMode(KODE::Function::Override);
+    }
+
+    KODE::Code demarshalCode;
+
+    const QName baseName = type->baseTypeName();
+    QString valueCode; // for the types derived from a builtin type
+    if (baseName != XmlAnyType && !baseName.isEmpty() && !type->isArray()) {
+        if (mTypeMap.isBuiltinType(baseName)) {
+            valueCode = mTypeMap.deserializeBuiltinFromText(baseName, QName(), QLatin1String("reader.readElementText(QXmlStreamReader::SkipChildElements)"),
+                                                           mTypeMap.localType(baseName));
+        }
+        if (valueCode.isEmpty()) {
+            // The base class (or simple type) only reads from a KDSoapValue
+            demarshalCode += QLatin1String("deserialize(KDSoapValue::fromXml(reader));") + COMMENT;
+            deserializeFunc.setBody(demarshalCode);
+            newClass.addFunction(deserializeFunc);
+            return;
+        }
+    }
+
+    // attributes, which are only available while the reader is on the start element
+    const XSD::Attribute::List attributes = type->attributes();
+    if (!attributes.isEmpty()) {
+        demarshalCode += "const QXmlStreamAttributes attribs = reader.attributes();";
+        demarshalCode += "for (const QXmlStreamAttribute& attrib : attribs) {";
+        demarshalCode.indent();
+        demarshalCode += "const auto _name = attrib.name();";
+
+        bool first = true;
+        for (const XSD::Attribute &attribute : qAsConst(attributes)) {
+            const QString attrName = attribute.name();
+            if (attrName.isEmpty()) {
+                continue;
+            }
+            const QString variableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(attrName);
+            const QString nilVariableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(attrName + "_nil");
+            const bool optional = attribute.attributeUse() == XSD::Attribute::Optional || attribute.attributeUse() == XSD::Attribute::Prohibited;
+
+            demarshalCode.addBlock(demarshalNameTest(attribute.type(), attrName, &first));
+            demarshalCode.indent();
+
+            QString value;
+            if (mTypeMap.isBuiltinType(attribute.type()) && !mTypeMap.isTypeAny(attribute.type())) {
+                value = mTypeMap.deserializeBuiltinFromText(attribute.type(), QName(), QLatin1String("attrib.value().toString()"),
+                                                            mTypeMap.localType(attribute.type()));
+            }
+            if (!value.isEmpty()) {
+                demarshalCode += variableName + QLatin1String(" = ") + value + QLatin1String(";") + COMMENT;
+                if (optional) {
+                    demarshalCode += nilVariableName + QLatin1String(" = false;") + COMMENT;
+                }
+            } else {
+                demarshalCode += QLatin1String("const KDSoapValue val(attrib.name().toString(), attrib.value().toString());") + COMMENT;
+                ElementArgumentSerializer serializer(mTypeMap, attribute.type(), QName(), variableName, nilVariableName);
+                serializer.setOptional(optional);
+                demarshalCode.addBlock(serializer.demarshalVariable("val"));
+            }
+
+            demarshalCode.unindent();
+            demarshalCode += "}";
+        }
+
+        demarshalCode.unindent();
+        demarshalCode += "}";
+    }
+
+    if (!valueCode.isEmpty()) {
+        const QString variableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(QLatin1String("value"));
+        demarshalCode += variableName + QLatin1String(" = ") + valueCode + QLatin1String(";") + COMMENT;
+    } else if (elements.isEmpty()) {
+        demarshalCode += QLatin1String("reader.skipCurrentElement();") + COMMENT;
+    } else {
+        demarshalCode += "while (reader.readNextStartElement()) {";
+        demarshalCode.indent();
+
+        if (type->isArray()) {
+            const XSD::Element elem = elements.first();
+            const QString variableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(elem.name());
+            const QString nilVariableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(elem.name() + "_nil");
+            ElementArgumentSerializer deserializer(mTypeMap, type->arrayType(), QName(), variableName, nilVariableName);
+            deserializer.setOptional(isElementOptional(elem));
+            demarshalCode.addBlock(deserializer.demarshalFromStream(QLatin1String("reader"), true));
+        } else {
+            demarshalCode += "const auto _name = reader.name();";
+            bool first = true;
+            bool hasAny = false;
+            for (const XSD::Element &elem : qAsConst(elements)) {
+                const QString elemName = elem.name();
+                const QString variableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(elemName);
+                const QString nilVariableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(elemName + "_nil");
+
+                hasAny = hasAny || (elem.type().nameSpace() == XMLSchemaURI && elem.type().localName() == QLatin1String("any"));
+                demarshalCode.addBlock(demarshalNameTest(elem.type(), elemName, &first));
+                demarshalCode.indent();
+
+                ElementArgumentSerializer deserializer(mTypeMap, elem.type(), QName(), variableName, nilVariableName);
+                deserializer.setOptional(isElementOptional(elem));
+                if (elem.maxOccurs() > 1 || elem.compositor().maxOccurs() > 1) {
+                    demarshalCode.addBlock(deserializer.demarshalFromStream(QLatin1String("reader"), true));
+                } else {
+                    deserializer.setUsePointer(usePointerForElement(elem, newClass, mTypeMap, false));
+                    demarshalCode.addBlock(deserializer.demarshalFromStream(QLatin1String("reader"), false));
+                }
+
+                demarshalCode.unindent();
+                demarshalCode += "}";
+            }
+            if (!hasAny) {
+                demarshalCode += "else {";
+                demarshalCode.indent();
+                demarshalCode += QLatin1String("reader.skipCurrentElement();") + COMMENT;
+                demarshalCode.unindent();
+                demarshalCode += "}";
+            }
+        }
+
+        demarshalCode.unindent();
+        demarshalCode += "}";
+    }
+
+    deserializeFunc.setBody(demarshalCode);
+    newClass.addFunction(deserializeFunc);
+}
+
+// Generates writeTo(QXmlStreamWriter&), which writes the same XML as serialize() in literal use, but directly to the stream,
+// for the elements and attributes which it can write directly; the others are serialized into a KDSoapValue first.
+void Converter::createComplexTypeStreamSerializer(KODE::Class &newClass, const XSD::ComplexType *type, const XSD::Element::List &elements)
+{
+    newClass.addHeaderInclude(QLatin1String("QtCore/QXmlStreamWriter"));
+
+    KODE::Function writeFunc(QLatin1String("writeTo"), QLatin1String("void"));
+    writeFunc.addArgument(QLatin1String("QXmlStreamWriter& writer"));
+    writeFunc.addArgument(QLatin1String("const QString& messageNamespace"));
+    if (!type->derivedTypes().isEmpty()) {
+        writeFunc.setVirtualMode(KODE::Function::Virtual);
+    }
+    if (!newClass.baseClasses().isEmpty()) {
+        writeFunc.setVirtualMode(KODE::Function::Override);
+    }
+    writeFunc.setConst(true);
+
+    KODE::Code marshalCode;
+
+    const QName baseName = type->baseTypeName();
+    QString valueText; // for the types derived from a builtin type
+    if (baseName != XmlAnyType && !baseName.isEmpty() && !type->isArray()) {
+        if (mTypeMap.isBuiltinType(baseName)) {
+            const QString variableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(QLatin1String("value"));
+            valueText = mTypeMap.serializeBuiltinToText(baseName, QName(), variableName, mTypeMap.localType(baseName));
+        }
+        if (valueText.isEmpty()) {
+            // The base class (or simple type) only serializes into a KDSoapValue, and its attributes come first
+            marshalCode += QLatin1String("serialize(QString()).writeXmlContents(writer, messageNamespace);") + COMMENT;
+            writeFunc.setBody(marshalCode);
+            newClass.addFunction(writeFunc);
+            return;
+        }
+    }
+
+    // attributes, which must be written before the child elements
+    const XSD::Attribute::List attributes = type->attributes();
+    KODE::Code attributesCode;
+    bool attributesFallback = false;
+    for (const XSD::Attribute &attribute : qAsConst(attributes)) {
+        const QString attrName = attribute.name();
+        if (attrName.isEmpty()) {
+            continue;
+        }
+        const QString variableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(attrName);
+        const QString nilVariableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(attrName + "_nil");
+
+        ElementArgumentSerializer serializer(mTypeMap, attribute.type(), QName(), variableName, nilVariableName);
+        serializer.setElementName(attribute.qualifiedName());
+        serializer.setIsQualified(attribute.isQualified());
+        serializer.setNillable(false);
+        serializer.setOptional(attribute.attributeUse() == XSD::Attribute::Optional || attribute.attributeUse() == XSD::Attribute::Prohibited);
+        attributesCode.addBlock(serializer.generateStreamAttributeCode(QLatin1String("writer"), QLatin1String("_attributes"), &attributesFallback));
+    }
+    if (attributesFallback) {
+        marshalCode += QLatin1String("KDSoapValue _attributes; // for the attributes which are written through a KDSoapValue");
+    }
+    marshalCode.addBlock(attributesCode);
+    if (attributesFallback) {
+        marshalCode += QLatin1String("_attributes.writeXmlContents(writer, messageNamespace);") + COMMENT;
+    }
+
+    if (!valueText.isEmpty()) {
+        marshalCode += QLatin1String("const QString _text = ") + valueText + QLatin1String(";");
+        marshalCode += "if (!_text.isEmpty()) {";
+        marshalCode.indent();
+        marshalCode += QLatin1String("writer.writeCharacters(_text);") + COMMENT;
+        marshalCode.unindent();
+        marshalCode += "}";
+    } else if (type->isArray()) {
+        Q_ASSERT(elements.count() == 1);
+        const XSD::Element elem = elements.first();
+        const QString variableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(elem.name());
+        const QName arrayType = type->arrayType();
+
+        marshalCode += QLatin1String("for (int i = 0; i < ") + variableName + QLatin1String(".count(); ++i) {") + COMMENT;
+        marshalCode.indent();
+        ElementArgumentSerializer serializer(mTypeMap, arrayType, QName(), variableName + QLatin1String(".at(i)"), QString());
+        serializer.setElementName(QName(elem.nameSpace(), QLatin1String("item")));
+        serializer.setIsQualified(elem.isQualified());
+        serializer.setQualifiedByType(complexTypeQualifiesElement(arrayType));
+        serializer.setNillable(elem.nillable());
+        serializer.setOptional(false); // if not set, not in array
+        marshalCode.addBlock(serializer.generateStreamWriterCode(QLatin1String("writer"), QLatin1String("messageNamespace")));
+        marshalCode.unindent();
+        marshalCode += '}';
+    } else {
+        for (const XSD::Element &elem : qAsConst(elements)) {
+            const QString elemName = elem.name();
+            const QString variableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(elemName);
+            const QString nilVariableName = QLatin1String("d_ptr->") + KODE::MemberVariable::memberVariableName(elemName + "_nil");
+            const QName qualName = elem.qualifiedName();
+
+            ElementArgumentSerializer serializer(mTypeMap, elem.type(), QName(), variableName, nilVariableName);
+            serializer.setIsQualified(elem.isQualified());
+            serializer.setQualifiedByType(complexTypeQualifiesElement(elem.type()));
+
+            if (elem.maxOccurs() > 1 || elem.compositor().maxOccurs() > 1) {
+                const QString localVariableName = variableName + QLatin1String(".at(i)");
+
+                marshalCode += QLatin1String("for (int i = 0; i < ") + variableName + QLatin1String(".count(); ++i) {") + COMMENT;
+                marshalCode.indent();
+
+                serializer.setLocalVariableName(localVariableName);
+                if (elem.hasSubstitutions()) {
+                    serializer.setDynamicElementName(localVariableName + "->_kd_substitutionElementName()",
+                                                     localVariableName + "->_kd_substitutionElementNameSpace()", qualName);
+                } else {
+                    serializer.setElementName(qualName);
+                }
+                serializer.setOptional(false); // if not set, not in array
+
+                marshalCode.addBlock(serializer.generateStreamWriterCode(QLatin1String("writer"), QLatin1String("messageNamespace")));
+                marshalCode.unindent();
+                marshalCode += '}';
+            } else {
+                if (elem.hasSubstitutions()) {
+                    serializer.setDynamicElementName(variableName + "->_kd_substitutionElementName()",
+                                                     variableName + "->_kd_substitutionElementNameSpace()", qualName);
+                } else {
+                    serializer.setElementName(qualName);
+                }
+                serializer.setOptional(isElementOptional(elem));
+                serializer.setUsePointer(usePointerForElement(elem, newClass, mTypeMap, false));
+                serializer.setNillable(elem.nillable());
+                marshalCode.addBlock(serializer.generateStreamWriterCode(QLatin1String("writer"), QLatin1String("messageNamespace")));
+            }
+        }
+    }
+
+    if (attributes.isEmpty() && elements.isEmpty() && valueText.isEmpty()) {
+        marshalCode += QLatin1String("Q_UNUSED(writer);") + COMMENT;
+        marshalCode += QLatin1String("Q_UNUSED(messageNamespace);");
+    }
+
+    writeFunc.setBody(marshalCode);
+    newClass.addFunction(writeFunc);
+}
+
+// Whether serialize() of this type makes the element qualified: KDSoapValue::setQualified(true) is called
+// when the first element of the type, or of one of its base types, is qualified
+bool Converter::complexTypeQualifiesElement(const QName &typeName) const
+{
+    if (!mTypeMap.isComplexType(typeName)) {
+        return false;
+    }
+    const XSD::ComplexType type = mWSDL.findComplexType(typeName);
+    if (type.isNull()) {
+        return false;
+    }
+    const XSD::Element::List elements = type.elements();
+    for (const XSD::Element &elem : elements) {
+        if (mTypeMap.localType(elem.type()) != QLatin1String("void")) { // see createComplexTypeSerializer
+            if (elem.isQualified()) {
+                return true;
+            }
+            break;
+        }
+    }
+    const QName baseName = type.baseTypeName();
+    if (baseName != XmlAnyType && !baseName.isEmpty() && mTypeMap.isComplexType(baseName)) {
+        return complexTypeQualifiesElement(baseName);
+    }
+    return false;
+}
+
+// Whether the values of this type can contain a QName: in an element or attribute of the type itself, of its base
+// or derived types, or of the types of its elements.
+// The prefix of a QName can be declared on any ancestor element, which the stream deserializers don't keep track of
+// (KDSoapValue::fromXml() only sees the declarations of the element it reads), so these types are only read from a KDSoapValue.
+bool Converter::complexTypeReadsQNames(const QName &typeName) const
+{
+    QSet<QName> visited;
+    return complexTypeReadsQNames(typeName, visited);
+}
+
+bool Converter::complexTypeReadsQNames(const QName &typeName, QSet<QName> &visited) const
+{
+    if (mTypeMap.isQNameType(typeName)) {
+        return true;
+    }
+    if (!mTypeMap.isComplexType(typeName) || visited.contains(typeName)) {
+        return false;
+    }
+    visited.insert(typeName);
+    const XSD::ComplexType type = mWSDL.findComplexType(typeName);
+    if (type.isNull()) {
+        return false;
+    }
+    QList<QName> typeNames;
+    typeNames << type.baseTypeName() << type.arrayType();
+    const auto derivedTypes = type.derivedTypes();
+    for (const QName &derivedTypeName : derivedTypes) {
+        typeNames << derivedTypeName;
+    }
+    const XSD::Element::List elements = type.elements();
+    for (const XSD::Element &elem : elements) {
+        typeNames << elem.type();
+    }
+    const XSD::Attribute::List attributes = type.attributes();
+    for (const XSD::Attribute &attribute : attributes) {
+        typeNames << attribute.type();
+    }
+    for (const QName &name : qAsConst(typeNames)) {
+        if (!name.isEmpty() && complexTypeReadsQNames(name, visited)) {
+            return true;
+        }
+    }
+    return false;
 }
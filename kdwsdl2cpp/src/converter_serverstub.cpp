@@ -45,6 +45,12 @@ void Converter::convertServerService()
             // Files included in the header
             serverClass.addHeaderInclude("QtCore/QObject");
             serverClass.addHeaderInclude("KDSoapServer/KDSoapServerObjectInterface.h");
+            if (Settings::self()->generateServerCoroutines()) {
+                serverClass.addHeaderInclude("KDSoapServer/KDSoapServerTask.h");
+            }
+            if (Settings::self()->generateStreamSerializers()) {
+                serverClass.addInclude("QtCore/QXmlStreamWriter");
+            }
 
             serverClass.addDeclarationMacro("Q_OBJECT");
             serverClass.addDeclarationMacro("Q_INTERFACES(KDSoapServerObjectInterface)");
@@ -179,7 +185,38 @@ void Converter::generateServerMethod(KODE::Code &code, const Binding &binding, c
             retPart = outPart;
         }
         const QString methodCall = methodName + '(' + inputVars.join(", ") + ')';
-        if (retType == "void") {
+        // Coroutine: the response is sent now if it completed without suspending, or once it completes
+        const bool coroutine = Settings::self()->generateServerCoroutines() && retType != "void";
+        if (coroutine) {
+            const QString taskType = "KDSoapServerTask<" + retType + ">";
+            code += taskType + " _task = this->" + methodCall + ";" + COMMENT;
+            code += "if (!_task.isReady()) {";
+            code.indent();
+            code += "const KDSoapDelayedResponseHandle _handle = prepareDelayedResponse();";
+            code += "_task.then(this, [this, _handle](const " + taskType + " &_completedTask) {";
+            code.indent();
+            code += "if (_completedTask.hasFault()) {";
+            code.indent();
+            code += "sendDelayedResponse(_handle, _completedTask.fault().toMessage());";
+            code.unindent();
+            code += "} else {";
+            code.indent();
+            code += methodName + "Response(_handle, _completedTask.result());";
+            code.unindent();
+            code += "}";
+            code.unindent();
+            code += "});";
+            code += "return;";
+            code.unindent();
+            code += "}";
+            code += "if (_task.hasFault()) {";
+            code.indent();
+            code += "const KDSoapServerFault &_fault = _task.fault();";
+            code += "setFault(_fault.faultCode(), _fault.faultString(), _fault.faultActor(), _fault.detail());";
+            code.unindent();
+            code += "}";
+            code += retType + " ret = _task.result();";
+        } else if (retType == "void") {
             code += methodCall + ";" + COMMENT;
         } else {
             code += retType + " ret = " + methodCall + ";" + COMMENT;
@@ -187,19 +224,12 @@ void Converter::generateServerMethod(KODE::Code &code, const Binding &binding, c
         code += "if (!hasFault()) {";
         code.indent();
 
-        // TODO factorize with same code in next method
-        if (soapStyle(binding) == SoapBinding::DocumentStyle) {
-            code.addBlock(serializePart(retPart, "ret", "ret_nil", responseVarName, false));
-        } else {
-            code += QString("KDSoapValue wrapper(\"%1\", QVariant(), \"%2\");").arg(outputMessage.name()).arg(outputMessage.nameSpace());
-            code.addBlock(serializePart(retPart, "ret", "ret_nil", "wrapper.childValues()", true));
-            code += responseVarName + " = wrapper;";
-        }
+        code.addBlock(serializeResponse(retPart, binding, outputMessage, responseVarName));
 
         code.unindent();
         code += "}";
         Q_ASSERT(!retType.isEmpty());
-        virtualMethod.setReturnType(retType);
+        virtualMethod.setReturnType(coroutine ? "KDSoapServerTask<" + retType + ">" : retType);
 
         newClass.addIncludes(mTypeMap.headerIncludes(retPart.type()), mTypeMap.forwardDeclarationsForElement(retPart.element()));
 
@@ -223,16 +253,46 @@ void Converter::generateDelayedReponseMethod(const QString &methodName, const QS
     KODE::Code code;
     code.addLine("KDSoapMessage _response;");
 
-    if (soapStyle(binding) == SoapBinding::DocumentStyle) {
-        code.addBlock(serializePart(retPart, "ret", "ret_nil", "_response", false));
-    } else {
-        code += QString("KDSoapValue wrapper(\"%1\", QVariant(), \"%2\");").arg(outputMessage.name()).arg(outputMessage.nameSpace());
-        code.addBlock(serializePart(retPart, "ret", "ret_nil", "wrapper.childValues()", true));
-        code += "_response = wrapper;";
-    }
+    code.addBlock(serializeResponse(retPart, binding, outputMessage, "_response"));
 
     code.addLine("sendDelayedResponse(responseHandle, _response);");
     delayedMethod.setBody(code);
 
     newClass.addFunction(delayedMethod);
 }
+
+// Fills the response message from the "ret" variable
+KODE::Code Converter::serializeResponse(const Part &retPart, const Binding &binding, const Message &outputMessage, const QString &responseVarName)
+{
+    const SoapBinding::Style style = soapStyle(binding);
+    const QString wrapperCode = QString("KDSoapValue wrapper(\"%1\", QVariant(), \"%2\");").arg(outputMessage.name()).arg(outputMessage.nameSpace());
+
+    KODE::Code code;
+    const bool stream = canStreamSerializeParts(Part::List() << retPart, style);
+    if (stream) {
+        // The use of the response depends on the server settings, only literal use can be streamed
+        code += "if (" + responseVarName + ".use() == KDSoapMessage::LiteralUse) {";
+        code.indent();
+        if (style != SoapBinding::DocumentStyle) {
+            code += wrapperCode;
+            code += responseVarName + " = wrapper;";
+        }
+        // Copy ret, the response could be written after it's gone (delayed responses)
+        code.addBlock(streamSerializeParts(Part::List() << retPart, QStringList() << "ret", style, responseVarName, "ret"));
+        code.unindent();
+        code += "} else {";
+        code.indent();
+    }
+    if (style == SoapBinding::DocumentStyle) {
+        code.addBlock(serializePart(retPart, "ret", "ret_nil", responseVarName, false));
+    } else {
+        code += wrapperCode;
+        code.addBlock(serializePart(retPart, "ret", "ret_nil", "wrapper.childValues()", true));
+        code += responseVarName + " = wrapper;";
+    }
+    if (stream) {
+        code.unindent();
+        code += "}";
+    }
+    return code;
+}
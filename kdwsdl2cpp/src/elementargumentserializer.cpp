@@ -22,6 +22,7 @@ ElementArgumentSerializer::ElementArgumentSerializer(const TypeMap &typeMap, con
     , mNillable(false)
     , mOptional(false)
     , mUsePointer(false)
+    , mQualifiedByType(false)
 {
 }
 
@@ -33,6 +34,7 @@ void ElementArgumentSerializer::setLocalVariableName(const QString &localVarName
 
 void ElementArgumentSerializer::setElementName(const QName &name)
 {
+    mElementName = name;
     mNameArg = QLatin1String("QString::fromLatin1(\"") + name.localName() + QLatin1String("\")");
     mNameNamespace = namespaceString(name.nameSpace());
     mValueVarName = QLatin1String("_value") + upperlize(KODE::Style::makeIdentifier(name.localName()));
@@ -40,6 +42,7 @@ void ElementArgumentSerializer::setElementName(const QName &name)
 
 void ElementArgumentSerializer::setDynamicElementName(const QString &codeLocalName, const QString &codeNamespace, const QName &baseName)
 {
+    mElementName = QName(); // only known at runtime
     mNameArg = codeLocalName;
     mNameNamespace = codeNamespace;
     mValueVarName = QLatin1String("_value") + upperlize(KODE::Style::makeIdentifier(baseName.localName()));
@@ -71,6 +74,11 @@ void ElementArgumentSerializer::setUsePointer(bool usePointer)
     mUsePointer = usePointer;
 }
 
+void ElementArgumentSerializer::setQualifiedByType(bool qualified)
+{
+    mQualifiedByType = qualified;
+}
+
 KODE::Code ElementArgumentSerializer::generateSerializationCode() const
 {
     Q_ASSERT(!mLocalVarName.isEmpty());
@@ -91,44 +99,12 @@ KODE::Code ElementArgumentSerializer::generateSerializationCode() const
         block.unindent();
         block += "}";
     } else {
-        const QName actualType = mType.isEmpty() ? mElementType : mType;
-        // UNUSED const QString typeArgs = namespaceString(actualType.nameSpace()) + QLatin1String(", QString::fromLatin1(\"") +
-        // actualType.localName() + QLatin1String("\")");
-        const bool isComplex = mTypeMap.isComplexType(mType, mElementType);
-        const bool isPolymorphic = mTypeMap.isPolymorphic(mType, mElementType);
-
         if (mAppend && mOptional) {
-            if (mUsePointer) {
-                block += "if (" + mLocalVarName + ") {";
-            } else {
-                block += "if (!" + mNilLocalVarName + ") {" + COMMENT;
-            }
+            block += optionalCheck();
             block.indent();
         }
 
-        if (isComplex) {
-            const QString op = (isPolymorphic || mUsePointer) ? "->" : ".";
-            block += QLatin1String("KDSoapValue ") + mValueVarName + QLatin1Char('(') + mLocalVarName + op + QLatin1String("serialize(") + mNameArg
-                + QLatin1String("));") + COMMENT;
-        } else {
-            if (mTypeMap.isBuiltinType(mType, mElementType)) {
-                const QString value =
-                    mTypeMap.serializeBuiltin(mType, mElementType, mLocalVarName, mNameArg, actualType.nameSpace(), actualType.localName());
-                block += QLatin1String("KDSoapValue ") + mValueVarName + QLatin1String(" = ") + value + QLatin1String(";") + COMMENT;
-            } else {
-                block += QLatin1String("KDSoapValue ") + mValueVarName + QLatin1String(" = ") + mLocalVarName + QLatin1String(".serialize(")
-                    + mNameArg + QLatin1String(");") + COMMENT;
-            }
-        }
-        if (!mNameNamespace.isEmpty()) {
-            block += mValueVarName + QLatin1String(".setNamespaceUri(") + mNameNamespace + QLatin1String(");");
-        }
-        if (mIsQualified) {
-            block += mValueVarName + QLatin1String(".setQualified(true);");
-        }
-        if (mNillable) {
-            block += mValueVarName + QLatin1String(".setNillable(true);");
-        }
+        block.addBlock(valueCreationCode());
         block += varAndMethodBefore + mValueVarName + varAndMethodAfter + QLatin1String(";") + COMMENT;
 
         if (mAppend && mOptional) {
@@ -139,6 +115,147 @@ KODE::Code ElementArgumentSerializer::generateSerializationCode() const
     return block;
 }
 
+KODE::Code ElementArgumentSerializer::generateStreamWriterCode(const QString &writerVarName, const QString &messageNamespaceVarName) const
+{
+    Q_ASSERT(!mLocalVarName.isEmpty());
+    KODE::Code block;
+    if (mTypeMap.isTypeAny(mType)) {
+        block += QLatin1String("if (!") + mLocalVarName + QLatin1String(".isNull()) {");
+        block.indent();
+        block += mLocalVarName + QLatin1String(".writeXml(") + writerVarName + QLatin1String(", ") + messageNamespaceVarName + QLatin1String(");")
+            + COMMENT;
+        block.unindent();
+        block += "}";
+        return block;
+    }
+
+    if (mOptional) {
+        block += optionalCheck();
+        block.indent();
+    }
+
+    // The cases which are written through a KDSoapValue: xsi:nil, substitution groups, polymorphic types, simple types, QName...
+    const bool canWriteElement = !mNillable && !mElementName.isEmpty() && !mTypeMap.isPolymorphic(mType, mElementType);
+    const bool isComplex = mTypeMap.isComplexType(mType, mElementType);
+    const QString text = canWriteElement && !isComplex && mTypeMap.isBuiltinType(mType, mElementType)
+        ? mTypeMap.serializeBuiltinToText(mType, mElementType, mLocalVarName, mTypeMap.localType(mType, mElementType))
+        : QString();
+
+    if (canWriteElement && isComplex) {
+        const QString op = mUsePointer ? "->" : ".";
+        block += writerVarName + QLatin1String(".writeStartElement(") + streamElementNameArgs(messageNamespaceVarName) + QLatin1String(");");
+        block += mLocalVarName + op + QLatin1String("writeTo(") + writerVarName + QLatin1String(", ") + messageNamespaceVarName + QLatin1String(");")
+            + COMMENT;
+        block += writerVarName + QLatin1String(".writeEndElement();");
+    } else if (!text.isEmpty()) {
+        block += writerVarName + QLatin1String(".writeTextElement(") + streamElementNameArgs(messageNamespaceVarName) + QLatin1String(", ") + text
+            + QLatin1String(");") + COMMENT;
+    } else {
+        block.addBlock(valueCreationCode());
+        block += mValueVarName + QLatin1String(".writeXml(") + writerVarName + QLatin1String(", ") + messageNamespaceVarName + QLatin1String(");")
+            + COMMENT;
+    }
+
+    if (mOptional) {
+        block.unindent();
+        block += "}";
+    }
+    return block;
+}
+
+KODE::Code ElementArgumentSerializer::generateStreamAttributeCode(const QString &writerVarName, const QString &fallbackVarName, bool *usesFallback) const
+{
+    Q_ASSERT(!mLocalVarName.isEmpty());
+    KODE::Code block;
+    if (mOptional) {
+        block += optionalCheck();
+        block.indent();
+    }
+
+    const QString text = mTypeMap.isBuiltinType(mType, mElementType) && !mElementName.isEmpty()
+        ? mTypeMap.serializeBuiltinToText(mType, mElementType, mLocalVarName, mTypeMap.localType(mType, mElementType))
+        : QString();
+    if (!text.isEmpty()) {
+        QString nameArgs = QLatin1String("QStringLiteral(\"") + mElementName.localName() + QLatin1String("\")");
+        if (mIsQualified && !mElementName.nameSpace().isEmpty()) {
+            nameArgs.prepend(QLatin1String("QStringLiteral(\"") + mElementName.nameSpace() + QLatin1String("\"), "));
+        }
+        block += writerVarName + QLatin1String(".writeAttribute(") + nameArgs + QLatin1String(", ") + text + QLatin1String(");") + COMMENT;
+    } else {
+        // Written at the end by fallbackVarName.writeXmlContents(), which only has attributes
+        block.addBlock(valueCreationCode());
+        block += fallbackVarName + QLatin1String(".childValues().attributes().append(") + mValueVarName + QLatin1String(");") + COMMENT;
+        *usesFallback = true;
+    }
+
+    if (mOptional) {
+        block.unindent();
+        block += "}";
+    }
+    return block;
+}
+
+QString ElementArgumentSerializer::optionalCheck() const
+{
+    if (mUsePointer) {
+        return "if (" + mLocalVarName + ") {";
+    } else {
+        return "if (!" + mNilLocalVarName + ") {" + COMMENT;
+    }
+}
+
+// The arguments for QXmlStreamWriter::writeStartElement, qualified the same way as KDSoapValue::writeElement does
+QString ElementArgumentSerializer::streamElementNameArgs(const QString &messageNamespaceVarName) const
+{
+    const QString localName = QLatin1String("QStringLiteral(\"") + mElementName.localName() + QLatin1String("\")");
+    const QString nameSpace = mElementName.nameSpace();
+    const bool qualified = mIsQualified || mQualifiedByType;
+    if (nameSpace.isEmpty()) {
+        return qualified ? messageNamespaceVarName + QLatin1String(", ") + localName : localName;
+    }
+    const QString nameSpaceArg = QLatin1String("QStringLiteral(\"") + nameSpace + QLatin1String("\")");
+    if (qualified) {
+        return nameSpaceArg + QLatin1String(", ") + localName;
+    }
+    // Elements in another namespace than the message are always qualified
+    return messageNamespaceVarName + QLatin1String(" == QLatin1String(\"") + nameSpace + QLatin1String("\") ? QString() : ") + nameSpaceArg
+        + QLatin1String(", ") + localName;
+}
+
+KODE::Code ElementArgumentSerializer::valueCreationCode() const
+{
+    KODE::Code block;
+    const QName actualType = mType.isEmpty() ? mElementType : mType;
+    // UNUSED const QString typeArgs = namespaceString(actualType.nameSpace()) + QLatin1String(", QString::fromLatin1(\"") +
+    // actualType.localName() + QLatin1String("\")");
+    const bool isComplex = mTypeMap.isComplexType(mType, mElementType);
+    const bool isPolymorphic = mTypeMap.isPolymorphic(mType, mElementType);
+
+    if (isComplex) {
+        const QString op = (isPolymorphic || mUsePointer) ? "->" : ".";
+        block += QLatin1String("KDSoapValue ") + mValueVarName + QLatin1Char('(') + mLocalVarName + op + QLatin1String("serialize(") + mNameArg
+            + QLatin1String("));") + COMMENT;
+    } else {
+        if (mTypeMap.isBuiltinType(mType, mElementType)) {
+            const QString value = mTypeMap.serializeBuiltin(mType, mElementType, mLocalVarName, mNameArg, actualType.nameSpace(), actualType.localName());
+            block += QLatin1String("KDSoapValue ") + mValueVarName + QLatin1String(" = ") + value + QLatin1String(";") + COMMENT;
+        } else {
+            block += QLatin1String("KDSoapValue ") + mValueVarName + QLatin1String(" = ") + mLocalVarName + QLatin1String(".serialize(") + mNameArg
+                + QLatin1String(");") + COMMENT;
+        }
+    }
+    if (!mNameNamespace.isEmpty()) {
+        block += mValueVarName + QLatin1String(".setNamespaceUri(") + mNameNamespace + QLatin1String(");");
+    }
+    if (mIsQualified) {
+        block += mValueVarName + QLatin1String(".setQualified(true);");
+    }
+    if (mNillable) {
+        block += mValueVarName + QLatin1String(".setNillable(true);");
+    }
+    return block;
+}
+
 QString ElementArgumentSerializer::pointerStorageType(const QString &typeName)
 {
     if (typeName == "QString" || typeName == "bool") {
@@ -203,6 +320,52 @@ KODE::Code ElementArgumentSerializer::demarshalVariable(const QString &soapValue
     }
 }
 
+KODE::Code ElementArgumentSerializer::demarshalFromStream(const QString &readerVarName, bool array) const
+{
+    KODE::Code code;
+    const QString qtTypeName = mTypeMap.localType(mType, mElementType);
+    const bool isPolymorphic = mTypeMap.isPolymorphic(mType, mElementType);
+    bool readFromStream = false;
+    if (mTypeMap.isTypeAny(mType) || isPolymorphic || mUsePointer) {
+        // read into a KDSoapValue, below
+    } else if (mTypeMap.isBuiltinType(mType, mElementType)) {
+        const QString text = readerVarName + QLatin1String(".readElementText(QXmlStreamReader::SkipChildElements)");
+        const QString value = mTypeMap.deserializeBuiltinFromText(mType, mElementType, text, qtTypeName);
+        if (!value.isEmpty()) {
+            if (array) {
+                code += mLocalVarName + QLatin1String(".append(") + value + QLatin1String(");") + COMMENT;
+            } else {
+                code += mLocalVarName + QLatin1String(" = ") + value + QLatin1String(";") + COMMENT;
+            }
+            readFromStream = true;
+        }
+    } else if (mTypeMap.isComplexType(mType, mElementType)) {
+        if (array) {
+            QString tempVar;
+            if (mLocalVarName.startsWith(QLatin1String("d_ptr->"))) {
+                tempVar = mLocalVarName.mid(7) + QLatin1String("Temp");
+            } else {
+                tempVar = mLocalVarName + QLatin1String("Temp");
+            }
+            code += qtTypeName + QLatin1String(" ") + tempVar + QLatin1String(";") + COMMENT;
+            code += tempVar + QLatin1String(".deserialize(") + readerVarName + QLatin1String(");") + COMMENT;
+            code += mLocalVarName + QLatin1String(".append(") + tempVar + QLatin1String(");") + COMMENT;
+        } else {
+            code += mLocalVarName + QLatin1String(".deserialize(") + readerVarName + QLatin1String(");") + COMMENT;
+        }
+        readFromStream = true;
+    }
+
+    if (!readFromStream) {
+        // Simple types, any and polymorphic types (QNames never get here, see Converter::complexTypeReadsQNames)
+        code += QLatin1String("const KDSoapValue val = KDSoapValue::fromXml(") + readerVarName + QLatin1String(");") + COMMENT;
+        code.addBlock(array ? demarshalArray(QLatin1String("val")) : demarshalVariable(QLatin1String("val")));
+    } else if (mOptional) {
+        code += mNilLocalVarName + QLatin1String(" = false;") + COMMENT;
+    }
+    return code;
+}
+
 KODE::Code ElementArgumentSerializer::demarshalVarHelper(const QString &soapValueVarName) const
 {
     KODE::Code code;
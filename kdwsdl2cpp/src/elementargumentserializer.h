@@ -87,12 +87,37 @@ public:
      */
     void setUsePointer(bool usePointer);
 
+    /**
+     * @brief sets whether the serialize() method of the (complex) type makes the element qualified,
+     * which happens when its first child element is qualified. Only used by generateStreamWriterCode.
+     * The default is false.
+     */
+    void setQualifiedByType(bool qualified);
+
     /**
      * The main method: generate the serialization code.
      * @return the generated code
      */
     KODE::Code generateSerializationCode() const;
 
+    /**
+     * Generate the code writing the element to a QXmlStreamWriter, in literal use.
+     * Builtin types and non-polymorphic complex types (with writeTo) are written directly,
+     * the other types are serialized into a KDSoapValue first, then written with KDSoapValue::writeXml.
+     * @param writerVarName the name of the variable containing the QXmlStreamWriter
+     * @param messageNamespaceVarName the name of the variable containing the namespace of the message
+     * @return the generated code
+     */
+    KODE::Code generateStreamWriterCode(const QString &writerVarName, const QString &messageNamespaceVarName) const;
+
+    /**
+     * Generate the code writing the element as an attribute to a QXmlStreamWriter.
+     * The attributes which need a KDSoapValue are added to the attributes of @p fallbackVarName instead,
+     * and @p usesFallback is set to true: the caller writes them with KDSoapValue::writeXmlContents.
+     * @return the generated code
+     */
+    KODE::Code generateStreamAttributeCode(const QString &writerVarName, const QString &fallbackVarName, bool *usesFallback) const;
+
     /**
      * Generate code to deserialize an entire array
      * @return the generated code
@@ -106,15 +131,30 @@ public:
      */
     KODE::Code demarshalVariable(const QString &soapValueVarName) const;
 
+    /**
+     * Generate code to deserialize the variable (or append to the array, if @p array is true)
+     * from the element at the current position of a QXmlStreamReader, up to its end element.
+     * Builtin types and non-polymorphic complex types are read directly from the stream,
+     * the other types are read into a KDSoapValue first, then deserialized like in demarshalVariable.
+     * @param readerVarName the name of the variable containing the QXmlStreamReader
+     * @return the generated code
+     */
+    KODE::Code demarshalFromStream(const QString &readerVarName, bool array) const;
+
     static QString pointerStorageType(const QString &typeName);
 
 private:
     // Low-level helper for demarshalVariable, doesn't handle the polymorphic case (so it can be called for lists of polymorphics)
     KODE::Code demarshalVarHelper(const QString &soapValueVarName) const;
+    // Declares the KDSoapValue mValueVarName, for generateSerializationCode and for the fallback of the stream writer
+    KODE::Code valueCreationCode() const;
+    QString optionalCheck() const;
+    QString streamElementNameArgs(const QString &messageNamespaceVarName) const;
 
     const KWSDL::TypeMap &mTypeMap;
     QName mType;
     QName mElementType;
+    QName mElementName;
     QString mNameArg;
     QString mNameNamespace;
     QString mLocalVarName;
@@ -126,6 +166,7 @@ private:
     bool mNillable;
     bool mOptional;
     bool mUsePointer;
+    bool mQualifiedByType;
 };
 
 #endif // ELEMENTARGUMENTSERIALIZER_H
@@ -37,6 +37,12 @@ static void showHelp(const char *appName)
             "  -impl <headerfile>        generate the implementation(.cpp) file, and #include <headerfile>\n"
             "  -both <basefilename>      generate both the header(.h) and the implementation(.cpp) file\n"
             "  -server                   generate server-side base class, instead of client service\n"
+            "  -server-coroutines        with -server, generate methods returning KDSoapServerTask<T>,\n"
+            "                            to be implemented as C++20 coroutines\n"
+            "  -stream-deserializers     also generate deserialize(QXmlStreamReader&) for complex types,\n"
+            "                            and use it for the responses of the client stubs\n"
+            "  -stream-serializers       also generate writeTo(QXmlStreamWriter&) for complex types,\n"
+            "                            and use it for the literal messages sent by the stubs\n"
             "  -exportMacro <macroname>  set the export declaration to use for generated classes\n"
             "  -namespace <ns>           put all generated classes into the given C++ namespace\n"
             "  -namespaceMapping <mapping>\n"
@@ -85,6 +91,9 @@ int main(int argc, char **argv)
     bool impl = false;
     bool outfileGiven = false;
     bool server = false;
+    bool serverCoroutines = false;
+    bool streamDeserializers = false;
+    bool streamSerializers = false;
     QString headerFile;
     QString serviceName;
     QString exportMacro;
@@ -124,6 +133,12 @@ int main(int argc, char **argv)
             outputFile.setFile(QFile::decodeName(argv[arg]));
         } else if (opt == QLatin1String("-server")) {
             server = true;
+        } else if (opt == QLatin1String("-server-coroutines")) {
+            serverCoroutines = true;
+        } else if (opt == QLatin1String("-stream-deserializers")) {
+            streamDeserializers = true;
+        } else if (opt == QLatin1String("-stream-serializers")) {
+            streamSerializers = true;
         } else if (opt == QLatin1String("-v") || opt == QLatin1String("-version")) {
             fprintf(stderr, "%s %s\n", WSDL2CPP_DESCRIPTION, WSDL2CPP_VERSION_STR);
             return 0;
@@ -280,6 +295,9 @@ int main(int argc, char **argv)
 
 
     Settings::self()->setGenerateServerCode(server);
+    Settings::self()->setGenerateServerCoroutines(serverCoroutines);
+    Settings::self()->setGenerateStreamDeserializers(streamDeserializers);
+    Settings::self()->setGenerateStreamSerializers(streamSerializers);
     Settings::self()->setOutputDirectory(outputFile.absolutePath());
     Settings::self()->setWsdlFile(fileName);
     Settings::self()->setWantedService(serviceName);
@@ -220,6 +220,36 @@ bool Settings::generateServerCode() const
     return mServer;
 }
 
+void Settings::setGenerateServerCoroutines(bool b)
+{
+    mServerCoroutines = b;
+}
+
+bool Settings::generateServerCoroutines() const
+{
+    return mServerCoroutines;
+}
+
+void Settings::setGenerateStreamDeserializers(bool b)
+{
+    mStreamDeserializers = b;
+}
+
+bool Settings::generateStreamDeserializers() const
+{
+    return mStreamDeserializers;
+}
+
+void Settings::setGenerateStreamSerializers(bool b)
+{
+    mStreamSerializers = b;
+}
+
+bool Settings::generateStreamSerializers() const
+{
+    return mStreamSerializers;
+}
+
 QString Settings::exportDeclaration() const
 {
     return mExportDeclaration;
@@ -42,6 +42,15 @@ public:
     void setGenerateServerCode(bool b);
     bool generateServerCode() const;
 
+    void setGenerateServerCoroutines(bool b);
+    bool generateServerCoroutines() const;
+
+    void setGenerateStreamDeserializers(bool b);
+    bool generateStreamDeserializers() const;
+
+    void setGenerateStreamSerializers(bool b);
+    bool generateStreamSerializers() const;
+
     void setWsdlFile(const QString &wsdlFile);
     QUrl wsdlUrl() const;
     QString wsdlBaseUrl() const;
@@ -104,6 +113,9 @@ private:
     bool mHeader = false;
     bool mImpl = false;
     bool mServer = false;
+    bool mServerCoroutines = false;
+    bool mStreamDeserializers = false;
+    bool mStreamSerializers = false;
     bool mKeepUnusedTypes = false;
     bool mUseLocalFilesOnly = false;
     bool mHelpOnMissing = false;
@@ -529,6 +529,22 @@ bool KWSDL::TypeMap::isTypeAny(const QName &typeName) const
     return (typeName.nameSpace() == XMLSchemaURI && (typeName.localName() == "any" || typeName.localName() == "anyType"));
 }
 
+bool KWSDL::TypeMap::isQNameType(const QName &typeName) const
+{
+    QName type = typeName;
+    for (int depth = 0; depth < 100 && !type.isEmpty(); ++depth) { // the depth is only a guard against loops in broken schemas
+        if (type.nameSpace() == XMLSchemaURI && type.localName() == "QName") {
+            return true;
+        }
+        QList<Entry>::ConstIterator it = typeEntry(type);
+        if (it == mTypeMap.constEnd() || (*it).builtinType || (*it).complexType) {
+            return false;
+        }
+        type = (*it).baseType;
+    }
+    return false;
+}
+
 QString KWSDL::TypeMap::Entry::dumpBools() const
 {
     QStringList lst;
@@ -564,6 +580,29 @@ QString KWSDL::TypeMap::deserializeBuiltin(const QName &typeName, const QName &e
     }
 }
 
+QString KWSDL::TypeMap::deserializeBuiltinFromText(const QName &typeName, const QName &elementName, const QString &text,
+                                                  const QString &qtTypeName) const
+{
+    // Same conversions as deserializeBuiltin, from the text which would have been the value of the KDSoapValue
+    const QName type = typeName.isEmpty() ? baseTypeForElement(elementName) : typeName;
+    if (type.nameSpace() == XMLSchemaURI && type.localName() == "hexBinary") {
+        return "QByteArray::fromHex(" + text + ".toLatin1())";
+    } else if (type.nameSpace() == XMLSchemaURI && type.localName() == "base64Binary") {
+        return "QByteArray::fromBase64(" + text + ".toLatin1())";
+    } else if (type.nameSpace() == XMLSchemaURI && type.localName() == "dateTime") {
+        Q_ASSERT(qtTypeName == QLatin1String("KDDateTime"));
+        return "KDDateTime::fromDateString(" + text + ")";
+    } else if (type.nameSpace() == XMLSchemaURI && type.localName() == "QName") {
+        return QString(); // needs the namespace declarations in scope
+    } else if (type.nameSpace() == XMLSchemaURI && type.localName() == "anySimpleType") {
+        return "QVariant(" + text + ")";
+    } else if (qtTypeName == QLatin1String("QString")) {
+        return text;
+    } else {
+        return "QVariant(" + text + ").value<" + qtTypeName + ">()";
+    }
+}
+
 QString KWSDL::TypeMap::serializeBuiltin(const QName &baseTypeName, const QName &elementName, const QString &var, const QString &name,
                                          const QString &typeNameSpace, const QString &typeName) const
 {
@@ -586,3 +625,31 @@ QString KWSDL::TypeMap::serializeBuiltin(const QName &baseTypeName, const QName
     }
     return "KDSoapValue(" + name + ", " + value + ", " + namespaceString(typeNameSpace) + ", QString::fromLatin1(\"" + typeName + "\"))";
 }
+
+QString KWSDL::TypeMap::serializeBuiltinToText(const QName &baseTypeName, const QName &elementName, const QString &var,
+                                              const QString &qtTypeName) const
+{
+    // Same text as variantToTextValue in KDSoapValue.cpp, for the value created by serializeBuiltin
+    const QName baseType = baseTypeName.isEmpty() ? baseTypeForElement(elementName) : baseTypeName;
+    if (baseType.nameSpace() == XMLSchemaURI && baseType.localName() == "hexBinary") {
+        return "QString::fromLatin1(" + var + ".toHex().constData())";
+    } else if (baseType.nameSpace() == XMLSchemaURI && baseType.localName() == "base64Binary") {
+        return "QString::fromLatin1(" + var + ".toBase64().constData())";
+    } else if (baseType.nameSpace() == XMLSchemaURI && baseType.localName() == "dateTime") {
+        return var + ".toDateString()";
+    } else if (baseType.nameSpace() == XMLSchemaURI && (baseType.localName() == "QName" || baseType.localName() == "anySimpleType")) {
+        return QString();
+    } else if (qtTypeName == QLatin1String("QString")) {
+        return var;
+    } else if (qtTypeName == QLatin1String("int") || qtTypeName == QLatin1String("unsigned int") || qtTypeName == QLatin1String("qint64")
+               || qtTypeName == QLatin1String("quint64")) {
+        return "QString::number(" + var + ")";
+    } else if (qtTypeName == QLatin1String("bool")) {
+        return "(" + var + " ? QStringLiteral(\"true\") : QStringLiteral(\"false\"))";
+    } else if (qtTypeName == QLatin1String("float") || qtTypeName == QLatin1String("double")) {
+        return "QVariant(" + var + ").toString()"; // same formatting as KDSoapValue, without allocating
+    } else if (qtTypeName == QLatin1String("QDate")) {
+        return var + ".toString(Qt::ISODate)";
+    }
+    return QString();
+}
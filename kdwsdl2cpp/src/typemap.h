@@ -54,6 +54,11 @@ public:
      */
     bool isTypeAny(const QName &typeName) const;
 
+    /**
+     * Returns true if @p typeName is xsd:QName, or a simple type derived from it.
+     */
+    bool isQNameType(const QName &typeName) const;
+
     QString localType(const QName &typeName) const;
     // unused QString baseType( const QName &typeName ) const;
     QStringList headers(const QName &typeName) const;
@@ -95,8 +100,19 @@ public:
      * Return C++ code for converting the variant in "var" into the right type.
      */
     QString deserializeBuiltin(const QName &typeName, const QName &elementName, const QString &var, const QString &qtTypeName) const;
+    /**
+     * Return C++ code for converting the QString "text" (the text of an element or attribute) into the right type,
+     * or an empty string if the type can't be converted from the text alone (QName).
+     */
+    QString deserializeBuiltinFromText(const QName &typeName, const QName &elementName, const QString &text, const QString &qtTypeName) const;
     QString serializeBuiltin(const QName &baseTypeName, const QName &elementName, const QString &var, const QString &name,
                              const QString &typeNameSpace, const QString &typeName) const;
+    /**
+     * Return C++ code for converting "var" into the QString written as the text of an element or attribute,
+     * the same as KDSoapValue would write for serializeBuiltin(), or an empty string if it needs a KDSoapValue
+     * (QName, anySimpleType, and the types which are rarely used).
+     */
+    QString serializeBuiltinToText(const QName &baseTypeName, const QName &elementName, const QString &var, const QString &qtTypeName) const;
 
     QString localTypeForAttribute(const QName &typeName) const;
     QStringList headersForAttribute(const QName &typeName) const;
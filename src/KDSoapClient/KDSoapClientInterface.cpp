@@ -174,11 +174,19 @@ KDSoapPendingCall KDSoapClientInterface::asyncCall(const QString &method, const
     maybeDebugRequest(buffer->data(), reply->request(), reply);
     KDSoapPendingCall call(reply, buffer);
     call.d->soapVersion = d->m_version;
+    call.d->arenaAllocation = d->m_arenaAllocation;
+    call.d->lazyParsing = d->m_lazyReplyParsing;
     return call;
 }
 
 KDSoapMessage KDSoapClientInterface::call(const QString &method, const KDSoapMessage &message, const QString &soapAction,
                                           const KDSoapHeaders &headers)
+{
+    return call(method, message, soapAction, headers, KDSoapBodyReader());
+}
+
+KDSoapMessage KDSoapClientInterface::call(const QString &method, const KDSoapMessage &message, const QString &soapAction,
+                                          const KDSoapHeaders &headers, const KDSoapBodyReader &bodyReader)
 {
     d->accessManager()->cookieJar(); // create it in the right thread, the secondary thread will use it
     // Problem is: I don't want a nested event loop here. Too dangerous for GUI programs.
@@ -186,6 +194,7 @@ KDSoapMessage KDSoapClientInterface::call(const QString &method, const KDSoapMes
     // So the only option that remains is a thread and acquiring a semaphore...
     KDSoapThreadTaskData *task = new KDSoapThreadTaskData(this, method, message, soapAction, headers);
     task->m_authentication = d->m_authentication;
+    task->m_bodyReader = bodyReader;
     d->m_thread.enqueue(task);
     if (!d->m_thread.isRunning()) {
         d->m_thread.start();
@@ -369,6 +378,26 @@ void KDSoapClientInterface::setSendSoapActionInWsAddressingHeader(bool sendInWsA
     d->m_sendSoapActionInWsAddressingHeader = sendInWsAddressingHeader;
 }
 
+void KDSoapClientInterface::setArenaAllocationEnabled(bool enabled)
+{
+    d->m_arenaAllocation = enabled;
+}
+
+bool KDSoapClientInterface::isArenaAllocationEnabled() const
+{
+    return d->m_arenaAllocation;
+}
+
+void KDSoapClientInterface::setLazyReplyParsingEnabled(bool enabled)
+{
+    d->m_lazyReplyParsing = enabled;
+}
+
+bool KDSoapClientInterface::isLazyReplyParsingEnabled() const
+{
+    return d->m_lazyReplyParsing;
+}
+
 #ifndef QT_NO_OPENSSL
 QSslConfiguration KDSoapClientInterface::sslConfiguration() const
 {
@@ -146,6 +146,17 @@ public:
     KDSoapMessage call(const QString &method, const KDSoapMessage &message, const QString &soapAction = QString(),
                        const KDSoapHeaders &headers = KDSoapHeaders());
 
+    /**
+     * Blocking call, like the above, except that the first element of the body of the response
+     * is read by \p bodyReader, directly from the XML stream, see KDSoapPendingCall::returnMessage(const KDSoapBodyReader &).
+     * Unless the response is a fault, the returned message only has the name and namespace of that element.
+     *
+     * \p bodyReader is called in the thread used internally for blocking calls, while this method waits for it.
+     * \since 2.2
+     */
+    KDSoapMessage call(const QString &method, const KDSoapMessage &message, const QString &soapAction, const KDSoapHeaders &headers,
+                       const KDSoapBodyReader &bodyReader);
+
     /**
      * Calls the method \p method on this interface and passes the parameters specified in \p message
      * to the method.
@@ -376,6 +387,44 @@ public:
      */
     bool sendSoapActionInWsAddressingHeader() const;
 
+    /**
+     * Enables arena allocation for the responses: all the values of a response message are allocated
+     * from a few large memory blocks, freed at once when the last of these values is destroyed,
+     * instead of one heap allocation per XML element. This makes parsing large responses faster.
+     *
+     * The memory of a response is only freed once all its values are gone, so avoid keeping
+     * a few values of many large responses around when this is enabled.
+     * This option is disabled by default.
+     * \since 2.2
+     */
+    void setArenaAllocationEnabled(bool enabled);
+
+    /**
+     * Returns true if arena allocation is enabled for the responses.
+     * \see setArenaAllocationEnabled
+     * \since 2.2
+     */
+    bool isArenaAllocationEnabled() const;
+
+    /**
+     * Enables lazy parsing of the responses: once a response is received, its elements are only indexed,
+     * and KDSoapPendingCall::value() or KDSoapPendingCall::returnValue() only parse the element they return.
+     * This makes picking a few values out of large responses faster.
+     * KDSoapPendingCall::returnMessage() and KDSoapPendingCall::returnHeaders() still parse the whole response.
+     *
+     * Faults, and responses which can't be indexed (e.g. not encoded in UTF-8) are always parsed right away.
+     * This option is disabled by default.
+     * \since 2.2
+     */
+    void setLazyReplyParsingEnabled(bool enabled);
+
+    /**
+     * Returns true if lazy parsing of the responses is enabled.
+     * \see setLazyReplyParsingEnabled
+     * \since 2.2
+     */
+    bool isLazyReplyParsingEnabled() const;
+
 private:
     friend class KDSoapThreadTask;
     KDSoapClientInterfacePrivate *const d;
@@ -52,6 +52,8 @@ public:
     int m_timeout;
     bool m_sendSoapActionInHttpHeader = true;
     bool m_sendSoapActionInWsAddressingHeader = false;
+    bool m_arenaAllocation = false;
+    bool m_lazyReplyParsing = false;
 
     QNetworkAccessManager *accessManager();
     QNetworkRequest prepareRequest(const QString &method, const QString &action);
@@ -93,6 +93,8 @@ void KDSoapThreadTask::process(QNetworkAccessManager &accessManager)
     maybeDebugRequest(buffer->data(), reply->request(), reply);
     KDSoapPendingCall pendingCall(reply, buffer);
     pendingCall.d->soapVersion = m_data->m_iface->d->m_version;
+    pendingCall.d->arenaAllocation = m_data->m_iface->d->m_arenaAllocation;
+    pendingCall.d->lazyParsing = m_data->m_iface->d->m_lazyReplyParsing;
 
     KDSoapPendingCallWatcher *watcher = new KDSoapPendingCallWatcher(pendingCall, this);
     connect(watcher, &KDSoapPendingCallWatcher::finished, this, &KDSoapThreadTask::slotFinished);
@@ -100,7 +102,7 @@ void KDSoapThreadTask::process(QNetworkAccessManager &accessManager)
 
 void KDSoapThreadTask::slotFinished(KDSoapPendingCallWatcher *watcher)
 {
-    m_data->m_response = watcher->returnMessage();
+    m_data->m_response = m_data->m_bodyReader ? watcher->returnMessage(m_data->m_bodyReader) : watcher->returnMessage();
     m_data->m_responseHeaders = watcher->returnHeaders();
     m_data->m_semaphore.release();
     // Helgrind bug: says this races with main thread. Looks like it's confused by QSharedDataPointer
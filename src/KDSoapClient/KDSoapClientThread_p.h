@@ -13,6 +13,7 @@
 
 #include "KDSoapAuthentication.h"
 #include "KDSoapMessage.h"
+#include "KDSoapPendingCall.h"
 #include <QtCore/QMutex>
 #include <QtCore/QQueue>
 #include <QtCore/QSemaphore>
@@ -61,6 +62,7 @@ public:
     KDSoapMessage m_response;
     KDSoapHeaders m_responseHeaders;
     KDSoapHeaders m_headers;
+    KDSoapBodyReader m_bodyReader; // called in the client thread, while the caller waits
 };
 
 class KDSoapThreadTask : public QObject
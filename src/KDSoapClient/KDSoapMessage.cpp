@@ -29,6 +29,7 @@ public:
     bool isFault;
     bool hasMessageAddressingProperties;
     KDSoapMessageAddressingProperties messageAddressingProperties;
+    KDSoapBodyWriter bodyWriter;
 };
 
 KDSoapMessage::KDSoapMessage()
@@ -186,6 +187,16 @@ bool KDSoapMessage::hasMessageAddressingProperties() const
     return d->hasMessageAddressingProperties;
 }
 
+void KDSoapMessage::setBodyWriter(const KDSoapBodyWriter &bodyWriter)
+{
+    d->bodyWriter = bodyWriter;
+}
+
+KDSoapBodyWriter KDSoapMessage::bodyWriter() const
+{
+    return d->bodyWriter;
+}
+
 KDSoapMessage::Use KDSoapMessage::use() const
 {
     return d->use;
@@ -219,5 +230,5 @@ KDSoapMessage KDSoapHeaders::header(const QString &name, const QString &namespac
 
 bool KDSoapMessage::isNull() const
 {
-    return childValues().isEmpty() && childValues().attributes().isEmpty() && value().isNull();
+    return childValues().isEmpty() && childValues().attributes().isEmpty() && value().isNull() && !d->bodyWriter;
 }
@@ -15,13 +15,24 @@
 
 #include "KDSoapMessageAddressingProperties.h"
 #include "KDSoapValue.h"
+#include <functional>
 
 QT_BEGIN_NAMESPACE
 class QString;
+class QXmlStreamWriter;
 QT_END_NAMESPACE
 class KDSoapMessageData;
 class KDSoapHeaders;
 
+/**
+ * Writes the contents of the message element directly to the XML stream,
+ * e.g. with the writeTo() methods generated by kdwsdl2cpp -stream-serializers, instead of creating KDSoapValues.
+ * It's called with \p writer inside the message element, and \p messageNamespace is the namespace of the message,
+ * for the child elements which aren't qualified.
+ * \since 2.2
+ */
+typedef std::function<void(QXmlStreamWriter &writer, const QString &messageNamespace)> KDSoapBodyWriter;
+
 /**
  * The KDSoapMessage class represents one message sent or received via SOAP.
  */
@@ -170,6 +181,26 @@ public:
      */
     KDSoapMessageAddressingProperties messageAddressingProperties() const;
 
+    /**
+     * Sets a function which writes the contents of the message element when the message is sent,
+     * after the arguments of the message. This avoids creating the KDSoapValues for large messages.
+     *
+     * The message element itself (its name and namespace) is still defined by the message.
+     * If the message has arguments (child elements), \p bodyWriter can't write attributes anymore.
+     * \p bodyWriter is responsible for writing \c xsi:type attributes, if the message uses EncodedUse.
+     *
+     * \p bodyWriter might be called in another thread, e.g. by KDSoapClientInterface::call(),
+     * so it should hold copies of the data it writes, rather than references.
+     * \since 2.2
+     */
+    void setBodyWriter(const KDSoapBodyWriter &bodyWriter);
+
+    /**
+     * Returns the function set with setBodyWriter(), if any.
+     * \since 2.2
+     */
+    KDSoapBodyWriter bodyWriter() const;
+
 private:
     bool isNull() const;
     friend class KDSoapPendingCall;
@@ -77,6 +77,7 @@ class KDSOAP_EXPORT KDSoapMessageAddressingProperties
 public:
     friend class KDSoapMessageWriter;
     friend class KDSoapMessageReader;
+    friend class KDSoapIncrementalMessageReader;
 
     /**
      * This enum contains all the predefined addresses defined by the ws addressing specification
@@ -12,24 +12,18 @@
 #include "KDSoapMessageReader_p.h"
 #include "KDSoapNamespaceManager.h"
 #include "KDSoapNamespacePrefixes_p.h"
+#include "KDSoapNamespaceScope_p.h"
+#include "KDSoapStringPool_p.h"
+#include "KDSoapValueArena_p.h"
 
 #include <QDebug>
+#include <QVector>
 #include <QXmlStreamReader>
 
 #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
 #define QStringView QStringRef
 #endif
 
-static QStringView namespaceForPrefix(const QXmlStreamNamespaceDeclarations &decls, const QString &prefix)
-{
-    for (const QXmlStreamNamespaceDeclaration &decl : qAsConst(decls)) {
-        if (decl.prefix() == prefix) {
-            return decl.namespaceUri();
-        }
-    }
-    return QStringView();
-}
-
 static int xmlTypeToMetaType(const QString &xmlType)
 {
     // Reverse operation from variantToXmlType in KDSoapClientInterface, keep in sync
@@ -61,14 +55,20 @@ static int xmlTypeToMetaType(const QString &xmlType)
     return -1;
 }
 
-static KDSoapValue parseElement(QXmlStreamReader &reader, const QXmlStreamNamespaceDeclarations &envNsDecls)
+// Names and namespaces repeat in every message, they share their data, see KDSoapStringPool
+static QString internedString(const QStringView &str)
 {
-    const QXmlStreamNamespaceDeclarations combinedNamespaceDeclarations = envNsDecls + reader.namespaceDeclarations();
-    const QString name = reader.name().toString();
+    return KDSoapStringPool::intern(str.constData(), int(str.size()));
+}
+
+// Creates the value for the start element the reader is positioned on, including attributes
+static KDSoapValue createElementValue(QXmlStreamReader &reader, const KDSoapNamespaceScope::Ptr &namespaceScope, QVariant::Type *pMetaTypeId)
+{
+    const QString name = internedString(reader.name());
     KDSoapValue val(name, QVariant());
-    val.setNamespaceUri(reader.namespaceUri().toString());
+    val.setNamespaceUri(internedString(reader.namespaceUri()));
     val.setNamespaceDeclarations(reader.namespaceDeclarations());
-    val.setEnvironmentNamespaceDeclarations(combinedNamespaceDeclarations);
+    KDSoapNamespaceScope::setEnvironment(val, namespaceScope);
     // qDebug() << "parsing" << name;
     QVariant::Type metaTypeId = QVariant::Invalid;
 
@@ -84,8 +84,8 @@ static KDSoapValue parseElement(QXmlStreamReader &reader, const QXmlStreamNamesp
                 // The type can be like xsd:float, resolve that
                 const QString type = attrValue.toString();
                 const int pos = type.indexOf(QLatin1Char(':'));
-                const QString dataType = type.mid(pos + 1);
-                val.setType(namespaceForPrefix(combinedNamespaceDeclarations, type.left(pos)).toString(), dataType);
+                const QString dataType = KDSoapStringPool::intern(type.constData() + pos + 1, type.size() - pos - 1);
+                val.setType(namespaceScope ? namespaceScope->namespaceForPrefix(type.left(pos)) : QString(), dataType);
                 metaTypeId = static_cast<QVariant::Type>(xmlTypeToMetaType(dataType));
             }
             continue;
@@ -94,22 +94,15 @@ static KDSoapValue parseElement(QXmlStreamReader &reader, const QXmlStreamNamesp
             continue;
         }
         // qDebug() << "Got attribute:" << name << ns << "=" << attrValue;
-        val.childValues().attributes().append(KDSoapValue(name.toString(), attrValue.toString()));
-    }
-    QString text;
-    while (reader.readNext() != QXmlStreamReader::Invalid) {
-        if (reader.isEndElement()) {
-            break;
-        }
-        if (reader.isCharacters()) {
-            text = reader.text().toString();
-            // qDebug() << "text=" << text;
-        } else if (reader.isStartElement()) {
-            const KDSoapValue subVal = parseElement(reader, combinedNamespaceDeclarations); // recurse
-            val.childValues().append(subVal);
-        }
+        val.childValues().attributes().append(KDSoapValue(internedString(name), attrValue.toString()));
     }
+    *pMetaTypeId = metaTypeId;
+    return val;
+}
 
+// Sets the text contents of an element, once its end was reached
+static void setElementText(KDSoapValue &val, const QString &text, QVariant::Type metaTypeId)
+{
     if (!text.isEmpty()) {
         QVariant variant(text);
         // qDebug() << text << variant << metaTypeId;
@@ -123,10 +116,45 @@ static KDSoapValue parseElement(QXmlStreamReader &reader, const QXmlStreamNamesp
         }
         val.setValue(variant);
     }
+}
+
+static KDSoapValue parseElement(QXmlStreamReader &reader, const KDSoapNamespaceScope::Ptr &parentScope)
+{
+    // Most elements don't declare namespaces, and share the scope of their parent
+    const KDSoapNamespaceScope::Ptr namespaceScope = KDSoapNamespaceScope::create(parentScope, reader.namespaceDeclarations());
+    QVariant::Type metaTypeId = QVariant::Invalid;
+    KDSoapValue val = createElementValue(reader, namespaceScope, &metaTypeId);
+    QString text;
+    while (reader.readNext() != QXmlStreamReader::Invalid) {
+        if (reader.isEndElement()) {
+            break;
+        }
+        if (reader.isCharacters()) {
+            text = reader.text().toString();
+            // qDebug() << "text=" << text;
+        } else if (reader.isStartElement()) {
+            const KDSoapValue subVal = parseElement(reader, namespaceScope); // recurse
+            val.childValues().append(subVal);
+        }
+    }
+    setElementText(val, text, metaTypeId);
     return val;
 }
 
+static bool isSoapEnvelopeNamespace(const QString &ns)
+{
+    return ns == KDSoapNamespaceManager::soapEnvelope() || ns == KDSoapNamespaceManager::soapEnvelope200305();
+}
+
+static void createXmlErrorFault(KDSoapMessage *pMsg, const QXmlStreamReader &reader, KDSoap::SoapVersion soapVersion)
+{
+    const QString faultText = QString::fromLatin1("XML error: [%1:%2] %3")
+                                  .arg(QString::number(reader.lineNumber()), QString::number(reader.columnNumber()), reader.errorString());
+    pMsg->createFaultMessage(QString::number(reader.error()), faultText, soapVersion);
+}
+
 KDSoapMessageReader::KDSoapMessageReader()
+    : m_arenaAllocation(false)
 {
 }
 
@@ -177,15 +205,17 @@ static QByteArray handleNotWellFormedError(const QByteArray &data, qint64 offset
 }
 
 KDSoapMessageReader::XmlError KDSoapMessageReader::xmlToMessage(const QByteArray &data, KDSoapMessage *pMsg, QString *pMessageNamespace,
-                                                                KDSoapHeaders *pRequestHeaders, KDSoap::SoapVersion soapVersion) const
+                                                                KDSoapHeaders *pRequestHeaders, KDSoap::SoapVersion soapVersion,
+                                                                const KDSoapBodyReader &bodyReader) const
 {
     Q_ASSERT(pMsg);
+    const KDSoapValueArena::Scope arenaScope(m_arenaAllocation);
     QXmlStreamReader reader(data);
     if (reader.readNextStartElement()) {
         if (reader.name() == QLatin1String("Envelope")
             && (reader.namespaceUri() == KDSoapNamespaceManager::soapEnvelope()
                 || reader.namespaceUri() == KDSoapNamespaceManager::soapEnvelope200305())) {
-            const QXmlStreamNamespaceDeclarations envNsDecls = reader.namespaceDeclarations();
+            const KDSoapNamespaceScope::Ptr envScope = KDSoapNamespaceScope::create(KDSoapNamespaceScope::Ptr(), reader.namespaceDeclarations());
             if (reader.readNextStartElement()) {
                 if (reader.name() == QLatin1String("Header")
                     && (reader.namespaceUri() == KDSoapNamespaceManager::soapEnvelope()
@@ -193,11 +223,11 @@ KDSoapMessageReader::XmlError KDSoapMessageReader::xmlToMessage(const QByteArray
                     KDSoapMessageAddressingProperties messageAddressingProperties;
                     while (reader.readNextStartElement()) {
                         if (KDSoapMessageAddressingProperties::isWSAddressingNamespace(reader.namespaceUri().toString())) {
-                            KDSoapValue value = parseElement(reader, envNsDecls);
+                            KDSoapValue value = parseElement(reader, envScope);
                             messageAddressingProperties.readMessageAddressingProperty(value);
                         } else {
                             KDSoapMessage header;
-                            static_cast<KDSoapValue &>(header) = parseElement(reader, envNsDecls);
+                            static_cast<KDSoapValue &>(header) = parseElement(reader, envScope);
                             pRequestHeaders->append(header);
                         }
                     }
@@ -208,15 +238,21 @@ KDSoapMessageReader::XmlError KDSoapMessageReader::xmlToMessage(const QByteArray
                     && (reader.namespaceUri() == KDSoapNamespaceManager::soapEnvelope()
                         || reader.namespaceUri() == KDSoapNamespaceManager::soapEnvelope200305())) {
                     if (reader.readNextStartElement()) {
-                        *pMsg = parseElement(reader, envNsDecls);
+                        const bool isFault = reader.name() == QLatin1String("Fault") && isSoapEnvelopeNamespace(reader.namespaceUri().toString());
+                        if (bodyReader && !isFault) {
+                            // The contents are read into the caller's objects, rather than into KDSoapValues
+                            pMsg->setName(internedString(reader.name()));
+                            pMsg->setNamespaceUri(internedString(reader.namespaceUri()));
+                            bodyReader(reader);
+                        } else {
+                            *pMsg = parseElement(reader, envScope);
+                            if (isFault) {
+                                pMsg->setFault(true);
+                            }
+                        }
                         if (pMessageNamespace) {
                             *pMessageNamespace = pMsg->namespaceUri();
                         }
-                        if (pMsg->name() == QLatin1String("Fault")
-                            && (reader.namespaceUri() == KDSoapNamespaceManager::soapEnvelope()
-                                || reader.namespaceUri() == KDSoapNamespaceManager::soapEnvelope200305())) {
-                            pMsg->setFault(true);
-                        }
                     }
 
                 } else {
@@ -234,14 +270,623 @@ KDSoapMessageReader::XmlError KDSoapMessageReader::xmlToMessage(const QByteArray
             qWarning() << "Handling a Not well Formed Error";
             QByteArray dataCleanedUp = handleNotWellFormedError(data, reader.characterOffset());
             if (!dataCleanedUp.isEmpty()) {
-                return xmlToMessage(dataCleanedUp, pMsg, pMessageNamespace, pRequestHeaders, soapVersion);
+                return xmlToMessage(dataCleanedUp, pMsg, pMessageNamespace, pRequestHeaders, soapVersion, bodyReader);
             }
         }
-        QString faultText = QString::fromLatin1("XML error: [%1:%2] %3")
-                                .arg(QString::number(reader.lineNumber()), QString::number(reader.columnNumber()), reader.errorString());
-        pMsg->createFaultMessage(QString::number(reader.error()), faultText, soapVersion);
+        createXmlErrorFault(pMsg, reader, soapVersion);
         return reader.error() == QXmlStreamReader::PrematureEndOfDocumentError ? PrematureEndOfDocumentError : ParseError;
     }
 
     return NoError;
 }
+
+KDSoapValue KDSoapMessageReader::readElement(QXmlStreamReader &reader)
+{
+    return parseElement(reader, KDSoapNamespaceScope::Ptr());
+}
+
+class KDSoapIncrementalMessageReader::Private
+{
+public:
+    enum State
+    {
+        ExpectEnvelope,
+        ExpectHeaderOrBody,
+        InHeader,
+        ExpectBody,
+        InBody,
+        Done
+    };
+
+    // An element which is being parsed, i.e. whose end element wasn't seen yet
+    struct Frame
+    {
+        KDSoapValue value;
+        KDSoapNamespaceScope::Ptr namespaceScope;
+        QString text;
+        QVariant::Type metaTypeId;
+        bool lastTokenWasText;
+        int streamedPath; // index in m_streamedPaths, or -1
+    };
+
+    Private()
+        : m_state(ExpectEnvelope)
+        , m_hasHeader(false)
+        , m_hasBody(false)
+    {
+    }
+
+    bool isSoapElement(const char *name) const
+    {
+        return m_reader.name() == QLatin1String(name) && isSoapEnvelopeNamespace(m_reader.namespaceUri().toString());
+    }
+
+    void startElement();
+    void endElement();
+    void characters();
+    void elementCompleted(const KDSoapValue &value);
+    int streamedPath() const;
+
+    QXmlStreamReader m_reader;
+    State m_state;
+    KDSoapNamespaceScope::Ptr m_envScope;
+    QVector<Frame> m_stack;
+
+    bool m_hasHeader;
+    bool m_hasBody;
+    KDSoapHeaders m_headers;
+    KDSoapMessageAddressingProperties m_messageAddressingProperties;
+    KDSoapValue m_body;
+
+    QVector<QStringList> m_streamedPaths;
+    KDSoapIncrementalMessageReader::StreamedElementCallback m_streamedElementCallback;
+};
+
+// The index of the path in m_streamedPaths matching the current start element, or -1
+int KDSoapIncrementalMessageReader::Private::streamedPath() const
+{
+    if (m_streamedPaths.isEmpty()) {
+        return -1;
+    }
+    const int depth = m_stack.count() + 2; // Header or Body, the ancestors, and the current element
+    if (m_state == InBody && m_stack.isEmpty() && isSoapElement("Fault")) {
+        return -1;
+    }
+    for (int i = 0; i < m_streamedPaths.count(); ++i) {
+        const QStringList &path = m_streamedPaths.at(i);
+        if (path.count() != depth || path.first() != QLatin1String(m_state == InHeader ? "Header" : "Body")) {
+            continue;
+        }
+        bool matches = true;
+        for (int level = 1; level < depth && matches; ++level) {
+            const QString &name = path.at(level);
+            if (name != QLatin1String("*")) {
+                matches = level < depth - 1 ? name == m_stack.at(level - 1).value.name() : m_reader.name() == name;
+            }
+        }
+        if (matches) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void KDSoapIncrementalMessageReader::Private::startElement()
+{
+    switch (m_state) {
+    case ExpectEnvelope:
+        if (isSoapElement("Envelope")) {
+            m_envScope = KDSoapNamespaceScope::create(KDSoapNamespaceScope::Ptr(), m_reader.namespaceDeclarations());
+            m_state = ExpectHeaderOrBody;
+        } else {
+            m_reader.raiseError(QObject::tr("Invalid SOAP Message, Envelope expected"));
+        }
+        return;
+    case ExpectHeaderOrBody:
+        if (isSoapElement("Header")) {
+            m_hasHeader = true;
+            m_state = InHeader;
+            return;
+        }
+        Q_FALLTHROUGH();
+    case ExpectBody:
+        if (isSoapElement("Body")) {
+            m_state = InBody;
+        } else {
+            m_reader.raiseError(QObject::tr("Invalid SOAP Message, Body expected"));
+        }
+        return;
+    case InHeader:
+    case InBody: {
+        // Like parseElement, the children of Header and Body only see the Envelope's namespace declarations
+        const KDSoapNamespaceScope::Ptr &parentScope = m_stack.isEmpty() ? m_envScope : m_stack.last().namespaceScope;
+        if (!m_stack.isEmpty()) {
+            m_stack.last().lastTokenWasText = false;
+        }
+        Frame frame;
+        frame.namespaceScope = KDSoapNamespaceScope::create(parentScope, m_reader.namespaceDeclarations());
+        frame.metaTypeId = QVariant::Invalid;
+        frame.value = createElementValue(m_reader, frame.namespaceScope, &frame.metaTypeId);
+        frame.lastTokenWasText = false;
+        frame.streamedPath = streamedPath();
+        m_stack.append(frame);
+        return;
+    }
+    case Done:
+        return;
+    }
+}
+
+void KDSoapIncrementalMessageReader::Private::endElement()
+{
+    if (m_stack.isEmpty()) {
+        switch (m_state) {
+        case ExpectHeaderOrBody:
+            m_reader.raiseError(QObject::tr("Invalid SOAP Message, empty Envelope"));
+            break;
+        case ExpectBody:
+            m_reader.raiseError(QObject::tr("Invalid SOAP Message, Body expected"));
+            break;
+        case InHeader: // </Header>
+            m_state = ExpectBody;
+            break;
+        case InBody: // empty <Body/>
+            m_state = Done;
+            break;
+        case ExpectEnvelope:
+        case Done:
+            break;
+        }
+        return;
+    }
+    Frame frame = m_stack.takeLast();
+    setElementText(frame.value, frame.text, frame.metaTypeId);
+    if (frame.streamedPath >= 0) {
+        // Not kept in the message
+        m_streamedElementCallback(frame.streamedPath, frame.value);
+        if (!m_stack.isEmpty()) {
+            m_stack.last().lastTokenWasText = false;
+        }
+    } else if (m_stack.isEmpty()) {
+        elementCompleted(frame.value);
+    } else {
+        Frame &parent = m_stack.last();
+        parent.value.childValues().append(frame.value);
+        parent.lastTokenWasText = false;
+    }
+}
+
+void KDSoapIncrementalMessageReader::Private::characters()
+{
+    if (m_stack.isEmpty()) {
+        return;
+    }
+    Frame &frame = m_stack.last();
+    // QXmlStreamReader can split text into several tokens when the data comes in pieces
+    if (frame.lastTokenWasText) {
+        frame.text.append(m_reader.text());
+    } else {
+        frame.text = m_reader.text().toString();
+    }
+    frame.lastTokenWasText = true;
+}
+
+void KDSoapIncrementalMessageReader::Private::elementCompleted(const KDSoapValue &value)
+{
+    if (m_state == InHeader) {
+        if (KDSoapMessageAddressingProperties::isWSAddressingNamespace(value.namespaceUri())) {
+            m_messageAddressingProperties.readMessageAddressingProperty(value);
+        } else {
+            KDSoapMessage header;
+            static_cast<KDSoapValue &>(header) = value;
+            m_headers.append(header);
+        }
+    } else {
+        // Only the first child of the Body matters
+        m_body = value;
+        m_hasBody = true;
+        m_state = Done;
+    }
+}
+
+KDSoapIncrementalMessageReader::KDSoapIncrementalMessageReader()
+    : d(new Private)
+{
+}
+
+KDSoapIncrementalMessageReader::~KDSoapIncrementalMessageReader()
+{
+    delete d;
+}
+
+void KDSoapIncrementalMessageReader::setStreamedPaths(const QVector<QStringList> &paths, const StreamedElementCallback &callback)
+{
+    d->m_streamedPaths = paths;
+    d->m_streamedElementCallback = callback;
+}
+
+KDSoapMessageReader::XmlError KDSoapIncrementalMessageReader::addData(const QByteArray &data)
+{
+    if (d->m_state == Private::Done) {
+        return KDSoapMessageReader::NoError;
+    }
+    QXmlStreamReader &reader = d->m_reader;
+    if (reader.hasError() && reader.error() != QXmlStreamReader::PrematureEndOfDocumentError) {
+        return KDSoapMessageReader::ParseError;
+    }
+    reader.addData(data);
+    while (d->m_state != Private::Done) {
+        const QXmlStreamReader::TokenType token = reader.readNext();
+        if (token == QXmlStreamReader::Invalid || token == QXmlStreamReader::EndDocument) {
+            break;
+        }
+        switch (token) {
+        case QXmlStreamReader::StartElement:
+            d->startElement();
+            break;
+        case QXmlStreamReader::EndElement:
+            d->endElement();
+            break;
+        case QXmlStreamReader::Characters:
+            d->characters();
+            break;
+        default:
+            if (!d->m_stack.isEmpty()) {
+                d->m_stack.last().lastTokenWasText = false;
+            }
+            break;
+        }
+        if (reader.hasError()) {
+            break;
+        }
+    }
+    if (d->m_state == Private::Done) {
+        return KDSoapMessageReader::NoError;
+    }
+    if (reader.hasError() && reader.error() != QXmlStreamReader::PrematureEndOfDocumentError) {
+        return KDSoapMessageReader::ParseError;
+    }
+    return KDSoapMessageReader::PrematureEndOfDocumentError;
+}
+
+KDSoapMessageReader::XmlError KDSoapIncrementalMessageReader::result(KDSoapMessage *pMsg, QString *pMessageNamespace,
+                                                                     KDSoapHeaders *pRequestHeaders, KDSoap::SoapVersion soapVersion) const
+{
+    Q_ASSERT(pMsg);
+    const QXmlStreamReader &reader = d->m_reader;
+    if (d->m_state != Private::Done) {
+        if (reader.hasError()) {
+            createXmlErrorFault(pMsg, reader, soapVersion);
+            return reader.error() == QXmlStreamReader::PrematureEndOfDocumentError ? KDSoapMessageReader::PrematureEndOfDocumentError
+                                                                                  : KDSoapMessageReader::ParseError;
+        }
+        // No data at all, or the end of the document was reached without a Body
+        const QString faultText = QString::fromLatin1("XML error: [%1:%2] %3")
+                                      .arg(QString::number(reader.lineNumber()), QString::number(reader.columnNumber()),
+                                           QObject::tr("Premature end of document."));
+        pMsg->createFaultMessage(QString::number(QXmlStreamReader::PrematureEndOfDocumentError), faultText, soapVersion);
+        return KDSoapMessageReader::PrematureEndOfDocumentError;
+    }
+
+    if (d->m_hasHeader) {
+        if (pRequestHeaders) {
+            *pRequestHeaders += d->m_headers;
+        }
+        pMsg->setMessageAddressingProperties(d->m_messageAddressingProperties);
+    }
+    if (d->m_hasBody) {
+        *pMsg = d->m_body;
+        if (pMessageNamespace) {
+            *pMessageNamespace = pMsg->namespaceUri();
+        }
+        if (pMsg->name() == QLatin1String("Fault") && isSoapEnvelopeNamespace(pMsg->namespaceUri())) {
+            pMsg->setFault(true);
+        }
+    }
+    return KDSoapMessageReader::NoError;
+}
+
+class KDSoapMessageIndex::Private
+{
+public:
+    struct Element
+    {
+        QString name;
+        QString namespaceUri;
+        int start; // in m_data, the '<' of the start tag
+        int end; // after the end tag
+        int firstChild;
+        int nextSibling;
+        KDSoapNamespaceScope::Ptr parentScope; // the declarations of the ancestors, needed to parse the element alone
+    };
+
+    Private()
+        : m_header(-1)
+        , m_body(-1)
+        , m_arenaAllocation(false)
+    {
+    }
+
+    bool isSoapElement(int element, const char *name) const
+    {
+        return element >= 0 && m_elements.at(element).name == QLatin1String(name) && isSoapEnvelopeNamespace(m_elements.at(element).namespaceUri);
+    }
+
+    QByteArray m_data;
+    QVector<Element> m_elements; // in document order, the first one is the Envelope
+    int m_header;
+    int m_body;
+    bool m_arenaAllocation;
+};
+
+KDSoapMessageIndex::KDSoapMessageIndex()
+    : d(new Private)
+{
+}
+
+KDSoapMessageIndex::~KDSoapMessageIndex()
+{
+    delete d;
+}
+
+// QXmlStreamReader reports offsets in characters (UTF-16 code units) of the decoded data,
+// this converts them to offsets in the UTF-8 data, moving forward only
+class Utf8OffsetMapper
+{
+public:
+    explicit Utf8OffsetMapper(const QByteArray &data)
+        : m_data(data)
+        , m_bytePos(data.startsWith("\xEF\xBB\xBF") ? 3 : 0) // the BOM isn't counted
+        , m_charPos(0)
+    {
+    }
+
+    // Returns -1 on invalid UTF-8
+    int byteOffset(qint64 charOffset)
+    {
+        while (m_charPos < charOffset) {
+            if (m_bytePos >= m_data.size()) {
+                return -1;
+            }
+            const uchar lead = static_cast<uchar>(m_data.at(m_bytePos));
+            const int length = lead < 0x80 ? 1 : lead < 0xC2 ? 0 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : lead < 0xF5 ? 4 : 0;
+            if (length == 0 || m_bytePos + length > m_data.size()) {
+                return -1;
+            }
+            for (int i = 1; i < length; ++i) {
+                if ((static_cast<uchar>(m_data.at(m_bytePos + i)) & 0xC0) != 0x80) {
+                    return -1;
+                }
+            }
+            m_bytePos += length;
+            m_charPos += length == 4 ? 2 : 1; // surrogate pair
+        }
+        return m_charPos == charOffset ? m_bytePos : -1;
+    }
+
+private:
+    const QByteArray &m_data;
+    int m_bytePos;
+    qint64 m_charPos;
+};
+
+// Checks that the start tag at \p start in \p data is the one of the current element of \p reader
+static bool isStartTag(const QByteArray &data, int start, const QXmlStreamReader &reader)
+{
+    const QStringView qualifiedName = reader.qualifiedName();
+    if (start < 0 || start + 1 + qualifiedName.size() >= data.size()) {
+        return false;
+    }
+    for (int i = 0; i < qualifiedName.size(); ++i) {
+        const ushort c = qualifiedName.at(i).unicode();
+        if (c >= 0x80) {
+            return true; // the ASCII part matched, good enough
+        }
+        if (data.at(start + 1 + i) != char(c)) {
+            return false;
+        }
+    }
+    const char next = data.at(start + 1 + qualifiedName.size());
+    return next == '>' || next == '/' || next == ' ' || next == '\t' || next == '\r' || next == '\n';
+}
+
+bool KDSoapMessageIndex::build(const QByteArray &data)
+{
+    d->m_data = data;
+    d->m_elements.clear();
+    d->m_header = -1;
+    d->m_body = -1;
+
+    QXmlStreamReader reader(data);
+    Utf8OffsetMapper mapper(data);
+    QVector<int> openElements;
+    QVector<int> lastChildren; // of the open elements
+    QVector<KDSoapNamespaceScope::Ptr> scopes; // of the open elements
+    while (reader.readNext() != QXmlStreamReader::Invalid && !reader.atEnd()) {
+        switch (reader.tokenType()) {
+        case QXmlStreamReader::StartDocument:
+            // QXmlStreamReader supports other encodings, but the offsets are converted for UTF-8 only
+            if (!reader.documentEncoding().isEmpty() && reader.documentEncoding().compare(QLatin1String("UTF-8"), Qt::CaseInsensitive) != 0) {
+                return false;
+            }
+            break;
+        case QXmlStreamReader::StartElement: {
+            // The start tag contains no other '<', even in attribute values
+            const int tagEnd = mapper.byteOffset(reader.characterOffset());
+            const int start = tagEnd < 0 ? -1 : data.lastIndexOf('<', tagEnd - 1);
+            if (!isStartTag(data, start, reader)) {
+                return false;
+            }
+            const int element = d->m_elements.count();
+            Private::Element elem;
+            elem.name = internedString(reader.name());
+            elem.namespaceUri = internedString(reader.namespaceUri());
+            elem.start = start;
+            elem.end = -1;
+            elem.firstChild = -1;
+            elem.nextSibling = -1;
+            if (openElements.isEmpty()) {
+                if (element != 0 || !(elem.name == QLatin1String("Envelope") && isSoapEnvelopeNamespace(elem.namespaceUri))) {
+                    return false;
+                }
+            } else {
+                elem.parentScope = scopes.last();
+                const int previousSibling = lastChildren.last();
+                if (previousSibling < 0) {
+                    d->m_elements[openElements.last()].firstChild = element;
+                } else {
+                    d->m_elements[previousSibling].nextSibling = element;
+                }
+                lastChildren.last() = element;
+            }
+            d->m_elements.append(elem);
+            openElements.append(element);
+            lastChildren.append(-1);
+            scopes.append(KDSoapNamespaceScope::create(elem.parentScope, reader.namespaceDeclarations()));
+            break;
+        }
+        case QXmlStreamReader::EndElement: {
+            const int end = mapper.byteOffset(reader.characterOffset());
+            if (end <= 0 || data.at(end - 1) != '>') {
+                return false;
+            }
+            d->m_elements[openElements.takeLast()].end = end;
+            lastChildren.removeLast();
+            scopes.removeLast();
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    if (reader.hasError() || d->m_elements.isEmpty()) {
+        return false;
+    }
+
+    // Like KDSoapMessageReader::xmlToMessage: optional Header, then Body
+    int child = d->m_elements.at(0).firstChild;
+    if (d->isSoapElement(child, "Header")) {
+        d->m_header = child;
+        child = d->m_elements.at(child).nextSibling;
+    }
+    if (!d->isSoapElement(child, "Body")) {
+        return false;
+    }
+    d->m_body = child;
+    return true;
+}
+
+QByteArray KDSoapMessageIndex::data() const
+{
+    return d->m_data;
+}
+
+void KDSoapMessageIndex::setArenaAllocation(bool enabled)
+{
+    d->m_arenaAllocation = enabled;
+}
+
+int KDSoapMessageIndex::header() const
+{
+    return d->m_header;
+}
+
+int KDSoapMessageIndex::body() const
+{
+    return d->m_body;
+}
+
+bool KDSoapMessageIndex::isFault() const
+{
+    return d->isSoapElement(firstChild(d->m_body), "Fault");
+}
+
+int KDSoapMessageIndex::firstChild(int element) const
+{
+    return element < 0 ? -1 : d->m_elements.at(element).firstChild;
+}
+
+int KDSoapMessageIndex::nextSibling(int element) const
+{
+    return element < 0 ? -1 : d->m_elements.at(element).nextSibling;
+}
+
+QString KDSoapMessageIndex::name(int element) const
+{
+    return d->m_elements.at(element).name;
+}
+
+QString KDSoapMessageIndex::namespaceUri(int element) const
+{
+    return d->m_elements.at(element).namespaceUri;
+}
+
+bool KDSoapMessageIndex::parsePath(const QString &path, QStringList *names, QVector<int> *positions)
+{
+    const QStringList steps = path.split(QLatin1Char('/'));
+    for (const QString &step : steps) {
+        if (step.isEmpty()) {
+            continue; // leading or trailing slash
+        }
+        QString name = step;
+        int position = 1;
+        if (step.endsWith(QLatin1Char(']'))) {
+            const int bracket = step.indexOf(QLatin1Char('['));
+            bool ok = false;
+            position = bracket > 0 ? step.mid(bracket + 1, step.size() - bracket - 2).toInt(&ok) : 0;
+            if (!ok || position < 1) {
+                return false;
+            }
+            name = step.left(bracket);
+        }
+        const int colon = name.indexOf(QLatin1Char(':'));
+        if (colon >= 0) {
+            name = name.mid(colon + 1); // prefixes are ignored
+        }
+        if (name.isEmpty()) {
+            return false;
+        }
+        names->append(name);
+        positions->append(position);
+    }
+    return !names->isEmpty();
+}
+
+int KDSoapMessageIndex::find(const QString &path) const
+{
+    QStringList names;
+    QVector<int> positions;
+    if (d->m_elements.isEmpty() || !parsePath(path, &names, &positions)) {
+        return -1;
+    }
+    int element = 0; // the Envelope
+    for (int i = 0; i < names.count(); ++i) {
+        int position = positions.at(i);
+        int child = firstChild(element);
+        for (; child >= 0; child = nextSibling(child)) {
+            if (d->m_elements.at(child).name == names.at(i) && --position == 0) {
+                break;
+            }
+        }
+        if (child < 0) {
+            return -1;
+        }
+        element = child;
+    }
+    return element;
+}
+
+KDSoapValue KDSoapMessageIndex::value(int element) const
+{
+    const Private::Element &elem = d->m_elements.at(element);
+    const KDSoapValueArena::Scope arenaScope(d->m_arenaAllocation);
+    QXmlStreamReader reader(QByteArray::fromRawData(d->m_data.constData() + elem.start, elem.end - elem.start));
+    // The prefixes can be declared by the ancestors, which aren't part of the data
+    if (elem.parentScope) {
+        reader.addExtraNamespaceDeclarations(elem.parentScope->allDeclarations());
+    }
+    if (!reader.readNextStartElement()) {
+        return KDSoapValue();
+    }
+    return parseElement(reader, elem.parentScope);
+}
@@ -13,6 +13,9 @@
 
 #include "KDSoapClientInterface.h"
 #include "KDSoapMessage.h"
+#include <QStringList>
+#include <QVector>
+#include <functional>
 
 class KDSOAP_EXPORT KDSoapMessageReader
 {
@@ -26,8 +29,125 @@ public:
 
     KDSoapMessageReader();
 
+    /**
+     * Allocates the KDSoapValue nodes of the parsed message from an arena (see KDSoapValueArena),
+     * rather than one by one. Useful for large messages. Off by default.
+     */
+    void setArenaAllocation(bool enabled)
+    {
+        m_arenaAllocation = enabled;
+    }
+
+    /**
+     * If \p bodyReader is set, it reads the first element of the body from the stream, unless it's a fault:
+     * \p pParsedMessage then only gets its name and namespace.
+     */
     XmlError xmlToMessage(const QByteArray &data, KDSoapMessage *pParsedMessage, QString *pMessageNamespace, KDSoapHeaders *pRequestHeaders,
-                          KDSoap::SoapVersion soapVersion) const;
+                          KDSoap::SoapVersion soapVersion, const KDSoapBodyReader &bodyReader = KDSoapBodyReader()) const;
+
+    /// Reads the current element of \p reader, up to its end, see KDSoapValue::fromXml
+    static KDSoapValue readElement(QXmlStreamReader &reader);
+
+private:
+    bool m_arenaAllocation;
+};
+
+/**
+ * \internal
+ * Incremental variant of KDSoapMessageReader, for XML data which arrives in pieces
+ * (e.g. from a socket). The data is parsed as it comes in, so that parsing overlaps with
+ * receiving, and the complete document never needs to be buffered.
+ *
+ * Note that unlike KDSoapMessageReader::xmlToMessage, this doesn't attempt to recover
+ * from invalid character references, since this would require keeping all the data around.
+ */
+class KDSOAP_EXPORT KDSoapIncrementalMessageReader
+{
+public:
+    KDSoapIncrementalMessageReader();
+    ~KDSoapIncrementalMessageReader();
+
+    /**
+     * Parses \p data, which follows the data passed to previous calls.
+     * \return PrematureEndOfDocumentError as long as the SOAP message isn't complete,
+     * NoError once it is, and ParseError if the data isn't a valid SOAP message.
+     * Data added after the SOAP message is complete is ignored.
+     */
+    KDSoapMessageReader::XmlError addData(const QByteArray &data);
+
+    /**
+     * Fills in the parsed message, like KDSoapMessageReader::xmlToMessage does.
+     * If the message is incomplete or invalid, \p pParsedMessage is set to a fault message.
+     */
+    KDSoapMessageReader::XmlError result(KDSoapMessage *pParsedMessage, QString *pMessageNamespace, KDSoapHeaders *pRequestHeaders,
+                                         KDSoap::SoapVersion soapVersion) const;
+
+    typedef std::function<void(int pathIndex, const KDSoapValue &element)> StreamedElementCallback;
+
+    /**
+     * Elements matching one of \p paths (local names from the Envelope, "*" matching any name, see
+     * KDSoapMessageStreamReader::addElementPath) are passed to \p callback as soon as their end element
+     * is read, and they aren't kept in the parsed message, so that their memory can be released right away.
+     * A fault, as first child of the Body, is never streamed.
+     */
+    void setStreamedPaths(const QVector<QStringList> &paths, const StreamedElementCallback &callback);
+
+private:
+    Q_DISABLE_COPY(KDSoapIncrementalMessageReader)
+    class Private;
+    Private *const d;
+};
+
+/**
+ * \internal
+ * Index of the elements of a SOAP message, for lazy parsing (see KDSoapClientInterface::setLazyReplyParsingEnabled).
+ *
+ * build() parses the data once, only recording where each element starts and ends, its name and
+ * the namespace declarations in scope. value() then creates the KDSoapValue of one element
+ * (with its children) from its part of the data, when someone needs it.
+ * Elements are referred to by their number, in document order; -1 means "none".
+ */
+class KDSOAP_EXPORT KDSoapMessageIndex
+{
+public:
+    KDSoapMessageIndex();
+    ~KDSoapMessageIndex();
+
+    /**
+     * Indexes \p data, which is kept.
+     * Returns false if the data isn't a well-formed SOAP message, or isn't encoded in UTF-8:
+     * use KDSoapMessageReader::xmlToMessage then, it creates the fault messages.
+     */
+    bool build(const QByteArray &data);
+    QByteArray data() const;
+
+    /// See KDSoapMessageReader::setArenaAllocation
+    void setArenaAllocation(bool enabled);
+
+    int header() const;
+    int body() const;
+    /// True if the first child of the Body is a SOAP fault
+    bool isFault() const;
+    int firstChild(int element) const;
+    int nextSibling(int element) const;
+    QString name(int element) const;
+    QString namespaceUri(int element) const;
+
+    /**
+     * Finds an element from its path in the envelope, see KDSoapPendingCall::value(const QString &).
+     * Returns -1 if there's no such element, or if the path is invalid.
+     */
+    int find(const QString &path) const;
+    /// Splits \p path into the local names of the elements, and their positions among the siblings with the same name (from 1)
+    static bool parsePath(const QString &path, QStringList *names, QVector<int> *positions);
+
+    /// Parses \p element, like KDSoapMessageReader::xmlToMessage would
+    KDSoapValue value(int element) const;
+
+private:
+    Q_DISABLE_COPY(KDSoapMessageIndex)
+    class Private;
+    Private *const d;
 };
 
 #endif
@@ -0,0 +1,123 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#include "KDSoapMessageStreamReader.h"
+#include "KDSoapMessageReader_p.h"
+
+#include <QQueue>
+#include <QVector>
+
+class KDSoapMessageStreamReader::Private
+{
+public:
+    Private()
+        : m_status(NeedMoreData)
+    {
+    }
+
+    void elementRead(int pathIndex, const KDSoapValue &element)
+    {
+        const ElementHandler &handler = m_handlers.at(pathIndex);
+        if (handler) {
+            handler(element);
+        } else {
+            m_pendingElements.enqueue(element);
+        }
+    }
+
+    KDSoapIncrementalMessageReader m_reader;
+    QVector<QStringList> m_paths;
+    QVector<ElementHandler> m_handlers;
+    QQueue<KDSoapValue> m_pendingElements;
+    Status m_status;
+};
+
+KDSoapMessageStreamReader::KDSoapMessageStreamReader()
+    : d(new Private)
+{
+}
+
+KDSoapMessageStreamReader::~KDSoapMessageStreamReader()
+{
+    delete d;
+}
+
+bool KDSoapMessageStreamReader::addElementPath(const QString &path, const ElementHandler &handler)
+{
+    QStringList names = path.split(QLatin1Char('/'));
+    if (path.startsWith(QLatin1Char('/'))) {
+        names.removeFirst();
+    }
+    if (names.count() < 2 || (names.first() != QLatin1String("Header") && names.first() != QLatin1String("Body"))) {
+        return false;
+    }
+    for (QString &name : names) {
+        if (name.isEmpty()) {
+            return false;
+        }
+        // Prefixes are ignored
+        const int colon = name.indexOf(QLatin1Char(':'));
+        if (colon >= 0) {
+            name = name.mid(colon + 1);
+        }
+    }
+    d->m_paths.append(names);
+    d->m_handlers.append(handler);
+    d->m_reader.setStreamedPaths(d->m_paths, [this](int pathIndex, const KDSoapValue &element) {
+        d->elementRead(pathIndex, element);
+    });
+    return true;
+}
+
+KDSoapMessageStreamReader::Status KDSoapMessageStreamReader::addData(const QByteArray &data)
+{
+    switch (d->m_reader.addData(data)) {
+    case KDSoapMessageReader::NoError:
+        d->m_status = Finished;
+        break;
+    case KDSoapMessageReader::PrematureEndOfDocumentError:
+        d->m_status = NeedMoreData;
+        break;
+    case KDSoapMessageReader::ParseError:
+        d->m_status = Error;
+        break;
+    }
+    return d->m_status;
+}
+
+KDSoapMessageStreamReader::Status KDSoapMessageStreamReader::status() const
+{
+    return d->m_status;
+}
+
+bool KDSoapMessageStreamReader::hasPendingElements() const
+{
+    return !d->m_pendingElements.isEmpty();
+}
+
+KDSoapValue KDSoapMessageStreamReader::takeElement()
+{
+    return d->m_pendingElements.isEmpty() ? KDSoapValue() : d->m_pendingElements.dequeue();
+}
+
+KDSoapMessage KDSoapMessageStreamReader::message(KDSoap::SoapVersion soapVersion) const
+{
+    KDSoapMessage message;
+    d->m_reader.result(&message, nullptr, nullptr, soapVersion);
+    return message;
+}
+
+KDSoapHeaders KDSoapMessageStreamReader::headers() const
+{
+    KDSoapMessage message;
+    KDSoapHeaders headers;
+    d->m_reader.result(&message, nullptr, &headers, KDSoap::SOAP1_1);
+    return headers;
+}
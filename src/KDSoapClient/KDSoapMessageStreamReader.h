@@ -0,0 +1,127 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#ifndef KDSOAPMESSAGESTREAMREADER_H
+#define KDSOAPMESSAGESTREAMREADER_H
+
+#include "KDSoapGlobal.h"
+#include "KDSoapMessage.h"
+
+#include <functional>
+
+/**
+ * \brief KDSoapMessageStreamReader parses a SOAP message as its data comes in, handing out
+ * selected elements one at a time, so that the memory used doesn't grow with the size of the message.
+ *
+ * Typically, a large response contains a long list of repeated elements. Register the path of those
+ * elements with addElementPath(): each of them is parsed into a KDSoapValue when its end tag is read,
+ * passed to the handler (or queued, see takeElement()), and not kept in the rest of the message.
+ * Everything else is parsed as usual, and is available in message() and headers() at the end.
+ *
+ * \code
+ * KDSoapMessageStreamReader streamReader;
+ * streamReader.addElementPath(QStringLiteral("Body/GetOrdersResponse/order"), [&](const KDSoapValue &order) {
+ *     TNS__Order tnsOrder;
+ *     tnsOrder.deserialize(order);
+ *     store(tnsOrder);
+ * });
+ * KDSoapPendingCall pendingCall = client.asyncCall(QStringLiteral("GetOrders"), request);
+ * pendingCall.setStreamReader(&streamReader);
+ * \endcode
+ *
+ * The data can also be passed to addData() directly, e.g. when reading a message from a file.
+ *
+ * Unlike KDSoapPendingCall::returnMessage(), this doesn't attempt to recover from invalid character
+ * references, since this would require keeping all the data around.
+ * \since 2.2
+ */
+class KDSOAP_EXPORT KDSoapMessageStreamReader
+{
+public:
+    /**
+     * Called with each element matching a path registered with addElementPath().
+     */
+    typedef std::function<void(const KDSoapValue &element)> ElementHandler;
+
+    enum Status
+    {
+        NeedMoreData, ///< The message isn't complete yet
+        Finished, ///< The message is complete, see message()
+        Error ///< The data isn't a valid SOAP message, see message()
+    };
+
+    KDSoapMessageStreamReader();
+    ~KDSoapMessageStreamReader();
+
+    /**
+     * Streams the elements designated by \p path, relative to the SOAP envelope: element names separated by '/',
+     * e.g. "Body/GetOrdersResponse/order". A "*" matches any name. Prefixes are ignored.
+     * The path must start with "Header/" or "Body/". A fault is never streamed.
+     *
+     * Each matching element is passed to \p handler as soon as it's complete, from addData().
+     * Without a \p handler, the elements are queued instead, see takeElement().
+     * Matching elements aren't kept in message() or headers().
+     *
+     * Paths should be added before the data, elements which are already being parsed aren't affected.
+     * Returns false if \p path is invalid.
+     */
+    bool addElementPath(const QString &path, const ElementHandler &handler = ElementHandler());
+
+    /**
+     * Parses \p data, which follows the data passed to previous calls.
+     * Data added after the SOAP message is complete is ignored.
+     */
+    Status addData(const QByteArray &data);
+
+    /**
+     * Returns the status after the last call to addData().
+     */
+    Status status() const;
+
+    /**
+     * Returns true if elements matching a path registered without a handler were read,
+     * and weren't taken yet with takeElement().
+     */
+    bool hasPendingElements() const;
+
+    /**
+     * Returns the next element matching a path registered without a handler, and removes it from the queue.
+     * Returns a null KDSoapValue if there is none. Take the elements after each addData() call,
+     * to keep the memory used bounded:
+     * \code
+     * while (streamReader.addData(socket->readAll()) == KDSoapMessageStreamReader::NeedMoreData) {
+     *     while (streamReader.hasPendingElements()) {
+     *         process(streamReader.takeElement());
+     *     }
+     *     socket->waitForReadyRead();
+     * }
+     * \endcode
+     */
+    KDSoapValue takeElement();
+
+    /**
+     * Returns the message, without the elements which were streamed.
+     * Could either be a fault (see KDSoapMessage::isFault) or the actual message,
+     * and it's a fault if the data isn't a complete and valid SOAP message.
+     */
+    KDSoapMessage message(KDSoap::SoapVersion soapVersion = KDSoap::SOAP1_1) const;
+
+    /**
+     * Returns the headers of the message, without the elements which were streamed.
+     */
+    KDSoapHeaders headers() const;
+
+private:
+    Q_DISABLE_COPY(KDSoapMessageStreamReader)
+    class Private;
+    Private *const d;
+};
+
+#endif // KDSOAPMESSAGESTREAMREADER_H
@@ -35,9 +35,26 @@ QByteArray KDSoapMessageWriter::messageToXml(const KDSoapMessage &message, const
 {
     QByteArray data;
     QXmlStreamWriter writer(&data);
+    KDSoapNamespacePrefixes namespacePrefixes;
+    QString messageNamespace;
+    if (writeMessageStart(writer, namespacePrefixes, message, method, headers, persistentHeaders, authentication, &messageNamespace)) {
+        message.writeElementContents(namespacePrefixes, writer, message.use(), messageNamespace);
+        if (message.d->bodyWriter) {
+            message.d->bodyWriter(writer, messageNamespace);
+        }
+        writer.writeEndElement();
+    }
+    writeMessageEnd(writer);
+    return data;
+}
+
+// Writes everything up to the start of the message element. Returns false if there's no message element (null message).
+bool KDSoapMessageWriter::writeMessageStart(QXmlStreamWriter &writer, KDSoapNamespacePrefixes &namespacePrefixes, const KDSoapMessage &message,
+                                            const QString &method, const KDSoapHeaders &headers, const QMap<QString, KDSoapMessage> &persistentHeaders,
+                                            const KDSoapAuthentication &authentication, QString *messageNamespaceOut) const
+{
     writer.writeStartDocument();
 
-    KDSoapNamespacePrefixes namespacePrefixes;
     namespacePrefixes.writeStandardNamespaces(writer, m_version, message.hasMessageAddressingProperties(),
                                               message.messageAddressingProperties().addressingNamespace());
 
@@ -60,6 +77,7 @@ QByteArray KDSoapMessageWriter::messageToXml(const KDSoapMessage &message, const
     if (!message.namespaceUri().isEmpty() && messageNamespace != message.namespaceUri()) {
         messageNamespace = message.namespaceUri();
     }
+    *messageNamespaceOut = messageNamespace;
 
     if (!headers.isEmpty() || !persistentHeaders.isEmpty() || message.hasMessageAddressingProperties() || authentication.hasWSUsernameTokenHeader()) {
         // This writeNamespace line adds the xmlns:n1 to <Envelope>, which looks ugly and unusual (and breaks all unittests)
@@ -96,21 +114,91 @@ QByteArray KDSoapMessageWriter::messageToXml(const KDSoapMessage &message, const
             qWarning("ERROR: Non-empty message with an empty name!");
             qDebug() << message;
         }
+        return false;
+    }
+    // Note that the message itself is always qualified.
+    // isQualified() is only for child elements.
+    if (!message.isFault()) {
+        writer.writeStartElement(messageNamespace, elementName);
     } else {
-        // Note that the message itself is always qualified.
-        // isQualified() is only for child elements.
-        if (!message.isFault()) {
-            writer.writeStartElement(messageNamespace, elementName);
-        } else {
-            // Fault element should be inside soap namespace
-            writer.writeStartElement(soapEnvelope, elementName);
-        }
-        message.writeElementContents(namespacePrefixes, writer, message.use(), messageNamespace);
-        writer.writeEndElement();
+        // Fault element should be inside soap namespace
+        writer.writeStartElement(soapEnvelope, elementName);
     }
+    return true;
+}
+
+void KDSoapMessageWriter::writeMessageEnd(QXmlStreamWriter &writer)
+{
     writer.writeEndElement(); // Body
     writer.writeEndElement(); // Envelope
     writer.writeEndDocument();
+}
 
-    return data;
+class KDSoapMessageStreamWriter::Private
+{
+public:
+    explicit Private(QIODevice *device)
+        : m_writer(device)
+        , m_use(KDSoapMessage::LiteralUse)
+        , m_state(NotStarted)
+    {
+    }
+
+    QXmlStreamWriter m_writer;
+    KDSoapNamespacePrefixes m_namespacePrefixes;
+    QString m_messageNamespace;
+    KDSoapMessage::Use m_use;
+    enum State
+    {
+        NotStarted,
+        InMessageElement,
+        NoMessageElement,
+        Ended
+    } m_state;
+};
+
+KDSoapMessageStreamWriter::KDSoapMessageStreamWriter(QIODevice *device)
+    : d(new Private(device))
+{
+}
+
+KDSoapMessageStreamWriter::~KDSoapMessageStreamWriter()
+{
+    delete d;
+}
+
+void KDSoapMessageStreamWriter::writeStart(const KDSoapMessageWriter &messageWriter, const KDSoapMessage &message, const QString &method,
+                                           const KDSoapHeaders &headers)
+{
+    Q_ASSERT(d->m_state == Private::NotStarted);
+    d->m_use = message.use();
+    const bool hasElement = messageWriter.writeMessageStart(d->m_writer, d->m_namespacePrefixes, message, method, headers, QMap<QString, KDSoapMessage>(),
+                                                            KDSoapAuthentication(), &d->m_messageNamespace);
+    if (hasElement) {
+        // The attributes and contents of the message itself, the streamed elements come after them
+        message.writeElementContents(d->m_namespacePrefixes, d->m_writer, d->m_use, d->m_messageNamespace);
+        const KDSoapBodyWriter bodyWriter = message.bodyWriter();
+        if (bodyWriter) {
+            bodyWriter(d->m_writer, d->m_messageNamespace);
+        }
+        d->m_state = Private::InMessageElement;
+    } else {
+        d->m_state = Private::NoMessageElement;
+    }
+}
+
+void KDSoapMessageStreamWriter::writeChild(const KDSoapValue &value)
+{
+    Q_ASSERT(d->m_state == Private::InMessageElement);
+    value.writeElement(d->m_namespacePrefixes, d->m_writer, d->m_use, d->m_messageNamespace, false);
+}
+
+void KDSoapMessageStreamWriter::writeEnd()
+{
+    Q_ASSERT(d->m_state == Private::InMessageElement || d->m_state == Private::NoMessageElement);
+    if (d->m_state == Private::InMessageElement) {
+        d->m_writer.writeEndElement();
+    }
+    KDSoapMessageWriter::writeMessageEnd(d->m_writer);
+    d->m_state = Private::Ended;
 }
@@ -22,6 +22,10 @@ class KDSoapHeaders;
 class KDSoapNamespacePrefixes;
 class KDSoapValue;
 class KDSoapValueList;
+class KDSoapMessageStreamWriter;
+QT_BEGIN_NAMESPACE
+class QIODevice;
+QT_END_NAMESPACE
 
 /**
  * \internal
@@ -41,8 +45,39 @@ public:
                             const KDSoapAuthentication &authentication = KDSoapAuthentication()) const;
 
 private:
+    friend class KDSoapMessageStreamWriter;
+    bool writeMessageStart(QXmlStreamWriter &writer, KDSoapNamespacePrefixes &namespacePrefixes, const KDSoapMessage &message, const QString &method,
+                           const KDSoapHeaders &headers, const QMap<QString, KDSoapMessage> &persistentHeaders,
+                           const KDSoapAuthentication &authentication, QString *messageNamespaceOut) const;
+    static void writeMessageEnd(QXmlStreamWriter &writer);
+
     QString m_messageNamespace;
     KDSoap::SoapVersion m_version;
 };
 
+/**
+ * \internal
+ * Writes a message to a device piece by piece, for streamed responses in the server lib:
+ * writeStart(), then writeChild() for each child element of the message, then writeEnd().
+ * Internal class -- only exported for the server lib
+ */
+class KDSOAP_EXPORT KDSoapMessageStreamWriter
+{
+public:
+    explicit KDSoapMessageStreamWriter(QIODevice *device);
+    ~KDSoapMessageStreamWriter();
+
+    /// Writes the envelope, headers and the start of \p message (its attributes and children), using the settings of \p messageWriter
+    void writeStart(const KDSoapMessageWriter &messageWriter, const KDSoapMessage &message, const QString &method, const KDSoapHeaders &headers);
+    /// Writes one more child element of the message
+    void writeChild(const KDSoapValue &value);
+    /// Closes the message element, the body and the envelope
+    void writeEnd();
+
+private:
+    Q_DISABLE_COPY(KDSoapMessageStreamWriter)
+    class Private;
+    Private *const d;
+};
+
 #endif // KDSOAPMESSAGEWRITER_P_H
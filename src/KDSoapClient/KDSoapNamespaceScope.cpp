@@ -0,0 +1,58 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#include "KDSoapNamespaceScope_p.h"
+#include "KDSoapStringPool_p.h"
+#include <QVarLengthArray>
+
+KDSoapNamespaceScope::KDSoapNamespaceScope(const Ptr &parent, const QXmlStreamNamespaceDeclarations &declarations)
+    : m_parent(parent)
+    , m_declarations(declarations)
+{
+}
+
+KDSoapNamespaceScope::Ptr KDSoapNamespaceScope::create(const Ptr &parent, const QXmlStreamNamespaceDeclarations &declarations)
+{
+    if (declarations.isEmpty()) {
+        return parent;
+    }
+    return Ptr(new KDSoapNamespaceScope(parent, declarations));
+}
+
+QString KDSoapNamespaceScope::namespaceForPrefix(const QString &prefix) const
+{
+    for (const KDSoapNamespaceScope *scope = this; scope; scope = scope->m_parent.data()) {
+        for (const QXmlStreamNamespaceDeclaration &decl : scope->m_declarations) {
+            if (decl.prefix() == prefix) {
+                return KDSoapStringPool::intern(decl.namespaceUri().constData(), int(decl.namespaceUri().size()));
+            }
+        }
+    }
+    return QString();
+}
+
+QXmlStreamNamespaceDeclarations KDSoapNamespaceScope::allDeclarations() const
+{
+    if (!m_parent) {
+        return m_declarations;
+    }
+    QVarLengthArray<const KDSoapNamespaceScope *, 16> scopes;
+    int count = 0;
+    for (const KDSoapNamespaceScope *scope = this; scope; scope = scope->m_parent.data()) {
+        scopes.append(scope);
+        count += scope->m_declarations.count();
+    }
+    QXmlStreamNamespaceDeclarations declarations;
+    declarations.reserve(count);
+    for (int i = scopes.count() - 1; i >= 0; --i) {
+        declarations += scopes.at(i)->m_declarations;
+    }
+    return declarations;
+}
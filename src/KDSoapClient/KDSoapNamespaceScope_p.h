@@ -0,0 +1,53 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#ifndef KDSOAPNAMESPACESCOPE_P_H
+#define KDSOAPNAMESPACESCOPE_P_H
+
+#include "KDSoapGlobal.h"
+#include <QtCore/QSharedData>
+#include <QtCore/QXmlStreamReader>
+
+class KDSoapValue;
+
+/**
+ * \internal
+ * The namespace declarations in scope for an element of a parsed message, as a chain of frames:
+ * each frame only holds the declarations of one element, and links to the frame of its parent.
+ *
+ * Elements which don't declare namespaces share the frame of their parent, so the parsed values
+ * only hold a reference, instead of a copy of all the declarations in scope.
+ * Frames are immutable once created, and can be shared between threads.
+ */
+class KDSOAP_EXPORT KDSoapNamespaceScope : public QSharedData
+{
+public:
+    typedef QExplicitlySharedDataPointer<const KDSoapNamespaceScope> Ptr;
+
+    /// Returns \p parent if \p declarations is empty, otherwise a new frame
+    static Ptr create(const Ptr &parent, const QXmlStreamNamespaceDeclarations &declarations);
+
+    /// The namespace of \p prefix, as declared by the innermost element, or an empty string
+    QString namespaceForPrefix(const QString &prefix) const;
+
+    /// All the declarations in scope, the outermost first
+    QXmlStreamNamespaceDeclarations allDeclarations() const;
+
+    /// Makes \p value return allDeclarations() of \p scope in KDSoapValue::environmentNamespaceDeclarations()
+    static void setEnvironment(KDSoapValue &value, const Ptr &scope);
+
+private:
+    KDSoapNamespaceScope(const Ptr &parent, const QXmlStreamNamespaceDeclarations &declarations);
+
+    const Ptr m_parent;
+    const QXmlStreamNamespaceDeclarations m_declarations;
+};
+
+#endif // KDSOAPNAMESPACESCOPE_P_H
@@ -9,6 +9,7 @@
 ****************************************************************************/
 #include "KDSoapPendingCall.h"
 #include "KDSoapMessageReader_p.h"
+#include "KDSoapMessageStreamReader.h"
 #include "KDSoapNamespaceManager.h"
 #include "KDSoapPendingCall_p.h"
 #include <QDebug>
@@ -128,6 +129,7 @@ KDSoapPendingCall::Private::~Private()
     }
     delete reply.data();
     delete buffer;
+    delete index;
 }
 
 KDSoapPendingCall::KDSoapPendingCall(QNetworkReply *reply, QBuffer *buffer)
@@ -155,28 +157,100 @@ bool KDSoapPendingCall::isFinished() const
     return d->reply.data()->isFinished();
 }
 
+void KDSoapPendingCall::setStreamReader(KDSoapMessageStreamReader *streamReader)
+{
+    QNetworkReply *reply = d->reply.data();
+    if (!reply || d->parsed) {
+        return;
+    }
+    if (!d->streamReader && streamReader) {
+        // The connection goes away with the reply, which is deleted by Private
+        Private *priv = d.data();
+        QObject::connect(reply, &QNetworkReply::readyRead, reply, [priv]() {
+            priv->readStreamedData();
+        });
+    }
+    d->streamReader = streamReader;
+}
+
 KDSoapMessage KDSoapPendingCall::returnMessage() const
 {
     d->parseReply();
+    d->parseMessage();
+    return d->replyMessage;
+}
+
+KDSoapMessage KDSoapPendingCall::returnMessage(const KDSoapBodyReader &bodyReader) const
+{
+    d->parseReply(bodyReader);
+    d->parseMessage();
     return d->replyMessage;
 }
 
 KDSoapHeaders KDSoapPendingCall::returnHeaders() const
 {
     d->parseReply();
+    d->parseMessage();
     return d->replyHeaders;
 }
 
 QVariant KDSoapPendingCall::returnValue() const
 {
     d->parseReply();
+    if (d->index) {
+        // Only the first argument of the response
+        const int argument = d->index->firstChild(d->index->firstChild(d->index->body()));
+        return argument < 0 ? QVariant() : d->index->value(argument).value();
+    }
     if (!d->replyMessage.childValues().isEmpty()) {
         return d->replyMessage.childValues().first().value();
     }
     return QVariant();
 }
 
-void KDSoapPendingCall::Private::parseReply()
+KDSoapValue KDSoapPendingCall::value(const QString &path) const
+{
+    d->parseReply();
+    if (d->index) {
+        const int element = d->index->find(path);
+        return element < 0 ? KDSoapValue() : d->index->value(element);
+    }
+
+    QStringList names;
+    QVector<int> positions;
+    if (!KDSoapMessageIndex::parsePath(path, &names, &positions)) {
+        return KDSoapValue();
+    }
+    KDSoapValueList children;
+    if (names.first() == QLatin1String("Header")) {
+        for (const KDSoapMessage &header : qAsConst(d->replyHeaders)) {
+            children.append(header);
+        }
+    } else if (names.first() == QLatin1String("Body")) {
+        children.append(d->replyMessage);
+    }
+    if (positions.first() != 1) {
+        return KDSoapValue();
+    }
+    KDSoapValue result;
+    for (int i = 1; i < names.count(); ++i) {
+        int position = positions.at(i);
+        auto it = children.cbegin();
+        for (; it != children.cend(); ++it) {
+            if (it->name() == names.at(i) && --position == 0) {
+                break;
+            }
+        }
+        if (it == children.cend()) {
+            return KDSoapValue();
+        }
+        result = *it;
+        children = result.childValues();
+    }
+    return result;
+}
+
+void KDSoapPendingCall::Private::parseReply(const KDSoapBodyReader &bodyReader)
 {
     if (parsed) {
         return;
@@ -186,15 +260,38 @@ void KDSoapPendingCall::Private::parseReply()
         qWarning("KDSoap: Parsing reply before it finished!");
         return;
     }
-    parsed = true;
 
-    // Don't try to read from an aborted (closed) reply
-    const QByteArray data = reply->isOpen() ? reply->readAll() : QByteArray();
-    maybeDebugResponse(data, reply);
+    if (streamReader) {
+        // The data was passed to the stream reader while it came in, except maybe for the last piece
+        readStreamedData();
+        parsed = true;
+        if (streamedData) {
+            replyMessage = streamReader->message(soapVersion);
+            replyHeaders = streamReader->headers();
+        }
+    } else {
+        parsed = true;
 
-    if (!data.isEmpty()) {
-        KDSoapMessageReader reader;
-        reader.xmlToMessage(data, &replyMessage, nullptr, &replyHeaders, this->soapVersion);
+        // Don't try to read from an aborted (closed) reply
+        const QByteArray data = reply->isOpen() ? reply->readAll() : QByteArray();
+        maybeDebugResponse(data, reply);
+
+        if (lazyParsing && !bodyReader && !data.isEmpty() && !reply->error()) {
+            // Only index the elements for now, faults and invalid messages are parsed right away
+            index = new KDSoapMessageIndex;
+            index->setArenaAllocation(arenaAllocation);
+            if (index->build(data) && !index->isFault()) {
+                return;
+            }
+            delete index;
+            index = nullptr;
+        }
+
+        if (!data.isEmpty()) {
+            KDSoapMessageReader reader;
+            reader.setArenaAllocation(arenaAllocation);
+            reader.xmlToMessage(data, &replyMessage, nullptr, &replyHeaders, this->soapVersion, bodyReader);
+        }
     }
 
     if (reply->error()) {
@@ -209,3 +306,29 @@ void KDSoapPendingCall::Private::parseReply()
         }
     }
 }
+
+void KDSoapPendingCall::Private::readStreamedData()
+{
+    QNetworkReply *reply = this->reply.data();
+    // Don't try to read from an aborted (closed) reply
+    if (parsed || !reply || !reply->isOpen()) {
+        return;
+    }
+    const QByteArray data = reply->readAll();
+    if (!data.isEmpty()) {
+        streamedData = true;
+        streamReader->addData(data);
+    }
+}
+
+void KDSoapPendingCall::Private::parseMessage()
+{
+    if (!index) {
+        return;
+    }
+    KDSoapMessageReader reader;
+    reader.setArenaAllocation(arenaAllocation);
+    reader.xmlToMessage(index->data(), &replyMessage, nullptr, &replyHeaders, soapVersion);
+    delete index;
+    index = nullptr;
+}
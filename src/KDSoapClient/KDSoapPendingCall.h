@@ -12,11 +12,22 @@
 
 #include "KDSoapMessage.h"
 #include <QtCore/QExplicitlySharedDataPointer>
+#include <functional>
 QT_BEGIN_NAMESPACE
 class QNetworkReply;
 class QBuffer;
+class QXmlStreamReader;
 QT_END_NAMESPACE
 class KDSoapPendingCallWatcher;
+class KDSoapMessageStreamReader;
+
+/**
+ * Reads the first element of the SOAP body of a response directly from the XML stream,
+ * e.g. into the types generated by kdwsdl2cpp -stream-deserializers, instead of creating KDSoapValues.
+ * It's called with \p reader on the StartElement, and must read up to the matching EndElement.
+ * \since 2.2
+ */
+typedef std::function<void(QXmlStreamReader &reader)> KDSoapBodyReader;
 
 /**
  * The KDSoapPendingCall class refers to one pending asynchronous call
@@ -68,6 +79,17 @@ public:
      */
     KDSoapMessage returnMessage() const;
 
+    /**
+     * Returns the response message sent by the server, like returnMessage(), except that
+     * the first element of the body is read by \p bodyReader, instead of into the message:
+     * unless the response is a fault, the returned message only has the name and namespace of that element.
+     * The headers are still available in returnHeaders().
+     *
+     * If the response was already parsed (by returnMessage(), returnValue() or value()), \p bodyReader is not called.
+     * \since 2.2
+     */
+    KDSoapMessage returnMessage(const KDSoapBodyReader &bodyReader) const;
+
     /**
      * Helper method for the simple case where a single argument is returned:
      * Returns the value of that single argument.
@@ -79,6 +101,19 @@ public:
      */
     KDSoapHeaders returnHeaders() const;
 
+    /**
+     * Returns a single element of the response, designated by \p path, relative to the SOAP envelope:
+     * element names separated by '/', with an optional 1-based position among the elements of the same name,
+     * e.g. "Body/GetItemsResponse/Items/Item[3]/Name". Prefixes are ignored.
+     * Returns a null KDSoapValue if there is no such element.
+     *
+     * With KDSoapClientInterface::setLazyReplyParsingEnabled, only the element designated by \p path
+     * (and its children) is parsed. Otherwise the element is looked up in returnMessage() and returnHeaders(),
+     * so the path must start with "Header/" or "Body/", and the WS-Addressing headers are not found.
+     * \since 2.2
+     */
+    KDSoapValue value(const QString &path) const;
+
     /**
      * Returns \c true if the pending call has finished processing and the reply has been received.
      *
@@ -90,6 +125,22 @@ public:
      */
     bool isFinished() const;
 
+    /**
+     * Passes the response to \p streamReader while it's being downloaded, rather than keeping all of it
+     * until the call finishes: the elements registered with KDSoapMessageStreamReader::addElementPath()
+     * are handled as they arrive, from the event loop, and the memory used doesn't grow with the size of the response.
+     *
+     * Call this right after KDSoapClientInterface::asyncCall(), before returning to the event loop.
+     * \p streamReader must stay valid until the call is finished and its result was read.
+     *
+     * returnMessage(), returnHeaders(), returnValue() and value() then return the rest of the response,
+     * from KDSoapMessageStreamReader::message() and KDSoapMessageStreamReader::headers().
+     * KDSoapClientInterface::setLazyReplyParsingEnabled, the body reader of returnMessage(const KDSoapBodyReader &)
+     * and the debug output of the response (KDSOAP_DEBUG) don't apply to such calls.
+     * \since 2.2
+     */
+    void setStreamReader(KDSoapMessageStreamReader *streamReader);
+
 private:
     friend class KDSoapClientInterface;
     friend class KDSoapThreadTask;
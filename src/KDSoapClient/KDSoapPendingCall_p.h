@@ -19,6 +19,8 @@
 #include <QXmlStreamReader>
 
 class KDSoapValue;
+class KDSoapMessageIndex;
+class KDSoapMessageStreamReader;
 
 void maybeDebugRequest(const QByteArray &data, const QNetworkRequest &request, QNetworkReply *reply);
 
@@ -30,12 +32,19 @@ public:
         , buffer(b)
         , soapVersion(KDSoap::SOAP1_1)
         , parsed(false)
+        , arenaAllocation(false)
+        , lazyParsing(false)
+        , index(nullptr)
+        , streamReader(nullptr)
+        , streamedData(false)
     {
     }
     ~Private();
 
-    void parseReply();
+    void parseReply(const KDSoapBodyReader &bodyReader = KDSoapBodyReader());
+    void parseMessage();
     KDSoapValue parseReplyElement(QXmlStreamReader &reader);
+    void readStreamedData();
 
     // Can be deleted under us if the KDSoapClientInterface (and its QNetworkAccessManager)
     // are deleted before the KDSoapPendingCall.
@@ -45,6 +54,11 @@ public:
     KDSoapHeaders replyHeaders;
     KDSoap::SoapVersion soapVersion;
     bool parsed;
+    bool arenaAllocation; // KDSoapClientInterface::setArenaAllocationEnabled
+    bool lazyParsing; // KDSoapClientInterface::setLazyReplyParsingEnabled
+    KDSoapMessageIndex *index; // until replyMessage and replyHeaders are parsed, with lazy parsing
+    KDSoapMessageStreamReader *streamReader; // KDSoapPendingCall::setStreamReader, owned by the caller
+    bool streamedData; // some data was passed to streamReader
 };
 
 #endif // KDSOAPPENDINGCALL_P_H
@@ -0,0 +1,39 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#include "KDSoapStringPool_p.h"
+#include <QSet>
+
+// Far more than the names of a WSDL, but small enough not to matter if filled with garbage
+static const int s_maxStringCount = 4096;
+static const int s_maxStringLength = 128;
+
+static thread_local QSet<QString> s_strings;
+
+QString KDSoapStringPool::intern(const QChar *data, int size)
+{
+    if (size == 0) {
+        return QString();
+    }
+    if (size > s_maxStringLength) {
+        return QString(data, size);
+    }
+    // Looked up without copying the data
+    const QString key = QString::fromRawData(data, size);
+    const auto it = s_strings.constFind(key);
+    if (it != s_strings.constEnd()) {
+        return *it;
+    }
+    const QString str(data, size);
+    if (s_strings.count() < s_maxStringCount) {
+        s_strings.insert(str);
+    }
+    return str;
+}
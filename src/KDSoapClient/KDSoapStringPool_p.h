@@ -0,0 +1,34 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#ifndef KDSOAPSTRINGPOOL_P_H
+#define KDSOAPSTRINGPOOL_P_H
+
+#include <QtCore/QString>
+
+/**
+ * \internal
+ * Intern table for the element names, attribute names and namespace URIs of parsed messages.
+ *
+ * The same few hundred names repeat in every message: instead of allocating a new QString
+ * for each element, the parser returns the string stored in the table, so all the values with
+ * the same name share its data (and comparing them is a pointer comparison, see QString::operator==).
+ *
+ * There's one table per thread, so no locking is needed. The tables are bounded, since the names
+ * come from the network: once full, or for long strings, intern() simply returns a copy.
+ */
+class KDSoapStringPool
+{
+public:
+    /// Returns the interned copy of the \p size characters at \p data
+    static QString intern(const QChar *data, int size);
+};
+
+#endif // KDSOAPSTRINGPOOL_P_H
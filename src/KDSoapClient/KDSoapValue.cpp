@@ -9,8 +9,11 @@
 ****************************************************************************/
 #include "KDSoapValue.h"
 #include "KDDateTime.h"
+#include "KDSoapMessageReader_p.h"
 #include "KDSoapNamespaceManager.h"
 #include "KDSoapNamespacePrefixes_p.h"
+#include "KDSoapNamespaceScope_p.h"
+#include "KDSoapValueArena_p.h"
 #include <QDateTime>
 #include <QDebug>
 #include <QStringList>
@@ -34,6 +37,16 @@ public:
     {
     }
 
+    // From the arena of the message being parsed, if any, see KDSoapMessageReader::setArenaAllocation
+    static void *operator new(size_t size)
+    {
+        return KDSoapValueArena::allocate(size);
+    }
+    static void operator delete(void *ptr)
+    {
+        KDSoapValueArena::deallocate(ptr);
+    }
+
     QString m_name;
     QString m_nameNamespace;
     QVariant m_value;
@@ -43,6 +56,7 @@ public:
     bool m_qualified;
     bool m_nillable;
     QXmlStreamNamespaceDeclarations m_environmentNamespaceDeclarations;
+    KDSoapNamespaceScope::Ptr m_environmentScope; // instead of m_environmentNamespaceDeclarations, for parsed values
     QXmlStreamNamespaceDeclarations m_localNamespaceDeclarations;
 };
 
@@ -139,13 +153,24 @@ QXmlStreamNamespaceDeclarations KDSoapValue::namespaceDeclarations() const
 void KDSoapValue::setEnvironmentNamespaceDeclarations(const QXmlStreamNamespaceDeclarations &environmentNamespaceDeclarations)
 {
     d->m_environmentNamespaceDeclarations = environmentNamespaceDeclarations;
+    d->m_environmentScope.reset();
 }
 
 QXmlStreamNamespaceDeclarations KDSoapValue::environmentNamespaceDeclarations() const
 {
+    if (d->m_environmentScope) {
+        return d->m_environmentScope->allDeclarations();
+    }
     return d->m_environmentNamespaceDeclarations;
 }
 
+// Here rather than in KDSoapNamespaceScope.cpp, for KDSoapValue::Private
+void KDSoapNamespaceScope::setEnvironment(KDSoapValue &value, const Ptr &scope)
+{
+    value.d->m_environmentScope = scope;
+    value.d->m_environmentNamespaceDeclarations.clear();
+}
+
 KDSoapValueList &KDSoapValue::childValues() const
 {
     // I want to fool the QSharedDataPointer mechanism here...
@@ -478,3 +503,20 @@ QByteArray KDSoapValue::toXml(KDSoapValue::Use use, const QString &messageNamesp
 
     return data;
 }
+
+KDSoapValue KDSoapValue::fromXml(QXmlStreamReader &reader)
+{
+    return KDSoapMessageReader::readElement(reader);
+}
+
+void KDSoapValue::writeXml(QXmlStreamWriter &writer, const QString &messageNamespace) const
+{
+    KDSoapNamespacePrefixes namespacePrefixes; // only used for xsi:type, i.e. in encoded use
+    writeElement(namespacePrefixes, writer, LiteralUse, messageNamespace, false);
+}
+
+void KDSoapValue::writeXmlContents(QXmlStreamWriter &writer, const QString &messageNamespace) const
+{
+    KDSoapNamespacePrefixes namespacePrefixes;
+    writeElementContents(namespacePrefixes, writer, LiteralUse, messageNamespace);
+}
@@ -270,6 +270,35 @@ public:
 
     QByteArray toXml(Use use = LiteralUse, const QString &messageNamespace = QString()) const;
 
+    /**
+     * Reads the element at the current position of \p reader (which must be on a StartElement),
+     * with its attributes and children, up to its EndElement.
+     * This is used by the deserializers generated by kdwsdl2cpp -stream-deserializers,
+     * for the types which aren't read directly from the stream.
+     *
+     * The namespace declarations of the ancestors of the element aren't available,
+     * only the ones of the element itself are in environmentNamespaceDeclarations().
+     * This is why kdwsdl2cpp doesn't generate stream deserializers for the types containing QNames.
+     * \since 2.2
+     */
+    static KDSoapValue fromXml(QXmlStreamReader &reader);
+
+    /**
+     * Writes this value as an element, in literal use, at the current position of \p writer.
+     * This is used by the serializers generated by kdwsdl2cpp -stream-serializers,
+     * for the values which aren't written directly to the stream.
+     * \param messageNamespace the namespace of the message, for the elements which aren't qualified
+     * \since 2.2
+     */
+    void writeXml(QXmlStreamWriter &writer, const QString &messageNamespace = QString()) const;
+
+    /**
+     * Same as writeXml(), but only writes the attributes, child elements and text of this value,
+     * inside an element which the caller has started with QXmlStreamWriter::writeStartElement().
+     * \since 2.2
+     */
+    void writeXmlContents(QXmlStreamWriter &writer, const QString &messageNamespace = QString()) const;
+
 protected: // for KDSoapMessage
     void setName(const QString &name);
 
@@ -278,6 +307,8 @@ private:
     KDSoapValue(QString, QString, QString);
 
     friend class KDSoapMessageWriter;
+    friend class KDSoapMessageStreamWriter;
+    friend class KDSoapNamespaceScope;
     void writeElement(KDSoapNamespacePrefixes &namespacePrefixes, QXmlStreamWriter &writer, KDSoapValue::Use use, const QString &messageNamespace,
                       bool forceQualified) const;
     void writeElementContents(KDSoapNamespacePrefixes &namespacePrefixes, QXmlStreamWriter &writer, KDSoapValue::Use use,
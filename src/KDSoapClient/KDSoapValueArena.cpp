@@ -0,0 +1,111 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#include "KDSoapValueArena_p.h"
+#include <cstddef>
+#include <new>
+
+// Enough for a few hundred nodes; bigger allocations don't go into the blocks
+static const size_t s_blockSize = 64 * 1024;
+
+// Precedes each allocation, to find the arena it comes from (nullptr for the heap)
+union NodeHeader
+{
+    KDSoapValueArena *arena;
+    std::max_align_t alignment;
+};
+
+static thread_local KDSoapValueArena *s_currentArena = nullptr;
+
+static size_t alignedSize(size_t size)
+{
+    const size_t alignment = alignof(std::max_align_t);
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+KDSoapValueArena::Scope::Scope(bool enabled)
+    : m_arena(enabled ? new KDSoapValueArena : nullptr)
+    , m_previousArena(s_currentArena)
+{
+    if (m_arena) {
+        s_currentArena = m_arena;
+    }
+}
+
+KDSoapValueArena::Scope::~Scope()
+{
+    if (m_arena) {
+        s_currentArena = m_previousArena;
+        m_arena->deref();
+    }
+}
+
+KDSoapValueArena::KDSoapValueArena()
+    : m_ref(1)
+    , m_next(nullptr)
+    , m_available(0)
+{
+}
+
+KDSoapValueArena::~KDSoapValueArena()
+{
+    for (char *block : qAsConst(m_blocks)) {
+        ::operator delete(block);
+    }
+}
+
+void *KDSoapValueArena::allocate(size_t size)
+{
+    const size_t totalSize = sizeof(NodeHeader) + alignedSize(size);
+    KDSoapValueArena *arena = s_currentArena;
+    NodeHeader *header;
+    if (arena && totalSize <= s_blockSize / 4) {
+        header = static_cast<NodeHeader *>(arena->allocateFromBlock(totalSize));
+        arena->m_ref.ref();
+    } else {
+        header = static_cast<NodeHeader *>(::operator new(totalSize));
+        arena = nullptr;
+    }
+    header->arena = arena;
+    return header + 1;
+}
+
+void KDSoapValueArena::deallocate(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    NodeHeader *header = static_cast<NodeHeader *>(ptr) - 1;
+    if (header->arena) {
+        header->arena->deref(); // the memory itself goes away with the blocks
+    } else {
+        ::operator delete(header);
+    }
+}
+
+void *KDSoapValueArena::allocateFromBlock(size_t size)
+{
+    if (size > m_available) {
+        m_next = static_cast<char *>(::operator new(s_blockSize));
+        m_available = s_blockSize;
+        m_blocks.append(m_next);
+    }
+    void *ptr = m_next;
+    m_next += size;
+    m_available -= size;
+    return ptr;
+}
+
+void KDSoapValueArena::deref()
+{
+    if (!m_ref.deref()) {
+        delete this;
+    }
+}
@@ -0,0 +1,65 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#ifndef KDSOAPVALUEARENA_P_H
+#define KDSOAPVALUEARENA_P_H
+
+#include "KDSoapGlobal.h"
+#include <QtCore/QAtomicInt>
+#include <QtCore/QVector>
+#include <cstddef>
+
+/**
+ * \internal
+ * Memory for the KDSoapValue nodes of a parsed message.
+ *
+ * While a Scope exists, the KDSoapValue nodes created in the same thread are allocated
+ * from the scope's arena: large blocks, carved out one node after the other, instead of
+ * one heap allocation per node. The nodes are still destroyed one by one (they own strings
+ * and lists), but their memory is only given back once all of them are gone, by freeing the blocks.
+ *
+ * Each node keeps its arena alive, so values can outlive the message they come from,
+ * or be passed to another thread; the blocks are freed when the last node goes away.
+ */
+class KDSOAP_EXPORT KDSoapValueArena
+{
+public:
+    /// Makes a new arena current for this thread, until the scope is destroyed. Does nothing if \p enabled is false.
+    class KDSOAP_EXPORT Scope
+    {
+    public:
+        explicit Scope(bool enabled = true);
+        ~Scope();
+
+    private:
+        Q_DISABLE_COPY(Scope)
+        KDSoapValueArena *m_arena;
+        KDSoapValueArena *m_previousArena;
+    };
+
+    /// Allocates from the current arena of this thread, if any, otherwise from the heap
+    static void *allocate(size_t size);
+    /// Frees memory returned by allocate(), in any thread
+    static void deallocate(void *ptr);
+
+private:
+    KDSoapValueArena();
+    ~KDSoapValueArena();
+    Q_DISABLE_COPY(KDSoapValueArena)
+    void *allocateFromBlock(size_t size);
+    void deref();
+
+    QAtomicInt m_ref; // the scope, and each node
+    QVector<char *> m_blocks;
+    char *m_next; // free space in the last block
+    size_t m_available;
+};
+
+#endif // KDSOAPVALUEARENA_P_H
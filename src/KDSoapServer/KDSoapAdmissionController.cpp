@@ -0,0 +1,126 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapAdmissionController_p.h"
+#include "KDSoapServerSocket_p.h"
+
+KDSoapAdmissionController::KDSoapAdmissionController()
+    : m_maxActiveRequests(-1)
+    , m_maxQueuedRequests(0)
+    , m_activeRequests(0)
+    , m_rejectedRequests(0)
+    , m_totalRejectedRequests(0)
+    , m_timedOutRequests(0)
+{
+}
+
+void KDSoapAdmissionController::setMaxActiveRequests(int requests)
+{
+    QMutexLocker lock(&m_mutex);
+    m_maxActiveRequests = requests;
+}
+
+int KDSoapAdmissionController::maxActiveRequests() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_maxActiveRequests;
+}
+
+void KDSoapAdmissionController::setMaxQueuedRequests(int requests)
+{
+    QMutexLocker lock(&m_mutex);
+    m_maxQueuedRequests = requests;
+}
+
+int KDSoapAdmissionController::maxQueuedRequests() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_maxQueuedRequests;
+}
+
+KDSoapAdmissionController::Decision KDSoapAdmissionController::admit(KDSoapServerSocket *socket)
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_maxActiveRequests < 0 || (m_activeRequests < m_maxActiveRequests && m_queue.isEmpty())) {
+        ++m_activeRequests;
+        return Admitted;
+    }
+    if (m_queue.count() < m_maxQueuedRequests) {
+        m_queue.append(socket);
+        return Queued;
+    }
+    ++m_rejectedRequests;
+    ++m_totalRejectedRequests;
+    return Rejected;
+}
+
+void KDSoapAdmissionController::release()
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_queue.isEmpty() && (m_maxActiveRequests < 0 || m_activeRequests <= m_maxActiveRequests)) {
+        // The place goes to the first queued request, m_activeRequests doesn't change.
+        // Still under the mutex, so that the socket can't be deleted in between (see cancel())
+        KDSoapServerSocket *socket = m_queue.takeFirst();
+        QMetaObject::invokeMethod(socket, "slotRequestAdmitted", Qt::QueuedConnection);
+        return;
+    }
+    Q_ASSERT(m_activeRequests > 0);
+    --m_activeRequests;
+}
+
+bool KDSoapAdmissionController::cancel(KDSoapServerSocket *socket, bool timedOut)
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_queue.removeOne(socket)) {
+        return false;
+    }
+    if (timedOut) {
+        ++m_timedOutRequests;
+        ++m_rejectedRequests;
+        ++m_totalRejectedRequests;
+    }
+    return true;
+}
+
+int KDSoapAdmissionController::activeRequestCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_activeRequests;
+}
+
+int KDSoapAdmissionController::queuedRequestCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_queue.count();
+}
+
+int KDSoapAdmissionController::rejectedRequestCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_rejectedRequests;
+}
+
+qint64 KDSoapAdmissionController::totalRejectedRequestCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_totalRejectedRequests;
+}
+
+int KDSoapAdmissionController::timedOutRequestCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_timedOutRequests;
+}
+
+void KDSoapAdmissionController::resetCounters()
+{
+    QMutexLocker lock(&m_mutex);
+    m_rejectedRequests = 0;
+    m_timedOutRequests = 0;
+}
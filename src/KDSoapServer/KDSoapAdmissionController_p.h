@@ -0,0 +1,69 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPADMISSIONCONTROLLER_P_H
+#define KDSOAPADMISSIONCONTROLLER_P_H
+
+#include <QList>
+#include <QMutex>
+
+class KDSoapServerSocket;
+
+/**
+ * \internal
+ * Limits the number of requests handled at the same time by a server, in all threads.
+ * Requests above the limit wait in a bounded FIFO queue; when the queue is full,
+ * they are rejected (the socket answers "503 Service Unavailable").
+ * Thread-safe: sockets from all the threads of the pool call it.
+ */
+class KDSoapAdmissionController
+{
+public:
+    enum Decision
+    {
+        Admitted,
+        Queued, ///< KDSoapServerSocket::slotRequestAdmitted() will be called (queued) when it's admitted
+        Rejected
+    };
+
+    KDSoapAdmissionController();
+
+    void setMaxActiveRequests(int requests);
+    int maxActiveRequests() const;
+    void setMaxQueuedRequests(int requests);
+    int maxQueuedRequests() const;
+
+    /// Called when the headers of a request were received
+    Decision admit(KDSoapServerSocket *socket);
+    /// Called when an admitted request is done. Hands over its place to the first queued request, if any
+    void release();
+    /// Removes a queued request, after its deadline or because its socket is deleted.
+    /// Returns false if the request was admitted in the meantime (so release() must be called)
+    bool cancel(KDSoapServerSocket *socket, bool timedOut);
+
+    int activeRequestCount() const;
+    int queuedRequestCount() const;
+    int rejectedRequestCount() const; // including the ones which timed out in the queue
+    qint64 totalRejectedRequestCount() const; // not affected by resetCounters(), for the metrics
+    int timedOutRequestCount() const;
+    void resetCounters();
+
+private:
+    Q_DISABLE_COPY(KDSoapAdmissionController)
+    mutable QMutex m_mutex;
+    int m_maxActiveRequests;
+    int m_maxQueuedRequests;
+    int m_activeRequests;
+    QList<KDSoapServerSocket *> m_queue;
+    int m_rejectedRequests;
+    qint64 m_totalRejectedRequests;
+    int m_timedOutRequests;
+};
+
+#endif // KDSOAPADMISSIONCONTROLLER_P_H
@@ -18,10 +18,12 @@ class KDSoapDelayedResponseHandleData : public QSharedData
 public:
     KDSoapDelayedResponseHandleData(KDSoapServerSocket *s)
         : socket(s)
+        , streamId(s ? s->currentStreamId() : 0)
     {
     }
     // QPointer in case the client disconnects during a delayed response
     QPointer<KDSoapServerSocket> socket;
+    int streamId; // HTTP/2 stream of the call, 0 for HTTP/1.1
 };
 
 KDSoapDelayedResponseHandle::KDSoapDelayedResponseHandle()
@@ -56,3 +58,8 @@ KDSoapServerSocket *KDSoapDelayedResponseHandle::serverSocket() const
 {
     return data->socket;
 }
+
+int KDSoapDelayedResponseHandle::streamId() const
+{
+    return data->streamId;
+}
@@ -38,6 +38,7 @@ private:
     friend class KDSoapServerObjectInterface;
     explicit KDSoapDelayedResponseHandle(KDSoapServerSocket *socket);
     KDSoapServerSocket *serverSocket() const;
+    int streamId() const;
     QSharedDataPointer<KDSoapDelayedResponseHandleData> data;
 };
 
@@ -0,0 +1,179 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapFileTransfer_p.h"
+#include <QAbstractSocket>
+#include <QDebug>
+#include <QFile>
+
+#ifdef Q_OS_LINUX
+#include <cstring>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/types.h>
+#endif
+
+// When copying, don't read more from the device while that much is still waiting in the socket's buffer
+static const qint64 s_maxBufferedData = 256 * 1024;
+static const int s_copyBlockSize = 64 * 1024;
+// sendfile() in one go at most, to give the other sockets of the thread a chance
+static const qint64 s_maxSendfileChunk = 1024 * 1024;
+
+KDSoapFileTransfer::KDSoapFileTransfer(QAbstractSocket *socket, QIODevice *device, qint64 offset, qint64 length, bool useSendfile)
+    : QObject(socket)
+    , m_socket(socket)
+    , m_device(device)
+    , m_offset(offset)
+    , m_remaining(length)
+    , m_fileDescriptor(-1)
+    , m_finished(false)
+{
+#ifdef Q_OS_LINUX
+    QFile *file = qobject_cast<QFile *>(device);
+    if (useSendfile && file && !file->isSequential() && socket->socketDescriptor() != -1) {
+        m_fileDescriptor = file->handle();
+    }
+#else
+    Q_UNUSED(useSendfile);
+#endif
+    if (m_fileDescriptor == -1 && offset > 0 && !m_device->seek(offset)) {
+        m_remaining = 0;
+    }
+    connect(m_socket, &QIODevice::bytesWritten, this, &KDSoapFileTransfer::slotContinue);
+}
+
+KDSoapFileTransfer::~KDSoapFileTransfer()
+{
+    delete m_device;
+}
+
+void KDSoapFileTransfer::start()
+{
+    // Not right away: the caller isn't done with the request yet
+    QMetaObject::invokeMethod(this, "slotContinue", Qt::QueuedConnection);
+}
+
+void KDSoapFileTransfer::slotContinue()
+{
+    if (m_finished) {
+        return;
+    }
+    if (m_fileDescriptor != -1) {
+        sendFileData();
+    } else {
+        copyData();
+    }
+}
+
+void KDSoapFileTransfer::sendFileData()
+{
+#ifdef Q_OS_LINUX
+    // The headers must be out first; bytesWritten() will call us again
+    if (m_socket->bytesToWrite() > 0) {
+        m_socket->flush();
+        if (m_socket->bytesToWrite() > 0) {
+            return;
+        }
+    }
+    const int socketDescriptor = int(m_socket->socketDescriptor());
+    while (m_remaining > 0) {
+        off_t offset = off_t(m_offset);
+        const ssize_t sent = ::sendfile(socketDescriptor, m_fileDescriptor, &offset, size_t(qMin(m_remaining, s_maxSendfileChunk)));
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // The socket's buffer is full. The next block goes through the socket's own write buffer,
+                // so that its bytesWritten() tells us when it can take more, without a second notifier on the descriptor.
+                writeBlock();
+                return;
+            }
+            abortTransfer(QString::fromLocal8Bit(strerror(errno)));
+            return;
+        }
+        if (sent == 0) {
+            abortTransfer(QStringLiteral("file truncated"));
+            return;
+        }
+        m_offset += sent;
+        m_remaining -= sent;
+        if (m_remaining > 0 && sent == s_maxSendfileChunk) {
+            // Let the event loop run
+            QMetaObject::invokeMethod(this, "slotContinue", Qt::QueuedConnection);
+            return;
+        }
+    }
+    finish();
+#endif
+}
+
+// Copies the next block at m_offset into the socket's write buffer.
+void KDSoapFileTransfer::writeBlock()
+{
+    char block[s_copyBlockSize];
+    if (!m_device->seek(m_offset)) {
+        abortTransfer(m_device->errorString());
+        return;
+    }
+    const qint64 in = m_device->read(block, qMin(m_remaining, qint64(sizeof(block))));
+    if (in <= 0) {
+        abortTransfer(in == 0 ? QStringLiteral("file truncated") : m_device->errorString());
+        return;
+    }
+    if (m_socket->write(block, in) != in) {
+        abortTransfer(m_socket->errorString());
+        return;
+    }
+    m_offset += in;
+    m_remaining -= in;
+    if (m_remaining == 0) {
+        finish();
+    }
+}
+
+void KDSoapFileTransfer::copyData()
+{
+    char block[s_copyBlockSize];
+    while (m_remaining > 0 && m_socket->bytesToWrite() < s_maxBufferedData) {
+        const qint64 in = m_device->read(block, qMin(m_remaining, qint64(sizeof(block))));
+        if (in <= 0) {
+            if (m_device->isSequential() && in == 0) {
+                // Sequential devices don't always know their size, stop at the end of the data
+                break;
+            }
+            abortTransfer(m_device->errorString());
+            return;
+        }
+        if (m_socket->write(block, in) != in) {
+            abortTransfer(m_socket->errorString());
+            return;
+        }
+        m_remaining -= in;
+    }
+    if (m_remaining == 0 || (m_device->isSequential() && m_device->atEnd())) {
+        finish();
+    }
+}
+
+// The response can't be completed, and the client would wait for the announced data: close the connection.
+void KDSoapFileTransfer::abortTransfer(const QString &error)
+{
+    qWarning() << "KDSoapServer: file download aborted:" << error;
+    m_finished = true;
+    m_socket->disconnectFromHost();
+}
+
+void KDSoapFileTransfer::finish()
+{
+    m_finished = true;
+    emit finished();
+}
+
+#include "moc_KDSoapFileTransfer_p.cpp"
@@ -0,0 +1,63 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPFILETRANSFER_P_H
+#define KDSOAPFILETRANSFER_P_H
+
+#include <QtCore/QObject>
+
+QT_BEGIN_NAMESPACE
+class QAbstractSocket;
+class QIODevice;
+QT_END_NAMESPACE
+
+/**
+ * \internal
+ * Sends part of a device (a file download) to a socket, after the HTTP headers.
+ *
+ * Instead of queuing the whole file in the socket's write buffer, the data is sent as the socket
+ * can take it. For plain TCP sockets and files, sendfile() is used on Linux, so that the data
+ * doesn't even go through user space.
+ */
+class KDSoapFileTransfer : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * Takes ownership of \p device, which must be open.
+     * \p useSendfile should only be true if nothing (like SSL) transforms the data written to \p socket.
+     */
+    KDSoapFileTransfer(QAbstractSocket *socket, QIODevice *device, qint64 offset, qint64 length, bool useSendfile);
+    ~KDSoapFileTransfer();
+
+    /// Starts sending, from the event loop. finished() is emitted once all the data was sent or queued.
+    void start();
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    void slotContinue();
+
+private:
+    void sendFileData();
+    void writeBlock();
+    void copyData();
+    void abortTransfer(const QString &error);
+    void finish();
+
+    QAbstractSocket *m_socket;
+    QIODevice *m_device;
+    qint64 m_offset;
+    qint64 m_remaining;
+    int m_fileDescriptor; // -1 when not using sendfile
+    bool m_finished;
+};
+
+#endif // KDSOAPFILETRANSFER_P_H
@@ -0,0 +1,62 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapHandlerPool_p.h"
+#include "KDSoapServer.h"
+
+KDSoapHandlerReply::KDSoapHandlerReply(QObject *socket, int streamId)
+    : m_socket(socket)
+    , m_streamId(streamId)
+{
+}
+
+void KDSoapHandlerReply::deliver(const QByteArray &xmlResponse, bool isFault, const QString &faultText, const QByteArray &httpHeaderItems,
+                                 bool dispatched, qint64 dispatchNsecs, qint64 serializeNsecs)
+{
+    // Holding the mutex: the socket can't be deleted while the call is being queued
+    QMutexLocker lock(&m_mutex);
+    if (m_socket) {
+        QMetaObject::invokeMethod(m_socket, "slotHandlerFinished", Qt::QueuedConnection, Q_ARG(QByteArray, xmlResponse), Q_ARG(bool, isFault),
+                                  Q_ARG(QString, faultText), Q_ARG(QByteArray, httpHeaderItems), Q_ARG(bool, dispatched), Q_ARG(qint64, dispatchNsecs), Q_ARG(qint64, serializeNsecs), Q_ARG(int, m_streamId));
+    }
+}
+
+void KDSoapHandlerReply::detach()
+{
+    QMutexLocker lock(&m_mutex);
+    m_socket = nullptr;
+}
+
+KDSoapHandlerPool::KDSoapHandlerPool(KDSoapServer *server)
+    : m_server(server)
+{
+}
+
+KDSoapHandlerPool::~KDSoapHandlerPool()
+{
+    m_threadPool.waitForDone();
+}
+
+void KDSoapHandlerPool::setMaxThreadCount(int threads)
+{
+    m_threadPool.setMaxThreadCount(qMax(1, threads));
+}
+
+void KDSoapHandlerPool::start(QRunnable *task)
+{
+    m_threadPool.start(task);
+}
+
+QObject *KDSoapHandlerPool::serverObject()
+{
+    if (!m_serverObjects.hasLocalData()) {
+        m_serverObjects.setLocalData(m_server->createServerObject());
+    }
+    return m_serverObjects.localData();
+}
@@ -0,0 +1,73 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPHANDLERPOOL_P_H
+#define KDSOAPHANDLERPOOL_P_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <QThreadStorage>
+
+class KDSoapServer;
+
+/**
+ * \internal
+ * Where a handler task sends its result: the socket which received the request,
+ * as long as it exists. The socket detaches itself when it's deleted (client gone).
+ * \p streamId is the HTTP/2 stream of the request, 0 for HTTP/1.1.
+ */
+class KDSoapHandlerReply
+{
+public:
+    explicit KDSoapHandlerReply(QObject *socket, int streamId = 0);
+
+    /// From the handler thread: queues a call to slotHandlerFinished in the socket's thread.
+    /// \p httpHeaderItems: the additional HTTP response header lines of the handler's server object, each ending with \r\n
+    /// \p dispatched: false if the server object didn't know the method
+    void deliver(const QByteArray &xmlResponse, bool isFault, const QString &faultText, const QByteArray &httpHeaderItems, bool dispatched,
+                 qint64 dispatchNsecs, qint64 serializeNsecs);
+    /// From the socket's thread
+    void detach();
+
+private:
+    Q_DISABLE_COPY(KDSoapHandlerReply)
+    QMutex m_mutex;
+    QObject *m_socket;
+    const int m_streamId;
+};
+
+/**
+ * \internal
+ * The threads running the server objects' methods, when KDSoapServer::setHandlerThreadCount is used,
+ * so that a slow method doesn't block the other connections handled by the same socket thread.
+ * Each thread of the pool has its own server object, created with KDSoapServer::createServerObject().
+ */
+class KDSoapHandlerPool
+{
+public:
+    explicit KDSoapHandlerPool(KDSoapServer *server);
+    ~KDSoapHandlerPool(); // waits for the running tasks
+
+    void setMaxThreadCount(int threads);
+    void start(QRunnable *task);
+
+    /// The server object of the current thread of the pool, created on first use
+    QObject *serverObject();
+
+private:
+    Q_DISABLE_COPY(KDSoapHandlerPool)
+    KDSoapServer *m_server;
+    QThreadStorage<QObject *> m_serverObjects; // deleted when the pool's threads exit, i.e. before this
+    QThreadPool m_threadPool;
+};
+
+#endif // KDSOAPHANDLERPOOL_P_H
@@ -0,0 +1,490 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapHpack_p.h"
+
+// RFC 7541 appendix A
+static const struct
+{
+    const char *name;
+    const char *value;
+} s_staticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+static const int s_staticTableSize = int(sizeof(s_staticTable) / sizeof(s_staticTable[0]));
+
+// The size of an entry is the length of its name and value plus 32, RFC 7541 section 4.1
+static const int s_entryOverhead = 32;
+static const int s_defaultTableSize = 4096;
+
+// Lengths of the Huffman codes of the 256 octets and of EOS, RFC 7541 appendix B
+static const quint8 s_huffmanCodeLengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6,  10, 10, 12, 13, 6,  8,  11, 10, 10, 8,  11, 8,  6,  6,  6,  5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8,  15, 6,  12, 10,
+    13, 6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8,  13, 19, 13, 14, 6,
+    15, 5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,  6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7,  15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23, 24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23, 21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25, 19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23, 26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30};
+static const int s_eos = 256;
+static const int s_maxCodeLength = 30;
+
+namespace {
+// The HPACK Huffman code is canonical: the codes of a given length are consecutive, in the order of the symbols,
+// and follow the codes of the shorter lengths. So the codes can be computed from their lengths,
+// and decoded with one range check per length.
+struct HuffmanCode
+{
+    HuffmanCode()
+    {
+        int symbolCount = 0;
+        for (int length = 0; length <= s_maxCodeLength; ++length) {
+            firstIndex[length] = symbolCount;
+            for (int symbol = 0; symbol <= s_eos; ++symbol) {
+                if (s_huffmanCodeLengths[symbol] == length) {
+                    sortedSymbols[symbolCount++] = quint16(symbol);
+                }
+            }
+            symbolsOfLength[length] = symbolCount - firstIndex[length];
+        }
+        quint32 code = 0;
+        int previousLength = s_huffmanCodeLengths[sortedSymbols[0]];
+        for (int i = 0; i <= s_eos; ++i) {
+            const int symbol = sortedSymbols[i];
+            const int length = s_huffmanCodeLengths[symbol];
+            code <<= length - previousLength;
+            previousLength = length;
+            codes[symbol] = code++;
+        }
+        for (int length = 0; length <= s_maxCodeLength; ++length) {
+            firstCode[length] = symbolsOfLength[length] > 0 ? codes[sortedSymbols[firstIndex[length]]] : 0;
+        }
+    }
+
+    quint32 codes[s_eos + 1];
+    quint16 sortedSymbols[s_eos + 1]; // by code length, then by symbol
+    int firstIndex[s_maxCodeLength + 1]; // in sortedSymbols
+    int symbolsOfLength[s_maxCodeLength + 1];
+    quint32 firstCode[s_maxCodeLength + 1];
+};
+}
+
+static const HuffmanCode &huffmanCode()
+{
+    static const HuffmanCode code;
+    return code;
+}
+
+static bool huffmanDecode(const char *data, int length, QByteArray *decoded)
+{
+    const HuffmanCode &huffman = huffmanCode();
+    decoded->reserve(length + length / 2); // the shortest codes have 5 bits
+    quint32 code = 0;
+    int codeLength = 0;
+    for (int i = 0; i < length; ++i) {
+        const quint8 byte = quint8(data[i]);
+        for (int bit = 7; bit >= 0; --bit) {
+            code = (code << 1) | ((byte >> bit) & 1);
+            ++codeLength;
+            const quint32 offset = code - huffman.firstCode[codeLength]; // wraps around if code is smaller
+            if (offset < quint32(huffman.symbolsOfLength[codeLength])) {
+                const int symbol = huffman.sortedSymbols[huffman.firstIndex[codeLength] + int(offset)];
+                if (symbol == s_eos) {
+                    return false; // section 5.2: EOS in a string is an error
+                }
+                decoded->append(char(symbol));
+                code = 0;
+                codeLength = 0;
+            } else if (codeLength == s_maxCodeLength) {
+                return false;
+            }
+        }
+    }
+    // The padding is the beginning of EOS (all ones), shorter than 8 bits
+    return codeLength < 8 && code == (1u << codeLength) - 1;
+}
+
+static int huffmanEncodedLength(const QByteArray &string)
+{
+    qint64 bits = 0;
+    for (const char c : string) {
+        bits += s_huffmanCodeLengths[quint8(c)];
+    }
+    return int((bits + 7) / 8);
+}
+
+static void huffmanEncode(const QByteArray &string, QByteArray *out)
+{
+    const HuffmanCode &huffman = huffmanCode();
+    quint64 bits = 0;
+    int bitCount = 0;
+    for (const char c : string) {
+        const int symbol = quint8(c);
+        bits = (bits << s_huffmanCodeLengths[symbol]) | huffman.codes[symbol];
+        bitCount += s_huffmanCodeLengths[symbol];
+        while (bitCount >= 8) {
+            bitCount -= 8;
+            out->append(char(quint8(bits >> bitCount)));
+        }
+        bits &= (quint64(1) << bitCount) - 1;
+    }
+    if (bitCount > 0) {
+        // Padded with the beginning of EOS
+        out->append(char(quint8((bits << (8 - bitCount)) | (0xff >> bitCount))));
+    }
+}
+
+// Integer representation, RFC 7541 section 5.1. \p flags are the bits above the prefix.
+static void encodeInteger(QByteArray *out, quint8 flags, int prefixBits, quint32 value)
+{
+    const quint32 maxPrefix = (1u << prefixBits) - 1;
+    if (value < maxPrefix) {
+        out->append(char(flags | value));
+        return;
+    }
+    out->append(char(flags | maxPrefix));
+    value -= maxPrefix;
+    while (value >= 128) {
+        out->append(char((value & 127) | 128));
+        value >>= 7;
+    }
+    out->append(char(value));
+}
+
+static bool decodeInteger(const char *&pos, const char *end, int prefixBits, quint32 *value)
+{
+    if (pos == end) {
+        return false;
+    }
+    const quint32 maxPrefix = (1u << prefixBits) - 1;
+    quint32 result = quint8(*pos++) & maxPrefix;
+    if (result == maxPrefix) {
+        int shift = 0;
+        quint8 byte;
+        do {
+            if (pos == end || shift > 21) { // nothing we handle comes close to 2^28
+                return false;
+            }
+            byte = quint8(*pos++);
+            result += quint32(byte & 127) << shift;
+            shift += 7;
+        } while (byte & 128);
+    }
+    *value = result;
+    return true;
+}
+
+// String literal, RFC 7541 section 5.2
+static void encodeString(QByteArray *out, const QByteArray &string)
+{
+    const int huffmanLength = huffmanEncodedLength(string);
+    if (huffmanLength < string.size()) {
+        encodeInteger(out, 0x80, 7, quint32(huffmanLength));
+        huffmanEncode(string, out);
+    } else {
+        encodeInteger(out, 0, 7, quint32(string.size()));
+        out->append(string);
+    }
+}
+
+static bool decodeString(const char *&pos, const char *end, QByteArray *string)
+{
+    if (pos == end) {
+        return false;
+    }
+    const bool huffman = quint8(*pos) & 0x80;
+    quint32 length;
+    if (!decodeInteger(pos, end, 7, &length) || length > quint32(end - pos)) {
+        return false;
+    }
+    if (huffman) {
+        string->clear();
+        if (!huffmanDecode(pos, int(length), string)) {
+            return false;
+        }
+    } else {
+        *string = QByteArray(pos, int(length));
+    }
+    pos += length;
+    return true;
+}
+
+static int entrySize(const KDSoapHttpHeader &header)
+{
+    return header.first.size() + header.second.size() + s_entryOverhead;
+}
+
+KDSoapHpackTable::KDSoapHpackTable()
+    : m_size(0)
+    , m_maxSize(s_defaultTableSize)
+{
+}
+
+void KDSoapHpackTable::setMaxSize(int maxSize)
+{
+    m_maxSize = maxSize;
+    evict(maxSize);
+}
+
+void KDSoapHpackTable::add(const QByteArray &name, const QByteArray &value)
+{
+    const KDSoapHttpHeader header(name, value);
+    const int size = entrySize(header);
+    // An entry larger than the table just empties it, section 4.4
+    evict(m_maxSize - size);
+    if (size <= m_maxSize) {
+        m_entries.append(header);
+        m_size += size;
+    }
+}
+
+// Evicts the oldest entries until the table fits in maxSize
+void KDSoapHpackTable::evict(int maxSize)
+{
+    int count = 0;
+    while (m_size > maxSize && count < m_entries.size()) {
+        m_size -= entrySize(m_entries.at(count));
+        ++count;
+    }
+    m_entries.remove(0, count);
+}
+
+bool KDSoapHpackTable::lookup(int index, KDSoapHttpHeader *header) const
+{
+    if (index <= 0) {
+        return false;
+    }
+    if (index <= s_staticTableSize) {
+        header->first = s_staticTable[index - 1].name;
+        header->second = s_staticTable[index - 1].value;
+        return true;
+    }
+    const int dynamicIndex = index - s_staticTableSize - 1; // 0 is the newest entry
+    if (dynamicIndex >= m_entries.size()) {
+        return false;
+    }
+    *header = m_entries.at(m_entries.size() - 1 - dynamicIndex);
+    return true;
+}
+
+int KDSoapHpackTable::find(const QByteArray &name, const QByteArray &value, int *nameIndex) const
+{
+    *nameIndex = 0;
+    for (int i = 0; i < s_staticTableSize; ++i) {
+        if (name == s_staticTable[i].name) {
+            if (*nameIndex == 0) {
+                *nameIndex = i + 1;
+            }
+            if (value == s_staticTable[i].value) {
+                return i + 1;
+            }
+        }
+    }
+    for (int i = m_entries.size() - 1; i >= 0; --i) {
+        const KDSoapHttpHeader &entry = m_entries.at(i);
+        if (entry.first == name) {
+            const int index = s_staticTableSize + m_entries.size() - i;
+            if (*nameIndex == 0) {
+                *nameIndex = index;
+            }
+            if (entry.second == value) {
+                return index;
+            }
+        }
+    }
+    return 0;
+}
+
+KDSoapHpackDecoder::KDSoapHpackDecoder()
+    : m_maxTableSizeLimit(s_defaultTableSize)
+    , m_maxHeaderListSize(-1)
+{
+}
+
+KDSoapHpackDecoder::Result KDSoapHpackDecoder::decode(const QByteArray &block, KDSoapHttpHeaderList *headers)
+{
+    const char *pos = block.constData();
+    const char *end = pos + block.size();
+    bool fieldSeen = false;
+    qint64 listSize = 0;
+    bool tooLarge = false;
+    // Even when the list is too large, the rest of the block is decoded, to keep the table in sync with the encoder
+    auto appendHeader = [&](const KDSoapHttpHeader &header) {
+        fieldSeen = true;
+        listSize += header.first.size() + header.second.size() + 4;
+        if (m_maxHeaderListSize >= 0 && listSize > m_maxHeaderListSize) {
+            tooLarge = true;
+        } else {
+            headers->append(header);
+        }
+    };
+    while (pos < end) {
+        const quint8 byte = quint8(*pos);
+        if (byte & 0x80) {
+            // Indexed header field, section 6.1
+            quint32 index;
+            KDSoapHttpHeader header;
+            if (!decodeInteger(pos, end, 7, &index) || !m_table.lookup(int(index), &header)) {
+                return CompressionError;
+            }
+            appendHeader(header);
+        } else if ((byte & 0xe0) == 0x20) {
+            // Dynamic table size update, section 6.3: only at the beginning of a block
+            quint32 maxSize;
+            if (fieldSeen || !decodeInteger(pos, end, 5, &maxSize) || maxSize > quint32(m_maxTableSizeLimit)) {
+                return CompressionError;
+            }
+            m_table.setMaxSize(int(maxSize));
+        } else {
+            // Literal header field with incremental indexing (01), without indexing (0000) or never indexed (0001), section 6.2
+            const bool addToTable = (byte & 0xc0) == 0x40;
+            quint32 nameIndex;
+            if (!decodeInteger(pos, end, addToTable ? 6 : 4, &nameIndex)) {
+                return CompressionError;
+            }
+            KDSoapHttpHeader header;
+            if (nameIndex == 0) {
+                if (!decodeString(pos, end, &header.first)) {
+                    return CompressionError;
+                }
+            } else if (!m_table.lookup(int(nameIndex), &header)) {
+                return CompressionError;
+            }
+            if (!decodeString(pos, end, &header.second)) {
+                return CompressionError;
+            }
+            if (addToTable) {
+                m_table.add(header.first, header.second);
+            }
+            appendHeader(header);
+        }
+    }
+    return tooLarge ? HeaderListTooLarge : Ok;
+}
+
+KDSoapHpackEncoder::KDSoapHpackEncoder()
+    : m_smallestTableSizeUpdate(-1)
+    , m_tableSizeUpdate(-1)
+{
+}
+
+void KDSoapHpackEncoder::setMaxTableSize(int maxSize)
+{
+    // There's no point in a table larger than the default, for the few headers of our responses
+    const int tableSize = qMin(maxSize, s_defaultTableSize);
+    if (tableSize == m_table.maxSize()) {
+        return;
+    }
+    m_table.setMaxSize(tableSize);
+    if (m_smallestTableSizeUpdate < 0 || tableSize < m_smallestTableSizeUpdate) {
+        m_smallestTableSizeUpdate = tableSize;
+    }
+    m_tableSizeUpdate = tableSize;
+}
+
+QByteArray KDSoapHpackEncoder::encode(const KDSoapHttpHeaderList &headers)
+{
+    QByteArray block;
+    if (m_tableSizeUpdate >= 0) {
+        // The decoder must evict what we evicted
+        if (m_smallestTableSizeUpdate < m_tableSizeUpdate) {
+            encodeInteger(&block, 0x20, 5, quint32(m_smallestTableSizeUpdate));
+        }
+        encodeInteger(&block, 0x20, 5, quint32(m_tableSizeUpdate));
+        m_smallestTableSizeUpdate = -1;
+        m_tableSizeUpdate = -1;
+    }
+    for (const KDSoapHttpHeader &header : headers) {
+        int nameIndex;
+        const int index = m_table.find(header.first, header.second, &nameIndex);
+        if (index > 0) {
+            encodeInteger(&block, 0x80, 7, quint32(index));
+            continue;
+        }
+        // Values which change with every response would only push the other entries out of the table
+        const QByteArray &name = header.first;
+        const bool addToTable =
+            name != "content-length" && name != "date" && name != "etag" && name != "last-modified" && name != "content-range" && name != "set-cookie";
+        if (addToTable) {
+            encodeInteger(&block, 0x40, 6, quint32(nameIndex));
+        } else {
+            encodeInteger(&block, name == "set-cookie" ? 0x10 : 0x00, 4, quint32(nameIndex));
+        }
+        if (nameIndex == 0) {
+            encodeString(&block, name);
+        }
+        encodeString(&block, header.second);
+        if (addToTable) {
+            m_table.add(name, header.second);
+        }
+    }
+    return block;
+}
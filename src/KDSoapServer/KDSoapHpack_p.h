@@ -0,0 +1,112 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPHPACK_P_H
+#define KDSOAPHPACK_P_H
+
+#include "KDSoapServerGlobal.h"
+#include <QByteArray>
+#include <QPair>
+#include <QVector>
+
+/// Name (lowercase) and value of an HTTP/2 header field
+typedef QPair<QByteArray, QByteArray> KDSoapHttpHeader;
+typedef QVector<KDSoapHttpHeader> KDSoapHttpHeaderList;
+
+/**
+ * \internal
+ * The static and dynamic tables of HPACK (RFC 7541 section 2.3), as seen by one side of a connection.
+ * Indexes start at 1, the dynamic table follows the 61 entries of the static table.
+ */
+class KDSOAPSERVER_EXPORT KDSoapHpackTable
+{
+public:
+    KDSoapHpackTable();
+
+    void setMaxSize(int maxSize);
+    int maxSize() const
+    {
+        return m_maxSize;
+    }
+
+    void add(const QByteArray &name, const QByteArray &value);
+    bool lookup(int index, KDSoapHttpHeader *header) const;
+    /// Returns the index of an entry with this name and value, or 0; \p nameIndex is set to an entry with this name, or 0
+    int find(const QByteArray &name, const QByteArray &value, int *nameIndex) const;
+
+private:
+    void evict(int maxSize);
+
+    QVector<KDSoapHttpHeader> m_entries; // the newest last
+    int m_size; // as defined in RFC 7541 section 4.1
+    int m_maxSize;
+};
+
+/**
+ * \internal
+ * Decodes the header blocks received on an HTTP/2 connection.
+ * All the blocks of a connection must go through the same decoder, in order.
+ */
+class KDSOAPSERVER_EXPORT KDSoapHpackDecoder
+{
+public:
+    enum Result
+    {
+        Ok,
+        CompressionError, ///< the connection can't be used anymore (COMPRESSION_ERROR)
+        HeaderListTooLarge ///< the block was decoded, but the headers beyond the limit were dropped
+    };
+
+    KDSoapHpackDecoder();
+
+    /**
+     * Limits the size of the decoded header list, counted as the length of each name and value
+     * plus 4, like "name: value\r\n" in HTTP/1.1. -1 means no limit.
+     * A small block can decode into a lot of data, with many references to a large table entry.
+     */
+    void setMaxHeaderListSize(int maxSize)
+    {
+        m_maxHeaderListSize = maxSize;
+    }
+
+    /**
+     * Decodes the complete header block \p block into \p headers.
+     */
+    Result decode(const QByteArray &block, KDSoapHttpHeaderList *headers);
+
+private:
+    KDSoapHpackTable m_table;
+    int m_maxTableSizeLimit; // SETTINGS_HEADER_TABLE_SIZE, we keep the default
+    int m_maxHeaderListSize;
+};
+
+/**
+ * \internal
+ * Encodes the header blocks sent on an HTTP/2 connection.
+ * Header fields which are the same in all responses (content type, server, ...) are added to the
+ * dynamic table, and then sent as a single byte in the following responses.
+ */
+class KDSOAPSERVER_EXPORT KDSoapHpackEncoder
+{
+public:
+    KDSoapHpackEncoder();
+
+    /// SETTINGS_HEADER_TABLE_SIZE of the peer
+    void setMaxTableSize(int maxSize);
+
+    QByteArray encode(const KDSoapHttpHeaderList &headers);
+
+private:
+    KDSoapHpackTable m_table;
+    // Table size changes to announce in the next block, RFC 7541 section 4.2; -1 if none
+    int m_smallestTableSizeUpdate;
+    int m_tableSizeUpdate;
+};
+
+#endif // KDSOAPHPACK_P_H
@@ -0,0 +1,843 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapHttp2Connection_p.h"
+#include <QList>
+#include <string.h>
+
+static const char s_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const int s_prefaceLength = sizeof(s_preface) - 1;
+
+static const int s_frameHeaderSize = 9;
+static const int s_defaultMaxFrameSize = 16384; // we keep the default SETTINGS_MAX_FRAME_SIZE
+static const int s_defaultWindowSize = 65535;
+static const qint64 s_maxWindowSize = 0x7fffffff;
+static const int s_maxConcurrentStreams = 100;
+
+// Frame flags
+static const quint8 s_endStreamFlag = 0x1;
+static const quint8 s_ackFlag = 0x1;
+static const quint8 s_endHeadersFlag = 0x4;
+static const quint8 s_paddedFlag = 0x8;
+static const quint8 s_priorityFlag = 0x20;
+
+// Setting identifiers, RFC 7540 section 6.5.2
+static const int s_headerTableSizeSetting = 0x1;
+static const int s_enablePushSetting = 0x2;
+static const int s_maxConcurrentStreamsSetting = 0x3;
+static const int s_initialWindowSizeSetting = 0x4;
+static const int s_maxFrameSizeSetting = 0x5;
+static const int s_maxHeaderListSizeSetting = 0x6;
+
+static quint32 readUInt32(const char *data)
+{
+    return (quint32(quint8(data[0])) << 24) | (quint32(quint8(data[1])) << 16) | (quint32(quint8(data[2])) << 8) | quint32(quint8(data[3]));
+}
+
+static void appendUInt32(QByteArray *out, quint32 value)
+{
+    out->append(char(value >> 24));
+    out->append(char(value >> 16));
+    out->append(char(value >> 8));
+    out->append(char(value));
+}
+
+static void appendSetting(QByteArray *out, int identifier, quint32 value)
+{
+    out->append(char(identifier >> 8));
+    out->append(char(identifier));
+    appendUInt32(out, value);
+}
+
+// Headers which only make sense for one HTTP/1.1 connection, RFC 7540 section 8.1.2.2
+static bool isConnectionSpecificHeader(const QByteArray &name)
+{
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "transfer-encoding" || name == "upgrade";
+}
+
+KDSoapHttp2Connection::Stream::Stream()
+    : requestComplete(false)
+    , requestTaken(false)
+    , contentLength(-1)
+    , sendWindow(s_defaultWindowSize)
+    , receiveWindow(s_defaultWindowSize)
+    , responseSent(false)
+    , bodyComplete(true)
+    , pendingOffset(0)
+{
+}
+
+KDSoapHttp2Connection::PrefaceMatch KDSoapHttp2Connection::matchPreface(const QByteArray &data)
+{
+    const int length = qMin(data.size(), s_prefaceLength);
+    if (memcmp(data.constData(), s_preface, size_t(length)) != 0) {
+        return NoPreface;
+    }
+    return length == s_prefaceLength ? CompletePreface : PartialPreface;
+}
+
+KDSoapHttp2Connection::KDSoapHttp2Connection(const KDSoapHttpRequestParser::Limits &limits)
+    : m_limits(limits)
+    , m_prefaceReceived(false)
+    , m_settingsReceived(false)
+    , m_goingAway(false)
+    , m_failed(false)
+    , m_lastStreamId(0)
+    , m_peerMaxFrameSize(s_defaultMaxFrameSize)
+    , m_peerInitialWindowSize(s_defaultWindowSize)
+    , m_connectionSendWindow(s_defaultWindowSize)
+    , m_connectionReceiveWindow(s_defaultWindowSize)
+    , m_headerBlockStreamId(0)
+    , m_headerBlockEndsStream(false)
+{
+    m_decoder.setMaxHeaderListSize(limits.maxHeaderSize);
+}
+
+bool KDSoapHttp2Connection::isValidUpgradeSettings(const QByteArray &upgradeSettings)
+{
+    const QByteArray payload = QByteArray::fromBase64(upgradeSettings, QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals);
+    return payload.size() % 6 == 0;
+}
+
+bool KDSoapHttp2Connection::start(const QByteArray &upgradeSettings)
+{
+    QByteArray settings;
+    appendSetting(&settings, s_maxConcurrentStreamsSetting, s_maxConcurrentStreams);
+    if (m_limits.maxHeaderSize >= 0) {
+        appendSetting(&settings, s_maxHeaderListSizeSetting, quint32(m_limits.maxHeaderSize));
+    }
+    writeFrame(SettingsFrame, 0, 0, settings.constData(), settings.size());
+
+    if (!upgradeSettings.isEmpty()) {
+        // The payload of a SETTINGS frame, which doesn't get acknowledged (RFC 7540 section 3.2.1)
+        const QByteArray payload = QByteArray::fromBase64(upgradeSettings, QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals);
+        if (payload.size() % 6 != 0) {
+            return connectionError(ProtocolError);
+        }
+        return applySettings(payload.constData(), payload.size());
+    }
+    return true;
+}
+
+void KDSoapHttp2Connection::addUpgradeRequest(const QByteArray &httpRequestHead, const QByteArray &body)
+{
+    m_lastStreamId = 1;
+    Stream &stream = m_streams[1];
+    stream.sendWindow = m_peerInitialWindowSize;
+    stream.upgradeRequestHead = httpRequestHead;
+    stream.body = body;
+    stream.requestComplete = true;
+}
+
+bool KDSoapHttp2Connection::receive(const QByteArray &data)
+{
+    if (m_failed) {
+        return false;
+    }
+    m_input += data;
+    int pos = 0;
+    if (!m_prefaceReceived) {
+        const PrefaceMatch match = matchPreface(m_input);
+        if (match == NoPreface) {
+            return connectionError(ProtocolError);
+        }
+        if (match == PartialPreface) {
+            return true;
+        }
+        m_prefaceReceived = true;
+        pos = s_prefaceLength;
+    }
+    while (m_input.size() - pos >= s_frameHeaderSize) {
+        const char *header = m_input.constData() + pos;
+        const int length = (int(quint8(header[0])) << 16) | (int(quint8(header[1])) << 8) | int(quint8(header[2]));
+        const quint8 type = quint8(header[3]);
+        const quint8 flags = quint8(header[4]);
+        const quint32 streamId = readUInt32(header + 5) & 0x7fffffff;
+        if (length > s_defaultMaxFrameSize) {
+            return connectionError(FrameSizeError);
+        }
+        if (m_input.size() - pos - s_frameHeaderSize < length) {
+            break;
+        }
+        // The preface is followed by a SETTINGS frame, section 3.5
+        if (!m_settingsReceived && type != SettingsFrame) {
+            return connectionError(ProtocolError);
+        }
+        if (!processFrame(type, flags, streamId, header + s_frameHeaderSize, length)) {
+            return false;
+        }
+        pos += s_frameHeaderSize + length;
+    }
+    m_input.remove(0, pos);
+    return true;
+}
+
+bool KDSoapHttp2Connection::processFrame(quint8 type, quint8 flags, quint32 streamId, const char *payload, int length)
+{
+    // Nothing can come between the frames of a header block, section 6.10
+    if (m_headerBlockStreamId != 0 && (type != ContinuationFrame || streamId != m_headerBlockStreamId)) {
+        return connectionError(ProtocolError);
+    }
+    switch (type) {
+    case DataFrame:
+        return handleData(flags, streamId, payload, length);
+    case HeadersFrame:
+        return handleHeaders(flags, streamId, payload, length);
+    case PriorityFrame:
+        // We don't prioritize, the responses are sent in the order of the streams
+        if (streamId == 0) {
+            return connectionError(ProtocolError);
+        }
+        if (length != 5) {
+            streamError(streamId, FrameSizeError);
+        }
+        return true;
+    case RstStreamFrame:
+        return handleRstStream(streamId, payload, length);
+    case SettingsFrame:
+        return handleSettings(flags, streamId, payload, length);
+    case PushPromiseFrame:
+        // Only servers push
+        return connectionError(ProtocolError);
+    case PingFrame:
+        if (streamId != 0) {
+            return connectionError(ProtocolError);
+        }
+        if (length != 8) {
+            return connectionError(FrameSizeError);
+        }
+        if (!(flags & s_ackFlag)) {
+            writeFrame(PingFrame, s_ackFlag, 0, payload, length);
+        }
+        return true;
+    case GoAwayFrame:
+        if (streamId != 0) {
+            return connectionError(ProtocolError);
+        }
+        if (length < 8) {
+            return connectionError(FrameSizeError);
+        }
+        // The client doesn't open new streams; answer the current ones, then close
+        goAway(NoError);
+        return true;
+    case WindowUpdateFrame:
+        return handleWindowUpdate(streamId, payload, length);
+    case ContinuationFrame:
+        if (m_headerBlockStreamId == 0) {
+            return connectionError(ProtocolError);
+        }
+        m_headerBlock.append(payload, length);
+        // Literals take about as much room as their decoded size, so such a block can't fit in the header limit.
+        // The block can't be skipped either: it has to be decoded, for the HPACK table.
+        if (m_limits.maxHeaderSize >= 0 && m_headerBlock.size() > 2 * qint64(m_limits.maxHeaderSize)) {
+            return connectionError(EnhanceYourCalm);
+        }
+        if (flags & s_endHeadersFlag) {
+            return handleHeaderBlock();
+        }
+        return true;
+    default:
+        // Unknown frame types are ignored, section 4.1
+        return true;
+    }
+}
+
+bool KDSoapHttp2Connection::handleData(quint8 flags, quint32 streamId, const char *payload, int length)
+{
+    if (streamId == 0) {
+        return connectionError(ProtocolError);
+    }
+    int padLength = 0;
+    if (flags & s_paddedFlag) {
+        if (length < 1 || int(quint8(payload[0])) >= length) {
+            return connectionError(ProtocolError);
+        }
+        padLength = quint8(payload[0]);
+    }
+
+    // The whole frame counts for the flow control, padding included.
+    // The windows are replenished once half used, the limits protect us from large requests.
+    m_connectionReceiveWindow -= length;
+    if (m_connectionReceiveWindow < 0) {
+        return connectionError(FlowControlError);
+    }
+    if (m_connectionReceiveWindow < s_defaultWindowSize / 2) {
+        writeWindowUpdate(0, quint32(s_defaultWindowSize - m_connectionReceiveWindow));
+        m_connectionReceiveWindow = s_defaultWindowSize;
+    }
+
+    QMap<quint32, Stream>::iterator it = m_streams.find(streamId);
+    if (it == m_streams.end()) {
+        if (streamId > m_lastStreamId) {
+            return connectionError(ProtocolError); // idle stream
+        }
+        return true; // closed, e.g. reset by us: the client might not know yet
+    }
+    Stream &stream = it.value();
+    if (stream.requestComplete) {
+        streamError(streamId, StreamClosed);
+        return true;
+    }
+    stream.receiveWindow -= length;
+    if (stream.receiveWindow < 0) {
+        streamError(streamId, FlowControlError);
+        return true;
+    }
+
+    const int dataOffset = (flags & s_paddedFlag) ? 1 : 0;
+    const int dataLength = length - dataOffset - padLength;
+    if (stream.body.size() + qint64(dataLength) > m_limits.bodySizeLimit()) {
+        sendErrorResponse(streamId, "413");
+        return true;
+    }
+    stream.body.append(payload + dataOffset, dataLength);
+
+    if (flags & s_endStreamFlag) {
+        endRequest(streamId, stream);
+    } else if (stream.receiveWindow < s_defaultWindowSize / 2) {
+        writeWindowUpdate(streamId, quint32(s_defaultWindowSize - stream.receiveWindow));
+        stream.receiveWindow = s_defaultWindowSize;
+    }
+    return true;
+}
+
+bool KDSoapHttp2Connection::handleHeaders(quint8 flags, quint32 streamId, const char *payload, int length)
+{
+    if (streamId == 0 || (streamId & 1) == 0) {
+        return connectionError(ProtocolError); // client streams are odd
+    }
+    if (streamId <= m_lastStreamId && !m_streams.contains(streamId)) {
+        return connectionError(StreamClosed);
+    }
+    int offset = 0;
+    int padLength = 0;
+    if (flags & s_paddedFlag) {
+        if (length < 1) {
+            return connectionError(FrameSizeError);
+        }
+        padLength = quint8(payload[0]);
+        offset = 1;
+    }
+    if (flags & s_priorityFlag) {
+        if (length - offset < 5) {
+            return connectionError(FrameSizeError);
+        }
+        offset += 5;
+    }
+    if (padLength > length - offset) {
+        return connectionError(ProtocolError);
+    }
+    m_headerBlockStreamId = streamId;
+    m_headerBlockEndsStream = flags & s_endStreamFlag;
+    m_headerBlock = QByteArray(payload + offset, length - offset - padLength);
+    if (flags & s_endHeadersFlag) {
+        return handleHeaderBlock();
+    }
+    return true;
+}
+
+bool KDSoapHttp2Connection::handleHeaderBlock()
+{
+    const quint32 streamId = m_headerBlockStreamId;
+    m_headerBlockStreamId = 0;
+    KDSoapHttpHeaderList headers;
+    const KDSoapHpackDecoder::Result result = m_decoder.decode(m_headerBlock, &headers);
+    m_headerBlock.clear();
+    if (result == KDSoapHpackDecoder::CompressionError) {
+        return connectionError(CompressionError);
+    }
+
+    QMap<quint32, Stream>::iterator it = m_streams.find(streamId);
+    if (it != m_streams.end()) {
+        // Trailers: they must end the request. We don't use them, like for chunked HTTP/1.1 requests.
+        Stream &stream = it.value();
+        if (stream.requestComplete) {
+            streamError(streamId, StreamClosed);
+        } else if (!m_headerBlockEndsStream) {
+            streamError(streamId, ProtocolError);
+        } else {
+            endRequest(streamId, stream);
+        }
+        return true;
+    }
+
+    // New stream
+    m_lastStreamId = streamId;
+    if (m_goingAway) {
+        return true; // above the last stream ID of our GOAWAY frame, the client will retry it elsewhere
+    }
+    if (m_streams.count() >= s_maxConcurrentStreams) {
+        writeRstStream(streamId, RefusedStream);
+        return true;
+    }
+    Stream &stream = m_streams[streamId];
+    stream.sendWindow = m_peerInitialWindowSize;
+    if (result == KDSoapHpackDecoder::HeaderListTooLarge || (m_limits.maxHeaderCount >= 0 && headers.count() > m_limits.maxHeaderCount)) {
+        if (m_headerBlockEndsStream) {
+            stream.requestComplete = true;
+        }
+        sendErrorResponse(streamId, "431");
+        return true;
+    }
+    stream.headers = headers;
+    if (!requestHeadersValid(stream)) {
+        streamError(streamId, ProtocolError);
+        return true;
+    }
+    for (const KDSoapHttpHeader &header : qAsConst(stream.headers)) {
+        if (header.first == "content-length") {
+            bool ok;
+            stream.contentLength = header.second.toLongLong(&ok);
+            if (!ok || stream.contentLength < 0) {
+                streamError(streamId, ProtocolError);
+                return true;
+            }
+        }
+    }
+    if (stream.contentLength > m_limits.bodySizeLimit()) {
+        if (m_headerBlockEndsStream) {
+            stream.requestComplete = true;
+        }
+        sendErrorResponse(streamId, "413");
+        return true;
+    }
+    if (m_headerBlockEndsStream) {
+        endRequest(streamId, stream);
+    }
+    return true;
+}
+
+void KDSoapHttp2Connection::endRequest(quint32 streamId, Stream &stream)
+{
+    stream.requestComplete = true;
+    // A content-length which doesn't match the DATA frames makes the request malformed, section 8.1.2.6
+    if (stream.contentLength >= 0 && stream.contentLength != stream.body.size()) {
+        streamError(streamId, ProtocolError);
+    }
+}
+
+bool KDSoapHttp2Connection::requestHeadersValid(const Stream &stream) const
+{
+    bool regularHeaderSeen = false;
+    int methodCount = 0;
+    int schemeCount = 0;
+    int pathCount = 0;
+    for (const KDSoapHttpHeader &header : stream.headers) {
+        const QByteArray &name = header.first;
+        const QByteArray &value = header.second;
+        if (name.isEmpty() || value.contains('\r') || value.contains('\n') || value.contains('\0')) {
+            return false;
+        }
+        for (int i = name.startsWith(':') ? 1 : 0; i < name.size(); ++i) {
+            const char c = name.at(i);
+            if ((c >= 'A' && c <= 'Z') || c <= ' ' || c == ':' || c == 0x7f) {
+                return false;
+            }
+        }
+        if (name.startsWith(':')) {
+            // Pseudo-header fields, only the request ones, before the regular fields, section 8.1.2.1
+            if (regularHeaderSeen) {
+                return false;
+            }
+            if (name == ":method") {
+                ++methodCount;
+            } else if (name == ":scheme") {
+                ++schemeCount;
+            } else if (name == ":path") {
+                ++pathCount;
+            } else if (name != ":authority") {
+                return false;
+            }
+            if (name != ":scheme" && value.contains(' ')) {
+                return false; // they end up in an HTTP/1.1 request line or header
+            }
+        } else {
+            regularHeaderSeen = true;
+            if (isConnectionSpecificHeader(name) || (name == "te" && value != "trailers")) {
+                return false;
+            }
+        }
+    }
+    return methodCount == 1 && schemeCount == 1 && pathCount == 1;
+}
+
+bool KDSoapHttp2Connection::takeRequest(int *streamId, QByteArray *httpRequestHead, QByteArray *body)
+{
+    for (QMap<quint32, Stream>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+        Stream &stream = it.value();
+        if (!stream.requestComplete || stream.requestTaken) {
+            continue;
+        }
+        stream.requestTaken = true;
+        *streamId = int(it.key());
+        body->clear();
+        body->swap(stream.body);
+        if (!stream.upgradeRequestHead.isEmpty()) {
+            httpRequestHead->clear();
+            httpRequestHead->swap(stream.upgradeRequestHead);
+            return true;
+        }
+
+        QByteArray method;
+        QByteArray path;
+        QByteArray authority;
+        QByteArray fields;
+        QList<QByteArray> cookies;
+        bool hasHost = false;
+        for (const KDSoapHttpHeader &header : qAsConst(stream.headers)) {
+            const QByteArray &name = header.first;
+            if (name == ":method") {
+                method = header.second;
+            } else if (name == ":path") {
+                path = header.second;
+            } else if (name == ":authority") {
+                authority = header.second;
+            } else if (name.startsWith(':') || name == "content-length" || name == "expect") {
+                // content-length is set below; there's no 100-continue to send, we have the body already
+            } else if (name == "cookie") {
+                // Can be split into several fields, section 8.1.2.5
+                cookies.append(header.second);
+            } else {
+                hasHost = hasHost || name == "host";
+                fields += name + ": " + header.second + "\r\n";
+            }
+        }
+        stream.headers.clear();
+
+        QByteArray head = method + ' ' + path + " HTTP/1.1\r\n";
+        if (!hasHost && !authority.isEmpty()) {
+            head += "host: " + authority + "\r\n";
+        }
+        head += fields;
+        if (!cookies.isEmpty()) {
+            head += "cookie: " + cookies.join("; ") + "\r\n";
+        }
+        head += "content-length: " + QByteArray::number(body->size()) + "\r\n\r\n";
+        *httpRequestHead = head;
+        return true;
+    }
+    return false;
+}
+
+void KDSoapHttp2Connection::sendResponse(int streamId, const QByteArray &httpResponse, bool bodyComplete)
+{
+    QMap<quint32, Stream>::iterator it = m_streams.find(quint32(streamId));
+    if (it == m_streams.end() || it.value().responseSent) {
+        return; // reset by the client
+    }
+
+    // "HTTP/1.1 200 OK\r\n" followed by the headers, an empty line, and the body
+    const int headEnd = httpResponse.indexOf("\r\n\r\n");
+    const int statusLineEnd = httpResponse.indexOf("\r\n");
+    const QList<QByteArray> statusLine = httpResponse.left(statusLineEnd).split(' ');
+    if (headEnd < 0 || statusLine.count() < 2 || !statusLine.at(0).startsWith("HTTP/") || statusLine.at(1).size() != 3) {
+        streamError(quint32(streamId), InternalError);
+        return;
+    }
+    KDSoapHttpHeaderList headers;
+    bool hasContentLength = false;
+    const QList<QByteArray> lines = httpResponse.mid(statusLineEnd + 2, headEnd - statusLineEnd - 2).split('\n');
+    for (const QByteArray &line : lines) {
+        const int colon = line.indexOf(':');
+        if (colon <= 0) {
+            continue;
+        }
+        const QByteArray name = line.left(colon).trimmed().toLower();
+        if (isConnectionSpecificHeader(name)) {
+            continue;
+        }
+        hasContentLength = hasContentLength || name == "content-length";
+        headers.append(KDSoapHttpHeader(name, line.mid(colon + 1).trimmed()));
+    }
+    const QByteArray body = httpResponse.mid(headEnd + 4);
+    if (!hasContentLength && bodyComplete) {
+        headers.append(KDSoapHttpHeader("content-length", QByteArray::number(body.size())));
+    }
+    queueResponse(quint32(streamId), it.value(), statusLine.at(1), headers, body, bodyComplete);
+}
+
+void KDSoapHttp2Connection::sendResponseData(int streamId, const QByteArray &data, bool bodyComplete)
+{
+    QMap<quint32, Stream>::iterator it = m_streams.find(quint32(streamId));
+    if (it == m_streams.end() || !it.value().responseSent || it.value().bodyComplete) {
+        return; // reset by the client
+    }
+    Stream &stream = it.value();
+    stream.pendingData.remove(0, stream.pendingOffset);
+    stream.pendingOffset = 0;
+    stream.pendingData += data;
+    stream.bodyComplete = bodyComplete;
+    if (bodyComplete && stream.pendingData.isEmpty()) {
+        // Everything was sent already, without END_STREAM
+        writeFrame(DataFrame, s_endStreamFlag, quint32(streamId), nullptr, 0);
+    }
+    sendPendingData();
+}
+
+qint64 KDSoapHttp2Connection::pendingResponseData(int streamId) const
+{
+    QMap<quint32, Stream>::const_iterator it = m_streams.constFind(quint32(streamId));
+    if (it == m_streams.constEnd()) {
+        return -1;
+    }
+    return it.value().pendingData.size() - it.value().pendingOffset;
+}
+
+void KDSoapHttp2Connection::resetStream(int streamId, ErrorCode error)
+{
+    if (m_streams.contains(quint32(streamId))) {
+        streamError(quint32(streamId), error);
+    }
+}
+
+void KDSoapHttp2Connection::sendErrorResponse(quint32 streamId, const char *status)
+{
+    KDSoapHttpHeaderList headers;
+    headers.append(KDSoapHttpHeader("content-length", "0"));
+    queueResponse(streamId, m_streams[streamId], status, headers, QByteArray());
+}
+
+void KDSoapHttp2Connection::queueResponse(quint32 streamId, Stream &stream, const QByteArray &status, const KDSoapHttpHeaderList &headers,
+                                          const QByteArray &body, bool bodyComplete)
+{
+    KDSoapHttpHeaderList fields;
+    fields.reserve(headers.count() + 1);
+    fields.append(KDSoapHttpHeader(":status", status));
+    fields += headers;
+    const QByteArray block = m_encoder.encode(fields);
+
+    // HEADERS, then CONTINUATION frames if the block doesn't fit. They aren't subject to flow control.
+    int pos = 0;
+    do {
+        const int length = qMin(block.size() - pos, m_peerMaxFrameSize);
+        quint8 flags = pos + length == block.size() ? s_endHeadersFlag : 0;
+        if (pos == 0 && body.isEmpty() && bodyComplete) {
+            flags |= s_endStreamFlag;
+        }
+        writeFrame(pos == 0 ? HeadersFrame : ContinuationFrame, flags, streamId, block.constData() + pos, length);
+        pos += length;
+    } while (pos < block.size());
+
+    stream.responseSent = true;
+    stream.bodyComplete = bodyComplete;
+    stream.pendingData = body;
+    stream.pendingOffset = 0;
+    sendPendingData();
+}
+
+// Sends the response bodies as far as the flow control windows allow, and closes the streams which are done
+void KDSoapHttp2Connection::sendPendingData()
+{
+    QMap<quint32, Stream>::iterator it = m_streams.begin();
+    while (it != m_streams.end()) {
+        Stream &stream = it.value();
+        if (!stream.responseSent) {
+            ++it;
+            continue;
+        }
+        while (stream.pendingOffset < stream.pendingData.size() && stream.sendWindow > 0 && m_connectionSendWindow > 0) {
+            const int remaining = stream.pendingData.size() - stream.pendingOffset;
+            const int length = int(qMin(qMin(qint64(remaining), qint64(m_peerMaxFrameSize)), qMin(stream.sendWindow, m_connectionSendWindow)));
+            const quint8 flags = length == remaining && stream.bodyComplete ? s_endStreamFlag : 0;
+            writeFrame(DataFrame, flags, it.key(), stream.pendingData.constData() + stream.pendingOffset, length);
+            stream.pendingOffset += length;
+            stream.sendWindow -= length;
+            m_connectionSendWindow -= length;
+        }
+        if (stream.pendingOffset < stream.pendingData.size() || !stream.bodyComplete) {
+            ++it;
+            continue;
+        }
+        // The response is complete. If the request isn't (we answered early with an error),
+        // tell the client to stop sending it, section 8.1
+        if (!stream.requestComplete) {
+            writeRstStream(it.key(), NoError);
+        }
+        it = m_streams.erase(it);
+    }
+}
+
+bool KDSoapHttp2Connection::handleSettings(quint8 flags, quint32 streamId, const char *payload, int length)
+{
+    if (streamId != 0) {
+        return connectionError(ProtocolError);
+    }
+    if (flags & s_ackFlag) {
+        if (length != 0) {
+            return connectionError(FrameSizeError);
+        }
+        return true;
+    }
+    if (length % 6 != 0) {
+        return connectionError(FrameSizeError);
+    }
+    if (!applySettings(payload, length)) {
+        return false;
+    }
+    m_settingsReceived = true;
+    writeFrame(SettingsFrame, s_ackFlag, 0, nullptr, 0);
+    sendPendingData(); // the initial window size might have grown
+    return true;
+}
+
+bool KDSoapHttp2Connection::applySettings(const char *payload, int length)
+{
+    for (int pos = 0; pos + 6 <= length; pos += 6) {
+        const int identifier = (int(quint8(payload[pos])) << 8) | int(quint8(payload[pos + 1]));
+        const quint32 value = readUInt32(payload + pos + 2);
+        switch (identifier) {
+        case s_headerTableSizeSetting:
+            m_encoder.setMaxTableSize(int(qMin(value, quint32(s_maxWindowSize))));
+            break;
+        case s_enablePushSetting:
+            if (value > 1) {
+                return connectionError(ProtocolError);
+            }
+            break; // we never push
+        case s_initialWindowSizeSetting: {
+            if (value > s_maxWindowSize) {
+                return connectionError(FlowControlError);
+            }
+            // Applies to the open streams too, section 6.9.2
+            const qint64 delta = qint64(value) - m_peerInitialWindowSize;
+            for (QMap<quint32, Stream>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+                it.value().sendWindow += delta;
+                if (it.value().sendWindow > s_maxWindowSize) {
+                    return connectionError(FlowControlError);
+                }
+            }
+            m_peerInitialWindowSize = value;
+            break;
+        }
+        case s_maxFrameSizeSetting:
+            if (value < quint32(s_defaultMaxFrameSize) || value > 0xffffff) {
+                return connectionError(ProtocolError);
+            }
+            m_peerMaxFrameSize = int(value);
+            break;
+        default:
+            // SETTINGS_MAX_CONCURRENT_STREAMS doesn't matter since we don't push; our headers are small
+            break;
+        }
+    }
+    return true;
+}
+
+bool KDSoapHttp2Connection::handleWindowUpdate(quint32 streamId, const char *payload, int length)
+{
+    if (length != 4) {
+        return connectionError(FrameSizeError);
+    }
+    const quint32 increment = readUInt32(payload) & 0x7fffffff;
+    if (streamId == 0) {
+        if (increment == 0) {
+            return connectionError(ProtocolError);
+        }
+        m_connectionSendWindow += increment;
+        if (m_connectionSendWindow > s_maxWindowSize) {
+            return connectionError(FlowControlError);
+        }
+    } else {
+        QMap<quint32, Stream>::iterator it = m_streams.find(streamId);
+        if (it == m_streams.end()) {
+            if (streamId > m_lastStreamId) {
+                return connectionError(ProtocolError);
+            }
+            return true; // closed
+        }
+        if (increment == 0) {
+            streamError(streamId, ProtocolError);
+            return true;
+        }
+        it.value().sendWindow += increment;
+        if (it.value().sendWindow > s_maxWindowSize) {
+            streamError(streamId, FlowControlError);
+            return true;
+        }
+    }
+    sendPendingData();
+    return true;
+}
+
+bool KDSoapHttp2Connection::handleRstStream(quint32 streamId, const char *payload, int length)
+{
+    Q_UNUSED(payload);
+    if (streamId == 0 || streamId > m_lastStreamId) {
+        return connectionError(ProtocolError);
+    }
+    if (length != 4) {
+        return connectionError(FrameSizeError);
+    }
+    // The response to it, if any is still to come, will be dropped by sendResponse
+    m_streams.remove(streamId);
+    return true;
+}
+
+void KDSoapHttp2Connection::goAway(ErrorCode error)
+{
+    if (m_goingAway) {
+        return;
+    }
+    m_goingAway = true;
+    QByteArray payload;
+    appendUInt32(&payload, m_lastStreamId);
+    appendUInt32(&payload, quint32(error));
+    writeFrame(GoAwayFrame, 0, 0, payload.constData(), payload.size());
+}
+
+bool KDSoapHttp2Connection::connectionError(ErrorCode error)
+{
+    if (!m_failed) {
+        m_failed = true;
+        m_goingAway = false; // a second GOAWAY, with the error
+        goAway(error);
+        m_streams.clear();
+    }
+    return false;
+}
+
+void KDSoapHttp2Connection::streamError(quint32 streamId, ErrorCode error)
+{
+    writeRstStream(streamId, error);
+    m_streams.remove(streamId);
+}
+
+QByteArray KDSoapHttp2Connection::takeOutput()
+{
+    QByteArray output;
+    output.swap(m_output);
+    return output;
+}
+
+void KDSoapHttp2Connection::writeFrame(FrameType type, quint8 flags, quint32 streamId, const char *payload, int length)
+{
+    m_output.append(char(length >> 16));
+    m_output.append(char(length >> 8));
+    m_output.append(char(length));
+    m_output.append(char(type));
+    m_output.append(char(flags));
+    appendUInt32(&m_output, streamId);
+    if (length > 0) {
+        m_output.append(payload, length);
+    }
+}
+
+void KDSoapHttp2Connection::writeWindowUpdate(quint32 streamId, quint32 increment)
+{
+    QByteArray payload;
+    appendUInt32(&payload, increment);
+    writeFrame(WindowUpdateFrame, 0, streamId, payload.constData(), payload.size());
+}
+
+void KDSoapHttp2Connection::writeRstStream(quint32 streamId, ErrorCode error)
+{
+    QByteArray payload;
+    appendUInt32(&payload, quint32(error));
+    writeFrame(RstStreamFrame, 0, streamId, payload.constData(), payload.size());
+}
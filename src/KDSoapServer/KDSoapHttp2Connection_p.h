@@ -0,0 +1,183 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPHTTP2CONNECTION_P_H
+#define KDSOAPHTTP2CONNECTION_P_H
+
+#include "KDSoapHpack_p.h"
+#include "KDSoapHttpRequestParser_p.h"
+#include <QByteArray>
+#include <QMap>
+
+/**
+ * \internal
+ * The server side of an HTTP/2 connection (RFC 7540): framing, HPACK, stream states and flow control.
+ *
+ * It doesn't do any I/O: receive() is given the data read from the socket, and the data to write
+ * is collected in takeOutput(). The requests and responses are exchanged as HTTP/1.1 messages,
+ * so that KDSoapServerSocket handles the requests of all the streams with its HTTP/1.1 code:
+ * takeRequest() returns a complete request, and sendResponse() takes the complete response to it.
+ * The streams are independent, their responses can be sent in any order.
+ */
+class KDSOAPSERVER_EXPORT KDSoapHttp2Connection
+{
+public:
+    enum ErrorCode
+    {
+        NoError = 0x0,
+        ProtocolError = 0x1,
+        InternalError = 0x2,
+        FlowControlError = 0x3,
+        StreamClosed = 0x5,
+        FrameSizeError = 0x6,
+        RefusedStream = 0x7,
+        Cancel = 0x8,
+        CompressionError = 0x9,
+        EnhanceYourCalm = 0xb
+    };
+
+    enum PrefaceMatch
+    {
+        NoPreface,
+        PartialPreface, ///< the data received so far could be the beginning of the preface
+        CompletePreface
+    };
+    /// Checks whether \p data starts with the HTTP/2 client connection preface ("PRI * HTTP/2.0...")
+    static PrefaceMatch matchPreface(const QByteArray &data);
+
+    /// The request header limits also apply to the header list of a request, and the body size limit to its DATA frames
+    explicit KDSoapHttp2Connection(const KDSoapHttpRequestParser::Limits &limits);
+
+    /**
+     * Starts the connection: queues our SETTINGS frame. For an upgrade from HTTP/1.1 ("Upgrade: h2c"),
+     * \p upgradeSettings is the value of the HTTP2-Settings header; returns false if it's invalid.
+     */
+    bool start(const QByteArray &upgradeSettings = QByteArray());
+    /// Checks the HTTP2-Settings header of an upgrade request, before agreeing to the upgrade
+    static bool isValidUpgradeSettings(const QByteArray &upgradeSettings);
+    /// After an upgrade: the request sent with HTTP/1.1 becomes stream 1, see takeRequest()
+    void addUpgradeRequest(const QByteArray &httpRequestHead, const QByteArray &body);
+
+    /**
+     * Processes the data received from the client.
+     * Returns false on a connection error: a GOAWAY frame was queued, close the connection once it's written.
+     */
+    bool receive(const QByteArray &data);
+
+    /**
+     * Returns the next stream whose request is complete, as the head of an HTTP/1.1 request
+     * (request line and headers) and the body. Returns false if there's none.
+     */
+    bool takeRequest(int *streamId, QByteArray *httpRequestHead, QByteArray *body);
+
+    /**
+     * Sends the response to the request of \p streamId, given as a complete HTTP/1.1 response.
+     * Does nothing if the client reset the stream in the meantime.
+     *
+     * If \p bodyComplete is false, \p httpResponse only has the beginning of the body (or none of it),
+     * and the rest follows with sendResponseData(). The Content-Length header must be set then.
+     */
+    void sendResponse(int streamId, const QByteArray &httpResponse, bool bodyComplete = true);
+    /// The next part of a response body, see sendResponse(). \p bodyComplete is true for the last part.
+    void sendResponseData(int streamId, const QByteArray &data, bool bodyComplete);
+    /// The size of the response body of \p streamId waiting for the flow control windows, or -1 if the stream is closed
+    qint64 pendingResponseData(int streamId) const;
+    /// Closes the stream, e.g. when its response can't be completed
+    void resetStream(int streamId, ErrorCode error);
+
+    /// No new streams are accepted, the connection should be closed once the current streams are done
+    void goAway(ErrorCode error);
+    bool isGoingAway() const
+    {
+        return m_goingAway;
+    }
+    /// Streams which are open (i.e. waiting for their request or response, or sending their response)
+    int streamCount() const
+    {
+        return m_streams.count();
+    }
+
+    /// The frames to write to the socket
+    QByteArray takeOutput();
+
+private:
+    enum FrameType
+    {
+        DataFrame = 0x0,
+        HeadersFrame = 0x1,
+        PriorityFrame = 0x2,
+        RstStreamFrame = 0x3,
+        SettingsFrame = 0x4,
+        PushPromiseFrame = 0x5,
+        PingFrame = 0x6,
+        GoAwayFrame = 0x7,
+        WindowUpdateFrame = 0x8,
+        ContinuationFrame = 0x9
+    };
+
+    struct Stream
+    {
+        Stream();
+
+        bool requestComplete; // END_STREAM received (half-closed remote)
+        bool requestTaken; // by takeRequest()
+        KDSoapHttpHeaderList headers;
+        QByteArray upgradeRequestHead; // the HTTP/1.1 request which created stream 1, after an upgrade
+        QByteArray body;
+        qint64 contentLength; // -1 if not given
+        qint64 sendWindow;
+        int receiveWindow;
+        bool responseSent; // the stream closes once pendingData is sent, if bodyComplete
+        bool bodyComplete; // false while more data is to come from sendResponseData()
+        QByteArray pendingData; // response body waiting for the flow control windows
+        int pendingOffset;
+    };
+
+    bool processFrame(quint8 type, quint8 flags, quint32 streamId, const char *payload, int length);
+    bool handleData(quint8 flags, quint32 streamId, const char *payload, int length);
+    bool handleHeaders(quint8 flags, quint32 streamId, const char *payload, int length);
+    bool handleHeaderBlock();
+    void endRequest(quint32 streamId, Stream &stream);
+    bool handleSettings(quint8 flags, quint32 streamId, const char *payload, int length);
+    bool applySettings(const char *payload, int length);
+    bool handleWindowUpdate(quint32 streamId, const char *payload, int length);
+    bool handleRstStream(quint32 streamId, const char *payload, int length);
+    bool connectionError(ErrorCode error);
+    void streamError(quint32 streamId, ErrorCode error);
+    bool requestHeadersValid(const Stream &stream) const;
+    void sendErrorResponse(quint32 streamId, const char *status);
+    void queueResponse(quint32 streamId, Stream &stream, const QByteArray &status, const KDSoapHttpHeaderList &headers, const QByteArray &body,
+                       bool bodyComplete = true);
+    void sendPendingData();
+    void writeFrame(FrameType type, quint8 flags, quint32 streamId, const char *payload, int length);
+    void writeWindowUpdate(quint32 streamId, quint32 increment);
+    void writeRstStream(quint32 streamId, ErrorCode error);
+
+    KDSoapHttpRequestParser::Limits m_limits;
+    KDSoapHpackDecoder m_decoder;
+    KDSoapHpackEncoder m_encoder;
+    QByteArray m_input;
+    QByteArray m_output;
+    bool m_prefaceReceived;
+    bool m_settingsReceived;
+    bool m_goingAway;
+    bool m_failed;
+    quint32 m_lastStreamId; // highest stream opened by the client
+    QMap<quint32, Stream> m_streams; // sorted, so that the requests and pending data are handled in order
+    int m_peerMaxFrameSize;
+    qint64 m_peerInitialWindowSize;
+    qint64 m_connectionSendWindow;
+    int m_connectionReceiveWindow;
+    // Header block being received, HEADERS followed by CONTINUATION frames
+    quint32 m_headerBlockStreamId; // 0 if none
+    bool m_headerBlockEndsStream;
+    QByteArray m_headerBlock;
+};
+
+#endif // KDSOAPHTTP2CONNECTION_P_H
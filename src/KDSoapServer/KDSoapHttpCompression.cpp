@@ -0,0 +1,241 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapHttpCompression_p.h"
+#include <QDebug>
+#include <QList>
+
+#include <cstring>
+
+#ifdef KDSOAPSERVER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// zlib's windowBits: 15 is the maximum window size, +16 means gzip wrapper, +32 means automatic gzip/zlib detection
+static const int s_maxWindowBits = 15;
+// Output buffer size for inflate
+static const int s_inflateChunkSize = 16 * 1024;
+
+bool KDSoapHttpCompression::isSupported()
+{
+#ifdef KDSOAPSERVER_HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+KDSoapHttpCompression::Encoding KDSoapHttpCompression::negotiate(const QByteArray &acceptEncoding)
+{
+    if (!isSupported() || acceptEncoding.isEmpty()) {
+        return Identity;
+    }
+    // Accept-Encoding: gzip;q=1.0, deflate;q=0.5, *;q=0
+    float gzipQuality = -1;
+    float deflateQuality = -1;
+    float wildcardQuality = -1;
+    const QList<QByteArray> codings = acceptEncoding.split(',');
+    for (const QByteArray &coding : codings) {
+        const int semicolon = coding.indexOf(';');
+        const QByteArray name = coding.left(semicolon).trimmed().toLower();
+        float quality = 1;
+        if (semicolon >= 0) {
+            const QByteArray param = coding.mid(semicolon + 1).trimmed();
+            if (param.startsWith("q=")) {
+                bool ok;
+                quality = param.mid(2).toFloat(&ok);
+                if (!ok) {
+                    quality = 0;
+                }
+            }
+        }
+        if (name == "gzip" || name == "x-gzip") {
+            gzipQuality = quality;
+        } else if (name == "deflate") {
+            deflateQuality = quality;
+        } else if (name == "*") {
+            wildcardQuality = quality;
+        }
+    }
+    if (gzipQuality < 0) {
+        gzipQuality = wildcardQuality;
+    }
+    if (deflateQuality < 0) {
+        deflateQuality = wildcardQuality;
+    }
+    if (gzipQuality > 0 && gzipQuality >= deflateQuality) {
+        return Gzip;
+    }
+    if (deflateQuality > 0) {
+        return Deflate;
+    }
+    return Identity;
+}
+
+int KDSoapHttpCompression::encodingFromName(const QByteArray &contentEncoding)
+{
+    const QByteArray name = contentEncoding.trimmed().toLower();
+    if (name.isEmpty() || name == "identity") {
+        return Identity;
+    }
+    if (!isSupported()) {
+        return -1;
+    }
+    if (name == "gzip" || name == "x-gzip") {
+        return Gzip;
+    }
+    if (name == "deflate") {
+        return Deflate;
+    }
+    return -1;
+}
+
+QByteArray KDSoapHttpCompression::encodingName(Encoding encoding)
+{
+    switch (encoding) {
+    case Gzip:
+        return QByteArrayLiteral("gzip");
+    case Deflate:
+        return QByteArrayLiteral("deflate");
+    case Identity:
+        break;
+    }
+    return QByteArrayLiteral("identity");
+}
+
+QByteArray KDSoapHttpCompression::compress(const QByteArray &data, Encoding encoding)
+{
+#ifdef KDSOAPSERVER_HAVE_ZLIB
+    if (encoding == Identity) {
+        return data;
+    }
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // "deflate" is the zlib format (RFC 1950), not raw deflate, see RFC 7230 section 4.2.2
+    const int windowBits = encoding == Gzip ? s_maxWindowBits + 16 : s_maxWindowBits;
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return QByteArray();
+    }
+    QByteArray output;
+    // deflateBound doesn't account for the gzip header and trailer
+    output.resize(int(deflateBound(&stream, uLong(data.size()))) + 18);
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    stream.avail_in = uInt(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(output.data());
+    stream.avail_out = uInt(output.size());
+    const int ret = ::deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (ret != Z_STREAM_END) {
+        qWarning() << "KDSoapServer: compressing the response failed" << ret;
+        return QByteArray();
+    }
+    output.resize(int(stream.total_out));
+    return output;
+#else
+    Q_UNUSED(encoding);
+    return data;
+#endif
+}
+
+class KDSoapHttpInflater::Private
+{
+public:
+#ifdef KDSOAPSERVER_HAVE_ZLIB
+    z_stream m_stream;
+    bool m_initialized;
+    bool m_finished;
+#endif
+    qint64 m_maxOutputSize;
+    bool m_limitExceeded;
+};
+
+KDSoapHttpInflater::KDSoapHttpInflater(KDSoapHttpCompression::Encoding encoding, qint64 maxOutputSize)
+    : d(new Private)
+{
+    d->m_maxOutputSize = maxOutputSize;
+    d->m_limitExceeded = false;
+#ifdef KDSOAPSERVER_HAVE_ZLIB
+    memset(&d->m_stream, 0, sizeof(d->m_stream));
+    // Automatic gzip/zlib header detection. Raw deflate data (sent by some clients for "deflate") isn't supported.
+    Q_UNUSED(encoding);
+    d->m_initialized = inflateInit2(&d->m_stream, s_maxWindowBits + 32) == Z_OK;
+    d->m_finished = false;
+#else
+    Q_UNUSED(encoding);
+#endif
+}
+
+KDSoapHttpInflater::~KDSoapHttpInflater()
+{
+#ifdef KDSOAPSERVER_HAVE_ZLIB
+    if (d->m_initialized) {
+        inflateEnd(&d->m_stream);
+    }
+#endif
+    delete d;
+}
+
+bool KDSoapHttpInflater::inflate(const char *data, int length, QByteArray *output)
+{
+#ifdef KDSOAPSERVER_HAVE_ZLIB
+    if (!d->m_initialized) {
+        return false;
+    }
+    if (d->m_finished) {
+        return length == 0; // trailing garbage after the compressed stream
+    }
+    d->m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    d->m_stream.avail_in = uInt(length);
+    // Also called again when the output chunk is full with no input left: zlib might have more pending output
+    for (;;) {
+        const int oldSize = output->size();
+        output->resize(oldSize + s_inflateChunkSize);
+        d->m_stream.next_out = reinterpret_cast<Bytef *>(output->data() + oldSize);
+        d->m_stream.avail_out = s_inflateChunkSize;
+        const int ret = ::inflate(&d->m_stream, Z_NO_FLUSH);
+        output->resize(oldSize + s_inflateChunkSize - int(d->m_stream.avail_out));
+        // Checked for each output chunk, a few bytes of input can decompress to gigabytes
+        if (d->m_maxOutputSize >= 0 && qint64(d->m_stream.total_out) > d->m_maxOutputSize) {
+            d->m_limitExceeded = true;
+            return false;
+        }
+        if (ret == Z_STREAM_END) {
+            d->m_finished = true;
+            return d->m_stream.avail_in == 0;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            qDebug() << "Invalid compressed request body:" << (d->m_stream.msg ? d->m_stream.msg : "");
+            return false;
+        }
+        if (d->m_stream.avail_out != 0) {
+            break; // all the available output was written, needs more input
+        }
+    }
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(length);
+    Q_UNUSED(output);
+    return false;
+#endif
+}
+
+bool KDSoapHttpInflater::isFinished() const
+{
+#ifdef KDSOAPSERVER_HAVE_ZLIB
+    return d->m_finished;
+#else
+    return false;
+#endif
+}
+
+bool KDSoapHttpInflater::limitExceeded() const
+{
+    return d->m_limitExceeded;
+}
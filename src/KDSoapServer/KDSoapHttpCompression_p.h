@@ -0,0 +1,73 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPHTTPCOMPRESSION_P_H
+#define KDSOAPHTTPCOMPRESSION_P_H
+
+#include <QtCore/QByteArray>
+
+/**
+ * \internal
+ * HTTP content codings (RFC 7230 section 4.2) for KDSoapServerSocket: gzip and deflate.
+ * Everything here requires zlib; without it, only the identity coding is supported.
+ */
+class KDSoapHttpCompression
+{
+public:
+    enum Encoding
+    {
+        Identity,
+        Gzip,
+        Deflate
+    };
+
+    /// Returns true if KDSoap was built with zlib
+    static bool isSupported();
+
+    /// Picks the encoding to use for the response, from the value of the Accept-Encoding header
+    static Encoding negotiate(const QByteArray &acceptEncoding);
+
+    /// Returns the encoding named in a Content-Encoding header, or -1 if not supported
+    static int encodingFromName(const QByteArray &contentEncoding);
+
+    /// The name to use in a Content-Encoding header
+    static QByteArray encodingName(Encoding encoding);
+
+    /// Compresses \p data in one go. Returns an empty array on error.
+    static QByteArray compress(const QByteArray &data, Encoding encoding);
+};
+
+/**
+ * \internal
+ * Streaming decompression of a request body: each piece of compressed data is
+ * decompressed as it arrives, so the compressed body is never held as a whole.
+ */
+class KDSoapHttpInflater
+{
+public:
+    /// \p maxOutputSize: limit for the decompressed body (against "zip bombs"), -1 for no limit
+    explicit KDSoapHttpInflater(KDSoapHttpCompression::Encoding encoding, qint64 maxOutputSize = -1);
+    ~KDSoapHttpInflater();
+
+    /// Decompresses \p length bytes at \p data, appending the result to \p output. Returns false on error.
+    bool inflate(const char *data, int length, QByteArray *output);
+
+    /// True once the end of the compressed stream was reached; a body ending before that is truncated
+    bool isFinished() const;
+
+    /// True if inflate() failed because the decompressed body is larger than maxOutputSize
+    bool limitExceeded() const;
+
+private:
+    Q_DISABLE_COPY(KDSoapHttpInflater)
+    class Private;
+    Private *const d;
+};
+
+#endif // KDSOAPHTTPCOMPRESSION_P_H
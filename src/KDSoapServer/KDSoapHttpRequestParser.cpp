@@ -0,0 +1,470 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapHttpRequestParser_p.h"
+#include <QDebug>
+#include <QDir>
+#include <QIODevice>
+#include <limits>
+#include <string.h>
+
+// Don't allocate more than this in one go when reading from the socket
+static const qint64 s_maxReadSize = 1024 * 1024;
+// The size of the buffer is an int, and QByteArray needs a bit more for its header
+static const qint64 s_maxBufferSize = std::numeric_limits<int>::max() - 1024;
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static inline int hexDigitValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+KDSoapHttpRequestParser::KDSoapHttpRequestParser()
+{
+    reset();
+}
+
+void KDSoapHttpRequestParser::reset()
+{
+    m_buffer.clear();
+    resetState();
+}
+
+void KDSoapHttpRequestParser::startNextRequest()
+{
+    if (m_state == Failed || m_pos >= m_buffer.size()) {
+        m_buffer.clear();
+    } else {
+        m_buffer.remove(0, m_pos);
+    }
+    resetState();
+}
+
+void KDSoapHttpRequestParser::resetState()
+{
+    m_state = RequestLine;
+    m_pos = 0;
+    m_scanPos = 0;
+    m_bodyStart = 0;
+    m_contentLength = 0;
+    m_remaining = 0;
+    m_chunked = false;
+    m_chunkCount = 0;
+    m_chunkedBodySize = 0;
+    m_trailerCount = 0;
+    m_error = Error;
+    m_requestType = Range {0, 0};
+    m_httpVersion = Range {0, 0};
+    m_path.clear();
+    m_headers.clear();
+}
+
+qint64 KDSoapHttpRequestParser::appendFromDevice(QIODevice *device)
+{
+    qint64 total = 0;
+    for (;;) {
+        const qint64 room = s_maxBufferSize - m_buffer.size();
+        const qint64 available = qMin(qMin(device->bytesAvailable(), s_maxReadSize), room);
+        if (available <= 0) {
+            if (room <= 0 && device->bytesAvailable() > 0) {
+                qWarning("KDSoapServer: request buffer full");
+                return -1;
+            }
+            break;
+        }
+        // Read straight into our buffer, no intermediate copy
+        const int oldSize = m_buffer.size();
+        m_buffer.resize(oldSize + int(available));
+        const qint64 nread = device->read(m_buffer.data() + oldSize, available);
+        m_buffer.resize(oldSize + int(qMax(nread, qint64(0))));
+        if (nread < 0) {
+            return -1;
+        }
+        if (nread == 0) {
+            break;
+        }
+        total += nread;
+    }
+    return total;
+}
+
+// Finds the next line, starting at m_pos. Only the bytes not seen yet are scanned.
+bool KDSoapHttpRequestParser::nextLine(Range *line)
+{
+    const char *data = m_buffer.constData();
+    const int size = m_buffer.size();
+    if (m_scanPos >= size) {
+        return false;
+    }
+    const char *eol = static_cast<const char *>(memchr(data + m_scanPos, '\n', size - m_scanPos));
+    if (!eol) {
+        m_scanPos = size;
+        return false;
+    }
+    const int eolPos = int(eol - data);
+    int end = eolPos;
+    if (end > m_pos && data[end - 1] == '\r') {
+        --end;
+    }
+    line->start = m_pos;
+    line->length = end - m_pos;
+    m_pos = eolPos + 1;
+    m_scanPos = m_pos;
+    return true;
+}
+
+// For the lines which can't be parsed until they are complete: don't wait forever for their end
+bool KDSoapHttpRequestParser::lineTooLong() const
+{
+    return m_limits.maxHeaderSize >= 0 && m_scanPos - m_pos > m_limits.maxHeaderSize;
+}
+
+KDSoapHttpRequestParser::Result KDSoapHttpRequestParser::parseHeaders()
+{
+    Range line;
+    while (m_state == RequestLine || m_state == Headers) {
+        const bool haveLine = nextLine(&line);
+        // The request starts at the beginning of the buffer, see startNextRequest()
+        if (m_limits.maxHeaderSize >= 0 && m_scanPos > m_limits.maxHeaderSize) {
+            m_error = HeadersTooLarge;
+            m_state = Failed;
+            break;
+        }
+        if (!haveLine) {
+            return NeedMoreData;
+        }
+        if (m_state == RequestLine) {
+            if (line.length == 0) {
+                // RFC 7230 section 3.5: ignore empty lines before the request-line
+                continue;
+            }
+            if (!parseRequestLine(line)) {
+                m_state = Failed;
+                break;
+            }
+            m_state = Headers;
+        } else if (line.length == 0) {
+            if (!headersDone()) {
+                m_state = Failed;
+            }
+        } else if (m_limits.maxHeaderCount >= 0 && m_headers.size() >= m_limits.maxHeaderCount) {
+            m_error = HeadersTooLarge;
+            m_state = Failed;
+        } else {
+            parseHeaderLine(line);
+        }
+    }
+    return m_state == Failed ? m_error : Ok;
+}
+
+bool KDSoapHttpRequestParser::parseRequestLine(const Range &line)
+{
+    const char *begin = m_buffer.constData();
+    const char *data = begin + line.start;
+    const char *end = data + line.length;
+    // The first line is special, it's the GET or POST line
+    const char *sp1 = static_cast<const char *>(memchr(data, ' ', line.length));
+    if (!sp1) {
+        qDebug() << "Malformed HTTP request:" << copy(line);
+        return false;
+    }
+    const char *target = sp1 + 1;
+    const char *sp2 = static_cast<const char *>(memchr(target, ' ', end - target));
+    if (!sp2) {
+        qDebug() << "Malformed HTTP request:" << copy(line);
+        return false;
+    }
+    m_requestType = Range {line.start, int(sp1 - data)};
+    m_httpVersion = Range {int(sp2 + 1 - begin), int(end - (sp2 + 1))};
+
+    // Grammar from https://datatracker.ietf.org/doc/html/rfc7230#section-5.3.1
+    //  origin-form    = absolute-path [ "?" query ]
+    // and https://datatracker.ietf.org/doc/html/rfc3986#section-3.3
+    // says the path ends at the first '?' or '#' character
+    const int targetLength = int(sp2 - target);
+    const char *query = static_cast<const char *>(memchr(target, '?', targetLength));
+    const int pathLength = query ? int(query - target) : targetLength;
+    // Unfortunately QDir::cleanPath works with QString
+    m_path = QDir::cleanPath(QString::fromUtf8(target, pathLength)).toUtf8();
+    if (query) {
+        m_path.append(query, targetLength - pathLength);
+    }
+    return true;
+}
+
+void KDSoapHttpRequestParser::parseHeaderLine(const Range &line)
+{
+    const char *data = m_buffer.constData();
+    const char *colon = static_cast<const char *>(memchr(data + line.start, ':', line.length));
+    if (!colon) {
+        qDebug() << "Malformed HTTP header:" << copy(line);
+        return;
+    }
+    const int nameLength = int(colon - (data + line.start));
+    // remove space before and after the value
+    int valueStart = int(colon - data) + 1;
+    int valueEnd = line.start + line.length;
+    while (valueStart < valueEnd && isSpace(data[valueStart])) {
+        ++valueStart;
+    }
+    while (valueEnd > valueStart && isSpace(data[valueEnd - 1])) {
+        --valueEnd;
+    }
+    const HeaderField field = {{line.start, nameLength}, {valueStart, valueEnd - valueStart}};
+    m_headers.append(field);
+}
+
+bool KDSoapHttpRequestParser::headersDone()
+{
+    const char *data = m_buffer.constData();
+    m_bodyStart = m_pos;
+    m_contentLength = 0;
+
+    const int transferEncoding = findHeader("transfer-encoding");
+    if (transferEncoding >= 0) {
+        const Range &value = m_headers.at(transferEncoding).value;
+        m_chunked = value.length == 7 && qstrnicmp(data + value.start, "chunked", 7) == 0;
+    }
+
+    if (m_chunked) {
+        m_state = ChunkSize;
+        return true;
+    }
+
+    const int contentLength = findHeader("content-length");
+    if (contentLength >= 0) {
+        const Range &value = m_headers.at(contentLength).value;
+        if (value.length == 0) {
+            return false;
+        }
+        for (int i = value.start; i < value.start + value.length; ++i) {
+            const char c = data[i];
+            if (c < '0' || c > '9' || m_contentLength > (std::numeric_limits<qint64>::max() - 9) / 10) {
+                qDebug() << "Invalid Content-Length:" << copy(value);
+                return false;
+            }
+            m_contentLength = m_contentLength * 10 + (c - '0');
+        }
+        // Reject it now, before receiving (and buffering) the body, even without a limit if it doesn't fit in the buffer
+        if (m_contentLength > m_limits.bodySizeLimit() || m_contentLength > s_maxBufferSize - m_bodyStart) {
+            m_error = BodyTooLarge;
+            return false;
+        }
+    }
+    m_remaining = m_contentLength;
+    m_state = Body;
+    return true;
+}
+
+bool KDSoapHttpRequestParser::parseChunkSize(const Range &line)
+{
+    // chunk = chunk-size [ chunk-ext ] CRLF
+    const char *data = m_buffer.constData() + line.start;
+    int i = 0;
+    while (i < line.length && isSpace(data[i])) {
+        ++i;
+    }
+    qint64 chunkSize = 0;
+    int digits = 0;
+    for (; i < line.length; ++i) {
+        const int digit = hexDigitValue(data[i]);
+        if (digit < 0) {
+            break;
+        }
+        if (++digits > 15) { // would overflow, and nobody sends chunks that big anyway
+            return false;
+        }
+        chunkSize = chunkSize * 16 + digit;
+    }
+    while (i < line.length && isSpace(data[i])) {
+        ++i;
+    }
+    if (digits == 0 || (i < line.length && data[i] != ';')) {
+        qDebug() << "Invalid chunk size:" << copy(line);
+        return false;
+    }
+    if (chunkSize == 0) { // done!
+        m_state = Trailers;
+    } else {
+        m_chunkedBodySize += chunkSize;
+        if ((m_limits.maxChunkCount >= 0 && ++m_chunkCount > m_limits.maxChunkCount)
+            || m_chunkedBodySize > m_limits.bodySizeLimit()) {
+            m_error = BodyTooLarge;
+            return false;
+        }
+        m_remaining = chunkSize;
+        m_state = ChunkData;
+    }
+    return true;
+}
+
+KDSoapHttpRequestParser::Result KDSoapHttpRequestParser::takeBodyData(int *offset, int *length)
+{
+    const int available = m_buffer.size() - m_pos;
+    if (available == 0) {
+        return NeedMoreData;
+    }
+    const int len = int(qMin(qint64(available), m_remaining));
+    *offset = m_pos;
+    *length = len;
+    m_pos += len;
+    m_scanPos = m_pos;
+    m_remaining -= len;
+    return Ok;
+}
+
+KDSoapHttpRequestParser::Result KDSoapHttpRequestParser::readBodyData(int *offset, int *length)
+{
+    Range line;
+    for (;;) {
+        switch (m_state) {
+        case RequestLine:
+        case Headers:
+            Q_ASSERT(!"readBodyData called before parseHeaders returned Ok");
+            return NeedMoreData;
+        case Body:
+            if (m_remaining == 0) {
+                m_state = Done;
+                return Complete;
+            }
+            return takeBodyData(offset, length);
+        case ChunkSize:
+            if (!nextLine(&line)) {
+                if (lineTooLong()) {
+                    m_error = BodyTooLarge;
+                    m_state = Failed;
+                    return m_error;
+                }
+                return NeedMoreData;
+            }
+            if (!parseChunkSize(line)) {
+                m_state = Failed;
+                return m_error;
+            }
+            break;
+        case ChunkData: {
+            const Result result = takeBodyData(offset, length);
+            if (m_remaining == 0) {
+                m_state = ChunkDataEnd;
+            }
+            return result;
+        }
+        case ChunkDataEnd:
+            if (!nextLine(&line)) {
+                if (lineTooLong()) { // should be an empty line
+                    m_state = Failed;
+                    return m_error;
+                }
+                return NeedMoreData;
+            }
+            if (line.length != 0) {
+                qDebug() << "Missing CRLF after chunk data";
+                m_state = Failed;
+                return Error;
+            }
+            m_state = ChunkSize;
+            break;
+        case Trailers:
+            // We have the full data, now read (and ignore) the trailers
+            if (!nextLine(&line)) {
+                if (lineTooLong()) {
+                    m_error = HeadersTooLarge;
+                    m_state = Failed;
+                    return m_error;
+                }
+                return NeedMoreData;
+            }
+            if (line.length == 0) {
+                m_state = Done;
+                return Complete;
+            }
+            if (m_limits.maxHeaderCount >= 0 && ++m_trailerCount > m_limits.maxHeaderCount) {
+                m_error = HeadersTooLarge;
+                m_state = Failed;
+                return m_error;
+            }
+            break;
+        case Done:
+            return Complete;
+        case Failed:
+            return m_error;
+        }
+    }
+}
+
+void KDSoapHttpRequestParser::discardConsumedBodyData()
+{
+    if (!headersComplete() || m_pos <= m_bodyStart) {
+        return;
+    }
+    const int consumed = m_pos - m_bodyStart;
+    m_buffer.remove(m_bodyStart, consumed);
+    m_pos -= consumed;
+    m_scanPos -= consumed;
+}
+
+QByteArray KDSoapHttpRequestParser::rawBody() const
+{
+    Q_ASSERT(!m_chunked);
+    return QByteArray::fromRawData(m_buffer.constData() + m_bodyStart, int(m_contentLength));
+}
+
+QByteArray KDSoapHttpRequestParser::requestType() const
+{
+    return copy(m_requestType);
+}
+
+QByteArray KDSoapHttpRequestParser::httpVersion() const
+{
+    return copy(m_httpVersion);
+}
+
+int KDSoapHttpRequestParser::findHeader(const char *lowerCaseName) const
+{
+    // RFC2616 section 4.2 "Field names are case-insensitive"
+    const int nameLength = int(qstrlen(lowerCaseName));
+    for (int i = m_headers.size() - 1; i >= 0; --i) {
+        const Range &name = m_headers.at(i).name;
+        if (name.length == nameLength && qstrnicmp(m_buffer.constData() + name.start, lowerCaseName, uint(nameLength)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+QByteArray KDSoapHttpRequestParser::header(const char *lowerCaseName) const
+{
+    const int index = findHeader(lowerCaseName);
+    return index >= 0 ? copy(m_headers.at(index).value) : QByteArray();
+}
+
+QMap<QByteArray, QByteArray> KDSoapHttpRequestParser::headerMap() const
+{
+    QMap<QByteArray, QByteArray> headersMap;
+    headersMap.insert("_requestType", requestType());
+    headersMap.insert("_path", m_path);
+    headersMap.insert("_httpVersion", httpVersion());
+    for (const HeaderField &field : m_headers) {
+        headersMap.insert(copy(field.name).toLower(), copy(field.value));
+    }
+    return headersMap;
+}
@@ -0,0 +1,245 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPHTTPREQUESTPARSER_P_H
+#define KDSOAPHTTPREQUESTPARSER_P_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMap>
+#include <QtCore/QVarLengthArray>
+#include <limits>
+QT_BEGIN_NAMESPACE
+class QIODevice;
+QT_END_NAMESPACE
+
+/**
+ * \internal
+ * Incremental HTTP/1.1 request parser used by KDSoapServerSocket.
+ *
+ * The parser owns the receive buffer: the socket reads directly into buffer(),
+ * and the parser resumes where it stopped on the previous call, so no byte is scanned twice.
+ * Headers are stored as offsets into the buffer rather than as separate strings,
+ * values are only copied out when someone asks for them.
+ */
+class KDSoapHttpRequestParser
+{
+public:
+    enum Result
+    {
+        NeedMoreData, ///< incomplete input, call again once more data arrived
+        Ok, ///< headers complete (parseHeaders) or body data available (readBodyData)
+        Complete, ///< the whole request (including trailers) has been received
+        Error, ///< malformed request, the caller should reply with 400 Bad Request
+        HeadersTooLarge, ///< Limits::maxHeaderSize or maxHeaderCount exceeded, reply with 431 Request Header Fields Too Large
+        BodyTooLarge ///< Limits::maxBodySize or maxChunkCount exceeded, reply with 413 Payload Too Large
+    };
+
+    /**
+     * The largest body which can be received, whatever the limits: the request is buffered
+     * in a QByteArray, indexed with ints. This leaves some room for the headers.
+     */
+    static const qint64 MaxBufferedBodySize = std::numeric_limits<int>::max() - 1024 * 1024;
+
+    /**
+     * What a request may contain, checked as soon as possible, so that the data of a request
+     * which is going to be rejected is never buffered. -1 means no limit
+     * (but the body can't be larger than MaxBufferedBodySize anyway).
+     */
+    struct Limits
+    {
+        Limits()
+            : maxHeaderSize(64 * 1024)
+            , maxHeaderCount(100)
+            , maxBodySize(64 * 1024 * 1024)
+            , maxChunkCount(-1)
+        {
+        }
+
+        int maxHeaderSize; ///< request line and headers; also the length of a chunk-size or trailer line
+        int maxHeaderCount; ///< headers, and trailers of chunked requests
+        qint64 maxBodySize; ///< Content-Length, or sum of the chunk sizes
+        int maxChunkCount;
+
+        /// maxBodySize, but never more than MaxBufferedBodySize, even when there is no limit
+        qint64 bodySizeLimit() const
+        {
+            if (maxBodySize >= 0 && maxBodySize < MaxBufferedBodySize) {
+                return maxBodySize;
+            }
+            return MaxBufferedBodySize;
+        }
+    };
+
+    KDSoapHttpRequestParser();
+
+    /**
+     * Sets the limits for the requests parsed from now on.
+     */
+    void setLimits(const Limits &limits)
+    {
+        m_limits = limits;
+    }
+
+    /**
+     * Reads all available data from \p device directly into the receive buffer.
+     * Returns the number of bytes read, or -1 on error, or if the buffer can't grow anymore.
+     */
+    qint64 appendFromDevice(QIODevice *device);
+
+    /**
+     * Appends \p data to the receive buffer, for requests which don't come from a device
+     * (the HTTP/2 streams, see KDSoapHttp2Connection).
+     */
+    void append(const QByteArray &data)
+    {
+        m_buffer += data;
+    }
+
+    /**
+     * The receive buffer. Offsets returned by readBodyData() refer to it.
+     */
+    const QByteArray &buffer() const
+    {
+        return m_buffer;
+    }
+
+    /**
+     * Parses the request line and headers, as far as possible.
+     * Returns Ok once the empty line terminating the headers has been seen.
+     */
+    Result parseHeaders();
+
+    /**
+     * Returns the next piece of body data, as \p offset and \p length into buffer().
+     * For chunked requests this is the decoded chunk data (possibly a partial chunk),
+     * for Content-Length requests it's the raw body bytes received since the last call.
+     * Returns Ok if data is available, NeedMoreData, Complete or Error.
+     */
+    Result readBodyData(int *offset, int *length);
+
+    /**
+     * Frees the body bytes which were already returned by readBodyData().
+     * Only call this when the caller doesn't need the body to be contiguous in buffer()
+     * (i.e. it copied or processed the data already). The headers are kept.
+     */
+    void discardConsumedBodyData();
+
+    /**
+     * Clears the buffer and resets the state, ready for the next request.
+     */
+    void reset();
+
+    /**
+     * Removes the current request from the buffer, but keeps any data received after it
+     * (i.e. the beginning of the next request, with HTTP pipelining), and resets the state.
+     * If the request was malformed, this is the same as reset().
+     */
+    void startNextRequest();
+
+    bool headersComplete() const
+    {
+        return m_state > Headers;
+    }
+    bool isChunked() const
+    {
+        return m_chunked;
+    }
+    qint64 contentLength() const
+    {
+        return m_contentLength;
+    }
+
+    /**
+     * Returns the raw body, for Content-Length requests, once readBodyData() returned Complete.
+     * This does not copy the data, the returned array is only valid until the buffer is modified.
+     */
+    QByteArray rawBody() const;
+
+    QByteArray requestType() const;
+    /// The path (cleaned up with QDir::cleanPath) followed by the query, if any
+    QByteArray path() const
+    {
+        return m_path;
+    }
+    QByteArray httpVersion() const;
+
+    /**
+     * Returns the value of the header \p lowerCaseName (which must be lowercase),
+     * or an empty QByteArray if not present. If the header was sent multiple times,
+     * the last value wins (like the QMap which used to be used here).
+     */
+    QByteArray header(const char *lowerCaseName) const;
+
+    /**
+     * Returns all headers in a map, keys lowercased, plus the special keys
+     * "_requestType", "_path" and "_httpVersion".
+     * This is only for the public interfaces which take a QMap (e.g. KDSoapServerRawXMLInterface),
+     * the server itself uses header() instead.
+     */
+    QMap<QByteArray, QByteArray> headerMap() const;
+
+private:
+    enum State
+    {
+        RequestLine,
+        Headers,
+        Body,
+        ChunkSize,
+        ChunkData,
+        ChunkDataEnd,
+        Trailers,
+        Done,
+        Failed
+    };
+    struct Range
+    {
+        int start;
+        int length;
+    };
+    struct HeaderField
+    {
+        Range name;
+        Range value;
+    };
+
+    void resetState();
+    bool nextLine(Range *line);
+    bool parseRequestLine(const Range &line);
+    void parseHeaderLine(const Range &line);
+    bool headersDone();
+    bool parseChunkSize(const Range &line);
+    bool lineTooLong() const;
+    int findHeader(const char *lowerCaseName) const;
+    Result takeBodyData(int *offset, int *length);
+    QByteArray copy(const Range &range) const
+    {
+        return QByteArray(m_buffer.constData() + range.start, range.length);
+    }
+
+    QByteArray m_buffer;
+    State m_state;
+    int m_pos; // everything before m_pos has been fully processed
+    int m_scanPos; // where to continue looking for the end of the current line
+    int m_bodyStart;
+    qint64 m_contentLength;
+    qint64 m_remaining; // remaining bytes in the body (Content-Length) or in the current chunk
+    bool m_chunked;
+    int m_chunkCount;
+    qint64 m_chunkedBodySize;
+    int m_trailerCount;
+    Result m_error; // returned once m_state is Failed
+    Limits m_limits;
+
+    Range m_requestType;
+    Range m_httpVersion;
+    QByteArray m_path;
+    QVarLengthArray<HeaderField, 16> m_headers;
+};
+
+#endif // KDSOAPHTTPREQUESTPARSER_P_H
@@ -0,0 +1,119 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapReusePortSocket_p.h"
+#include <QObject>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#if defined(Q_OS_UNIX) && defined(SO_REUSEPORT)
+#define KDSOAP_HAVE_REUSEPORT
+#endif
+
+bool KDSoapReusePortSocket::isSupported()
+{
+#ifdef KDSOAP_HAVE_REUSEPORT
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef KDSOAP_HAVE_REUSEPORT
+static int socketError(int fd, QString *errorString)
+{
+    *errorString = QString::fromLocal8Bit(strerror(errno));
+    if (fd != -1) {
+        ::close(fd);
+    }
+    return -1;
+}
+#endif
+
+static int createSocket(const QHostAddress &address, quint16 port, bool listen, QString *errorString)
+{
+#ifdef KDSOAP_HAVE_REUSEPORT
+    sockaddr_storage storage;
+    memset(&storage, 0, sizeof(storage));
+    socklen_t addressLength;
+    // QHostAddress::Any means dual-stack, i.e. an IPv6 socket which also accepts IPv4 connections
+    const bool dualStack = address == QHostAddress(QHostAddress::Any);
+    if (address.protocol() == QAbstractSocket::IPv4Protocol) {
+        sockaddr_in *sa4 = reinterpret_cast<sockaddr_in *>(&storage);
+        sa4->sin_family = AF_INET;
+        sa4->sin_port = htons(port);
+        sa4->sin_addr.s_addr = htonl(address.toIPv4Address());
+        addressLength = sizeof(sockaddr_in);
+    } else if (address.protocol() == QAbstractSocket::IPv6Protocol || dualStack) {
+        sockaddr_in6 *sa6 = reinterpret_cast<sockaddr_in6 *>(&storage);
+        sa6->sin6_family = AF_INET6;
+        sa6->sin6_port = htons(port);
+        const Q_IPV6ADDR ip6 = dualStack ? QHostAddress(QHostAddress::AnyIPv6).toIPv6Address() : address.toIPv6Address();
+        memcpy(&sa6->sin6_addr, &ip6, sizeof(ip6));
+        addressLength = sizeof(sockaddr_in6);
+    } else {
+        *errorString = QObject::tr("Unsupported address %1").arg(address.toString());
+        return -1;
+    }
+
+    const int fd = ::socket(storage.ss_family, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return socketError(fd, errorString);
+    }
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    const int on = 1;
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 || ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+        return socketError(fd, errorString);
+    }
+    if (dualStack) {
+        const int off = 0;
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&storage), addressLength) != 0) {
+        return socketError(fd, errorString);
+    }
+    // Only listening sockets are part of the group between which the kernel distributes the connections
+    if (listen && ::listen(fd, SOMAXCONN) != 0) {
+        return socketError(fd, errorString);
+    }
+    return fd;
+#else
+    Q_UNUSED(address);
+    Q_UNUSED(port);
+    Q_UNUSED(listen);
+    *errorString = QObject::tr("SO_REUSEPORT is not supported on this platform");
+    return -1;
+#endif
+}
+
+int KDSoapReusePortSocket::createListeningSocket(const QHostAddress &address, quint16 port, QString *errorString)
+{
+    return createSocket(address, port, true, errorString);
+}
+
+int KDSoapReusePortSocket::createBoundSocket(const QHostAddress &address, quint16 port, QString *errorString)
+{
+    return createSocket(address, port, false, errorString);
+}
+
+void KDSoapReusePortSocket::closeSocket(int socketDescriptor)
+{
+#ifdef Q_OS_UNIX
+    ::close(socketDescriptor);
+#else
+    Q_UNUSED(socketDescriptor);
+#endif
+}
@@ -0,0 +1,39 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPREUSEPORTSOCKET_P_H
+#define KDSOAPREUSEPORTSOCKET_P_H
+
+#include <QtCore/QString>
+#include <QtNetwork/QHostAddress>
+
+/**
+ * \internal
+ * Creates listening sockets with SO_REUSEPORT, so that several sockets (one per thread)
+ * can listen on the same port, and the kernel distributes incoming connections between them.
+ * QTcpServer::listen() doesn't allow setting socket options before bind(), so the sockets
+ * are created here and handed over with QTcpServer::setSocketDescriptor().
+ */
+class KDSoapReusePortSocket
+{
+public:
+    /// Returns true if the platform supports SO_REUSEPORT (Linux >= 3.9, BSDs, macOS)
+    static bool isSupported();
+
+    /// Returns the descriptor of a new listening socket, or -1 on error (see \p errorString)
+    static int createListeningSocket(const QHostAddress &address, quint16 port, QString *errorString);
+
+    /// Returns the descriptor of a new socket which is bound but doesn't listen, or -1 on error (see \p errorString).
+    /// It holds the port (and picks it, when \p port is 0) without receiving any of the incoming connections.
+    static int createBoundSocket(const QHostAddress &address, quint16 port, QString *errorString);
+
+    static void closeSocket(int socketDescriptor);
+};
+
+#endif // KDSOAPREUSEPORTSOCKET_P_H
@@ -8,9 +8,17 @@
 **
 ****************************************************************************/
 #include "KDSoapServer.h"
+#include "KDSoapAdmissionController_p.h"
+#include "KDSoapHandlerPool_p.h"
+#include "KDSoapReusePortSocket_p.h"
+#include "KDSoapServerLogger_p.h"
+#include "KDSoapServerMetrics_p.h"
+#include "KDSoapServerSettings_p.h"
 #include "KDSoapSocketList_p.h"
 #include "KDSoapThreadPool.h"
+#include <QDateTime>
 #include <QFile>
+#include <QFileInfo>
 #include <QMutex>
 #ifdef Q_OS_UNIX
 #include <errno.h>
@@ -25,41 +33,54 @@ public:
     Private()
         : m_threadPool(nullptr)
         , m_mainThreadSocketList(nullptr)
-        , m_use(KDSoapMessage::LiteralUse)
-        , m_logLevel(KDSoapServer::LogNothing)
-        , m_path(QString::fromLatin1("/"))
-        , m_maxConnections(-1)
+        , m_handlerPool(nullptr)
+        , m_settings(new KDSoapServerSettings)
+        , m_openConnections(0)
         , m_portBeforeSuspend(0)
+        , m_listeningPerThread(false)
     {
     }
 
     ~Private()
     {
+        delete m_handlerPool; // waits for the running calls
         delete m_mainThreadSocketList;
     }
 
+    // Publishes a modified copy of the settings. The previous snapshot is deleted
+    // once the last thread which is still using it releases it.
+    template<typename Modifier>
+    void updateSettings(Modifier modify)
+    {
+        QMutexLocker lock(&m_settingsMutex);
+        KDSoapServerSettings *newSettings = new KDSoapServerSettings(*m_settings);
+        modify(newSettings);
+        m_settings = QSharedPointer<const KDSoapServerSettings>(newSettings);
+    }
+
     KDSoapThreadPool *m_threadPool;
     KDSoapSocketList *m_mainThreadSocketList;
-    KDSoapMessage::Use m_use;
-    KDSoapServer::Features m_features;
+    KDSoapHandlerPool *m_handlerPool; // created by setHandlerThreadCount
+
+    KDSoapServerLogger m_logger;
+    KDSoapServerMetrics m_metrics;
+
+    QSharedPointer<const KDSoapServerSettings> m_settings;
+    QMutex m_settingsMutex; // only held while copying m_settings
+
+    // Contents of the wsdl file, so that it isn't read again for every download
+    QMutex m_wsdlCacheMutex;
+    QString m_cachedWsdlFile;
+    QByteArray m_cachedWsdlContents;
+    QDateTime m_cachedWsdlLastModified;
 
-    QMutex m_logMutex;
-    KDSoapServer::LogLevel m_logLevel;
-    QString m_logFileName;
-    QFile m_logFile;
+    KDSoapAdmissionController m_admissionController;
 
-    QMutex m_serverDataMutex;
-    QString m_wsdlFile;
-    QString m_wsdlPathInUrl;
-    QString m_path;
-    int m_maxConnections;
+    QAtomicInt m_openConnections; // in all threads, updated by KDSoapSocketList
 
     QHostAddress m_addressBeforeSuspend;
     quint16 m_portBeforeSuspend;
-
-#ifndef QT_NO_SSL
-    QSslConfiguration m_sslConfiguration;
-#endif
+    bool m_listeningPerThread;
 };
 
 KDSoapServer::KDSoapServer(QObject *parent)
@@ -72,17 +93,31 @@ KDSoapServer::KDSoapServer(QObject *parent)
 
 KDSoapServer::~KDSoapServer()
 {
+    if (d->m_listeningPerThread && d->m_threadPool) {
+        d->m_threadPool->stopAcceptors(this);
+    }
     delete d;
 }
 
-void KDSoapServer::incomingConnection(qintptr socketDescriptor)
+// Called from the acceptor threads too, with listenPerThread
+bool KDSoapServer::acceptConnection()
 {
     const int max = maxConnections();
     const int numSockets = numConnectedSockets();
     if (max > -1 && numSockets >= max) {
         emit connectionRejected();
-        log(QByteArray("ERROR Too many connections (") + QByteArray::number(numSockets) + "), incoming connection rejected\n");
-    } else if (d->m_threadPool) {
+        logError("Too many connections (" + QByteArray::number(numSockets) + "), incoming connection rejected");
+        return false;
+    }
+    return true;
+}
+
+void KDSoapServer::incomingConnection(qintptr socketDescriptor)
+{
+    if (!acceptConnection()) {
+        return;
+    }
+    if (d->m_threadPool) {
         // qDebug() << "incomingConnection: using thread pool";
         d->m_threadPool->handleIncomingConnection(socketDescriptor, this);
     } else {
@@ -137,86 +172,141 @@ KDSoapThreadPool *KDSoapServer::threadPool() const
 
 QString KDSoapServer::endPoint() const
 {
-    QMutexLocker lock(&d->m_serverDataMutex);
+    const KDSoapServerSettingsPtr currentSettings = settings();
     const QHostAddress address = serverAddress();
     if (address == QHostAddress::Null) {
         return QString();
     }
     const QString addressStr = address == QHostAddress::Any ? QString::fromLatin1("127.0.0.1") : address.toString();
     return QString::fromLatin1("%1://%2:%3%4")
-        .arg(QString::fromLatin1((d->m_features & Ssl) ? "https" : "http"))
+        .arg(QString::fromLatin1((currentSettings->features & Ssl) ? "https" : "http"))
         .arg(addressStr)
         .arg(serverPort())
-        .arg(d->m_path);
+        .arg(currentSettings->path);
+}
+
+bool KDSoapServer::listenPerThread(const QHostAddress &address, quint16 port)
+{
+    if (!KDSoapReusePortSocket::isSupported()) {
+        qWarning("KDSoapServer: listenPerThread is not supported on this platform");
+        return false;
+    }
+    if (!d->m_threadPool) {
+        qWarning("KDSoapServer: listenPerThread requires a thread pool");
+        return false;
+    }
+    if (isListening()) {
+        qWarning("KDSoapServer: listenPerThread called while already listening");
+        return false;
+    }
+    // The server's own socket is only bound, so that serverPort(), endPoint() etc. work, and it determines the port
+    // in case port 0 was passed. It doesn't listen, otherwise the kernel would hand it its share of the connections.
+    QString errorString;
+    const int socketDescriptor = KDSoapReusePortSocket::createBoundSocket(address, port, &errorString);
+    if (socketDescriptor == -1) {
+        qWarning("KDSoapServer: failed to listen on %s port %d: %s", qPrintable(address.toString()), port, qPrintable(errorString));
+        return false;
+    }
+    if (!setSocketDescriptor(socketDescriptor)) {
+        KDSoapReusePortSocket::closeSocket(socketDescriptor);
+        return false;
+    }
+    // There is nothing to accept, and a socket which doesn't listen would be reported as readable all the time
+    pauseAccepting();
+    if (!d->m_threadPool->startAcceptors(this, address, serverPort())) {
+        close();
+        return false;
+    }
+    d->m_listeningPerThread = true;
+    return true;
 }
 
 void KDSoapServer::setUse(KDSoapMessage::Use use)
 {
-    d->m_use = use;
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->use = use;
+    });
 }
 
 KDSoapMessage::Use KDSoapServer::use() const
 {
-    return d->m_use;
+    return settings()->use;
 }
 
 void KDSoapServer::setLogLevel(KDSoapServer::LogLevel level)
 {
-    QMutexLocker lock(&d->m_logMutex);
-    d->m_logLevel = level;
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->logLevel = level;
+    });
+    if (level != LogNothing) {
+        d->m_logger.ensureStarted();
+    }
 }
 
 KDSoapServer::LogLevel KDSoapServer::logLevel() const
 {
-    QMutexLocker lock(&d->m_logMutex);
-    return d->m_logLevel;
+    return settings()->logLevel;
 }
 
 void KDSoapServer::setLogFileName(const QString &fileName)
 {
-    QMutexLocker lock(&d->m_logMutex);
-    d->m_logFileName = fileName;
+    d->m_logger.setFileName(fileName);
 }
 
 QString KDSoapServer::logFileName() const
 {
-    QMutexLocker lock(&d->m_logMutex);
-    return d->m_logFileName;
+    return d->m_logger.fileName();
 }
 
-void KDSoapServer::log(const QByteArray &text)
+void KDSoapServer::setLogFormat(LogFormat format)
 {
-    if (d->m_logLevel == KDSoapServer::LogNothing) {
-        return;
-    }
+    d->m_logger.setFormat(format);
+}
+
+KDSoapServer::LogFormat KDSoapServer::logFormat() const
+{
+    return d->m_logger.format();
+}
+
+void KDSoapServer::setLogFileRotation(qint64 maxSize, int backupCount)
+{
+    d->m_logger.setRotation(maxSize, backupCount);
+}
+
+qint64 KDSoapServer::logFileMaxSize() const
+{
+    return d->m_logger.maxFileSize();
+}
+
+int KDSoapServer::logFileBackupCount() const
+{
+    return d->m_logger.backupCount();
+}
 
-    QMutexLocker lock(&d->m_logMutex);
-    if (d->m_logFileName.isEmpty()) {
+// For errors outside of request handling (the request log goes through KDSoapSocketList::log)
+void KDSoapServer::logError(const QByteArray &text)
+{
+    if (settings()->logLevel == KDSoapServer::LogNothing) {
         return;
     }
-    if (!d->m_logFile.isOpen()) {
-        d->m_logFile.setFileName(d->m_logFileName);
-        if (!d->m_logFile.open(QIODevice::Append)) {
-            qCritical("Could not open log file for writing: %s", qPrintable(d->m_logFileName));
-            d->m_logFileName.clear(); // don't retry every time log() is called
-            return;
-        }
-    }
-    d->m_logFile.write(text);
+    KDSoapLogRecord record(KDSoapLogRecord::Error);
+    record.text = text;
+    d->m_logger.log(record);
+}
+
+KDSoapServerLogger *KDSoapServer::logger() const
+{
+    return &d->m_logger;
 }
 
 void KDSoapServer::flushLogFile()
 {
-    if (d->m_logFile.isOpen()) {
-        d->m_logFile.flush();
-    }
+    d->m_logger.flush(false);
 }
 
 void KDSoapServer::closeLogFile()
 {
-    if (d->m_logFile.isOpen()) {
-        d->m_logFile.close();
-    }
+    d->m_logger.flush(true);
 }
 
 bool KDSoapServer::setExpectedSocketCount(int sockets)
@@ -274,6 +364,9 @@ void KDSoapServer::suspend()
     d->m_portBeforeSuspend = serverPort();
     d->m_addressBeforeSuspend = serverAddress();
     close();
+    if (d->m_listeningPerThread && d->m_threadPool) {
+        d->m_threadPool->stopAcceptors(this);
+    }
 
     // Disconnect connected sockets, otherwise they could still make calls
     if (d->m_threadPool) {
@@ -287,6 +380,12 @@ void KDSoapServer::resume()
 {
     if (d->m_portBeforeSuspend == 0) {
         qWarning("KDSoapServer: resume() called without calling suspend() first");
+    } else if (d->m_listeningPerThread) {
+        d->m_listeningPerThread = false;
+        if (!listenPerThread(d->m_addressBeforeSuspend, d->m_portBeforeSuspend)) {
+            qWarning("KDSoapServer: failed to listen on %s port %d", qPrintable(d->m_addressBeforeSuspend.toString()), d->m_portBeforeSuspend);
+        }
+        d->m_portBeforeSuspend = 0;
     } else {
         if (!listen(d->m_addressBeforeSuspend, d->m_portBeforeSuspend)) {
             qWarning("KDSoapServer: failed to listen on %s port %d", qPrintable(d->m_addressBeforeSuspend.toString()), d->m_portBeforeSuspend);
@@ -297,68 +396,325 @@ void KDSoapServer::resume()
 
 void KDSoapServer::setWsdlFile(const QString &file, const QString &pathInUrl)
 {
-    QMutexLocker lock(&d->m_serverDataMutex);
-    d->m_wsdlFile = file;
-    d->m_wsdlPathInUrl = pathInUrl;
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->wsdlFile = file;
+        settings->wsdlPathInUrl = pathInUrl;
+    });
 }
 
 QString KDSoapServer::wsdlFile() const
 {
-    QMutexLocker lock(&d->m_serverDataMutex);
-    return d->m_wsdlFile;
+    return settings()->wsdlFile;
 }
 
 QString KDSoapServer::wsdlPathInUrl() const
 {
-    QMutexLocker lock(&d->m_serverDataMutex);
-    return d->m_wsdlPathInUrl;
+    return settings()->wsdlPathInUrl;
+}
+
+bool KDSoapServer::wsdlFileContents(QByteArray *contents, QDateTime *lastModified)
+{
+    const QString fileName = wsdlFile();
+    const QFileInfo fileInfo(fileName);
+    if (!fileInfo.isFile()) {
+        return false;
+    }
+    QMutexLocker lock(&d->m_wsdlCacheMutex);
+    // Read it again if it was modified on disk
+    if (d->m_cachedWsdlFile != fileName || d->m_cachedWsdlLastModified != fileInfo.lastModified()
+        || d->m_cachedWsdlContents.size() != fileInfo.size()) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            d->m_cachedWsdlFile.clear();
+            d->m_cachedWsdlContents.clear();
+            return false;
+        }
+        d->m_cachedWsdlFile = fileName;
+        d->m_cachedWsdlContents = file.readAll();
+        d->m_cachedWsdlLastModified = fileInfo.lastModified();
+    }
+    *contents = d->m_cachedWsdlContents; // shared, not copied
+    *lastModified = d->m_cachedWsdlLastModified;
+    return true;
+}
+
+void KDSoapServer::setMetricsPath(const QString &pathInUrl)
+{
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->metricsPath = pathInUrl;
+    });
+}
+
+QString KDSoapServer::metricsPath() const
+{
+    return settings()->metricsPath;
+}
+
+KDSoapServerMetrics *KDSoapServer::metrics() const
+{
+    return &d->m_metrics;
+}
+
+QByteArray KDSoapServer::metricsText() const
+{
+    KDSoapServerMetrics::Gauges gauges;
+    gauges.activeRequests = d->m_admissionController.activeRequestCount();
+    gauges.queuedRequests = d->m_admissionController.queuedRequestCount();
+    gauges.openConnections = openConnectionCount();
+    gauges.totalRejectedRequests = d->m_admissionController.totalRejectedRequestCount();
+    return d->m_metrics.toPrometheusText(gauges);
 }
 
 void KDSoapServer::setPath(const QString &path)
 {
-    QMutexLocker lock(&d->m_serverDataMutex);
-    d->m_path = path;
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->path = path;
+    });
 }
 
 QString KDSoapServer::path() const
 {
-    QMutexLocker lock(&d->m_serverDataMutex);
-    return d->m_path;
+    return settings()->path;
 }
 
 void KDSoapServer::setMaxConnections(int sockets)
 {
-    QMutexLocker lock(&d->m_serverDataMutex);
-    d->m_maxConnections = sockets;
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->maxConnections = sockets;
+    });
 }
 
 int KDSoapServer::maxConnections() const
 {
-    QMutexLocker lock(&d->m_serverDataMutex);
-    return d->m_maxConnections;
+    return settings()->maxConnections;
+}
+
+void KDSoapServer::setResponseCompressionThreshold(int bytes)
+{
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->responseCompressionThreshold = bytes;
+    });
+}
+
+int KDSoapServer::responseCompressionThreshold() const
+{
+    return settings()->responseCompressionThreshold;
+}
+
+void KDSoapServer::setIdleTimeout(int msecs)
+{
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->idleTimeout = msecs;
+    });
+}
+
+int KDSoapServer::idleTimeout() const
+{
+    return settings()->idleTimeout;
+}
+
+void KDSoapServer::setMaxRequestsPerConnection(int requests)
+{
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->maxRequestsPerConnection = requests;
+    });
+}
+
+int KDSoapServer::maxRequestsPerConnection() const
+{
+    return settings()->maxRequestsPerConnection;
+}
+
+void KDSoapServer::setMaxKeepAliveConnections(int sockets)
+{
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->maxKeepAliveConnections = sockets;
+    });
+}
+
+int KDSoapServer::maxKeepAliveConnections() const
+{
+    return settings()->maxKeepAliveConnections;
+}
+
+void KDSoapServer::setMaxRequestHeaderSize(int bytes)
+{
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->requestLimits.maxHeaderSize = bytes;
+    });
+}
+
+int KDSoapServer::maxRequestHeaderSize() const
+{
+    return settings()->requestLimits.maxHeaderSize;
+}
+
+void KDSoapServer::setMaxRequestHeaderCount(int count)
+{
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->requestLimits.maxHeaderCount = count;
+    });
+}
+
+int KDSoapServer::maxRequestHeaderCount() const
+{
+    return settings()->requestLimits.maxHeaderCount;
+}
+
+void KDSoapServer::setMaxRequestBodySize(qint64 bytes)
+{
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->requestLimits.maxBodySize = bytes;
+    });
+}
+
+qint64 KDSoapServer::maxRequestBodySize() const
+{
+    return settings()->requestLimits.maxBodySize;
+}
+
+void KDSoapServer::setMaxRequestChunkCount(int count)
+{
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->requestLimits.maxChunkCount = count;
+    });
+}
+
+int KDSoapServer::maxRequestChunkCount() const
+{
+    return settings()->requestLimits.maxChunkCount;
+}
+
+void KDSoapServer::setHandlerThreadCount(int threads)
+{
+    if (threads > 0) {
+        if (!d->m_handlerPool) {
+            d->m_handlerPool = new KDSoapHandlerPool(this);
+        }
+        d->m_handlerPool->setMaxThreadCount(threads);
+    }
+    // Published after the pool exists, the sockets only use the pool when this is > 0
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->handlerThreadCount = qMax(0, threads);
+    });
+}
+
+int KDSoapServer::handlerThreadCount() const
+{
+    return settings()->handlerThreadCount;
+}
+
+void KDSoapServer::setMaxConcurrentRequests(int requests)
+{
+    d->m_admissionController.setMaxActiveRequests(requests);
+}
+
+int KDSoapServer::maxConcurrentRequests() const
+{
+    return d->m_admissionController.maxActiveRequests();
+}
+
+void KDSoapServer::setMaxQueuedRequests(int requests)
+{
+    d->m_admissionController.setMaxQueuedRequests(requests);
+}
+
+int KDSoapServer::maxQueuedRequests() const
+{
+    return d->m_admissionController.maxQueuedRequests();
+}
+
+void KDSoapServer::setRequestQueueTimeout(int msecs)
+{
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->requestQueueTimeout = msecs;
+    });
+}
+
+int KDSoapServer::requestQueueTimeout() const
+{
+    return settings()->requestQueueTimeout;
+}
+
+int KDSoapServer::activeRequestCount() const
+{
+    return d->m_admissionController.activeRequestCount();
+}
+
+int KDSoapServer::queuedRequestCount() const
+{
+    return d->m_admissionController.queuedRequestCount();
+}
+
+int KDSoapServer::rejectedRequestCount() const
+{
+    return d->m_admissionController.rejectedRequestCount();
+}
+
+int KDSoapServer::timedOutRequestCount() const
+{
+    return d->m_admissionController.timedOutRequestCount();
+}
+
+void KDSoapServer::resetRejectedRequestCount()
+{
+    d->m_admissionController.resetCounters();
+}
+
+KDSoapAdmissionController *KDSoapServer::admissionController() const
+{
+    return &d->m_admissionController;
+}
+
+KDSoapHandlerPool *KDSoapServer::handlerPool() const
+{
+    return d->m_handlerPool;
+}
+
+QSharedPointer<const KDSoapServerSettings> KDSoapServer::settings() const
+{
+    QMutexLocker lock(&d->m_settingsMutex);
+    return d->m_settings;
+}
+
+void KDSoapServer::connectionOpened()
+{
+    d->m_openConnections.ref();
+}
+
+void KDSoapServer::connectionClosed()
+{
+    d->m_openConnections.deref();
+}
+
+int KDSoapServer::openConnectionCount() const
+{
+    return d->m_openConnections.loadAcquire();
 }
 
 void KDSoapServer::setFeatures(Features features)
 {
-    QMutexLocker lock(&d->m_serverDataMutex);
-    d->m_features = features;
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->features = features;
+    });
 }
 
 KDSoapServer::Features KDSoapServer::features() const
 {
-    QMutexLocker lock(&d->m_serverDataMutex);
-    return d->m_features;
+    return settings()->features;
 }
 
 #ifndef QT_NO_SSL
 QSslConfiguration KDSoapServer::sslConfiguration() const
 {
-    return d->m_sslConfiguration;
+    return settings()->sslConfiguration;
 }
 
 void KDSoapServer::setSslConfiguration(const QSslConfiguration &config)
 {
-    d->m_sslConfiguration = config;
+    d->updateSettings([&](KDSoapServerSettings *settings) {
+        settings->sslConfiguration = config;
+    });
 }
 #endif
 
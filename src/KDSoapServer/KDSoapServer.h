@@ -12,10 +12,19 @@
 
 #include "KDSoapServerGlobal.h"
 #include <KDSoapClient/KDSoapMessage.h>
+#include <QtCore/QSharedPointer>
 #include <QtNetwork/QSslConfiguration>
 #include <QtNetwork/QTcpServer>
 
 class KDSoapThreadPool;
+class KDSoapAdmissionController;
+class KDSoapHandlerPool;
+class KDSoapServerLogger;
+class KDSoapServerMetrics;
+struct KDSoapServerSettings;
+QT_BEGIN_NAMESPACE
+class QDateTime;
+QT_END_NAMESPACE
 
 /**
  * HTTP soap server.
@@ -47,8 +56,25 @@ public:
     {
         Public = 0, ///< HTTP with no ssl and no authentication needed (default)
         Ssl = 1, ///< HTTPS
-        AuthRequired = 2 ///< Requires authentication. Currently not implemented, patches welcome.
-                         // bitfield, next item is 4
+        AuthRequired = 2, ///< Requires authentication. Currently not implemented, patches welcome.
+        /**
+         * Parse SOAP requests while their body is still being received, instead of buffering
+         * the whole body first. This reduces latency and memory usage for large requests.
+         * Note that in this mode, invalid character references in the request are reported as errors,
+         * rather than being replaced. \since 2.2
+         */
+        StreamRequestParsing = 4,
+        /**
+         * Accept HTTP/2 connections, in addition to HTTP/1.1: with prior knowledge (the client starts
+         * with the HTTP/2 connection preface), after an "Upgrade: h2c" request on unencrypted connections,
+         * and negotiated with ALPN ("h2") on SSL connections.
+         * The concurrent calls of a client are multiplexed over a single connection,
+         * and each one can have its own delayed response.
+         * Streaming responses (KDSoapServerObjectInterface::prepareStreamingResponse) are not supported over HTTP/2.
+         * \since 2.2
+         */
+        Http2 = 8
+        // bitfield, next item is 16
     };
     Q_DECLARE_FLAGS(Features, Feature)
 
@@ -77,6 +103,25 @@ public:
      */
     KDSoapThreadPool *threadPool() const;
 
+    /**
+     * Starts listening on \p address and \p port with one listening socket per thread
+     * of the thread pool, instead of accepting all connections in the thread of the server
+     * and then handing them over to the threads.
+     * The sockets use SO_REUSEPORT, so that the operating system distributes incoming
+     * connections between the threads. This helps with many short-lived connections.
+     * The socket of the server itself doesn't listen and never accepts connections, it only
+     * holds the port, for serverPort() and endPoint().
+     *
+     * A thread pool must have been set with setThreadPool() first, and all of its threads
+     * (maxThreadCount()) are started immediately.
+     * To stop listening, call suspend() (resume() will listen per thread again) or delete the server.
+     *
+     * \return false if SO_REUSEPORT isn't supported on this platform, or on error.
+     * In that case, use the normal listen() instead.
+     * \since 2.2
+     */
+    bool listenPerThread(const QHostAddress &address = QHostAddress::Any, quint16 port = 0);
+
     /**
      * Sets the path that the server expects in client requests.
      * By default the path is '/', but this can be changed here.
@@ -135,9 +180,10 @@ public:
      *  <li>LogEveryCall: log every call, successful or not.</li>
      * </ul>
      *
-     * Warning: enabling logging reduces performance severely. Not only
-     * because of the time spent logging, but also because the threads can
-     * only write one at a time to the file, to avoid mixed output.
+     * The log is written by a background thread: the threads handling requests
+     * only queue the log entries, they don't wait for the file.
+     * If the log can't keep up, entries are dropped (and the number of dropped entries is logged)
+     * rather than slowing down the server.
      */
     void setLogLevel(LogLevel level);
     /**
@@ -157,14 +203,61 @@ public:
      */
     QString logFileName() const;
 
+    enum LogFormat
+    {
+        PlainTextLogFormat, ///< "CALL method", "FAULT method -- fault" and "ERROR message" lines (the default)
+        /**
+         * One JSON object per line, with the fields "time", "type" (CALL, FAULT or ERROR), "method",
+         * "status" (HTTP status), "bytesIn" and "bytesOut" (request and response bodies),
+         * "durationUs" (from the request headers to the response, in microseconds), "fault" and "message".
+         */
+        JsonLogFormat
+    };
+
+    /**
+     * Sets the format of the log entries.
+     * \since 2.2
+     */
+    void setLogFormat(LogFormat format);
+
+    /**
+     * Returns the format set by setLogFormat.
+     * \since 2.2
+     */
+    LogFormat logFormat() const;
+
+    /**
+     * Enables rotation of the log file: when writing to it would make it larger than \p maxSize bytes,
+     * the file is renamed to "<name>.1" (and "<name>.1" to "<name>.2", and so on, up to \p backupCount files),
+     * and a new log file is started.
+     *
+     * The special value -1 for \p maxSize disables rotation (the default).
+     * \since 2.2
+     */
+    void setLogFileRotation(qint64 maxSize, int backupCount = 1);
+
+    /**
+     * Returns the maximum size of the log file, as set by setLogFileRotation.
+     * \since 2.2
+     */
+    qint64 logFileMaxSize() const;
+
+    /**
+     * Returns the number of rotated log files which are kept, as set by setLogFileRotation.
+     * \since 2.2
+     */
+    int logFileBackupCount() const;
+
     /**
      * Force flushing the log file to disk.
+     * This waits until all the entries logged so far are written.
      */
     void flushLogFile();
 
     /**
-     * Close the log file. This can be used to then rename it, in order to
-     * implement log file rotation.
+     * Close the log file, after writing all the entries logged so far. This can be used to then rename it,
+     * in order to implement log file rotation (also see setLogFileRotation).
+     * The file is opened again when the next entry is written.
      */
     void closeLogFile();
 
@@ -184,6 +277,252 @@ public:
      */
     int maxConnections() const;
 
+    /**
+     * Enables compression of responses whose body is at least \p bytes long,
+     * for clients that accept it (Accept-Encoding header): gzip or deflate.
+     * Small responses aren't worth compressing, the overhead would be larger than the savings.
+     *
+     * The special value -1 disables compression of responses (the default).
+     *
+     * Compressed request bodies (Content-Encoding: gzip or deflate) are always accepted,
+     * and decompressed while they are being received.
+     * This requires KDSoap to be built with zlib, otherwise this setting has no effect,
+     * and compressed requests are rejected with the status "415 Unsupported Media Type".
+     * \since 2.2
+     */
+    void setResponseCompressionThreshold(int bytes);
+
+    /**
+     * Returns the threshold set by setResponseCompressionThreshold.
+     * \since 2.2
+     */
+    int responseCompressionThreshold() const;
+
+    /**
+     * Sets the time after which idle connections are closed by the server, in milliseconds.
+     * A connection is idle when no request is being received or handled, for instance
+     * a keep-alive connection between two requests, or a connection where nothing was sent yet.
+     * This frees the resources (file descriptors) used by clients which vanished without closing their connections.
+     *
+     * The special value -1 means no timeout (the default).
+     * \since 2.2
+     */
+    void setIdleTimeout(int msecs);
+
+    /**
+     * Returns the timeout set by setIdleTimeout.
+     * \since 2.2
+     */
+    int idleTimeout() const;
+
+    /**
+     * Sets the maximum number of requests handled on a single connection. The response to the last request
+     * has the header "Connection: close", and the connection is then closed by the server.
+     *
+     * The special value -1 means unlimited (the default).
+     * \since 2.2
+     */
+    void setMaxRequestsPerConnection(int requests);
+
+    /**
+     * Returns the maximum number of requests per connection, as set by setMaxRequestsPerConnection.
+     * \since 2.2
+     */
+    int maxRequestsPerConnection() const;
+
+    /**
+     * Sets the number of connections above which the server stops keeping connections alive:
+     * when more connections than this are open, responses are sent with "Connection: close"
+     * and the connection is closed after the response, leaving room for other clients.
+     * This is meant to be lower than maxConnections().
+     *
+     * The special value -1 means that connections are always kept alive (the default).
+     * \since 2.2
+     */
+    void setMaxKeepAliveConnections(int sockets);
+
+    /**
+     * Returns the number set by setMaxKeepAliveConnections.
+     * \since 2.2
+     */
+    int maxKeepAliveConnections() const;
+
+    /**
+     * Sets the maximum size of the request line and headers of a request, in bytes.
+     * Requests with larger headers are rejected with "431 Request Header Fields Too Large",
+     * as soon as the limit is reached, and the connection is closed.
+     * This also limits the length of the lines of chunked requests (chunk sizes and trailers).
+     *
+     * The default is 64 KiB. The special value -1 means unlimited.
+     * \since 2.2
+     */
+    void setMaxRequestHeaderSize(int bytes);
+
+    /**
+     * Returns the maximum size of the headers, as set by setMaxRequestHeaderSize.
+     * \since 2.2
+     */
+    int maxRequestHeaderSize() const;
+
+    /**
+     * Sets the maximum number of headers in a request (and of trailers, in chunked requests).
+     * Requests with more headers are rejected with "431 Request Header Fields Too Large",
+     * and the connection is closed.
+     *
+     * The default is 100. The special value -1 means unlimited.
+     * \since 2.2
+     */
+    void setMaxRequestHeaderCount(int count);
+
+    /**
+     * Returns the maximum number of headers, as set by setMaxRequestHeaderCount.
+     * \since 2.2
+     */
+    int maxRequestHeaderCount() const;
+
+    /**
+     * Sets the maximum size of the body of a request, in bytes.
+     * Larger requests are rejected with "413 Payload Too Large" and the connection is closed:
+     * with a Content-Length header, before the body is received, with chunked transfer encoding,
+     * as soon as the chunks add up to more than this.
+     * For compressed requests, this is also the limit of the decompressed body.
+     *
+     * The default is 64 MiB. The special value -1 means unlimited, except that a body
+     * larger than what can be buffered (a bit less than 2 GiB) is always rejected.
+     * \since 2.2
+     */
+    void setMaxRequestBodySize(qint64 bytes);
+
+    /**
+     * Returns the maximum size of the request body, as set by setMaxRequestBodySize.
+     * \since 2.2
+     */
+    qint64 maxRequestBodySize() const;
+
+    /**
+     * Sets the maximum number of chunks in a request sent with chunked transfer encoding.
+     * Requests with more chunks are rejected with "413 Payload Too Large", and the connection is closed.
+     *
+     * The special value -1 means unlimited (the default).
+     * \since 2.2
+     */
+    void setMaxRequestChunkCount(int count);
+
+    /**
+     * Returns the maximum number of chunks, as set by setMaxRequestChunkCount.
+     * \since 2.2
+     */
+    int maxRequestChunkCount() const;
+
+    /**
+     * Runs the server objects' methods (KDSoapServerObjectInterface::processRequest) in a separate
+     * pool of \p threads threads, instead of the threads handling the connections (see setThreadPool).
+     * The connection threads then only parse requests and write responses, so that a slow method,
+     * for instance one waiting for a database, doesn't delay the other connections handled by the same thread.
+     * The response is serialized in the pool thread, and sent like a delayed response.
+     *
+     * Each thread of the pool has its own server object, created with createServerObject().
+     * The methods can't use KDSoapServerObjectInterface::serverSocket(), prepareDelayedResponse(),
+     * prepareStreamingResponse(), writeHTTP() or writeXML() then, since the socket belongs to another thread.
+     * The additional HTTP response header items (KDSoapServerObjectInterface::additionalHttpResponseHeaderItems)
+     * are those of the pool thread's server object, after the call.
+     *
+     * The special value 0 means that the methods are called in the connection threads (the default).
+     * \since 2.2
+     */
+    void setHandlerThreadCount(int threads);
+
+    /**
+     * Returns the number of threads set by setHandlerThreadCount.
+     * \since 2.2
+     */
+    int handlerThreadCount() const;
+
+    /**
+     * Sets the maximum number of requests handled at the same time by this server, in all threads.
+     * Unlike setMaxConnections(), this limits the actual work: idle keep-alive connections don't count.
+     * Requests above the limit wait in a queue (see setMaxQueuedRequests), and when the queue is full
+     * they are answered with "503 Service Unavailable" and a Retry-After header, instead of waiting
+     * for an unbounded amount of time. The connection stays open.
+     *
+     * A request counts from the moment its headers are received until its response is sent,
+     * including delayed responses (KDSoapDelayedResponseHandle).
+     *
+     * The special value -1 means unlimited (the default).
+     * \since 2.2
+     */
+    void setMaxConcurrentRequests(int requests);
+
+    /**
+     * Returns the maximum number of concurrent requests, as set by setMaxConcurrentRequests.
+     * \since 2.2
+     */
+    int maxConcurrentRequests() const;
+
+    /**
+     * Sets the maximum number of requests waiting for one of the setMaxConcurrentRequests() places.
+     * They are handled in the order they arrived. Requests arriving when the queue is full are rejected.
+     *
+     * The default value is 0: requests above the limit are rejected immediately.
+     * \since 2.2
+     */
+    void setMaxQueuedRequests(int requests);
+
+    /**
+     * Returns the maximum number of queued requests, as set by setMaxQueuedRequests.
+     * \since 2.2
+     */
+    int maxQueuedRequests() const;
+
+    /**
+     * Sets the maximum time that a request waits in the queue, in milliseconds.
+     * Requests which are still queued after this time are rejected, like when the queue is full.
+     * This is also the value of the Retry-After header (rounded up to seconds).
+     *
+     * The special value -1 means no timeout. The default is 5000 (5 seconds).
+     * \since 2.2
+     */
+    void setRequestQueueTimeout(int msecs);
+
+    /**
+     * Returns the timeout set by setRequestQueueTimeout.
+     * \since 2.2
+     */
+    int requestQueueTimeout() const;
+
+    /**
+     * Returns the number of requests being handled at this precise moment (not including the queued ones).
+     * This information can change at any time, and is therefore only useful for statistical purposes.
+     * \since 2.2
+     */
+    int activeRequestCount() const;
+
+    /**
+     * Returns the number of requests waiting in the queue at this precise moment.
+     * \since 2.2
+     */
+    int queuedRequestCount() const;
+
+    /**
+     * Returns the number of requests rejected with "503 Service Unavailable", because the queue was full
+     * or because they waited too long in it, since the last call to resetRejectedRequestCount().
+     * \since 2.2
+     */
+    int rejectedRequestCount() const;
+
+    /**
+     * Returns the number of rejected requests which waited too long in the queue (see setRequestQueueTimeout),
+     * since the last call to resetRejectedRequestCount().
+     * \since 2.2
+     */
+    int timedOutRequestCount() const;
+
+    /**
+     * Resets rejectedRequestCount and timedOutRequestCount to 0.
+     * \since 2.2
+     */
+    void resetRejectedRequestCount();
+
     /**
      * Sets the number of expected sockets (connections) in this process.
      * This is necessary in order to increase system limits when a large number of clients
@@ -218,6 +557,9 @@ public:
 
     /**
      * Sets the .wsdl file that users can download from the soap server.
+     * The contents of the file are kept in memory, and only read again when the file
+     * is modified on disk. Clients can use conditional requests (If-None-Match, If-Modified-Since)
+     * and byte ranges when downloading it.
      * \param file relative or absolute path to the .wsdl file (including the filename), on disk
      * \param pathInUrl that clients can use in order to download the file:
      *                  for instance "/files/myservice.wsdl" for "https://myserver.example.com/files/myservice.wsdl" as final URL.
@@ -234,6 +576,31 @@ public:
      */
     QString wsdlPathInUrl() const;
 
+    /**
+     * Enables the collection of metrics about the requests, and exports them in the Prometheus text format,
+     * for GET requests on \p pathInUrl (for instance "/metrics").
+     *
+     * For each SOAP operation, the server counts requests, faults, and request and response bytes, and it
+     * measures the time spent parsing the HTTP headers, parsing the XML, in processRequest, serializing
+     * the response and writing it. It also exports the number of active and queued requests
+     * (see setMaxConcurrentRequests) and of open connections, and the number of rejected requests
+     * since the server started (resetRejectedRequestCount doesn't affect it).
+     *
+     * Only the methods handled by the server object get their own operation label: requests for unknown methods,
+     * and requests which couldn't be handled at all, are counted under the operation "other".
+     *
+     * An empty path disables the metrics (the default).
+     * If the metrics must not be public, restrict access to this path with KDSoapServerAuthInterface.
+     * \since 2.2
+     */
+    void setMetricsPath(const QString &pathInUrl);
+
+    /**
+     * \returns the path given to setMetricsPath
+     * \since 2.2
+     */
+    QString metricsPath() const;
+
 #ifndef QT_NO_SSL
     /**
      * \returns the ssl configuration for this server
@@ -271,7 +638,21 @@ protected:
 
 private:
     friend class KDSoapServerSocket;
-    void log(const QByteArray &text);
+    friend class KDSoapThreadAcceptor;
+    friend class KDSoapSocketList;
+    void logError(const QByteArray &text);
+    KDSoapServerLogger *logger() const;
+    KDSoapServerMetrics *metrics() const;
+    QByteArray metricsText() const;
+    bool acceptConnection();
+    bool wsdlFileContents(QByteArray *contents, QDateTime *lastModified);
+    void connectionOpened();
+    void connectionClosed();
+    int openConnectionCount() const;
+    KDSoapAdmissionController *admissionController() const;
+    KDSoapHandlerPool *handlerPool() const;
+    // For every request. The returned snapshot isn't modified, and stays valid as long as it's referenced.
+    QSharedPointer<const KDSoapServerSettings> settings() const;
     class Private;
     Private *const d;
 };
@@ -0,0 +1,330 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapServerLogger_p.h"
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+// How often the logger thread collects the records, when nobody waits for them (flush)
+static const int s_writeInterval = 100; // msecs
+
+KDSoapLogRecord::KDSoapLogRecord(Type recordType)
+    : type(recordType)
+    , timestamp(QDateTime::currentMSecsSinceEpoch())
+    , status(0)
+    , bytesIn(-1)
+    , bytesOut(-1)
+    , durationUsecs(-1)
+{
+}
+
+KDSoapLogRing::KDSoapLogRing(int capacity)
+    : m_records(capacity)
+    , m_slots(m_records.data())
+    , m_capacity(capacity)
+    , m_head(0)
+    , m_tail(0)
+    , m_dropped(0)
+    , m_retired(0)
+{
+}
+
+bool KDSoapLogRing::push(const KDSoapLogRecord &record)
+{
+    const int tail = m_tail.loadAcquire();
+    const int next = (tail + 1) % m_capacity;
+    if (next == m_head.loadAcquire()) {
+        m_dropped.ref();
+        return false;
+    }
+    m_slots[tail] = record;
+    m_tail.storeRelease(next); // publishes the record
+    return true;
+}
+
+bool KDSoapLogRing::pop(KDSoapLogRecord *record)
+{
+    const int head = m_head.loadAcquire();
+    if (head == m_tail.loadAcquire()) {
+        return false;
+    }
+    *record = m_slots[head];
+    m_slots[head] = KDSoapLogRecord(); // don't keep the strings around
+    m_head.storeRelease((head + 1) % m_capacity);
+    return true;
+}
+
+KDSoapServerLogger::KDSoapServerLogger()
+    : m_format(KDSoapServer::PlainTextLogFormat)
+    , m_maxFileSize(-1)
+    , m_backupCount(1)
+    , m_flushRequests(0)
+    , m_flushesDone(0)
+    , m_closeRequested(false)
+    , m_stopRequested(false)
+{
+}
+
+KDSoapServerLogger::~KDSoapServerLogger()
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        m_stopRequested = true;
+        m_wakeUp.wakeOne();
+    }
+    wait();
+}
+
+void KDSoapServerLogger::ensureStarted()
+{
+    QMutexLocker lock(&m_mutex);
+    if (!isRunning() && !m_stopRequested) {
+        start(QThread::LowPriority);
+    }
+}
+
+QSharedPointer<KDSoapLogRing> KDSoapServerLogger::createRing()
+{
+    QSharedPointer<KDSoapLogRing> ring(new KDSoapLogRing(4096));
+    QMutexLocker lock(&m_mutex);
+    m_rings.append(ring);
+    return ring;
+}
+
+void KDSoapServerLogger::log(const KDSoapLogRecord &record)
+{
+    QMutexLocker lock(&m_mutex);
+    m_pending.append(record);
+}
+
+void KDSoapServerLogger::setFileName(const QString &fileName)
+{
+    QMutexLocker lock(&m_mutex);
+    m_fileName = fileName;
+}
+
+QString KDSoapServerLogger::fileName() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_fileName;
+}
+
+void KDSoapServerLogger::setFormat(KDSoapServer::LogFormat format)
+{
+    QMutexLocker lock(&m_mutex);
+    m_format = format;
+}
+
+KDSoapServer::LogFormat KDSoapServerLogger::format() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_format;
+}
+
+void KDSoapServerLogger::setRotation(qint64 maxFileSize, int backupCount)
+{
+    QMutexLocker lock(&m_mutex);
+    m_maxFileSize = maxFileSize;
+    m_backupCount = backupCount;
+}
+
+qint64 KDSoapServerLogger::maxFileSize() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_maxFileSize;
+}
+
+int KDSoapServerLogger::backupCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_backupCount;
+}
+
+void KDSoapServerLogger::flush(bool close)
+{
+    QMutexLocker lock(&m_mutex);
+    if (!isRunning()) {
+        return; // nothing was logged
+    }
+    const int request = ++m_flushRequests;
+    if (close) {
+        m_closeRequested = true;
+    }
+    m_wakeUp.wakeOne();
+    while (m_flushesDone < request && isRunning()) {
+        m_flushed.wait(&m_mutex);
+    }
+}
+
+void KDSoapServerLogger::run()
+{
+    QVector<KDSoapLogRecord> records;
+    QMutexLocker lock(&m_mutex);
+    forever {
+        if (m_flushesDone == m_flushRequests && !m_stopRequested) {
+            m_wakeUp.wait(&m_mutex, s_writeInterval);
+        }
+        const int flushRequests = m_flushRequests;
+        const bool closeRequested = m_closeRequested;
+        const bool stopRequested = m_stopRequested;
+        const QList<QSharedPointer<KDSoapLogRing>> rings = m_rings;
+        records.swap(m_pending);
+        lock.unlock();
+
+        QList<QSharedPointer<KDSoapLogRing>> retiredRings;
+        KDSoapLogRecord record;
+        for (const QSharedPointer<KDSoapLogRing> &ring : rings) {
+            const bool retired = ring->isRetired(); // before draining: nothing is pushed after retire()
+            while (ring->pop(&record)) {
+                records.append(record);
+            }
+            const int dropped = ring->takeDroppedCount();
+            if (dropped > 0) {
+                KDSoapLogRecord droppedRecord(KDSoapLogRecord::Error);
+                droppedRecord.text = QByteArray::number(dropped) + " log records dropped, the logger couldn't keep up";
+                records.append(droppedRecord);
+            }
+            if (retired) {
+                retiredRings.append(ring);
+            }
+        }
+        if (!records.isEmpty()) {
+            writeRecords(records);
+            records.clear();
+        }
+        if (closeRequested || stopRequested) {
+            m_file.close();
+        }
+
+        lock.relock();
+        for (const QSharedPointer<KDSoapLogRing> &ring : qAsConst(retiredRings)) {
+            m_rings.removeOne(ring);
+        }
+        if (closeRequested) {
+            m_closeRequested = false;
+        }
+        m_flushesDone = flushRequests;
+        m_flushed.wakeAll();
+        if (stopRequested) {
+            return;
+        }
+    }
+}
+
+static QByteArray formatPlainText(const KDSoapLogRecord &record)
+{
+    QByteArray line;
+    switch (record.type) {
+    case KDSoapLogRecord::Call:
+        line = "CALL " + record.method;
+        break;
+    case KDSoapLogRecord::Fault:
+        line = "FAULT " + record.method + " -- " + record.text;
+        break;
+    case KDSoapLogRecord::Error:
+        line = "ERROR " + record.text;
+        break;
+    }
+    line += '\n';
+    return line;
+}
+
+static QByteArray formatJson(const KDSoapLogRecord &record)
+{
+    static const char *const types[] = {"CALL", "FAULT", "ERROR"};
+    QJsonObject object;
+    object.insert(QStringLiteral("time"), QDateTime::fromMSecsSinceEpoch(record.timestamp, Qt::UTC).toString(Qt::ISODateWithMs));
+    object.insert(QStringLiteral("type"), QLatin1String(types[record.type]));
+    if (!record.method.isEmpty()) {
+        object.insert(QStringLiteral("method"), QString::fromLatin1(record.method));
+    }
+    if (record.status > 0) {
+        object.insert(QStringLiteral("status"), record.status);
+    }
+    if (record.bytesIn >= 0) {
+        object.insert(QStringLiteral("bytesIn"), record.bytesIn);
+    }
+    if (record.bytesOut >= 0) {
+        object.insert(QStringLiteral("bytesOut"), record.bytesOut);
+    }
+    if (record.durationUsecs >= 0) {
+        object.insert(QStringLiteral("durationUs"), record.durationUsecs);
+    }
+    if (!record.text.isEmpty()) {
+        object.insert(record.type == KDSoapLogRecord::Fault ? QStringLiteral("fault") : QStringLiteral("message"), QString::fromUtf8(record.text));
+    }
+    QByteArray line = QJsonDocument(object).toJson(QJsonDocument::Compact);
+    line += '\n';
+    return line;
+}
+
+void KDSoapServerLogger::writeRecords(const QVector<KDSoapLogRecord> &records)
+{
+    QMutexLocker lock(&m_mutex);
+    const QString fileName = m_fileName;
+    const KDSoapServer::LogFormat format = m_format;
+    const qint64 maxFileSize = m_maxFileSize;
+    lock.unlock();
+
+    if (fileName.isEmpty() || fileName == m_failedFileName) {
+        return;
+    }
+    if (m_file.isOpen() && m_file.fileName() != fileName) {
+        m_file.close();
+    }
+    if (!m_file.isOpen()) {
+        m_file.setFileName(fileName);
+        if (!openFile()) {
+            return;
+        }
+    }
+
+    QByteArray batch;
+    for (const KDSoapLogRecord &record : records) {
+        batch += format == KDSoapServer::JsonLogFormat ? formatJson(record) : formatPlainText(record);
+    }
+    if (maxFileSize > 0 && m_file.size() > 0 && m_file.size() + batch.size() > maxFileSize) {
+        rotateFile();
+        if (!m_file.isOpen()) {
+            return;
+        }
+    }
+    m_file.write(batch);
+    m_file.flush(); // one write per batch, and visible to "tail -f"
+}
+
+bool KDSoapServerLogger::openFile()
+{
+    if (!m_file.open(QIODevice::Append)) {
+        qCritical("Could not open log file for writing: %s", qPrintable(m_file.fileName()));
+        m_failedFileName = m_file.fileName();
+        return false;
+    }
+    m_failedFileName.clear();
+    return true;
+}
+
+// log -> log.1 -> log.2 ... up to the number of backups
+void KDSoapServerLogger::rotateFile()
+{
+    const QString fileName = m_file.fileName();
+    const int backupCount = this->backupCount();
+    m_file.close();
+    if (backupCount > 0) {
+        QFile::remove(fileName + QLatin1Char('.') + QString::number(backupCount));
+        for (int i = backupCount - 1; i >= 1; --i) {
+            QFile::rename(fileName + QLatin1Char('.') + QString::number(i), fileName + QLatin1Char('.') + QString::number(i + 1));
+        }
+        QFile::rename(fileName, fileName + QStringLiteral(".1"));
+    } else {
+        QFile::remove(fileName);
+    }
+    openFile();
+}
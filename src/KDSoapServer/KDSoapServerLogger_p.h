@@ -0,0 +1,158 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPSERVERLOGGER_P_H
+#define KDSOAPSERVERLOGGER_P_H
+
+#include "KDSoapServer.h"
+#include <QAtomicInt>
+#include <QFile>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+/**
+ * \internal
+ * One entry of the server log. Created in the worker threads,
+ * formatted and written by KDSoapServerLogger's thread.
+ */
+struct KDSoapLogRecord
+{
+    enum Type
+    {
+        Call,
+        Fault,
+        Error
+    };
+
+    KDSoapLogRecord()
+        : type(Error)
+        , timestamp(0)
+        , status(0)
+        , bytesIn(-1)
+        , bytesOut(-1)
+        , durationUsecs(-1)
+    {
+    }
+    explicit KDSoapLogRecord(Type recordType);
+
+    Type type;
+    qint64 timestamp; // msecs since epoch
+    QByteArray method;
+    QByteArray text; // fault or error description
+    int status; // HTTP status of the response
+    qint64 bytesIn; // request body, -1 if unknown
+    qint64 bytesOut; // response body, -1 if unknown
+    qint64 durationUsecs; // from the request headers to the response, -1 if unknown
+};
+
+/**
+ * \internal
+ * Lock-free ring buffer of log records, with a single producer (the thread of a KDSoapSocketList)
+ * and a single consumer (the logger thread).
+ * When it's full, records are dropped and counted, rather than blocking the producer.
+ */
+class KDSoapLogRing
+{
+public:
+    explicit KDSoapLogRing(int capacity);
+
+    // Producer thread only
+    bool push(const KDSoapLogRecord &record);
+    // The producer is done with this ring, the logger removes it once it's empty
+    void retire()
+    {
+        m_retired.storeRelease(1);
+    }
+
+    // Consumer thread only
+    bool pop(KDSoapLogRecord *record);
+    int takeDroppedCount()
+    {
+        return m_dropped.fetchAndStoreOrdered(0);
+    }
+    bool isRetired() const
+    {
+        return m_retired.loadAcquire() != 0;
+    }
+
+private:
+    Q_DISABLE_COPY(KDSoapLogRing)
+    QVector<KDSoapLogRecord> m_records;
+    KDSoapLogRecord *m_slots; // m_records.data(), to avoid detach checks
+    const int m_capacity;
+    QAtomicInt m_head; // next record to pop, only written by the consumer
+    QAtomicInt m_tail; // next free slot, only written by the producer
+    QAtomicInt m_dropped;
+    QAtomicInt m_retired;
+};
+
+/**
+ * \internal
+ * Writes the log of a KDSoapServer from a background thread, so that the threads
+ * handling requests never wait for the log file (nor for each other).
+ * The records are collected from the rings of all the threads every s_writeInterval,
+ * and written with one write per batch. The file is rotated once it exceeds the maximum size.
+ */
+class KDSoapServerLogger : public QThread
+{
+    Q_OBJECT
+public:
+    KDSoapServerLogger();
+    ~KDSoapServerLogger() override; // writes the remaining records
+
+    /// Starts the logger thread, if needed
+    void ensureStarted();
+
+    /// For one producer thread (see KDSoapSocketList)
+    QSharedPointer<KDSoapLogRing> createRing();
+    /// From any thread, with a mutex: for occasional records, outside of a KDSoapSocketList
+    void log(const KDSoapLogRecord &record);
+
+    void setFileName(const QString &fileName);
+    QString fileName() const;
+    void setFormat(KDSoapServer::LogFormat format);
+    KDSoapServer::LogFormat format() const;
+    void setRotation(qint64 maxFileSize, int backupCount);
+    qint64 maxFileSize() const;
+    int backupCount() const;
+
+    /// Waits until all the records logged so far are written; then closes the file if \p close is true
+    void flush(bool close);
+
+protected:
+    void run() override;
+
+private:
+    void writeRecords(const QVector<KDSoapLogRecord> &records);
+    bool openFile();
+    void rotateFile();
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_wakeUp;
+    QWaitCondition m_flushed;
+    QList<QSharedPointer<KDSoapLogRing>> m_rings;
+    QVector<KDSoapLogRecord> m_pending; // from log()
+    QString m_fileName;
+    KDSoapServer::LogFormat m_format;
+    qint64 m_maxFileSize;
+    int m_backupCount;
+    int m_flushRequests;
+    int m_flushesDone;
+    bool m_closeRequested;
+    bool m_stopRequested;
+
+    // Logger thread only
+    QFile m_file;
+    QString m_failedFileName; // don't retry every time
+};
+
+#endif // KDSOAPSERVERLOGGER_P_H
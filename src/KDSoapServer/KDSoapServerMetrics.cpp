@@ -0,0 +1,221 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapServerMetrics_p.h"
+#include <QMap>
+
+const qint64 KDSoapLatencyHistogram::s_bucketBounds[BucketCount] = {100,    250,    500,     1000,    2500,    5000,    10000,   25000,
+                                                                   50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000};
+
+// Per thread, beyond that the requests are counted under "other"
+static const int s_maxOperations = 200;
+
+static const char *const s_phaseNames[KDSoapRequestTimings::PhaseCount] = {"header_parse", "xml_parse", "dispatch", "serialize", "write"};
+
+KDSoapLatencyHistogram::KDSoapLatencyHistogram()
+    : m_count(0)
+    , m_sumUsecs(0)
+{
+    for (int bucket = 0; bucket <= BucketCount; ++bucket) {
+        m_buckets[bucket] = 0;
+    }
+}
+
+void KDSoapLatencyHistogram::add(qint64 usecs)
+{
+    int bucket = 0;
+    while (bucket < BucketCount && usecs > s_bucketBounds[bucket]) {
+        ++bucket;
+    }
+    ++m_buckets[bucket];
+    ++m_count;
+    m_sumUsecs += usecs;
+}
+
+void KDSoapLatencyHistogram::merge(const KDSoapLatencyHistogram &other)
+{
+    for (int bucket = 0; bucket <= BucketCount; ++bucket) {
+        m_buckets[bucket] += other.m_buckets[bucket];
+    }
+    m_count += other.m_count;
+    m_sumUsecs += other.m_sumUsecs;
+}
+
+void KDSoapOperationMetrics::merge(const KDSoapOperationMetrics &other)
+{
+    requests += other.requests;
+    faults += other.faults;
+    bytesIn += other.bytesIn;
+    bytesOut += other.bytesOut;
+    for (int phase = 0; phase < KDSoapRequestTimings::PhaseCount; ++phase) {
+        phases[phase].merge(other.phases[phase]);
+    }
+    total.merge(other.total);
+}
+
+KDSoapThreadMetrics::KDSoapThreadMetrics()
+    : m_retired(0)
+{
+}
+
+void KDSoapThreadMetrics::record(const QByteArray &operation, const KDSoapRequestTimings &timings, qint64 totalNsecs, qint64 bytesIn, qint64 bytesOut,
+                                 bool fault)
+{
+    QMutexLocker lock(&m_mutex);
+    // Server objects with a custom processRequest() could accept any method name: keep the number of series bounded
+    const bool known = m_operations.contains(operation) || m_operations.count() < s_maxOperations;
+    KDSoapOperationMetrics &metrics = m_operations[known ? operation : QByteArray("other")];
+    ++metrics.requests;
+    if (fault) {
+        ++metrics.faults;
+    }
+    metrics.bytesIn += bytesIn;
+    metrics.bytesOut += bytesOut;
+    for (int phase = 0; phase < KDSoapRequestTimings::PhaseCount; ++phase) {
+        metrics.phases[phase].add(timings.phaseNsecs[phase] / 1000);
+    }
+    metrics.total.add(totalNsecs / 1000);
+}
+
+KDSoapServerMetrics::KDSoapServerMetrics()
+{
+}
+
+QSharedPointer<KDSoapThreadMetrics> KDSoapServerMetrics::createThreadMetrics()
+{
+    QSharedPointer<KDSoapThreadMetrics> threadMetrics(new KDSoapThreadMetrics);
+    QMutexLocker lock(&m_mutex);
+    m_threads.append(threadMetrics);
+    return threadMetrics;
+}
+
+// Label values: backslash, double-quote and line feed must be escaped
+static QByteArray escapeLabelValue(const QByteArray &value)
+{
+    QByteArray escaped;
+    escaped.reserve(value.size());
+    for (const char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static QByteArray secondsFromUsecs(qint64 usecs)
+{
+    return QByteArray::number(double(usecs) / 1000000.0, 'g', 12);
+}
+
+static void writeHeader(QByteArray &out, const char *name, const char *type, const char *help)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+// labels: without braces, e.g. operation="foo"
+static void writeHistogram(QByteArray &out, const char *name, const QByteArray &labels, const KDSoapLatencyHistogram &histogram)
+{
+    qint64 cumulative = 0;
+    for (int bucket = 0; bucket <= KDSoapLatencyHistogram::BucketCount; ++bucket) {
+        cumulative += histogram.bucketCount(bucket);
+        out += name;
+        out += "_bucket{" + labels + ",le=\"";
+        out += bucket < KDSoapLatencyHistogram::BucketCount ? secondsFromUsecs(KDSoapLatencyHistogram::s_bucketBounds[bucket]) : QByteArray("+Inf");
+        out += "\"} " + QByteArray::number(cumulative) + '\n';
+    }
+    out += name;
+    out += "_sum{" + labels + "} " + secondsFromUsecs(histogram.sumUsecs()) + '\n';
+    out += name;
+    out += "_count{" + labels + "} " + QByteArray::number(histogram.count()) + '\n';
+}
+
+QByteArray KDSoapServerMetrics::toPrometheusText(const Gauges &gauges)
+{
+    // Merge the threads, sorted by operation
+    QMap<QByteArray, KDSoapOperationMetrics> operations;
+    {
+        QMutexLocker lock(&m_mutex);
+        for (int i = m_threads.count() - 1; i >= 0; --i) {
+            KDSoapThreadMetrics *threadMetrics = m_threads.at(i).data();
+            if (threadMetrics->m_retired.loadAcquire()) {
+                for (auto it = threadMetrics->m_operations.constBegin(); it != threadMetrics->m_operations.constEnd(); ++it) {
+                    m_retiredOperations[it.key()].merge(it.value());
+                }
+                m_threads.removeAt(i);
+            }
+        }
+        for (auto it = m_retiredOperations.constBegin(); it != m_retiredOperations.constEnd(); ++it) {
+            operations[it.key()].merge(it.value());
+        }
+        for (const QSharedPointer<KDSoapThreadMetrics> &threadMetrics : qAsConst(m_threads)) {
+            QMutexLocker threadLock(&threadMetrics->m_mutex);
+            for (auto it = threadMetrics->m_operations.constBegin(); it != threadMetrics->m_operations.constEnd(); ++it) {
+                operations[it.key()].merge(it.value());
+            }
+        }
+    }
+
+    QByteArray out;
+    out.reserve(4096 + operations.count() * 8192);
+    QMap<QByteArray, QByteArray> labels; // operation -> escaped label
+    for (auto it = operations.constBegin(); it != operations.constEnd(); ++it) {
+        labels.insert(it.key(), "operation=\"" + escapeLabelValue(it.key()) + '"');
+    }
+
+    writeHeader(out, "kdsoap_requests_total", "counter", "SOAP requests handled, per operation.");
+    for (auto it = operations.constBegin(); it != operations.constEnd(); ++it) {
+        out += "kdsoap_requests_total{" + labels.value(it.key()) + "} " + QByteArray::number(it->requests) + '\n';
+    }
+    writeHeader(out, "kdsoap_faults_total", "counter", "SOAP faults returned, per operation.");
+    for (auto it = operations.constBegin(); it != operations.constEnd(); ++it) {
+        out += "kdsoap_faults_total{" + labels.value(it.key()) + "} " + QByteArray::number(it->faults) + '\n';
+    }
+    writeHeader(out, "kdsoap_request_bytes_total", "counter", "Size of the request bodies, as received, per operation.");
+    for (auto it = operations.constBegin(); it != operations.constEnd(); ++it) {
+        out += "kdsoap_request_bytes_total{" + labels.value(it.key()) + "} " + QByteArray::number(it->bytesIn) + '\n';
+    }
+    writeHeader(out, "kdsoap_response_bytes_total", "counter", "Size of the response bodies, before compression, per operation.");
+    for (auto it = operations.constBegin(); it != operations.constEnd(); ++it) {
+        out += "kdsoap_response_bytes_total{" + labels.value(it.key()) + "} " + QByteArray::number(it->bytesOut) + '\n';
+    }
+    writeHeader(out, "kdsoap_request_duration_seconds", "histogram", "Time from the request headers to the response, per operation.");
+    for (auto it = operations.constBegin(); it != operations.constEnd(); ++it) {
+        writeHistogram(out, "kdsoap_request_duration_seconds", labels.value(it.key()), it->total);
+    }
+    writeHeader(out, "kdsoap_request_phase_seconds", "histogram",
+                "Time spent in each phase of the requests (header_parse, xml_parse, dispatch, serialize, write), per operation.");
+    for (auto it = operations.constBegin(); it != operations.constEnd(); ++it) {
+        for (int phase = 0; phase < KDSoapRequestTimings::PhaseCount; ++phase) {
+            writeHistogram(out, "kdsoap_request_phase_seconds", labels.value(it.key()) + ",phase=\"" + s_phaseNames[phase] + '"', it->phases[phase]);
+        }
+    }
+
+    writeHeader(out, "kdsoap_active_requests", "gauge", "Requests being handled.");
+    out += "kdsoap_active_requests " + QByteArray::number(gauges.activeRequests) + '\n';
+    writeHeader(out, "kdsoap_queued_requests", "gauge", "Requests waiting in the admission queue.");
+    out += "kdsoap_queued_requests " + QByteArray::number(gauges.queuedRequests) + '\n';
+    writeHeader(out, "kdsoap_open_connections", "gauge", "Open client connections.");
+    out += "kdsoap_open_connections " + QByteArray::number(gauges.openConnections) + '\n';
+    writeHeader(out, "kdsoap_rejected_requests_total", "counter", "Requests rejected with 503 Service Unavailable.");
+    out += "kdsoap_rejected_requests_total " + QByteArray::number(gauges.totalRejectedRequests) + '\n';
+    return out;
+}
@@ -0,0 +1,162 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPSERVERMETRICS_P_H
+#define KDSOAPSERVERMETRICS_P_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+
+/**
+ * \internal
+ * Latency histogram with fixed buckets, from 100µs to 10s.
+ */
+class KDSoapLatencyHistogram
+{
+public:
+    enum
+    {
+        BucketCount = 16
+    };
+    static const qint64 s_bucketBounds[BucketCount]; // upper bounds, in microseconds
+
+    KDSoapLatencyHistogram();
+    void add(qint64 usecs);
+    void merge(const KDSoapLatencyHistogram &other);
+
+    qint64 count() const
+    {
+        return m_count;
+    }
+    qint64 sumUsecs() const
+    {
+        return m_sumUsecs;
+    }
+    // Not cumulative; the last one is for values above all the bounds
+    qint64 bucketCount(int bucket) const
+    {
+        return m_buckets[bucket];
+    }
+
+private:
+    qint64 m_buckets[BucketCount + 1];
+    qint64 m_count;
+    qint64 m_sumUsecs;
+};
+
+/**
+ * \internal
+ * What KDSoapServerSocket measures for one SOAP call.
+ */
+struct KDSoapRequestTimings
+{
+    enum Phase
+    {
+        HeaderParse,
+        XmlParse,
+        Dispatch, // KDSoapServerObjectInterface::processRequest
+        Serialize,
+        Write,
+        PhaseCount
+    };
+
+    KDSoapRequestTimings()
+    {
+        reset();
+    }
+    void reset()
+    {
+        for (int phase = 0; phase < PhaseCount; ++phase) {
+            phaseNsecs[phase] = 0;
+        }
+    }
+
+    qint64 phaseNsecs[PhaseCount];
+};
+
+/**
+ * \internal
+ * Counters of one SOAP operation (method).
+ */
+struct KDSoapOperationMetrics
+{
+    KDSoapOperationMetrics()
+        : requests(0)
+        , faults(0)
+        , bytesIn(0)
+        , bytesOut(0)
+    {
+    }
+    void merge(const KDSoapOperationMetrics &other);
+
+    qint64 requests;
+    qint64 faults;
+    qint64 bytesIn;
+    qint64 bytesOut;
+    KDSoapLatencyHistogram phases[KDSoapRequestTimings::PhaseCount];
+    KDSoapLatencyHistogram total;
+};
+
+/**
+ * \internal
+ * The metrics recorded by the sockets of one thread (see KDSoapSocketList).
+ * Only that thread writes, the mutex is only contended while the metrics are being exported.
+ */
+class KDSoapThreadMetrics
+{
+public:
+    KDSoapThreadMetrics();
+
+    void record(const QByteArray &operation, const KDSoapRequestTimings &timings, qint64 totalNsecs, qint64 bytesIn, qint64 bytesOut, bool fault);
+    /// The thread is done with it, KDSoapServerMetrics keeps its counters and drops it
+    void retire()
+    {
+        m_retired.storeRelease(1);
+    }
+
+private:
+    friend class KDSoapServerMetrics;
+    Q_DISABLE_COPY(KDSoapThreadMetrics)
+    QMutex m_mutex;
+    QHash<QByteArray, KDSoapOperationMetrics> m_operations;
+    QAtomicInt m_retired;
+};
+
+/**
+ * \internal
+ * All the metrics of a server, exported in the Prometheus text format (see KDSoapServer::setMetricsPath).
+ */
+class KDSoapServerMetrics
+{
+public:
+    KDSoapServerMetrics();
+
+    QSharedPointer<KDSoapThreadMetrics> createThreadMetrics();
+
+    struct Gauges
+    {
+        int activeRequests;
+        int queuedRequests;
+        int openConnections;
+        qint64 totalRejectedRequests; // a counter, never reset
+    };
+    QByteArray toPrometheusText(const Gauges &gauges);
+
+private:
+    Q_DISABLE_COPY(KDSoapServerMetrics)
+    QMutex m_mutex;
+    QList<QSharedPointer<KDSoapThreadMetrics>> m_threads;
+    QHash<QByteArray, KDSoapOperationMetrics> m_retiredOperations; // from the threads which are gone, counters never go down
+};
+
+#endif // KDSOAPSERVERMETRICS_P_H
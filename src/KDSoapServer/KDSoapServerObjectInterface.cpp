@@ -18,6 +18,7 @@ class KDSoapServerObjectInterface::Private
 public:
     Private()
         : m_serverSocket(nullptr)
+        , m_methodNotFound(false)
     {
     }
 
@@ -32,6 +33,7 @@ public:
     QByteArray m_soapAction;
     // QPointer in case the client disconnects during a delayed response
     QPointer<KDSoapServerSocket> m_serverSocket;
+    bool m_methodNotFound;
 };
 
 KDSoapServerObjectInterface::HttpResponseHeaderItem::HttpResponseHeaderItem(const QByteArray &name, const QByteArray &value)
@@ -57,6 +59,7 @@ KDSoapServerObjectInterface::~KDSoapServerObjectInterface()
 void KDSoapServerObjectInterface::processRequest(const KDSoapMessage &request, KDSoapMessage &response, const QByteArray &soapAction)
 {
     const QString method = request.name();
+    d->m_methodNotFound = true;
     qDebug() << "Slot not found:" << method << "[soapAction =" << soapAction << "]" /* << "in" << metaObject()->className()*/;
     const KDSoap::SoapVersion soapVersion = KDSoap::SOAP1_1; // TODO version selection on the server side
     response.createFaultMessage(QString::fromLatin1("Server.MethodNotFound"), QString::fromLatin1("%1 not found").arg(method), soapVersion);
@@ -74,6 +77,7 @@ void KDSoapServerObjectInterface::processRequestWithPath(const KDSoapMessage &re
 {
     Q_UNUSED(soapAction);
     const QString method = request.name();
+    d->m_methodNotFound = true;
     qWarning("Invalid path: \"%s\"", qPrintable(path));
     // qWarning() << "Invalid path:" << path << "[method =" << method << "; soapAction =" << soapAction << "]" /* << "in" <<
     // metaObject()->className();
@@ -154,6 +158,12 @@ void KDSoapServerObjectInterface::setRequestHeaders(const KDSoapHeaders &headers
     // Prepare for a new request to be handled
     d->m_faultCode.clear();
     d->m_responseHeaders.clear();
+    d->m_methodNotFound = false;
+}
+
+bool KDSoapServerObjectInterface::methodNotFound() const
+{
+    return d->m_methodNotFound;
 }
 
 void KDSoapServerObjectInterface::setResponseHeaders(const KDSoapHeaders &headers)
@@ -173,6 +183,10 @@ QByteArray KDSoapServerObjectInterface::soapAction() const
 
 KDSoapDelayedResponseHandle KDSoapServerObjectInterface::prepareDelayedResponse()
 {
+    if (!d->m_serverSocket) {
+        qWarning("KDSoapServerObjectInterface::prepareDelayedResponse: not supported when using KDSoapServer::setHandlerThreadCount");
+        return KDSoapDelayedResponseHandle();
+    }
     return KDSoapDelayedResponseHandle(d->m_serverSocket);
 }
 
@@ -185,19 +199,33 @@ void KDSoapServerObjectInterface::sendDelayedResponse(const KDSoapDelayedRespons
 {
     KDSoapServerSocket *socket = responseHandle.serverSocket();
     if (socket) {
-        socket->sendDelayedReply(this, response);
+        socket->sendDelayedReply(this, response, responseHandle.streamId());
     }
 }
 
+KDSoapStreamingResponse *KDSoapServerObjectInterface::prepareStreamingResponse()
+{
+    KDSoapServerSocket *socket = d->m_serverSocket;
+    return socket ? socket->prepareStreamingResponse(this) : nullptr;
+}
+
 void KDSoapServerObjectInterface::writeHTTP(const QByteArray &httpReply)
 {
-    const qint64 written = d->m_serverSocket->write(httpReply);
+    if (!d->m_serverSocket) {
+        qWarning("KDSoapServerObjectInterface::writeHTTP: not supported when using KDSoapServer::setHandlerThreadCount");
+        return;
+    }
+    const qint64 written = d->m_serverSocket->writeResponse(httpReply);
     Q_ASSERT(written == httpReply.size()); // Please report a bug if you hit this.
     Q_UNUSED(written);
 }
 
 void KDSoapServerObjectInterface::writeXML(const QByteArray &reply, bool isFault)
 {
+    if (!d->m_serverSocket) {
+        qWarning("KDSoapServerObjectInterface::writeXML: not supported when using KDSoapServer::setHandlerThreadCount");
+        return;
+    }
     d->m_serverSocket->writeXML(reply, isFault);
 }
 
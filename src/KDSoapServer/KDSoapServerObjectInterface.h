@@ -20,6 +20,7 @@
 #include <QtCore/QVector>
 
 class KDSoapServerSocket;
+class KDSoapStreamingResponse;
 
 QT_BEGIN_NAMESPACE
 class QAbstractSocket;
@@ -206,6 +207,7 @@ public:
     /**
      * Returns a pointer to the server socket. Only valid during processRequest().
      * This can be used to retrieve information from the server socket, such as peerAddress etc.
+     * Returns nullptr when the method runs in a thread of the handler pool (see KDSoapServer::setHandlerThreadCount).
      * \since 1.3
      */
     QAbstractSocket *serverSocket() const;
@@ -234,6 +236,15 @@ public:
      */
     void sendDelayedResponse(const KDSoapDelayedResponseHandle &responseHandle, const KDSoapMessage &response);
 
+    /**
+     * Call this method (from processRequest) in order to send a large response while it's being generated,
+     * instead of filling the response message. See KDSoapStreamingResponse.
+     * The response message passed to processRequest is then ignored.
+     * Calling this method again for the same request returns the same object.
+     * \since 2.2
+     */
+    KDSoapStreamingResponse *prepareStreamingResponse();
+
     /**
      * Low-level method, not needed for normal operations.
      * Call this method to write an HTTP reply back, e.g. in case of an error.
@@ -259,6 +270,7 @@ private:
     KDSoapHeaders responseHeaders() const;
     QString responseNamespace() const;
     void storeFaultAttributes(KDSoapMessage &message) const;
+    bool methodNotFound() const; // the default processRequest() or processRequestWithPath() was called
     class Private;
     Private *const d;
 };
@@ -0,0 +1,62 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPSERVERSETTINGS_P_H
+#define KDSOAPSERVERSETTINGS_P_H
+
+#include "KDSoapHttpRequestParser_p.h"
+#include "KDSoapServer.h"
+#include <QString>
+
+/**
+ * \internal
+ * The settings of a KDSoapServer which are read while handling requests, in all threads.
+ * A snapshot is never modified once published, see KDSoapServer::settings():
+ * the setters publish a modified copy instead. Readers hold a reference while they use a snapshot,
+ * and shouldn't keep it for longer than that (e.g. a request), so that old snapshots are freed.
+ */
+struct KDSoapServerSettings
+{
+    KDSoapServerSettings()
+        : use(KDSoapMessage::LiteralUse)
+        , logLevel(KDSoapServer::LogNothing)
+        , path(QString::fromLatin1("/"))
+        , maxConnections(-1)
+        , responseCompressionThreshold(-1)
+        , idleTimeout(-1)
+        , maxRequestsPerConnection(-1)
+        , maxKeepAliveConnections(-1)
+        , requestQueueTimeout(5000)
+        , handlerThreadCount(0)
+    {
+    }
+
+    KDSoapServer::Features features;
+    KDSoapMessage::Use use;
+    KDSoapServer::LogLevel logLevel;
+    QString path;
+    QString wsdlFile;
+    QString wsdlPathInUrl;
+    QString metricsPath; // empty: no metrics
+    int maxConnections;
+    int responseCompressionThreshold;
+    int idleTimeout;
+    int maxRequestsPerConnection;
+    int maxKeepAliveConnections;
+    int requestQueueTimeout;
+    KDSoapHttpRequestParser::Limits requestLimits;
+    int handlerThreadCount; // 0: the server objects are called in the threads of the sockets
+#ifndef QT_NO_SSL
+    QSslConfiguration sslConfiguration;
+#endif
+};
+
+typedef QSharedPointer<const KDSoapServerSettings> KDSoapServerSettingsPtr;
+
+#endif // KDSOAPSERVERSETTINGS_P_H
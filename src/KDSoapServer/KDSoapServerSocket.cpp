@@ -7,27 +7,127 @@
 ** SPDX-License-Identifier: MIT
 **
 ****************************************************************************/
+#include "KDSoapAdmissionController_p.h"
+#include "KDSoapFileTransfer_p.h"
+#include "KDSoapHandlerPool_p.h"
+#include "KDSoapHttp2Connection_p.h"
+#include "KDSoapHttpCompression_p.h"
 #include "KDSoapServer.h"
 #include "KDSoapServerAuthInterface.h"
 #include "KDSoapServerCustomVerbRequestInterface.h"
 #include "KDSoapServerObjectInterface.h"
 #include "KDSoapServerRawXMLInterface.h"
+#include "KDSoapServerLogger_p.h"
+#include "KDSoapServerMetrics_p.h"
+#include "KDSoapServerSettings_p.h"
 #include "KDSoapServerSocket_p.h"
 #include "KDSoapSocketList_p.h"
+#include "KDSoapStreamingResponse.h"
+#include "KDSoapThreadPool.h"
 #include <KDSoapClient/KDSoapMessage.h>
 #include <KDSoapClient/KDSoapMessageReader_p.h>
 #include <KDSoapClient/KDSoapMessageWriter_p.h>
 #include <KDSoapClient/KDSoapNamespaceManager.h>
-#include <QBuffer>
-#include <QDir>
+#include <QDateTime>
+#include <QDeadlineTimer>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
+#include <QLocale>
 #include <QMetaMethod>
 #include <QThread>
 #include <QVarLengthArray>
+#include <utility>
 
 static const char s_forbidden[] = "HTTP/1.1 403 Forbidden\r\nContent-Length: 0\r\n\r\n";
 
+// A request received on an HTTP/2 stream
+struct KDSoapServerSocket::Http2Call
+{
+    explicit Http2Call(int id)
+        : streamId(id)
+        , admitted(false)
+        , delayedResponse(false)
+        , requestBodySize(0)
+        , collectMetrics(false)
+        , responseEncoding(KDSoapHttpCompression::Identity)
+        , responseCompressionThreshold(-1)
+        , download(nullptr)
+        , downloadRemaining(0)
+    {
+    }
+    ~Http2Call()
+    {
+        delete download;
+    }
+
+    int streamId;
+    bool admitted;
+    QDeadlineTimer queueDeadline; // while waiting in the admission queue
+    QByteArray body;
+    QByteArray response; // as HTTP/1.1, see writeResponse()
+    QIODevice *download; // file being sent after the headers in response, see continueHttp2Download()
+    qint64 downloadRemaining;
+
+    // The state of the call, in the members of the socket while the call is handled (see Http2CallScope)
+    KDSoapHttpRequestParser parser; // only has the headers
+    bool delayedResponse;
+    QElapsedTimer requestTimer;
+    qint64 requestBodySize;
+    bool collectMetrics;
+    KDSoapRequestTimings timings;
+    QSharedPointer<KDSoapHandlerReply> handlerReply;
+    QString messageNamespace;
+    QString method;
+    QByteArray metricsOperation;
+    int responseEncoding;
+    int responseCompressionThreshold;
+};
+
+// Makes the socket handle \p call, with the code written for one HTTP/1.1 request at a time:
+// the state of the call is swapped into the members of the socket, and back when leaving the scope.
+// Scopes can be nested, e.g. when a server object sends a delayed response while handling another call.
+class KDSoapServerSocket::Http2CallScope
+{
+public:
+    Http2CallScope(KDSoapServerSocket *socket, Http2Call *call)
+        : m_socket(socket)
+        , m_call(call)
+        , m_previousCall(socket->m_http2Call)
+    {
+        swapState();
+        m_socket->m_http2Call = call;
+    }
+    ~Http2CallScope()
+    {
+        swapState();
+        m_socket->m_http2Call = m_previousCall;
+    }
+
+private:
+    Q_DISABLE_COPY(Http2CallScope)
+    void swapState()
+    {
+        using std::swap;
+        swap(m_socket->m_parser, m_call->parser);
+        swap(m_socket->m_delayedResponse, m_call->delayedResponse);
+        swap(m_socket->m_requestTimer, m_call->requestTimer);
+        swap(m_socket->m_requestBodySize, m_call->requestBodySize);
+        swap(m_socket->m_collectMetrics, m_call->collectMetrics);
+        swap(m_socket->m_timings, m_call->timings);
+        swap(m_socket->m_handlerReply, m_call->handlerReply);
+        swap(m_socket->m_messageNamespace, m_call->messageNamespace);
+        swap(m_socket->m_method, m_call->method);
+        swap(m_socket->m_metricsOperation, m_call->metricsOperation);
+        swap(m_socket->m_responseEncoding, m_call->responseEncoding);
+        swap(m_socket->m_responseCompressionThreshold, m_call->responseCompressionThreshold);
+    }
+
+    KDSoapServerSocket *m_socket;
+    Http2Call *m_call;
+    Http2Call *m_previousCall;
+};
+
 KDSoapServerSocket::KDSoapServerSocket(KDSoapSocketList *owner, QObject *serverObject)
 #ifndef QT_NO_SSL
     : QSslSocket()
@@ -41,9 +141,26 @@ KDSoapServerSocket::KDSoapServerSocket(KDSoapSocketList *owner, QObject *serverO
     , m_delayedResponse(false)
     , m_socketEnabled(true)
     , m_receivedData(false)
+    , m_requestInFlight(false)
+    , m_closeAfterResponse(false)
+    , m_requestCount(0)
+    , m_lastActivity(owner->elapsedMsecs())
+    , m_requestBodySize(0)
+    , m_collectMetrics(false)
+    , m_headerParseNsecs(0)
+    , m_admissionState(NoRequest)
+    , m_admissionController(owner->server()->admissionController())
     , m_useRawXML(false)
-    , m_bytesReceived(0)
-    , m_chunkStart(0)
+    , m_streamingReader(nullptr)
+    , m_inflater(nullptr)
+    , m_fileTransfer(nullptr)
+    , m_streamingResponse(nullptr)
+    , m_handlerHttpHeaderItems(nullptr)
+    , m_responseEncoding(KDSoapHttpCompression::Identity)
+    , m_responseCompressionThreshold(-1)
+    , m_upgradeToHttp2(false)
+    , m_http2(nullptr)
+    , m_http2Call(nullptr)
 {
     connect(this, &QIODevice::readyRead, this, &KDSoapServerSocket::slotReadyRead);
     m_doDebug = qEnvironmentVariableIsSet("KDSOAP_DEBUG");
@@ -54,64 +171,27 @@ KDSoapServerSocket::~KDSoapServerSocket()
 {
     // same as m_owner->socketDeleted, but safe in case m_owner is deleted first
     emit socketDeleted(this);
-}
-
-typedef QMap<QByteArray, QByteArray> HeadersMap;
-static HeadersMap parseHeaders(const QByteArray &headerData)
-{
-    HeadersMap headersMap;
-    QBuffer sourceBuffer;
-    sourceBuffer.setData(headerData);
-    sourceBuffer.open(QIODevice::ReadOnly);
-    // The first line is special, it's the GET or POST line
-    const QList<QByteArray> firstLine = sourceBuffer.readLine().split(' ');
-    if (firstLine.count() < 3) {
-        qDebug() << "Malformed HTTP request:" << firstLine;
-        return headersMap;
-    }
-    const QByteArray &requestType = firstLine.at(0);
-    headersMap.insert("_requestType", requestType);
-
-    // Grammar from https://datatracker.ietf.org/doc/html/rfc7230#section-5.3.1
-    //  origin-form    = absolute-path [ "?" query ]
-    // and https://datatracker.ietf.org/doc/html/rfc3986#section-3.3
-    // says the path ends at the first '?' or '#' character
-    const QByteArray arg1 = firstLine.at(1);
-    const int queryPos = arg1.indexOf('?');
-    const QByteArray path = queryPos >= 0 ? arg1.left(queryPos) : arg1;
-    const QByteArray query = queryPos >= 0 ? arg1.mid(queryPos) : QByteArray();
-    // Unfortunately QDir::cleanPath works with QString
-    const QByteArray cleanedPath = QDir::cleanPath(QString::fromUtf8(path)).toUtf8();
-    headersMap.insert("_path", cleanedPath + query);
-
-    const QByteArray &httpVersion = firstLine.at(2);
-    headersMap.insert("_httpVersion", httpVersion);
-
-    while (!sourceBuffer.atEnd()) {
-        const QByteArray line = sourceBuffer.readLine();
-        const int pos = line.indexOf(':');
-        if (pos == -1) {
-            qDebug() << "Malformed HTTP header:" << line;
-        }
-        const QByteArray header = line.left(pos).toLower(); // RFC2616 section 4.2 "Field names are case-insensitive"
-        const QByteArray value = line.mid(pos + 1).trimmed(); // remove space before and \r\n after
-        // qDebug() << "HEADER" << header << "VALUE" << value;
-        headersMap.insert(header, value);
-    }
-    return headersMap;
-}
-
-// We could parse headers as we go along looking for \r\n, and stop at empty header line, to avoid all this memory copying
-// But in practice XML parsing (and writing) is far, far slower anyway.
-static bool splitHeadersAndData(const QByteArray &request, QByteArray &header, QByteArray &data)
-{
-    const int sep = request.indexOf("\r\n\r\n");
-    if (sep <= 0) {
-        return false;
+    if (m_handlerReply) {
+        m_handlerReply->detach(); // the client is gone, drop the result
     }
-    header = request.left(sep);
-    data = request.mid(sep + 4);
-    return true;
+    releaseAdmission();
+    for (Http2Call *call : qAsConst(m_http2Calls)) {
+        if (call->handlerReply) {
+            call->handlerReply->detach();
+        }
+        if (call->admitted) {
+            m_admissionController->release();
+        }
+    }
+    for (int i = 0; i < m_http2WaitingCalls.count(); ++i) {
+        if (!m_admissionController->cancel(this, false)) {
+            m_admissionController->release(); // admitted in the meantime
+        }
+    }
+    qDeleteAll(m_http2Calls);
+    delete m_http2;
+    delete m_streamingReader;
+    delete m_inflater;
 }
 
 static QByteArray stripQuotes(const QByteArray &bar)
@@ -123,179 +203,571 @@ static QByteArray stripQuotes(const QByteArray &bar)
     return bar;
 }
 
-static QByteArray httpResponseHeaders(bool fault, const QByteArray &contentType, int responseDataSize, QObject *serverObject)
+// responseDataSize: -1 for chunked transfer encoding (streaming response)
+// extraHeaders: complete header lines, each one ending with \r\n
+// bodyCapacity: the size of the body which will be appended to the returned headers, so that it's sent in one write
+static QByteArray httpResponseHeadersWithStatus(const char *status, const QByteArray &contentType, qint64 responseDataSize, QObject *serverObject,
+                                                const QByteArray &extraHeaders, int bodyCapacity = 0)
 {
     QByteArray httpResponse;
-    httpResponse.reserve(50);
-    if (fault) {
-        // https://www.w3.org/TR/2007/REC-soap12-part0-20070427 and look for 500
-        httpResponse += "HTTP/1.1 500 Internal Server Error\r\n";
-    } else if (responseDataSize == 0) {
-        httpResponse += "HTTP/1.1 204 No Content\r\n";
-    } else {
-        httpResponse += "HTTP/1.1 200 OK\r\n";
-    }
-
-    httpResponse += "Content-Type: ";
+    httpResponse.reserve(100 + extraHeaders.size() + bodyCapacity);
+    httpResponse += "HTTP/1.1 ";
+    httpResponse += status;
+    httpResponse += "\r\nContent-Type: ";
     httpResponse += contentType;
-    httpResponse += "\r\nContent-Length: ";
-    httpResponse += QByteArray::number(responseDataSize);
     httpResponse += "\r\n";
 
+    // Not cached: subclasses can return different items for each request
     KDSoapServerObjectInterface *serverObjectInterface = qobject_cast<KDSoapServerObjectInterface *>(serverObject);
     if (serverObjectInterface) {
-        const KDSoapServerObjectInterface::HttpResponseHeaderItems &additionalItems = serverObjectInterface->additionalHttpResponseHeaderItems();
-        for (const KDSoapServerObjectInterface::HttpResponseHeaderItem &headerItem : qAsConst(additionalItems)) {
+        const KDSoapServerObjectInterface::HttpResponseHeaderItems additionalItems = serverObjectInterface->additionalHttpResponseHeaderItems();
+        for (const KDSoapServerObjectInterface::HttpResponseHeaderItem &headerItem : additionalItems) {
             httpResponse += headerItem.m_name;
             httpResponse += ": ";
             httpResponse += headerItem.m_value;
             httpResponse += "\r\n";
         }
     }
-
+    if (responseDataSize < 0) {
+        httpResponse += "Transfer-Encoding: chunked\r\n";
+    } else {
+        httpResponse += "Content-Length: ";
+        httpResponse += QByteArray::number(responseDataSize);
+        httpResponse += "\r\n";
+    }
+    httpResponse += extraHeaders;
     httpResponse += "\r\n"; // end of headers
     return httpResponse;
 }
 
+static QByteArray httpResponseHeaders(bool fault, const QByteArray &contentType, qint64 responseDataSize, QObject *serverObject,
+                                      const QByteArray &extraHeaders = QByteArray(), int bodyCapacity = 0)
+{
+    const char *status;
+    if (fault) {
+        // https://www.w3.org/TR/2007/REC-soap12-part0-20070427 and look for 500
+        status = "500 Internal Server Error";
+    } else if (responseDataSize == 0) {
+        status = "204 No Content";
+    } else {
+        status = "200 OK";
+    }
+    return httpResponseHeadersWithStatus(status, contentType, responseDataSize, serverObject, extraHeaders, bodyCapacity);
+}
+
+// The response to a request which the parser gave up on
+static const char *errorStatus(KDSoapHttpRequestParser::Result result)
+{
+    switch (result) {
+    case KDSoapHttpRequestParser::HeadersTooLarge:
+        return "431 Request Header Fields Too Large";
+    case KDSoapHttpRequestParser::BodyTooLarge:
+        return "413 Payload Too Large";
+    default:
+        return "400 Bad Request";
+    }
+}
+
+// HTTP-date, RFC 7231 section 7.1.1.1, for instance "Sun, 06 Nov 1994 08:49:37 GMT"
+static const char s_httpDateFormat[] = "ddd, dd MMM yyyy hh:mm:ss 'GMT'";
+
+static QByteArray httpDate(const QDateTime &dateTime)
+{
+    return QLocale::c().toString(dateTime.toUTC(), QLatin1String(s_httpDateFormat)).toLatin1();
+}
+
+static QDateTime parseHttpDate(const QByteArray &value)
+{
+    QDateTime dateTime = QLocale::c().toDateTime(QString::fromLatin1(value.trimmed()), QLatin1String(s_httpDateFormat));
+    dateTime.setTimeSpec(Qt::UTC);
+    return dateTime;
+}
+
+// A strong validator, which changes when the file is modified
+static QByteArray entityTag(qint64 size, const QDateTime &lastModified)
+{
+    return '"' + QByteArray::number(size, 16) + '-' + QByteArray::number(lastModified.toMSecsSinceEpoch(), 16) + '"';
+}
+
+static bool entityTagMatches(const QByteArray &ifNoneMatch, const QByteArray &etag)
+{
+    const QList<QByteArray> tags = ifNoneMatch.split(',');
+    for (QByteArray tag : tags) {
+        tag = tag.trimmed();
+        if (tag.startsWith("W/")) { // krazy:exclude=strings
+            tag = tag.mid(2); // weak comparison, RFC 7232 section 2.3.2
+        }
+        if (tag == etag || tag == "*") {
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+// Accounts the time spent handling data, for the load-aware scheduling in KDSoapThreadPool
+class BusyTimeRecorder
+{
+public:
+    explicit BusyTimeRecorder(KDSoapSocketList *socketList)
+        : m_socketList(socketList)
+    {
+        m_timer.start();
+    }
+    ~BusyTimeRecorder()
+    {
+        m_socketList->addBusyTime(m_timer.nsecsElapsed());
+    }
+
+private:
+    KDSoapSocketList *m_socketList;
+    QElapsedTimer m_timer;
+};
+
+// Adds the time spent in a scope to one phase of the request, for KDSoapServer::setMetricsPath
+class PhaseTimer
+{
+public:
+    PhaseTimer(bool enabled, qint64 *nsecs)
+        : m_nsecs(enabled ? nsecs : nullptr)
+    {
+        if (m_nsecs) {
+            m_timer.start();
+        }
+    }
+    ~PhaseTimer()
+    {
+        if (m_nsecs) {
+            *m_nsecs += m_timer.nsecsElapsed();
+        }
+    }
+
+private:
+    qint64 *m_nsecs;
+    QElapsedTimer m_timer;
+};
+}
+
 void KDSoapServerSocket::slotReadyRead()
 {
+    m_lastActivity = m_owner->elapsedMsecs(); // for the idle timeout
     if (!m_socketEnabled) {
         return;
     }
+    BusyTimeRecorder busyTimeRecorder(m_owner);
 
-    // QNAM in Qt 5.x tends to connect additional sockets in advance and not use them
-    // So only count the sockets which actually sent us data (for the servertest unittest).
-    if (!m_receivedData) {
-        m_receivedData = true;
-        m_owner->increaseConnectionCount();
+    // qDebug() << this << QThread::currentThread() << "slotReadyRead!";
+
+    if (m_http2) {
+        processHttp2Data(readAll());
+        return;
     }
 
-    // qDebug() << this << QThread::currentThread() << "slotReadyRead!";
+    if (m_parser.appendFromDevice(this) < 0) {
+        qDebug() << "Error reading from server socket:" << errorString();
+        return;
+    }
 
-    QByteArray buf(2048, ' ');
-    qint64 nread = -1;
-    while (nread != 0) {
-        nread = read(buf.data(), buf.size());
-        if (nread < 0) {
-            qDebug() << "Error reading from server socket:" << errorString();
-            return;
-        }
-        m_requestBuffer += buf.left(nread);
-        m_bytesReceived += nread;
+    // With HTTP pipelining, the buffer can contain several requests, handle them in order.
+    // A delayed response disables the socket, the requests after it are handled once the response was sent.
+    bool handledRequest = false;
+    while (m_socketEnabled && !m_parser.buffer().isEmpty() && processBufferedRequest()) {
+        handledRequest = true;
+    }
+    if (handledRequest && !m_delayedResponse) {
+        scheduleMigrationCheck();
     }
+}
 
+// Returns true if a complete request was handled, false if more data is needed or the connection is being closed
+bool KDSoapServerSocket::processBufferedRequest()
+{
     KDSoapServerRawXMLInterface *rawXmlInterface = qobject_cast<KDSoapServerRawXMLInterface *>(m_serverObject);
 
-    if (m_httpHeaders.isEmpty()) {
+    if (!m_parser.headersComplete()) {
+        if (m_requestCount == 0 && (m_owner->server()->settings()->features & KDSoapServer::Http2)) {
+            // HTTP/2 with prior knowledge, or negotiated with ALPN: the client starts with the connection preface
+            switch (KDSoapHttp2Connection::matchPreface(m_parser.buffer())) {
+            case KDSoapHttp2Connection::PartialPreface:
+                return false;
+            case KDSoapHttp2Connection::CompletePreface: {
+                if (!m_receivedData) {
+                    m_receivedData = true;
+                    m_owner->increaseConnectionCount();
+                }
+                const QByteArray data = m_parser.buffer();
+                m_parser.reset();
+                startHttp2(QByteArray());
+                processHttp2Data(data);
+                return false;
+            }
+            case KDSoapHttp2Connection::NoPreface:
+                break;
+            }
+        }
         // New request: see if we can parse headers
-        QByteArray receivedHttpHeaders, receivedData;
-        const bool splitOK = splitHeadersAndData(m_requestBuffer, receivedHttpHeaders, receivedData);
-        if (!splitOK) {
+        KDSoapHttpRequestParser::Result result;
+        {
+            const KDSoapServerSettingsPtr settings = m_owner->server()->settings();
+            PhaseTimer phaseTimer(!settings->metricsPath.isEmpty(), &m_headerParseNsecs);
+            m_parser.setLimits(settings->requestLimits);
+            result = m_parser.parseHeaders();
+        }
+        if (result == KDSoapHttpRequestParser::NeedMoreData) {
             // qDebug() << "Incomplete SOAP request, wait for more data";
             // incomplete request, wait for more data
-            return;
+            return false;
+        }
+        if (result != KDSoapHttpRequestParser::Ok) {
+            handleBadRequest(errorStatus(result));
+            return false;
+        }
+        // QNAM in Qt 5.x tends to connect additional sockets in advance and not use them
+        // So only count the sockets which actually sent us data (for the servertest unittest).
+        if (!m_receivedData) {
+            m_receivedData = true;
+            m_owner->increaseConnectionCount();
+        }
+        if (m_doDebug) {
+            qDebug() << "headers:" << m_parser.headerMap();
         }
-        m_httpHeaders = parseHeaders(receivedHttpHeaders);
-        // Leave only the actual data in the buffer
-        m_requestBuffer = receivedData;
-        m_bytesReceived = receivedData.size();
+        if (isHttp2Upgrade()) {
+            // The request becomes the first stream of the HTTP/2 connection, it's admitted and handled as such
+            m_upgradeToHttp2 = true;
+            return processHttp2Upgrade();
+        }
+        const int requestEncoding = KDSoapHttpCompression::encodingFromName(m_parser.header("content-encoding"));
+        if (requestEncoding < 0) {
+            handleBadRequest("415 Unsupported Media Type");
+            return false;
+        }
+        KDSoapServer *server = m_owner->server();
+        const KDSoapServerSettingsPtr settings = server->settings();
+        setRequestInFlight(true);
+        m_requestTimer.start();
+        m_requestBodySize = 0;
+        m_collectMetrics = !settings->metricsPath.isEmpty();
+        m_timings.reset();
+        m_metricsOperation.clear();
+        m_timings.phaseNsecs[KDSoapRequestTimings::HeaderParse] = m_headerParseNsecs;
+        m_headerParseNsecs = 0;
+        ++m_requestCount;
+        const int maxRequests = settings->maxRequestsPerConnection;
+        const int maxKeepAliveConnections = settings->maxKeepAliveConnections;
+        m_closeAfterResponse = m_parser.header("connection").toLower().contains("close") || (maxRequests > 0 && m_requestCount >= maxRequests)
+            || (maxKeepAliveConnections >= 0 && server->openConnectionCount() > maxKeepAliveConnections);
         m_useRawXML = false;
-        if (rawXmlInterface) {
-            KDSoapServerObjectInterface *serverObjectInterface = qobject_cast<KDSoapServerObjectInterface *>(m_serverObject);
-            serverObjectInterface->setServerSocket(this);
-            m_useRawXML = rawXmlInterface->newRequest(m_httpHeaders.value("_requestType"), m_httpHeaders);
+        switch (m_admissionController->admit(this)) {
+        case KDSoapAdmissionController::Admitted:
+            m_admissionState = RequestAdmitted;
+            beginRequest();
+            break;
+        case KDSoapAdmissionController::Queued:
+            // The rest of the request stays in the socket until slotRequestAdmitted() or requestQueueTimedOut()
+            m_admissionState = RequestQueued;
+            m_owner->scheduleQueueTimeout(this);
+            setSocketEnabled(false);
+            return false;
+        case KDSoapAdmissionController::Rejected:
+            m_admissionState = RequestRejected;
+            logRejectedRequest();
+            break;
         }
+    } else if (m_upgradeToHttp2) {
+        return processHttp2Upgrade();
     }
 
-    if (m_doDebug) {
-        qDebug() << "headers:" << m_httpHeaders;
-        qDebug() << "data received:" << m_requestBuffer;
+    int offset;
+    int length;
+    KDSoapHttpRequestParser::Result result;
+    while ((result = m_parser.readBodyData(&offset, &length)) == KDSoapHttpRequestParser::Ok) {
+        const char *data = m_parser.buffer().constData() + offset;
+        m_requestBodySize += length;
+        if (m_admissionState == RequestRejected) {
+            continue; // discarded below
+        }
+        if (m_inflater) {
+            // Decompress piece by piece, the compressed body is discarded below
+            QByteArray inflated;
+            if (!m_inflater->inflate(data, length, &inflated)) {
+                result = m_inflater->limitExceeded() ? KDSoapHttpRequestParser::BodyTooLarge : KDSoapHttpRequestParser::Error;
+                break;
+            }
+            handleBodyData(inflated.constData(), inflated.size());
+        } else {
+            handleBodyData(data, length);
+        }
+    }
+    if (result == KDSoapHttpRequestParser::Complete && m_inflater && !m_inflater->isFinished() && m_admissionState != RequestRejected) {
+        result = KDSoapHttpRequestParser::Error; // truncated compressed body
+    }
+    if (result != KDSoapHttpRequestParser::NeedMoreData && result != KDSoapHttpRequestParser::Complete) {
+        handleBadRequest(errorStatus(result));
+        return false;
+    }
+    if (m_useRawXML || m_streamingReader || m_inflater || m_parser.isChunked() || m_admissionState == RequestRejected) {
+        m_parser.discardConsumedBodyData();
+    }
+    if (result == KDSoapHttpRequestParser::NeedMoreData) {
+        return false; // incomplete request, wait for more data
     }
 
-    if (m_httpHeaders.value("transfer-encoding") != "chunked") {
-        if (m_useRawXML) {
-            rawXmlInterface->processXML(m_requestBuffer);
-            m_requestBuffer.clear();
+    if (m_admissionState == RequestRejected) {
+        writeServiceUnavailable();
+    } else if (m_useRawXML) {
+        rawXmlInterface->endRequest();
+    } else if (m_streamingReader) {
+        handleRequest(QByteArray());
+    } else {
+        const QByteArray receivedData = (m_parser.isChunked() || m_inflater) ? m_decodedRequestBuffer : m_parser.rawBody();
+        if (m_doDebug) {
+            qDebug() << "data received:" << receivedData;
         }
+        handleRequest(receivedData);
+    }
+    // Keeps the data received after this request (pipelining)
+    resetRequest();
+    return true;
+}
 
-        const QByteArray contentLength = m_httpHeaders.value("content-length");
-        if (m_bytesReceived < contentLength.toInt()) {
-            return; // incomplete request, wait for more data
-        }
+// Called once the request is admitted: prepares the handling of its body
+void KDSoapServerSocket::beginRequest()
+{
+    const KDSoapServerSettingsPtr settings = m_owner->server()->settings();
+    KDSoapServerRawXMLInterface *rawXmlInterface = qobject_cast<KDSoapServerRawXMLInterface *>(m_serverObject);
+    if (rawXmlInterface) {
+        KDSoapServerObjectInterface *serverObjectInterface = qobject_cast<KDSoapServerObjectInterface *>(m_serverObject);
+        serverObjectInterface->setServerSocket(this);
+        m_useRawXML = rawXmlInterface->newRequest(m_parser.requestType(), m_parser.headerMap());
+    }
+    const int requestEncoding = KDSoapHttpCompression::encodingFromName(m_parser.header("content-encoding"));
+    if (requestEncoding != KDSoapHttpCompression::Identity) {
+        m_inflater = new KDSoapHttpInflater(KDSoapHttpCompression::Encoding(requestEncoding), settings->requestLimits.bodySizeLimit());
+    }
+    if (!m_useRawXML && m_parser.requestType() == "POST" && (settings->features & KDSoapServer::StreamRequestParsing)) {
+        m_streamingReader = new KDSoapIncrementalMessageReader;
+    }
+    negotiateResponseEncoding();
+}
 
-        if (m_useRawXML) {
-            rawXmlInterface->endRequest();
-        } else {
-            handleRequest(m_httpHeaders, m_requestBuffer);
-        }
-    } else {
-        // qDebug() << "requestBuffer has " << m_requestBuffer.size() << "bytes, starting at" << m_chunkStart;
-        while (m_chunkStart >= 0) {
-            const int nextEOL = m_requestBuffer.indexOf("\r\n", m_chunkStart);
-            if (nextEOL == -1) {
-                return;
-            }
-            const QByteArray chunkSizeStr = m_requestBuffer.mid(m_chunkStart, nextEOL - m_chunkStart);
-            // qDebug() << m_chunkStart << nextEOL << "chunkSizeStr=" << chunkSizeStr;
-            bool ok;
-            int chunkSize = chunkSizeStr.toInt(&ok, 16);
-            if (!ok) {
-                const QByteArray badRequest = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
-                write(badRequest);
-                return;
-            }
-            if (chunkSize == 0) { // done!
-                m_requestBuffer = m_requestBuffer.mid(nextEOL);
-                m_chunkStart = -1;
+// Negotiated when the request begins, but used when writing the response, which might be delayed
+void KDSoapServerSocket::negotiateResponseEncoding()
+{
+    m_responseCompressionThreshold = m_owner->server()->settings()->responseCompressionThreshold;
+    m_responseEncoding = m_responseCompressionThreshold < 0 ? KDSoapHttpCompression::Identity
+                                                            : KDSoapHttpCompression::negotiate(m_parser.header("accept-encoding"));
+}
+
+void KDSoapServerSocket::slotRequestAdmitted()
+{
+    if (m_http2) {
+        // The queued streams of this socket are interchangeable in the controller's queue, take them in order
+        Http2Call *call = m_http2Calls.value(m_http2WaitingCalls.takeFirst());
+        scheduleHttp2QueueTimeout();
+        call->admitted = true;
+        handleHttp2Call(call);
+        return;
+    }
+    Q_ASSERT(m_admissionState == RequestQueued);
+    m_admissionState = RequestAdmitted;
+    m_owner->cancelQueueTimeout(this);
+    beginRequest();
+    setSocketEnabled(true);
+}
+
+void KDSoapServerSocket::requestQueueTimedOut()
+{
+    if (m_http2) {
+        // Only the streams whose deadline passed, oldest first.
+        // When cancel() fails, the first stream was admitted in the meantime, slotRequestAdmitted() takes it.
+        while (!m_http2WaitingCalls.isEmpty()) {
+            Http2Call *call = m_http2Calls.value(m_http2WaitingCalls.first());
+            if (!call->queueDeadline.hasExpired() || !m_admissionController->cancel(this, true)) {
                 break;
             }
-            if (nextEOL + 2 + chunkSize + 2 >= m_requestBuffer.size()) {
-                return; // not enough data, chunk is incomplete
+            m_http2WaitingCalls.removeFirst();
+            {
+                Http2CallScope scope(this, call);
+                writeServiceUnavailable();
             }
-            const QByteArray chunk = m_requestBuffer.mid(nextEOL + 2, chunkSize);
-            if (m_useRawXML) {
-                rawXmlInterface->processXML(chunk);
-            } else {
-                m_decodedRequestBuffer += chunk;
-            }
-            m_chunkStart = nextEOL + 2 + chunkSize + 2;
-        }
-        // We have the full data, now ensure we read trailers
-        if (!m_requestBuffer.contains("\r\n\r\n")) {
-            return;
+            finishHttp2Call(call);
         }
-        if (m_useRawXML) {
-            rawXmlInterface->endRequest();
-        } else {
-            handleRequest(m_httpHeaders, m_decodedRequestBuffer);
-        }
-        m_decodedRequestBuffer.clear();
-        m_chunkStart = 0;
+        scheduleHttp2QueueTimeout();
+        return;
+    }
+    if (m_admissionState != RequestQueued || !m_admissionController->cancel(this, true)) {
+        return; // admitted in the meantime, slotRequestAdmitted() is on its way
     }
-    m_requestBuffer.clear();
-    m_httpHeaders.clear();
+    m_admissionState = RequestRejected;
+    setSocketEnabled(true);
+}
+
+// The queued streams are in the order they arrived, so the first one has the earliest deadline
+void KDSoapServerSocket::scheduleHttp2QueueTimeout()
+{
+    const qint64 remaining = m_http2WaitingCalls.isEmpty() ? -1 : m_http2Calls.value(m_http2WaitingCalls.first())->queueDeadline.remainingTime();
+    if (remaining < 0) { // nothing waiting, or no timeout
+        m_owner->cancelQueueTimeout(this);
+    } else {
+        m_owner->scheduleQueueTimeout(this, int(remaining));
+    }
+}
+
+// Unlike handleBadRequest, the connection stays usable: the body of the request was read
+void KDSoapServerSocket::writeServiceUnavailable()
+{
+    const int queueTimeout = m_owner->server()->settings()->requestQueueTimeout;
+    const int retryAfter = qMax(1, (queueTimeout + 999) / 1000); // seconds
+    QByteArray response = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: ";
+    response += QByteArray::number(retryAfter);
+    response += "\r\n";
+    response += connectionHeader();
+    response += "\r\n";
+    writeResponse(response);
+}
+
+void KDSoapServerSocket::logRejectedRequest()
+{
+    if (m_owner->server()->settings()->logLevel != KDSoapServer::LogNothing) {
+        KDSoapLogRecord record(KDSoapLogRecord::Error);
+        record.text = "Too many requests (" + QByteArray::number(m_admissionController->activeRequestCount()) + " active, "
+            + QByteArray::number(m_admissionController->queuedRequestCount()) + " queued), request rejected";
+        record.status = 503;
+        m_owner->log(record);
+    }
+}
+
+void KDSoapServerSocket::releaseAdmission()
+{
+    if (m_admissionState == RequestAdmitted || (m_admissionState == RequestQueued && !m_admissionController->cancel(this, false))) {
+        m_admissionController->release();
+    }
+    m_admissionState = NoRequest;
+}
+
+void KDSoapServerSocket::handleBodyData(const char *data, int length)
+{
+    if (m_useRawXML) {
+        // A real copy, since the implementation might keep it around
+        KDSoapServerRawXMLInterface *rawXmlInterface = qobject_cast<KDSoapServerRawXMLInterface *>(m_serverObject);
+        rawXmlInterface->processXML(QByteArray(data, length));
+    } else if (m_streamingReader) {
+        // Parse what we have so far; the XML reader takes its own copy
+        PhaseTimer phaseTimer(m_collectMetrics, &m_timings.phaseNsecs[KDSoapRequestTimings::XmlParse]);
+        m_streamingReader->addData(QByteArray(data, length));
+    } else if (m_parser.isChunked() || m_inflater) {
+        m_decodedRequestBuffer.append(data, length);
+    }
+    // Otherwise the body is kept in the parser's buffer, no need to copy it
+}
+
+// The request can't be handled, and we can't know where the next one would start: give up on this connection.
+void KDSoapServerSocket::handleBadRequest(const char *httpStatus)
+{
+    QByteArray badRequest = "HTTP/1.1 ";
+    badRequest += httpStatus;
+    badRequest += "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    write(badRequest);
+    resetRequest();
+    m_parser.reset();
+    disconnectFromHost();
+}
+
+void KDSoapServerSocket::resetRequest()
+{
+    m_decodedRequestBuffer.clear();
+    delete m_streamingReader;
+    m_streamingReader = nullptr;
+    delete m_inflater;
+    m_inflater = nullptr;
+    m_parser.startNextRequest();
     m_receivedData = false;
+    if (!m_delayedResponse) {
+        setRequestInFlight(false);
+        responseComplete();
+    }
+}
+
+// Called once the response to the current request was written
+void KDSoapServerSocket::responseComplete()
+{
+    if (m_closeAfterResponse) {
+        // Requests received after this one (pipelining) are dropped, the client sends them again on a new connection
+        m_socketEnabled = false;
+        m_parser.reset();
+        disconnectFromHost(); // after writing the response
+        return;
+    }
+    m_owner->scheduleIdleTimeout(this);
+}
+
+QByteArray KDSoapServerSocket::connectionHeader() const
+{
+    return m_closeAfterResponse ? QByteArrayLiteral("Connection: close\r\n") : QByteArray();
+}
+
+void KDSoapServerSocket::setRequestInFlight(bool inFlight)
+{
+    if (m_requestInFlight == inFlight) {
+        return;
+    }
+    m_requestInFlight = inFlight;
+    if (inFlight) {
+        m_owner->requestStarted();
+    } else {
+        m_owner->requestFinished();
+        releaseAdmission();
+    }
+}
+
+void KDSoapServerSocket::scheduleMigrationCheck()
+{
+    KDSoapThreadPool *threadPool = m_owner->server()->threadPool();
+    if (threadPool && threadPool->isIdleConnectionMigrationEnabled()) {
+        // Not now: we might be called from within QAbstractSocket's readyRead emission
+        QMetaObject::invokeMethod(this, "slotMaybeMigrate", Qt::QueuedConnection);
+    }
 }
 
-void KDSoapServerSocket::handleRequest(const QMap<QByteArray, QByteArray> &httpHeaders, const QByteArray &receivedData)
+void KDSoapServerSocket::slotMaybeMigrate()
 {
-    const QByteArray requestType = httpHeaders.value("_requestType");
-    const QString path = QString::fromLatin1(httpHeaders.value("_path").constData());
+    // Only idle keep-alive connections can move: nothing received, being processed, or left to write.
+    // HTTP/2 connections stay, their state isn't only in the socket.
+    if (m_http2 || !m_socketEnabled || m_delayedResponse || m_parser.headersComplete() || !m_parser.buffer().isEmpty() || bytesAvailable() > 0
+        || state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+#ifndef QT_NO_SSL
+    if (mode() != QSslSocket::UnencryptedMode) {
+        return;
+    }
+#endif
+    flush();
+    if (bytesToWrite() > 0) {
+        return;
+    }
+    m_owner->migrateSocket(this);
+}
+
+void KDSoapServerSocket::handleRequest(const QByteArray &receivedData)
+{
+    const QByteArray requestType = m_parser.requestType();
+    const QString path = QString::fromLatin1(m_parser.path().constData());
 
     if (!path.startsWith(QLatin1String("/"))) {
         // denied for security reasons (ex: path starting with "..")
-        write(s_forbidden);
+        writeResponse(s_forbidden);
         return;
     }
 
     KDSoapServerAuthInterface *serverAuthInterface = qobject_cast<KDSoapServerAuthInterface *>(m_serverObject);
     if (serverAuthInterface) {
-        const QByteArray authValue = httpHeaders.value("authorization");
+        const QByteArray authValue = m_parser.header("authorization");
         if (!serverAuthInterface->handleHttpAuth(authValue, path)) {
             // send auth request (Qt supports basic, ntlm and digest)
             const QByteArray unauthorized =
                 "HTTP/1.1 401 Authorization Required\r\nWWW-Authenticate: Basic realm=\"example\"\r\nContent-Length: 0\r\n\r\n";
-            write(unauthorized);
+            writeResponse(unauthorized);
             return;
         }
     }
@@ -303,22 +775,24 @@ void KDSoapServerSocket::handleRequest(const QMap<QByteArray, QByteArray> &httpH
     if (requestType != "GET" && requestType != "POST") {
         KDSoapServerCustomVerbRequestInterface *serverCustomRequest = qobject_cast<KDSoapServerCustomVerbRequestInterface *>(m_serverObject);
         QByteArray customVerbRequestAnswer;
-        if (serverCustomRequest && serverCustomRequest->processCustomVerbRequest(requestType, receivedData, httpHeaders, customVerbRequestAnswer)) {
-            write(customVerbRequestAnswer);
+        // receivedData might point into the parser's buffer, make a real copy for the implementation
+        const QByteArray requestData(receivedData.constData(), receivedData.size());
+        if (serverCustomRequest && serverCustomRequest->processCustomVerbRequest(requestType, requestData, m_parser.headerMap(), customVerbRequestAnswer)) {
+            writeResponse(customVerbRequestAnswer);
             return;
         } else {
             qWarning() << "Unknown HTTP request:" << requestType;
             // handleError(replyMsg, "Client.Data", QString::fromLatin1("Invalid request type '%1', should be GET or
             // POST").arg(QString::fromLatin1(requestType.constData()))); sendReply(0, replyMsg);
             const QByteArray methodNotAllowed = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET POST\r\nContent-Length: 0\r\n\r\n";
-            write(methodNotAllowed);
+            writeResponse(methodNotAllowed);
             return;
         }
     }
 
-    KDSoapServer *server = m_owner->server();
+    const KDSoapServerSettingsPtr settings = m_owner->server()->settings();
     KDSoapMessage replyMsg;
-    replyMsg.setUse(server->use());
+    replyMsg.setUse(settings->use);
 
     KDSoapServerObjectInterface *serverObjectInterface = qobject_cast<KDSoapServerObjectInterface *>(m_serverObject);
     if (!serverObjectInterface) {
@@ -332,7 +806,10 @@ void KDSoapServerSocket::handleRequest(const QMap<QByteArray, QByteArray> &httpH
     }
 
     if (requestType == "GET") {
-        if (path == server->wsdlPathInUrl() && handleWsdlDownload()) {
+        if (path == settings->wsdlPathInUrl && handleWsdlDownload()) {
+            return;
+        } else if (!settings->metricsPath.isEmpty() && path == settings->metricsPath) {
+            handleMetricsRequest();
             return;
         } else if (handleFileDownload(serverObjectInterface, path)) {
             return;
@@ -349,8 +826,17 @@ void KDSoapServerSocket::handleRequest(const QMap<QByteArray, QByteArray> &httpH
     // parse message
     KDSoapMessage requestMsg;
     KDSoapHeaders requestHeaders;
-    KDSoapMessageReader reader;
-    KDSoapMessageReader::XmlError err = reader.xmlToMessage(receivedData, &requestMsg, &m_messageNamespace, &requestHeaders, KDSoap::SOAP1_1);
+    KDSoapMessageReader::XmlError err;
+    {
+        PhaseTimer xmlParseTimer(m_collectMetrics, &m_timings.phaseNsecs[KDSoapRequestTimings::XmlParse]);
+        if (m_streamingReader) {
+            // The body was already parsed while it was being received
+            err = m_streamingReader->result(&requestMsg, &m_messageNamespace, &requestHeaders, KDSoap::SOAP1_1);
+        } else {
+            KDSoapMessageReader reader;
+            err = reader.xmlToMessage(receivedData, &requestMsg, &m_messageNamespace, &requestHeaders, KDSoap::SOAP1_1);
+        }
+    }
     if (err == KDSoapMessageReader::PrematureEndOfDocumentError) {
         // qDebug() << "Incomplete SOAP message, wait for more data";
         // This should never happen, since we check for content-size above.
@@ -359,10 +845,10 @@ void KDSoapServerSocket::handleRequest(const QMap<QByteArray, QByteArray> &httpH
 
     // check soap version and extract soapAction header
     QByteArray soapAction;
-    const QByteArray contentType = httpHeaders.value("content-type");
+    const QByteArray contentType = m_parser.header("content-type");
     if (contentType.startsWith("text/xml")) { // krazy:exclude=strings
         // SOAP 1.1
-        soapAction = httpHeaders.value("soapaction");
+        soapAction = m_parser.header("soapaction");
         // The SOAP standard allows quotation marks around the SoapAction, so we have to get rid of these.
         soapAction = stripQuotes(soapAction);
 
@@ -379,29 +865,125 @@ void KDSoapServerSocket::handleRequest(const QMap<QByteArray, QByteArray> &httpH
 
     m_method = requestMsg.name();
 
+    if (!replyMsg.isFault() && !requestMsg.isFault() && settings->handlerThreadCount > 0) {
+        startHandlerTask(requestMsg, requestHeaders, soapAction, path);
+        return;
+    }
+
     if (!replyMsg.isFault()) {
-        makeCall(serverObjectInterface, requestMsg, replyMsg, requestHeaders, soapAction, path);
+        PhaseTimer dispatchTimer(m_collectMetrics, &m_timings.phaseNsecs[KDSoapRequestTimings::Dispatch]);
+        if (makeCall(serverObjectInterface, requestMsg, replyMsg, requestHeaders, soapAction, path)) {
+            m_metricsOperation = m_method.toLatin1();
+        }
     }
 
     if (serverObjectInterface && m_delayedResponse) {
         // Delayed response. Disable the socket to make sure we don't handle another call at the same time.
-        setSocketEnabled(false);
+        // HTTP/2 clients can send other calls in the meantime, on other streams.
+        if (!m_http2) {
+            setSocketEnabled(false);
+        }
     } else {
         sendReply(serverObjectInterface, replyMsg);
     }
 }
 
+// Handles conditional requests (RFC 7232) and byte ranges (RFC 7233) for downloads.
+// Writes the headers, and returns false if there's no content to send, otherwise the part of the content to send.
+bool KDSoapServerSocket::writeDownloadHeaders(const QByteArray &contentType, qint64 size, const QDateTime &lastModified, bool supportsRanges,
+                                              qint64 *offset, qint64 *length)
+{
+    *offset = 0;
+    *length = size;
+    QByteArray extraHeaders = connectionHeader();
+    QByteArray etag;
+    if (lastModified.isValid()) {
+        etag = entityTag(size, lastModified);
+        extraHeaders += "ETag: " + etag + "\r\nLast-Modified: " + httpDate(lastModified) + "\r\n";
+
+        // If-None-Match takes precedence over If-Modified-Since, RFC 7232 section 6
+        const QByteArray ifNoneMatch = m_parser.header("if-none-match");
+        bool notModified;
+        if (!ifNoneMatch.isEmpty()) {
+            notModified = entityTagMatches(ifNoneMatch, etag);
+        } else {
+            const QDateTime ifModifiedSince = parseHttpDate(m_parser.header("if-modified-since"));
+            notModified = ifModifiedSince.isValid() && lastModified.toSecsSinceEpoch() <= ifModifiedSince.toSecsSinceEpoch();
+        }
+        if (notModified) {
+            writeResponse("HTTP/1.1 304 Not Modified\r\n" + extraHeaders + "\r\n");
+            return false;
+        }
+    }
+    if (!supportsRanges) {
+        writeResponse(httpResponseHeaders(false, contentType, size, m_serverObject, extraHeaders));
+        return size > 0;
+    }
+    extraHeaders += "Accept-Ranges: bytes\r\n";
+
+    // Only a single range is supported, for multiple ranges we send everything, which is allowed
+    const QByteArray range = m_parser.header("range");
+    const QByteArray ifRange = m_parser.header("if-range");
+    const bool useRange = range.startsWith("bytes=") && !range.contains(',') // krazy:exclude=strings
+        && (ifRange.isEmpty() || (!etag.isEmpty() && (ifRange == etag || ifRange == httpDate(lastModified))));
+    if (useRange) {
+        const QByteArray spec = range.mid(6).trimmed();
+        const int dash = spec.indexOf('-');
+        const QByteArray first = spec.left(dash).trimmed();
+        const QByteArray last = spec.mid(dash + 1).trimmed();
+        bool firstOk = true;
+        bool lastOk = true;
+        const qint64 firstValue = first.isEmpty() ? -1 : first.toLongLong(&firstOk);
+        const qint64 lastValue = last.isEmpty() ? -1 : last.toLongLong(&lastOk);
+        // "bytes=500-999", "bytes=500-" or "bytes=-500" (the last 500 bytes)
+        if (dash >= 0 && firstOk && lastOk && (firstValue >= 0 || lastValue >= 0) && (firstValue < 0 || lastValue < 0 || lastValue >= firstValue)) {
+            qint64 start;
+            qint64 end = size - 1;
+            if (firstValue < 0) {
+                start = qMax(Q_INT64_C(0), size - lastValue);
+            } else {
+                start = firstValue;
+                if (lastValue >= 0) {
+                    end = qMin(end, lastValue);
+                }
+            }
+            if (start >= size || (firstValue < 0 && lastValue == 0)) {
+                writeResponse("HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" + QByteArray::number(size) + "\r\nContent-Length: 0\r\n" + connectionHeader() + "\r\n");
+                return false;
+            }
+            *offset = start;
+            *length = end - start + 1;
+            const QByteArray contentRange =
+                "Content-Range: bytes " + QByteArray::number(start) + '-' + QByteArray::number(end) + '/' + QByteArray::number(size) + "\r\n";
+            writeResponse(httpResponseHeadersWithStatus("206 Partial Content", contentType, *length, m_serverObject, contentRange + extraHeaders));
+            return true;
+        }
+        // Syntactically invalid ranges are ignored, RFC 7233 section 3.1
+    }
+    const QByteArray response = httpResponseHeaders(false, contentType, size, m_serverObject, extraHeaders);
+    if (m_doDebug) {
+        qDebug() << "KDSoapServerSocket: download response" << response;
+    }
+    writeResponse(response);
+    return size > 0;
+}
+
 bool KDSoapServerSocket::handleWsdlDownload()
 {
     KDSoapServer *server = m_owner->server();
-    const QString wsdlFile = server->wsdlFile();
-    QFile wf(wsdlFile);
-    if (wf.open(QIODevice::ReadOnly)) {
+    QByteArray responseText;
+    QDateTime lastModified;
+    if (server->wsdlFileContents(&responseText, &lastModified)) {
         // qDebug() << "Returning wsdl file contents";
-        const QByteArray responseText = wf.readAll();
-        const QByteArray response = httpResponseHeaders(false, "application/xml", responseText.size(), m_serverObject);
-        write(response);
-        write(responseText);
+        qint64 offset;
+        qint64 length;
+        if (writeDownloadHeaders("application/xml", responseText.size(), lastModified, true, &offset, &length)) {
+            if (length == responseText.size()) {
+                writeResponse(responseText);
+            } else {
+                writeResponse(responseText.mid(offset, length));
+            }
+        }
         return true;
     }
     return false;
@@ -413,56 +995,86 @@ bool KDSoapServerSocket::handleFileDownload(KDSoapServerObjectInterface *serverO
     QIODevice *device = serverObjectInterface->processFileRequest(path, contentType);
     if (!device) {
         const QByteArray notFound = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
-        write(notFound);
+        writeResponse(notFound);
         return true;
     }
     if (!device->open(QIODevice::ReadOnly)) {
-        write(s_forbidden);
+        writeResponse(s_forbidden);
         delete device;
         return true; // handled!
     }
-    const QByteArray response = httpResponseHeaders(false, contentType, device->size(), m_serverObject);
-    if (m_doDebug) {
-        qDebug() << "KDSoapServerSocket: file download response" << response;
+    QFile *file = qobject_cast<QFile *>(device);
+    const QDateTime lastModified = file ? QFileInfo(*file).lastModified() : QDateTime();
+    qint64 offset;
+    qint64 length;
+    if (!writeDownloadHeaders(contentType, device->size(), lastModified, !device->isSequential(), &offset, &length)) {
+        delete device;
+        return true;
     }
-    qint64 written = write(response);
-    Q_ASSERT(written == response.size()); // Please report a bug if you hit this.
-    Q_UNUSED(written);
-
-    char block[4096] = {0};
-    // qint64 totalRead = 0;
-    while (!device->atEnd()) {
-        const qint64 in = device->read(block, sizeof(block));
-        if (in <= 0) {
-            break;
-        }
-        // totalRead += in;
-        if (in != write(block, in)) {
-            // error = true;
-            break;
+    if (m_http2) {
+        // The data is read as the flow control windows of the stream open, see continueHttp2Download()
+        if (offset > 0) {
+            device->seek(offset);
         }
+        m_http2Call->download = device;
+        m_http2Call->downloadRemaining = length;
+        m_delayedResponse = true;
+        return true;
     }
-    // if (totalRead != device->size()) {
-    //    // Unable to read from the source.
-    //    error = true;
-    //}
 
-    delete device;
+    // The data is sent as the client reads it; until then, this is like a delayed response
+    bool plainTcp = true;
+#ifndef QT_NO_SSL
+    plainTcp = mode() == QSslSocket::UnencryptedMode;
+#endif
+    m_fileTransfer = new KDSoapFileTransfer(this, device, offset, length, plainTcp);
+    connect(m_fileTransfer, &KDSoapFileTransfer::finished, this, &KDSoapServerSocket::slotFileTransferFinished);
+    m_delayedResponse = true;
+    setSocketEnabled(false);
+    m_fileTransfer->start();
     // TODO log the file request, if logging is enabled?
     return true;
 }
 
-void KDSoapServerSocket::writeXML(const QByteArray &xmlResponse, bool isFault)
+void KDSoapServerSocket::slotFileTransferFinished()
 {
-    const QByteArray httpHeaders = httpResponseHeaders(isFault, "text/xml", xmlResponse.size(),
-                                                       m_serverObject); // TODO return application/soap+xml;charset=utf-8 instead for SOAP 1.2
+    m_fileTransfer->deleteLater(); // deletes the device
+    m_fileTransfer = nullptr;
+    finishDelayedResponse();
+}
+
+void KDSoapServerSocket::writeXML(const QByteArray &uncompressedResponse, bool isFault)
+{
+    QByteArray xmlResponse = uncompressedResponse;
+    QByteArray extraHeaders = connectionHeader();
+    if (m_responseCompressionThreshold >= 0 && KDSoapHttpCompression::isSupported()) {
+        // The response depends on Accept-Encoding, even when it isn't compressed, so that caches don't serve the wrong variant
+        extraHeaders += "Vary: Accept-Encoding\r\n";
+    }
+    if (m_responseEncoding != KDSoapHttpCompression::Identity && !xmlResponse.isEmpty() && xmlResponse.size() >= m_responseCompressionThreshold) {
+        const KDSoapHttpCompression::Encoding encoding = KDSoapHttpCompression::Encoding(m_responseEncoding);
+        const QByteArray compressed = KDSoapHttpCompression::compress(xmlResponse, encoding);
+        if (!compressed.isEmpty()) {
+            xmlResponse = compressed;
+            extraHeaders += "Content-Encoding: " + KDSoapHttpCompression::encodingName(encoding) + "\r\n";
+        }
+    }
+    // Headers and body in a single buffer and a single write, so that small responses fit in one TCP segment
+    // (or one TLS record), instead of the body waiting for the ACK of the headers (Nagle's algorithm vs delayed ACKs)
+    QObject *headerServerObject = m_serverObject;
+    if (m_handlerHttpHeaderItems) {
+        // The header items of the handler pool's server object, which handled the call
+        headerServerObject = nullptr;
+        extraHeaders.prepend(*m_handlerHttpHeaderItems);
+    }
+    QByteArray httpResponse = httpResponseHeaders(isFault, "text/xml", xmlResponse.size(), headerServerObject, extraHeaders,
+                                                  xmlResponse.size()); // TODO return application/soap+xml;charset=utf-8 instead for SOAP 1.2
     if (m_doDebug) {
-        qDebug() << "KDSoapServerSocket: writing" << httpHeaders << xmlResponse;
+        qDebug() << "KDSoapServerSocket: writing" << httpResponse << xmlResponse;
     }
-    qint64 written = write(httpHeaders);
-    Q_ASSERT(written == httpHeaders.size()); // Please report a bug if you hit this.
-    written = write(xmlResponse);
-    Q_ASSERT(written == xmlResponse.size()); // Please report a bug if you hit this.
+    httpResponse += xmlResponse;
+    const qint64 written = writeResponse(httpResponse);
+    Q_ASSERT(written == httpResponse.size()); // Please report a bug if you hit this.
     Q_UNUSED(written);
     // flush() ?
 }
@@ -473,48 +1085,165 @@ void KDSoapServerSocket::sendReply(KDSoapServerObjectInterface *serverObjectInte
 
     QByteArray xmlResponse;
     if (!replyMsg.isNull()) {
+        PhaseTimer serializeTimer(m_collectMetrics, &m_timings.phaseNsecs[KDSoapRequestTimings::Serialize]);
         KDSoapMessageWriter msgWriter;
-        // Note that the kdsoap client parsing code doesn't care for the name (except if it's fault), even in
-        // Document mode. Other implementations do, though.
-        QString responseName = isFault ? QString::fromLatin1("Fault") : replyMsg.name();
-        if (responseName.isEmpty()) {
-            responseName = m_method;
-        }
-        QString responseNamespace = m_messageNamespace;
+        QString responseName;
         KDSoapHeaders responseHeaders;
-        if (serverObjectInterface) {
-            responseHeaders = serverObjectInterface->responseHeaders();
-            if (!serverObjectInterface->responseNamespace().isEmpty()) {
-                responseNamespace = serverObjectInterface->responseNamespace();
-            }
-        }
-        msgWriter.setMessageNamespace(responseNamespace);
+        prepareMessageWriter(serverObjectInterface, replyMsg, &msgWriter, &responseName, &responseHeaders);
         xmlResponse = msgWriter.messageToXml(replyMsg, responseName, responseHeaders, QMap<QString, KDSoapMessage>());
     }
+    writeReply(xmlResponse, isFault, isFault ? replyMsg.faultAsString() : QString(), serverObjectInterface != nullptr);
+}
 
-    writeXML(xmlResponse, isFault);
+// soapCall: false for errors outside of SOAP calls, which aren't counted in the metrics
+void KDSoapServerSocket::writeReply(const QByteArray &xmlResponse, bool isFault, const QString &faultText, bool soapCall)
+{
+    // Check if we should log this. Before writing, so that the entry is queued by the time the client has the response.
+    const KDSoapServer::LogLevel logLevel = m_owner->server()->settings()->logLevel; // we do this here in order to support dynamic settings changes
+    if (logLevel == KDSoapServer::LogEveryCall || (logLevel == KDSoapServer::LogFaults && isFault)) {
+        // Only the fields: the formatting is done in the logger thread
+        KDSoapLogRecord record(isFault ? KDSoapLogRecord::Fault : KDSoapLogRecord::Call);
+        record.method = m_method.toLatin1();
+        record.text = faultText.toUtf8();
+        record.status = isFault ? 500 : xmlResponse.isEmpty() ? 204 : 200;
+        record.bytesIn = m_requestBodySize;
+        record.bytesOut = xmlResponse.size();
+        record.durationUsecs = m_requestTimer.nsecsElapsed() / 1000;
+        m_owner->log(record);
+    }
 
-    // All done, check if we should log this
-    KDSoapServer *server = m_owner->server();
-    const KDSoapServer::LogLevel logLevel =
-        server->logLevel(); // we do this here in order to support dynamic settings changes (at the price of a mutex)
-    if (logLevel != KDSoapServer::LogNothing) {
-        if (logLevel == KDSoapServer::LogEveryCall || (logLevel == KDSoapServer::LogFaults && isFault)) {
+    {
+        PhaseTimer writeTimer(m_collectMetrics, &m_timings.phaseNsecs[KDSoapRequestTimings::Write]);
+        writeXML(xmlResponse, isFault);
+    }
+    if (m_collectMetrics && soapCall) {
+        // Only the methods of the server object: the names of unknown methods come from the clients, there's no limit to them
+        m_owner->metrics()->record(m_metricsOperation.isEmpty() ? QByteArray("other") : m_metricsOperation, m_timings, m_requestTimer.nsecsElapsed(), m_requestBodySize, xmlResponse.size(), isFault);
+    }
+}
 
-            if (isFault) {
-                server->log("FAULT " + m_method.toLatin1() + " -- " + replyMsg.faultAsString().toUtf8() + '\n');
-            } else {
-                server->log("CALL " + m_method.toLatin1() + '\n');
-            }
+void KDSoapServerSocket::handleMetricsRequest()
+{
+    const QByteArray metrics = m_owner->server()->metricsText();
+    QByteArray response =
+        httpResponseHeadersWithStatus("200 OK", "text/plain; version=0.0.4; charset=utf-8", metrics.size(), m_serverObject, connectionHeader(), metrics.size());
+    response += metrics;
+    writeResponse(response);
+}
+
+// The HTTP/1.1 response to the current request. With HTTP/2, it's sent on the stream of the call once complete.
+qint64 KDSoapServerSocket::writeResponse(const QByteArray &httpResponse)
+{
+    if (m_http2Call) {
+        m_http2Call->response += httpResponse;
+        return httpResponse.size();
+    }
+    if (m_http2) {
+        qWarning("KDSoapServerSocket: writing outside of a call isn't supported over HTTP/2, use a delayed response");
+        return -1;
+    }
+    return write(httpResponse);
+}
+
+void KDSoapServerSocket::prepareMessageWriter(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &replyMsg,
+                                              KDSoapMessageWriter *msgWriter, QString *responseName, KDSoapHeaders *responseHeaders) const
+{
+    prepareMessageWriter(serverObjectInterface, replyMsg, m_method, m_messageNamespace, msgWriter, responseName, responseHeaders);
+}
+
+void KDSoapServerSocket::prepareMessageWriter(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &replyMsg, const QString &method,
+                                              const QString &messageNamespace, KDSoapMessageWriter *msgWriter, QString *responseName,
+                                              KDSoapHeaders *responseHeaders)
+{
+    // Note that the kdsoap client parsing code doesn't care for the name (except if it's fault), even in
+    // Document mode. Other implementations do, though.
+    *responseName = replyMsg.isFault() ? QString::fromLatin1("Fault") : replyMsg.name();
+    if (responseName->isEmpty()) {
+        *responseName = method;
+    }
+    QString responseNamespace = messageNamespace;
+    if (serverObjectInterface) {
+        *responseHeaders = serverObjectInterface->responseHeaders();
+        if (!serverObjectInterface->responseNamespace().isEmpty()) {
+            responseNamespace = serverObjectInterface->responseNamespace();
         }
     }
+    msgWriter->setMessageNamespace(responseNamespace);
+}
+
+KDSoapStreamingResponse *KDSoapServerSocket::prepareStreamingResponse(KDSoapServerObjectInterface *serverObjectInterface)
+{
+    if (m_http2) {
+        qWarning("KDSoapServerObjectInterface::prepareStreamingResponse: not supported over HTTP/2");
+        return nullptr;
+    }
+    if (!m_streamingResponse) {
+        m_streamingResponse = new KDSoapStreamingResponse(this, serverObjectInterface);
+        // Like a delayed response: the next request (pipelining) waits until the streaming response is finished
+        m_delayedResponse = true;
+    }
+    return m_streamingResponse;
 }
 
-void KDSoapServerSocket::sendDelayedReply(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &replyMsg)
+void KDSoapServerSocket::writeStreamingResponseHeaders()
 {
+    const QByteArray httpHeaders = httpResponseHeadersWithStatus("200 OK", "text/xml", -1, m_serverObject, connectionHeader());
+    if (m_doDebug) {
+        qDebug() << "KDSoapServerSocket: starting streaming response" << httpHeaders;
+    }
+    write(httpHeaders);
+}
+
+void KDSoapServerSocket::streamingResponseFinished()
+{
+    m_streamingResponse = nullptr;
+    // Not right away: finish() might be called from within processRequest()
+    QMetaObject::invokeMethod(this, "slotStreamingResponseFinished", Qt::QueuedConnection);
+}
+
+void KDSoapServerSocket::slotStreamingResponseFinished()
+{
+    finishDelayedResponse();
+}
+
+void KDSoapServerSocket::sendDelayedReply(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &replyMsg, int streamId)
+{
+    if (streamId != 0) {
+        Http2Call *call = m_http2Calls.value(streamId);
+        if (!call) {
+            return; // already answered
+        }
+        if (call == m_http2Call) {
+            // Sent right away, from processRequest: the call is finished once it returns
+            sendReply(serverObjectInterface, replyMsg);
+            m_delayedResponse = false;
+            return;
+        }
+        if (!call->delayedResponse) {
+            return;
+        }
+        {
+            Http2CallScope scope(this, call);
+            sendReply(serverObjectInterface, replyMsg);
+            m_delayedResponse = false;
+        }
+        finishHttp2Call(call);
+        return;
+    }
     sendReply(serverObjectInterface, replyMsg);
+    finishDelayedResponse();
+}
+
+void KDSoapServerSocket::finishDelayedResponse()
+{
     m_delayedResponse = false;
+    setRequestInFlight(false);
+    responseComplete();
+    if (m_closeAfterResponse) {
+        return;
+    }
     setSocketEnabled(true);
+    scheduleMigrationCheck();
 }
 
 void KDSoapServerSocket::setResponseDelayed()
@@ -529,7 +1258,7 @@ void KDSoapServerSocket::handleError(KDSoapMessage &replyMsg, const char *errorC
     replyMsg.createFaultMessage(QString::fromLatin1(errorCode), error, soapVersion);
 }
 
-void KDSoapServerSocket::makeCall(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &requestMsg, KDSoapMessage &replyMsg,
+bool KDSoapServerSocket::makeCall(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &requestMsg, KDSoapMessage &replyMsg,
                                   const KDSoapHeaders &requestHeaders, const QByteArray &soapAction, const QString &path)
 {
     Q_ASSERT(serverObjectInterface);
@@ -540,22 +1269,439 @@ void KDSoapServerSocket::makeCall(KDSoapServerObjectInterface *serverObjectInter
         // Oh well, just use the incoming fault :-)
         replyMsg = requestMsg;
         handleError(replyMsg, "Client.Data", QString::fromLatin1("Request was a fault"));
+        return false;
+    }
+    return callServerObject(this, serverObjectInterface, requestMsg, replyMsg, requestHeaders, soapAction, path, m_owner->server()->settings()->path);
+}
+
+bool KDSoapServerSocket::callServerObject(KDSoapServerSocket *socket, KDSoapServerObjectInterface *serverObjectInterface,
+                                          const KDSoapMessage &requestMsg, KDSoapMessage &replyMsg, const KDSoapHeaders &requestHeaders,
+                                          const QByteArray &soapAction, const QString &path, const QString &serverPath)
+{
+    // Call method on m_serverObject
+    serverObjectInterface->setServerSocket(socket);
+    serverObjectInterface->setRequestHeaders(requestHeaders, soapAction);
+
+    if (path != serverPath) {
+        serverObjectInterface->processRequestWithPath(requestMsg, replyMsg, soapAction, path);
     } else {
+        serverObjectInterface->processRequest(requestMsg, replyMsg, soapAction);
+    }
+    if (serverObjectInterface->hasFault()) {
+        // qDebug() << "Got fault!";
+        replyMsg.setFault(true);
+        serverObjectInterface->storeFaultAttributes(replyMsg);
+    }
+    return !serverObjectInterface->methodNotFound();
+}
 
-        // Call method on m_serverObject
-        serverObjectInterface->setRequestHeaders(requestHeaders, soapAction);
+// Runs a call in a thread of the handler pool, with that thread's server object, and serializes the response there too.
+// Only copies of the request data are used: the socket might be deleted in the meantime.
+class KDSoapServerSocket::HandlerTask : public QRunnable
+{
+public:
+    HandlerTask(KDSoapHandlerPool *pool, const QSharedPointer<KDSoapHandlerReply> &reply, const KDSoapServerSettings &settings,
+                const KDSoapMessage &requestMsg, const KDSoapHeaders &requestHeaders, const QByteArray &soapAction, const QString &path,
+                const QString &method, const QString &messageNamespace)
+        : m_pool(pool)
+        , m_reply(reply)
+        , m_use(settings.use)
+        , m_serverPath(settings.path)
+        , m_requestMsg(requestMsg)
+        , m_requestHeaders(requestHeaders)
+        , m_soapAction(soapAction)
+        , m_path(path)
+        , m_method(method)
+        , m_messageNamespace(messageNamespace)
+    {
+    }
 
-        KDSoapServer *server = m_owner->server();
-        if (path != server->path()) {
-            serverObjectInterface->processRequestWithPath(requestMsg, replyMsg, soapAction, path);
+    void run() override
+    {
+        QElapsedTimer timer;
+        timer.start();
+        KDSoapMessage replyMsg;
+        replyMsg.setUse(m_use);
+        QObject *serverObject = m_pool->serverObject();
+        KDSoapServerObjectInterface *serverObjectInterface = qobject_cast<KDSoapServerObjectInterface *>(serverObject);
+        bool dispatched = false;
+        if (serverObjectInterface) {
+            // No socket: it belongs to another thread, so no delayed or streaming responses from here
+            dispatched = callServerObject(nullptr, serverObjectInterface, m_requestMsg, replyMsg, m_requestHeaders, m_soapAction, m_path, m_serverPath);
         } else {
-            serverObjectInterface->processRequest(requestMsg, replyMsg, soapAction);
+            const QString error = QString::fromLatin1("Server object %1 does not implement KDSoapServerObjectInterface!")
+                                      .arg(QString::fromLatin1(serverObject->metaObject()->className()));
+            handleError(replyMsg, "Server.ImplementationError", error);
+        }
+        const qint64 dispatchNsecs = timer.nsecsElapsed();
+
+        QByteArray xmlResponse;
+        if (!replyMsg.isNull()) {
+            KDSoapMessageWriter msgWriter;
+            QString responseName;
+            KDSoapHeaders responseHeaders;
+            prepareMessageWriter(serverObjectInterface, replyMsg, m_method, m_messageNamespace, &msgWriter, &responseName, &responseHeaders);
+            xmlResponse = msgWriter.messageToXml(replyMsg, responseName, responseHeaders, QMap<QString, KDSoapMessage>());
+        }
+        // The header items can depend on the call, and the socket's own server object knows nothing about it
+        QByteArray httpHeaderItems;
+        if (serverObjectInterface) {
+            const KDSoapServerObjectInterface::HttpResponseHeaderItems items = serverObjectInterface->additionalHttpResponseHeaderItems();
+            for (const KDSoapServerObjectInterface::HttpResponseHeaderItem &item : items) {
+                httpHeaderItems += item.m_name + ": " + item.m_value + "\r\n";
+            }
+        }
+        const bool isFault = replyMsg.isFault();
+        m_reply->deliver(xmlResponse, isFault, isFault ? replyMsg.faultAsString() : QString(), httpHeaderItems, dispatched, dispatchNsecs,
+                         timer.nsecsElapsed() - dispatchNsecs);
+    }
+
+private:
+    KDSoapHandlerPool *m_pool;
+    QSharedPointer<KDSoapHandlerReply> m_reply;
+    KDSoapMessage::Use m_use;
+    QString m_serverPath;
+    KDSoapMessage m_requestMsg;
+    KDSoapHeaders m_requestHeaders;
+    QByteArray m_soapAction;
+    QString m_path;
+    QString m_method;
+    QString m_messageNamespace;
+};
+
+// Like a delayed response: this thread goes on with the other connections until slotHandlerFinished()
+void KDSoapServerSocket::startHandlerTask(const KDSoapMessage &requestMsg, const KDSoapHeaders &requestHeaders, const QByteArray &soapAction,
+                                          const QString &path)
+{
+    KDSoapServer *server = m_owner->server();
+    m_delayedResponse = true;
+    if (!m_http2) {
+        setSocketEnabled(false);
+    }
+    m_handlerReply.reset(new KDSoapHandlerReply(this, currentStreamId()));
+    server->handlerPool()->start(
+        new HandlerTask(server->handlerPool(), m_handlerReply, *server->settings(), requestMsg, requestHeaders, soapAction, path, m_method, m_messageNamespace));
+}
+
+void KDSoapServerSocket::slotHandlerFinished(const QByteArray &xmlResponse, bool isFault, const QString &faultText, const QByteArray &httpHeaderItems,
+                                             bool dispatched, qint64 dispatchNsecs, qint64 serializeNsecs, int streamId)
+{
+    if (streamId != 0) {
+        Http2Call *call = m_http2Calls.value(streamId);
+        if (!call) {
+            return;
         }
-        if (serverObjectInterface->hasFault()) {
-            // qDebug() << "Got fault!";
-            replyMsg.setFault(true);
-            serverObjectInterface->storeFaultAttributes(replyMsg);
+        {
+            Http2CallScope scope(this, call);
+            m_handlerReply.reset();
+            m_timings.phaseNsecs[KDSoapRequestTimings::Dispatch] += dispatchNsecs;
+            m_timings.phaseNsecs[KDSoapRequestTimings::Serialize] += serializeNsecs;
+            if (dispatched) {
+                m_metricsOperation = m_method.toLatin1();
+            }
+            m_handlerHttpHeaderItems = &httpHeaderItems;
+            writeReply(xmlResponse, isFault, faultText, true);
+            m_handlerHttpHeaderItems = nullptr;
+            m_delayedResponse = false;
         }
+        finishHttp2Call(call);
+        return;
+    }
+    m_handlerReply.reset();
+    m_timings.phaseNsecs[KDSoapRequestTimings::Dispatch] += dispatchNsecs;
+    m_timings.phaseNsecs[KDSoapRequestTimings::Serialize] += serializeNsecs;
+    if (dispatched) {
+        m_metricsOperation = m_method.toLatin1();
+    }
+    m_handlerHttpHeaderItems = &httpHeaderItems;
+    writeReply(xmlResponse, isFault, faultText, true);
+    m_handlerHttpHeaderItems = nullptr;
+    finishDelayedResponse();
+}
+
+int KDSoapServerSocket::currentStreamId() const
+{
+    return m_http2Call ? m_http2Call->streamId : 0;
+}
+
+// Checks whether the current request asks to switch to HTTP/2 ("h2c" upgrade, RFC 7540 section 3.2)
+bool KDSoapServerSocket::isHttp2Upgrade() const
+{
+    if (!(m_owner->server()->settings()->features & KDSoapServer::Http2)) {
+        return false;
+    }
+#ifndef QT_NO_SSL
+    if (mode() != QSslSocket::UnencryptedMode) {
+        return false; // over TLS, HTTP/2 is negotiated with ALPN
+    }
+#endif
+    bool h2c = false;
+    const QList<QByteArray> protocols = m_parser.header("upgrade").split(',');
+    for (const QByteArray &protocol : protocols) {
+        h2c = h2c || protocol.trimmed().toLower() == "h2c";
+    }
+    return h2c && m_parser.headerMap().contains("http2-settings") && KDSoapHttp2Connection::isValidUpgradeSettings(m_parser.header("http2-settings"));
+}
+
+// Reads the body of the upgrade request, then switches to HTTP/2. Returns false, like processBufferedRequest() when it needs more data.
+bool KDSoapServerSocket::processHttp2Upgrade()
+{
+    int offset;
+    int length;
+    KDSoapHttpRequestParser::Result result;
+    while ((result = m_parser.readBodyData(&offset, &length)) == KDSoapHttpRequestParser::Ok) {
+        if (m_parser.isChunked()) {
+            m_decodedRequestBuffer.append(m_parser.buffer().constData() + offset, length);
+        }
+    }
+    if (result == KDSoapHttpRequestParser::NeedMoreData) {
+        return false;
+    }
+    if (result != KDSoapHttpRequestParser::Complete) {
+        m_upgradeToHttp2 = false;
+        handleBadRequest(errorStatus(result));
+        return false;
+    }
+
+    // The request is handled as stream 1, rewritten without the HTTP/1.1 connection headers
+    const QByteArray body = m_parser.isChunked() ? m_decodedRequestBuffer : QByteArray(m_parser.rawBody().constData(), m_parser.rawBody().size());
+    QByteArray requestHead = m_parser.requestType() + ' ' + m_parser.path() + " HTTP/1.1\r\n";
+    const QMap<QByteArray, QByteArray> headers = m_parser.headerMap();
+    for (auto it = headers.constBegin(); it != headers.constEnd(); ++it) {
+        const QByteArray &name = it.key();
+        if (!name.startsWith('_') && name != "connection" && name != "upgrade" && name != "http2-settings" && name != "content-length"
+            && name != "transfer-encoding") {
+            requestHead += name + ": " + it.value() + "\r\n";
+        }
+    }
+    requestHead += "content-length: " + QByteArray::number(body.size()) + "\r\n\r\n";
+    const QByteArray upgradeSettings = m_parser.header("http2-settings");
+
+    write("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    m_upgradeToHttp2 = false;
+    m_decodedRequestBuffer.clear();
+    m_parser.startNextRequest(); // keeps what the client sent after the request, i.e. the connection preface
+    const QByteArray data = m_parser.buffer();
+    m_parser.reset();
+    startHttp2(upgradeSettings);
+    m_http2->addUpgradeRequest(requestHead, body);
+    processHttp2Data(data);
+    return false;
+}
+
+// From now on, the data received goes to the HTTP/2 connection, and m_parser is only used by Http2CallScope
+void KDSoapServerSocket::startHttp2(const QByteArray &upgradeSettings)
+{
+    if (m_doDebug) {
+        qDebug() << "Switching to HTTP/2" << this;
+    }
+    m_http2 = new KDSoapHttp2Connection(m_owner->server()->settings()->requestLimits);
+    m_http2->start(upgradeSettings); // checked by isHttp2Upgrade()
+    connect(this, &QIODevice::bytesWritten, this, &KDSoapServerSocket::slotHttp2BytesWritten);
+}
+
+void KDSoapServerSocket::slotHttp2BytesWritten()
+{
+    continueHttp2Downloads();
+    flushHttp2Output();
+}
+
+void KDSoapServerSocket::processHttp2Data(const QByteArray &data)
+{
+    if (!m_http2->receive(data)) {
+        if (m_doDebug) {
+            qDebug() << "HTTP/2 connection error, closing" << this;
+        }
+        flushHttp2Output(); // the GOAWAY frame
+        disconnectFromHost();
+        return;
+    }
+    startHttp2Calls();
+    continueHttp2Downloads(); // WINDOW_UPDATE frames might have made room
+    flushHttp2Output();
+}
+
+// Starts the calls for the streams whose request is complete
+void KDSoapServerSocket::startHttp2Calls()
+{
+    KDSoapServer *server = m_owner->server();
+    int streamId;
+    QByteArray requestHead;
+    QByteArray body;
+    while (m_http2->takeRequest(&streamId, &requestHead, &body)) {
+        Http2Call *call = new Http2Call(streamId);
+        // The connection already applied the request limits
+        KDSoapHttpRequestParser::Limits noLimits;
+        noLimits.maxHeaderSize = -1;
+        noLimits.maxHeaderCount = -1;
+        call->parser.setLimits(noLimits);
+        call->parser.append(requestHead);
+        if (call->parser.parseHeaders() != KDSoapHttpRequestParser::Ok) {
+            m_http2->sendResponse(streamId, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+            delete call;
+            continue;
+        }
+        if (m_doDebug) {
+            qDebug() << "HTTP/2 stream" << streamId << "headers:" << call->parser.headerMap();
+        }
+        call->body = body;
+        m_http2Calls.insert(streamId, call);
+        setRequestInFlight(true);
+
+        const KDSoapServerSettingsPtr settings = server->settings();
+        call->requestTimer.start();
+        call->requestBodySize = body.size();
+        call->collectMetrics = !settings->metricsPath.isEmpty();
+        ++m_requestCount;
+        const int maxRequests = settings->maxRequestsPerConnection;
+        if (maxRequests > 0 && m_requestCount >= maxRequests) {
+            // The client opens a new connection for the next calls, once these are answered
+            m_http2->goAway(KDSoapHttp2Connection::NoError);
+        }
+        switch (m_admissionController->admit(this)) {
+        case KDSoapAdmissionController::Admitted:
+            call->admitted = true;
+            handleHttp2Call(call);
+            break;
+        case KDSoapAdmissionController::Queued:
+            // Until slotRequestAdmitted() or requestQueueTimedOut(); the other streams go on meanwhile
+            call->queueDeadline = QDeadlineTimer(settings->requestQueueTimeout); // negative: forever
+            m_http2WaitingCalls.append(streamId);
+            if (m_http2WaitingCalls.count() == 1) {
+                scheduleHttp2QueueTimeout();
+            }
+            break;
+        case KDSoapAdmissionController::Rejected:
+            logRejectedRequest();
+            {
+                Http2CallScope scope(this, call);
+                writeServiceUnavailable();
+            }
+            finishHttp2Call(call);
+            break;
+        }
+    }
+}
+
+// Like processBufferedRequest() once the body is received, the whole body being there already
+void KDSoapServerSocket::handleHttp2Call(Http2Call *call)
+{
+    {
+        Http2CallScope scope(this, call);
+        negotiateResponseEncoding();
+        QByteArray body = call->body;
+        call->body.clear();
+        const int requestEncoding = KDSoapHttpCompression::encodingFromName(m_parser.header("content-encoding"));
+        if (requestEncoding < 0) {
+            writeResponse("HTTP/1.1 415 Unsupported Media Type\r\nContent-Length: 0\r\n\r\n");
+            body.clear();
+        } else if (requestEncoding != KDSoapHttpCompression::Identity) {
+            KDSoapHttpInflater inflater(KDSoapHttpCompression::Encoding(requestEncoding), m_owner->server()->settings()->requestLimits.bodySizeLimit());
+            QByteArray inflated;
+            if (inflater.inflate(body.constData(), body.size(), &inflated) && inflater.isFinished()) {
+                body = inflated;
+            } else {
+                writeResponse(inflater.limitExceeded() ? "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\n\r\n"
+                                                       : "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+                body.clear();
+            }
+        }
+        if (m_http2Call->response.isEmpty()) {
+            if (m_doDebug) {
+                qDebug() << "data received:" << body;
+            }
+            KDSoapServerRawXMLInterface *rawXmlInterface = qobject_cast<KDSoapServerRawXMLInterface *>(m_serverObject);
+            bool useRawXML = false;
+            if (rawXmlInterface) {
+                KDSoapServerObjectInterface *serverObjectInterface = qobject_cast<KDSoapServerObjectInterface *>(m_serverObject);
+                serverObjectInterface->setServerSocket(this);
+                useRawXML = rawXmlInterface->newRequest(m_parser.requestType(), m_parser.headerMap());
+            }
+            if (useRawXML) {
+                // The response must be written from endRequest(), or with a delayed response
+                rawXmlInterface->processXML(body);
+                rawXmlInterface->endRequest();
+            } else {
+                handleRequest(body);
+            }
+        }
+    }
+    if (call->download) {
+        m_http2->sendResponse(call->streamId, call->response, call->downloadRemaining == 0);
+        call->response.clear();
+        continueHttp2Download(call);
+    } else if (!call->delayedResponse) {
+        finishHttp2Call(call);
+    }
+}
+
+// The body of a file download, a block at a time: only as much as the flow control windows
+// of the stream and what the socket has yet to write allow, so that the memory used doesn't
+// grow with the size of the file. Called again on WINDOW_UPDATE and when the socket wrote data.
+void KDSoapServerSocket::continueHttp2Download(Http2Call *call)
+{
+    static const qint64 s_blockSize = 64 * 1024;
+    static const qint64 s_maxBytesToWrite = 4 * s_blockSize;
+    while (call->downloadRemaining > 0) {
+        const qint64 pending = m_http2->pendingResponseData(call->streamId);
+        if (pending < 0) {
+            break; // reset by the client
+        }
+        if (pending >= s_blockSize || bytesToWrite() >= s_maxBytesToWrite) {
+            return;
+        }
+        const QByteArray data = call->download->read(qMin(s_blockSize, call->downloadRemaining));
+        if (data.isEmpty()) {
+            qWarning("KDSoapServerSocket: error reading the file to download: %s", qPrintable(call->download->errorString()));
+            m_http2->resetStream(call->streamId, KDSoapHttp2Connection::InternalError);
+            break;
+        }
+        call->downloadRemaining -= data.size();
+        m_http2->sendResponseData(call->streamId, data, call->downloadRemaining == 0);
+    }
+    call->delayedResponse = false;
+    finishHttp2Call(call);
+}
+
+void KDSoapServerSocket::continueHttp2Downloads()
+{
+    const QList<int> streamIds = m_http2Calls.keys();
+    for (int streamId : streamIds) {
+        Http2Call *call = m_http2Calls.value(streamId);
+        if (call && call->download) {
+            continueHttp2Download(call);
+        }
+    }
+}
+
+void KDSoapServerSocket::finishHttp2Call(Http2Call *call)
+{
+    if (!call->download) { // otherwise sent by continueHttp2Download() already
+        if (call->response.isEmpty()) {
+            call->response = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+        }
+        m_http2->sendResponse(call->streamId, call->response);
+    }
+    if (call->admitted) {
+        m_admissionController->release();
+    }
+    m_http2Calls.remove(call->streamId);
+    delete call;
+    if (m_http2Calls.isEmpty()) {
+        setRequestInFlight(false);
+        m_owner->scheduleIdleTimeout(this);
+    }
+    flushHttp2Output();
+}
+
+void KDSoapServerSocket::flushHttp2Output()
+{
+    const QByteArray output = m_http2->takeOutput();
+    if (!output.isEmpty()) {
+        write(output);
+    }
+    if (m_http2->isGoingAway() && m_http2Calls.isEmpty() && m_http2->streamCount() == 0) {
+        disconnectFromHost(); // after writing the pending data
     }
 }
 
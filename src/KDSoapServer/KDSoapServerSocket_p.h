@@ -10,6 +10,10 @@
 #ifndef KDSOAPSERVERSOCKET_P_H
 #define KDSOAPSERVERSOCKET_P_H
 
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QSharedPointer>
 #include <QtGlobal>
 
 #include <QTcpSocket> //may define QT_NO_SSL
@@ -17,14 +21,24 @@
 #include <QSslSocket>
 #endif
 
-#include <QMap>
+#include "KDSoapHttpRequestParser_p.h"
+#include "KDSoapServerMetrics_p.h"
 QT_BEGIN_NAMESPACE
 class QObject;
+class QDateTime;
 QT_END_NAMESPACE
 class KDSoapSocketList;
 class KDSoapServerObjectInterface;
 class KDSoapMessage;
 class KDSoapHeaders;
+class KDSoapIncrementalMessageReader;
+class KDSoapHttpInflater;
+class KDSoapFileTransfer;
+class KDSoapStreamingResponse;
+class KDSoapMessageWriter;
+class KDSoapAdmissionController;
+class KDSoapHandlerReply;
+class KDSoapHttp2Connection;
 
 class KDSoapServerSocket
 #ifndef QT_NO_SSL
@@ -39,24 +53,106 @@ public:
     ~KDSoapServerSocket();
 
     void setResponseDelayed();
-    void sendDelayedReply(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &replyMsg);
+    // streamId: see currentStreamId()
+    void sendDelayedReply(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &replyMsg, int streamId = 0);
     void sendReply(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &replyMsg);
+
+    bool isRequestInFlight() const
+    {
+        return m_requestInFlight;
+    }
+
+    // For the idle timeout in KDSoapSocketList
+    bool isIdle() const
+    {
+        return !m_requestInFlight && !m_delayedResponse && m_socketEnabled;
+    }
+    qint64 lastActivity() const
+    {
+        return m_lastActivity;
+    }
+
+    // Called by KDSoapSocketList when the request waited too long in the admission queue
+    void requestQueueTimedOut();
+
+    // The HTTP/2 stream of the call being handled, 0 for HTTP/1.1
+    int currentStreamId() const;
+
 Q_SIGNALS:
     void socketDeleted(KDSoapServerSocket *);
 
 private Q_SLOTS:
     void slotReadyRead();
+    void slotMaybeMigrate();
+    void slotFileTransferFinished();
+    void slotStreamingResponseFinished();
+    void slotRequestAdmitted();
+    void slotHttp2BytesWritten();
+    void slotHandlerFinished(const QByteArray &xmlResponse, bool isFault, const QString &faultText, const QByteArray &httpHeaderItems, bool dispatched,
+                             qint64 dispatchNsecs, qint64 serializeNsecs, int streamId);
 
 private:
-    void handleRequest(const QMap<QByteArray, QByteArray> &headers, const QByteArray &receivedData);
+    bool processBufferedRequest();
+    void handleRequest(const QByteArray &receivedData);
+    void handleBodyData(const char *data, int length);
+    void handleBadRequest(const char *httpStatus = "400 Bad Request");
+    void beginRequest();
+    void writeServiceUnavailable();
+    void logRejectedRequest();
+    void negotiateResponseEncoding();
+    void releaseAdmission();
+    void resetRequest();
+    void responseComplete();
+    QByteArray connectionHeader() const;
+    void setRequestInFlight(bool inFlight);
+    void scheduleMigrationCheck();
+    void finishDelayedResponse();
+    bool writeDownloadHeaders(const QByteArray &contentType, qint64 size, const QDateTime &lastModified, bool supportsRanges, qint64 *offset,
+                              qint64 *length);
     bool handleWsdlDownload();
+    void handleMetricsRequest();
     bool handleFileDownload(KDSoapServerObjectInterface *serverObjectInterface, const QString &path);
-    void makeCall(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &requestMsg, KDSoapMessage &replyMsg,
+    bool makeCall(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &requestMsg, KDSoapMessage &replyMsg,
                   const KDSoapHeaders &requestHeaders, const QByteArray &soapAction, const QString &path);
-    void handleError(KDSoapMessage &replyMsg, const char *errorCode, const QString &error);
+    void startHandlerTask(const KDSoapMessage &requestMsg, const KDSoapHeaders &requestHeaders, const QByteArray &soapAction, const QString &path);
+    static void handleError(KDSoapMessage &replyMsg, const char *errorCode, const QString &error);
     void setSocketEnabled(bool enabled);
     void writeXML(const QByteArray &xmlResponse, bool isFault);
+    qint64 writeResponse(const QByteArray &httpResponse);
+    void writeReply(const QByteArray &xmlResponse, bool isFault, const QString &faultText, bool soapCall);
+    void prepareMessageWriter(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &replyMsg, KDSoapMessageWriter *msgWriter,
+                              QString *responseName, KDSoapHeaders *responseHeaders) const;
+    // Also used in the threads of the handler pool, which don't touch the socket.
+    // Returns false if the server object didn't know the method (or the path)
+    static bool callServerObject(KDSoapServerSocket *socket, KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &requestMsg,
+                                 KDSoapMessage &replyMsg, const KDSoapHeaders &requestHeaders, const QByteArray &soapAction, const QString &path,
+                                 const QString &serverPath);
+    static void prepareMessageWriter(KDSoapServerObjectInterface *serverObjectInterface, const KDSoapMessage &replyMsg, const QString &method,
+                                     const QString &messageNamespace, KDSoapMessageWriter *msgWriter, QString *responseName,
+                                     KDSoapHeaders *responseHeaders);
+    class HandlerTask;
+    KDSoapStreamingResponse *prepareStreamingResponse(KDSoapServerObjectInterface *serverObjectInterface);
+    void writeStreamingResponseHeaders();
+    void streamingResponseFinished();
+
+    // HTTP/2 (KDSoapServer::Http2): each stream is a call, handled by the code above as an HTTP/1.1 request
+    struct Http2Call;
+    class Http2CallScope;
+    bool isHttp2Upgrade() const;
+    bool processHttp2Upgrade();
+    void startHttp2(const QByteArray &upgradeSettings);
+    void processHttp2Data(const QByteArray &data);
+    void startHttp2Calls();
+    void handleHttp2Call(Http2Call *call);
+    void continueHttp2Download(Http2Call *call);
+    void continueHttp2Downloads();
+    void finishHttp2Call(Http2Call *call);
+    void scheduleHttp2QueueTimeout();
+    void flushHttp2Output();
+
     friend class KDSoapServerObjectInterface;
+    friend class KDSoapStreamingResponse;
+    friend class KDSoapSocketList;
 
     KDSoapSocketList *m_owner;
     QObject *m_serverObject;
@@ -64,18 +160,51 @@ private:
     bool m_doDebug;
     bool m_socketEnabled;
     bool m_receivedData;
+    bool m_requestInFlight; // from the headers until the response is sent, for KDSoapThreadPool
+    bool m_closeAfterResponse; // Connection: close
+    int m_requestCount;
+    qint64 m_lastActivity; // see KDSoapSocketList::elapsedMsecs()
+    QElapsedTimer m_requestTimer; // since the headers of the current request, for the log
+    qint64 m_requestBodySize; // as received, for the log
+    bool m_collectMetrics; // KDSoapServer::setMetricsPath
+    qint64 m_headerParseNsecs; // until the headers are complete
+    KDSoapRequestTimings m_timings;
+
+    // Admission control (KDSoapServer::setMaxConcurrentRequests) of the current request
+    enum AdmissionState
+    {
+        NoRequest,
+        RequestQueued,
+        RequestAdmitted,
+        RequestRejected // the body is read and discarded, then "503 Service Unavailable" is sent
+    };
+    AdmissionState m_admissionState;
+    KDSoapAdmissionController *m_admissionController; // the server's
 
     // Current request being assembled
     bool m_useRawXML;
-    int m_bytesReceived;
-    int m_chunkStart;
-    QMap<QByteArray, QByteArray> m_httpHeaders;
-    QByteArray m_requestBuffer;
-    QByteArray m_decodedRequestBuffer; // used for chunked transfer encoding only
+    KDSoapHttpRequestParser m_parser;
+    QByteArray m_decodedRequestBuffer; // used for chunked transfer encoding and compressed requests only
+    KDSoapIncrementalMessageReader *m_streamingReader; // only with KDSoapServer::StreamRequestParsing
+    KDSoapHttpInflater *m_inflater; // only for compressed requests (Content-Encoding)
+    KDSoapFileTransfer *m_fileTransfer; // file download in progress
+    KDSoapStreamingResponse *m_streamingResponse; // between KDSoapServerObjectInterface::prepareStreamingResponse() and finish()
+    QSharedPointer<KDSoapHandlerReply> m_handlerReply; // while the handler pool runs the call (KDSoapServer::setHandlerThreadCount)
+    const QByteArray *m_handlerHttpHeaderItems; // while writing the response of the handler pool, instead of m_serverObject's
 
     // Data for the current call (stored here for delayed replies)
     QString m_messageNamespace;
     QString m_method;
+    QByteArray m_metricsOperation; // m_method once the server object handled it, otherwise empty (see writeReply)
+    int m_responseEncoding; // KDSoapHttpCompression::Encoding
+    int m_responseCompressionThreshold;
+
+    // HTTP/2, once the connection switched to it
+    bool m_upgradeToHttp2; // the current request asks for "Upgrade: h2c"
+    KDSoapHttp2Connection *m_http2;
+    QHash<int, Http2Call *> m_http2Calls; // by stream
+    QList<int> m_http2WaitingCalls; // in the admission queue
+    Http2Call *m_http2Call; // being handled, see Http2CallScope
 };
 
 #endif // KDSOAPSERVERSOCKET_P_H
@@ -0,0 +1,282 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPSERVERTASK_H
+#define KDSOAPSERVERTASK_H
+
+#include "KDSoapServerGlobal.h"
+#include <KDSoapClient/KDSoapMessage.h>
+
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <utility>
+
+/**
+ * A SOAP fault, returned by a coroutine method of a server object, using
+ * \code
+ * co_return KDSoapServerFault(QStringLiteral("Server.EntryNotFound"), QStringLiteral("No such employee"));
+ * \endcode
+ * See KDSoapServerObjectInterface::setFault for the meaning of the fields.
+ * \since 2.2
+ */
+class KDSoapServerFault
+{
+public:
+    KDSoapServerFault()
+    {
+    }
+    KDSoapServerFault(const QString &faultCode, const QString &faultString, const QString &faultActor = QString(), const QString &detail = QString())
+        : m_faultCode(faultCode)
+        , m_faultString(faultString)
+        , m_faultActor(faultActor)
+        , m_detail(detail)
+    {
+    }
+
+    QString faultCode() const
+    {
+        return m_faultCode;
+    }
+    QString faultString() const
+    {
+        return m_faultString;
+    }
+    QString faultActor() const
+    {
+        return m_faultActor;
+    }
+    QString detail() const
+    {
+        return m_detail;
+    }
+
+    /**
+     * Returns the fault as a message, for KDSoapServerObjectInterface::sendDelayedResponse.
+     */
+    KDSoapMessage toMessage() const
+    {
+        KDSoapMessage message;
+        message.setFault(true);
+        message.addArgument(QString::fromLatin1("faultcode"), m_faultCode);
+        message.addArgument(QString::fromLatin1("faultstring"), m_faultString);
+        message.addArgument(QString::fromLatin1("faultactor"), m_faultActor);
+        message.addArgument(QString::fromLatin1("detail"), m_detail);
+        return message;
+    }
+
+private:
+    QString m_faultCode;
+    QString m_faultString;
+    QString m_faultActor;
+    QString m_detail;
+};
+
+/**
+ * The return type of the coroutine methods generated by kdwsdl2cpp with the option -server-coroutines.
+ *
+ * The coroutine starts running when the method is called. If it completes without suspending
+ * (no co_await, or only on things which are ready), the response is sent right away, like for a normal method.
+ * Otherwise the generated processRequest() turns the call into a delayed response
+ * (see KDSoapServerObjectInterface::prepareDelayedResponse) and returns, so that the thread
+ * goes on serving the other connections; the response is sent when the coroutine reaches co_return.
+ *
+ * The coroutine is resumed in the thread which wakes it up, typically by emitting the signal
+ * awaited with kdSoapAwaitSignal(); this must be the thread of the server object.
+ * Coroutine methods can therefore not be combined with KDSoapServer::setHandlerThreadCount.
+ *
+ * Requires a C++20 compiler, for the code including this header (the KDSoap libraries don't need it).
+ * \since 2.2
+ */
+template<typename T>
+class KDSoapServerTask
+{
+    struct State
+    {
+        bool ready = false;
+        bool hasFault = false;
+        T value = T();
+        KDSoapServerFault fault;
+        QPointer<QObject> context;
+        std::function<void()> continuation;
+    };
+
+public:
+    class promise_type
+    {
+    public:
+        promise_type()
+            : m_state(std::make_shared<State>())
+        {
+        }
+
+        KDSoapServerTask get_return_object()
+        {
+            return KDSoapServerTask(m_state);
+        }
+        // Start right away, and let the frame go when done: the result lives in the shared state
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_value(T value)
+        {
+            m_state->value = std::move(value);
+            complete();
+        }
+        void return_value(const KDSoapServerFault &fault)
+        {
+            m_state->fault = fault;
+            m_state->hasFault = true;
+            complete();
+        }
+        void unhandled_exception()
+        {
+            // Like an exception thrown from a normal method, from the event loop
+            std::terminate();
+        }
+
+    private:
+        void complete()
+        {
+            m_state->ready = true;
+            if (m_state->continuation) {
+                // Not if the server object is gone in the meantime
+                const std::function<void()> continuation = std::move(m_state->continuation);
+                m_state->continuation = nullptr;
+                if (m_state->context) {
+                    continuation();
+                }
+            }
+        }
+
+        std::shared_ptr<State> m_state;
+    };
+
+    /**
+     * Returns true once the coroutine reached co_return.
+     */
+    bool isReady() const
+    {
+        return m_state->ready;
+    }
+    /**
+     * Returns true if the coroutine returned a KDSoapServerFault.
+     */
+    bool hasFault() const
+    {
+        return m_state->hasFault;
+    }
+    /**
+     * Returns the value of co_return, once ready.
+     */
+    const T &result() const
+    {
+        return m_state->value;
+    }
+    /**
+     * Returns the fault of co_return, once ready.
+     */
+    const KDSoapServerFault &fault() const
+    {
+        return m_state->fault;
+    }
+
+    /**
+     * Calls \p callback with this task once it's ready (right away if it's already ready).
+     * The callback isn't called if \p context is deleted before that.
+     */
+    template<typename Callback>
+    void then(QObject *context, Callback callback)
+    {
+        if (m_state->ready) {
+            callback(*this);
+            return;
+        }
+        m_state->context = context;
+        const KDSoapServerTask self = *this;
+        m_state->continuation = [self, callback]() {
+            callback(self);
+        };
+    }
+
+private:
+    explicit KDSoapServerTask(const std::shared_ptr<State> &state)
+        : m_state(state)
+    {
+    }
+
+    std::shared_ptr<State> m_state;
+};
+
+/**
+ * Awaiter returned by kdSoapAwaitSignal().
+ * \since 2.2
+ */
+template<typename Sender, typename Signal>
+class KDSoapSignalAwaiter
+{
+public:
+    KDSoapSignalAwaiter(Sender *sender, Signal signal)
+        : m_sender(sender)
+        , m_signal(signal)
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        // Single shot: disconnect before resuming, the coroutine might await the same signal again
+        std::shared_ptr<QMetaObject::Connection> connection = std::make_shared<QMetaObject::Connection>();
+        *connection = QObject::connect(m_sender, m_signal, m_sender, [connection, handle]() {
+            QObject::disconnect(*connection);
+            handle.resume();
+        });
+    }
+    void await_resume() const noexcept
+    {
+    }
+
+private:
+    Sender *m_sender;
+    Signal m_signal;
+};
+
+/**
+ * Suspends the coroutine until \p sender emits \p signal, for instance:
+ * \code
+ * QNetworkReply *reply = m_manager.get(request);
+ * co_await kdSoapAwaitSignal(reply, &QNetworkReply::finished);
+ * \endcode
+ * If the sender is deleted before emitting the signal, the coroutine is never resumed
+ * and no response is sent for the call.
+ * \since 2.2
+ */
+template<typename Sender, typename Signal>
+KDSoapSignalAwaiter<Sender, Signal> kdSoapAwaitSignal(Sender *sender, Signal signal)
+{
+    return KDSoapSignalAwaiter<Sender, Signal>(sender, signal);
+}
+
+#endif // __cpp_impl_coroutine
+
+#endif // KDSOAPSERVERTASK_H
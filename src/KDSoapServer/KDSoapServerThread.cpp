@@ -7,6 +7,7 @@
 ** SPDX-License-Identifier: MIT
 **
 ****************************************************************************/
+#include "KDSoapReusePortSocket_p.h"
 #include "KDSoapServer.h"
 #include "KDSoapServerSocket_p.h"
 #include "KDSoapServerThread_p.h"
@@ -20,6 +21,8 @@ KDSoapServerThread::KDSoapServerThread(QObject *parent)
 {
     qRegisterMetaType<KDSoapServer *>("KDSoapServer*");
     qRegisterMetaType<QSemaphore *>("QSemaphore*");
+    qRegisterMetaType<QAtomicInt *>("QAtomicInt*");
+    qRegisterMetaType<KDSoapServerSocket *>("KDSoapServerSocket*");
 }
 
 KDSoapServerThread::~KDSoapServerThread()
@@ -43,6 +46,22 @@ int KDSoapServerThread::socketCount() const
     return 0;
 }
 
+int KDSoapServerThread::inFlightRequests() const
+{
+    if (d) {
+        return d->inFlightRequests();
+    }
+    return 0;
+}
+
+qint64 KDSoapServerThread::recentBusyTime() const
+{
+    if (d) {
+        return d->recentBusyTime();
+    }
+    return 0;
+}
+
 int KDSoapServerThread::socketCountForServer(const KDSoapServer *server) const
 {
     if (d) {
@@ -73,6 +92,24 @@ void KDSoapServerThread::disconnectSocketsForServer(KDSoapServer *server, QSemap
     }
 }
 
+void KDSoapServerThread::startAcceptor(KDSoapServer *server, int socketDescriptor, QSemaphore &semaphore, QAtomicInt &failures)
+{
+    QMetaObject::invokeMethod(d, "startAcceptor", Q_ARG(KDSoapServer *, server), Q_ARG(int, socketDescriptor), Q_ARG(QSemaphore *, &semaphore),
+                              Q_ARG(QAtomicInt *, &failures));
+}
+
+void KDSoapServerThread::stopAcceptor(KDSoapServer *server, QSemaphore &semaphore)
+{
+    QMetaObject::invokeMethod(d, "stopAcceptor", Q_ARG(KDSoapServer *, server), Q_ARG(QSemaphore *, &semaphore));
+}
+
+// The socket was already moved to this thread
+void KDSoapServerThread::adoptSocket(KDSoapServerSocket *socket, KDSoapServer *server)
+{
+    d->addIncomingConnection();
+    QMetaObject::invokeMethod(d, "adoptSocket", Q_ARG(KDSoapServerSocket *, socket), Q_ARG(KDSoapServer *, server));
+}
+
 void KDSoapServerThread::startThread()
 {
     QThread::start();
@@ -100,6 +137,7 @@ KDSoapServerThreadImpl::KDSoapServerThreadImpl()
 
 KDSoapServerThreadImpl::~KDSoapServerThreadImpl()
 {
+    qDeleteAll(m_acceptors.values());
     qDeleteAll(m_socketLists.values());
 }
 
@@ -115,6 +153,28 @@ int KDSoapServerThreadImpl::socketCount()
     return sc;
 }
 
+// Called from other threads too
+int KDSoapServerThreadImpl::inFlightRequests()
+{
+    QMutexLocker lock(&m_socketListMutex);
+    int requests = 0;
+    for (KDSoapSocketList *socketList : qAsConst(m_socketLists)) {
+        requests += socketList->inFlightRequests();
+    }
+    return requests;
+}
+
+// Called from other threads too
+qint64 KDSoapServerThreadImpl::recentBusyTime()
+{
+    QMutexLocker lock(&m_socketListMutex);
+    qint64 busyTime = 0;
+    for (KDSoapSocketList *socketList : qAsConst(m_socketLists)) {
+        busyTime += socketList->recentBusyTime();
+    }
+    return busyTime;
+}
+
 KDSoapSocketList *KDSoapServerThreadImpl::socketListForServer(KDSoapServer *server)
 {
     KDSoapSocketList *sockets = m_socketLists.value(server);
@@ -143,6 +203,36 @@ void KDSoapServerThreadImpl::handleIncomingConnection(int socketDescriptor, KDSo
     m_incomingConnectionCount.fetchAndAddAcquire(-1);
 }
 
+void KDSoapServerThreadImpl::startAcceptor(KDSoapServer *server, int socketDescriptor, QSemaphore *semaphore, QAtomicInt *failures)
+{
+    KDSoapThreadAcceptor *acceptor = new KDSoapThreadAcceptor(this, server);
+    if (acceptor->setSocketDescriptor(socketDescriptor)) {
+        delete m_acceptors.value(server);
+        m_acceptors.insert(server, acceptor);
+    } else {
+        qWarning("KDSoapServer: cannot use listening socket in thread: %s", qPrintable(acceptor->errorString()));
+        KDSoapReusePortSocket::closeSocket(socketDescriptor);
+        delete acceptor;
+        failures->ref();
+    }
+    // release() orders the failure count before the waiting thread's acquire()
+    semaphore->release();
+}
+
+void KDSoapServerThreadImpl::stopAcceptor(KDSoapServer *server, QSemaphore *semaphore)
+{
+    delete m_acceptors.take(server);
+    semaphore->release();
+}
+
+void KDSoapServerThreadImpl::adoptSocket(KDSoapServerSocket *socket, KDSoapServer *server)
+{
+    QMutexLocker lock(&m_socketListMutex);
+    KDSoapSocketList *sockets = socketListForServer(server);
+    sockets->adoptSocket(socket);
+    m_incomingConnectionCount.fetchAndAddAcquire(-1);
+}
+
 void KDSoapServerThreadImpl::quit()
 {
     thread()->quit();
@@ -180,3 +270,24 @@ void KDSoapServerThreadImpl::resetTotalConnectionCountForServer(const KDSoapServ
         sockets->resetTotalConnectionCount();
     }
 }
+
+////
+
+KDSoapThreadAcceptor::KDSoapThreadAcceptor(KDSoapServerThreadImpl *threadImpl, KDSoapServer *server)
+    : QTcpServer(nullptr)
+    , m_threadImpl(threadImpl)
+    , m_server(server)
+{
+    setMaxPendingConnections(1000);
+}
+
+void KDSoapThreadAcceptor::incomingConnection(qintptr socketDescriptor)
+{
+    if (!m_server->acceptConnection()) {
+        KDSoapReusePortSocket::closeSocket(int(socketDescriptor));
+        return;
+    }
+    // Accepted in this thread, no need to go through the thread pool
+    m_threadImpl->addIncomingConnection();
+    m_threadImpl->handleIncomingConnection(int(socketDescriptor), m_server);
+}
@@ -13,9 +13,28 @@
 #include <QHash>
 #include <QMutex>
 #include <QSemaphore>
+#include <QTcpServer>
 #include <QThread>
 class KDSoapServer;
 class KDSoapSocketList;
+class KDSoapServerSocket;
+class KDSoapServerThreadImpl;
+
+// Listening socket owned by a server thread (see KDSoapServer::listenPerThread),
+// connections accepted here are handled in this thread directly.
+class KDSoapThreadAcceptor : public QTcpServer
+{
+    Q_OBJECT
+public:
+    KDSoapThreadAcceptor(KDSoapServerThreadImpl *threadImpl, KDSoapServer *server);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    KDSoapServerThreadImpl *m_threadImpl;
+    KDSoapServer *m_server;
+};
 
 class KDSoapServerThreadImpl : public QObject
 {
@@ -27,10 +46,15 @@ public:
 public Q_SLOTS:
     void handleIncomingConnection(int socketDescriptor, KDSoapServer *server);
     void disconnectSocketsForServer(KDSoapServer *server, QSemaphore *semaphore);
+    void startAcceptor(KDSoapServer *server, int socketDescriptor, QSemaphore *semaphore, QAtomicInt *failures);
+    void stopAcceptor(KDSoapServer *server, QSemaphore *semaphore);
+    void adoptSocket(KDSoapServerSocket *socket, KDSoapServer *server);
     void quit();
 
 public:
     int socketCount();
+    int inFlightRequests();
+    qint64 recentBusyTime();
     int socketCountForServer(const KDSoapServer *server);
     int totalConnectionCountForServer(const KDSoapServer *server);
     void resetTotalConnectionCountForServer(const KDSoapServer *server);
@@ -44,6 +68,9 @@ private:
     SocketLists m_socketLists;
 
     QAtomicInt m_incomingConnectionCount;
+
+    typedef QHash<KDSoapServer *, KDSoapThreadAcceptor *> Acceptors;
+    Acceptors m_acceptors;
 };
 
 class KDSoapServerThread : public QThread
@@ -57,12 +84,17 @@ public:
     void quitThread();
 
     int socketCount() const;
+    int inFlightRequests() const;
+    qint64 recentBusyTime() const;
     int socketCountForServer(const KDSoapServer *server) const;
     int totalConnectionCountForServer(const KDSoapServer *server) const;
     void resetTotalConnectionCountForServer(const KDSoapServer *server);
 
     void disconnectSocketsForServer(KDSoapServer *server, QSemaphore &semaphore);
     void handleIncomingConnection(int socketDescriptor, KDSoapServer *server);
+    void startAcceptor(KDSoapServer *server, int socketDescriptor, QSemaphore &semaphore, QAtomicInt &failures);
+    void stopAcceptor(KDSoapServer *server, QSemaphore &semaphore);
+    void adoptSocket(KDSoapServerSocket *socket, KDSoapServer *server);
 
 protected:
     virtual void run() override;
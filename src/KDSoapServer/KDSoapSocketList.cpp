@@ -8,21 +8,39 @@
 **
 ****************************************************************************/
 #include "KDSoapServer.h"
+#include "KDSoapServerLogger_p.h"
+#include "KDSoapServerMetrics_p.h"
+#include "KDSoapServerSettings_p.h"
 #include "KDSoapServerSocket_p.h"
+#include "KDSoapServerThread_p.h"
 #include "KDSoapSocketList_p.h"
+#include "KDSoapThreadPool.h"
 #include <QDebug>
 
+// The recent busy time is measured over the current window and the previous one
+static const qint64 s_loadWindowMsecs = 1000;
+
 KDSoapSocketList::KDSoapSocketList(KDSoapServer *server)
     : m_server(server)
     , m_serverObject(server->createServerObject())
     , m_totalConnectionCount(0)
+    , m_logRing(server->logger()->createRing())
+    , m_metrics(server->metrics()->createThreadMetrics())
+    , m_inFlightRequests(0)
+    , m_currentBusyTime(0)
+    , m_previousBusyTime(0)
 {
     Q_ASSERT(m_server);
     Q_ASSERT(m_serverObject);
+    m_clock.start();
+    connect(&m_idleTimeouts, &KDSoapTimerWheel::expired, this, &KDSoapSocketList::slotIdleTimeout);
+    connect(&m_queueTimeouts, &KDSoapTimerWheel::expired, this, &KDSoapSocketList::slotQueueTimeout);
 }
 
 KDSoapSocketList::~KDSoapSocketList()
 {
+    m_logRing->retire();
+    m_metrics->retire();
     delete m_serverObject;
 }
 
@@ -30,13 +48,22 @@ KDSoapServerSocket *KDSoapSocketList::handleIncomingConnection(int socketDescrip
 {
     KDSoapServerSocket *socket = new KDSoapServerSocket(this, m_serverObject);
     socket->setSocketDescriptor(socketDescriptor);
+    // Each response is written in one go (see KDSoapServerSocket::writeXML), Nagle's algorithm would only delay it
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
 
 #ifndef QT_NO_SSL
-    if (m_server->features() & KDSoapServer::Ssl) {
+    const KDSoapServerSettingsPtr settings = m_server->settings();
+    if (settings->features & KDSoapServer::Ssl) {
         // We could call a virtual "m_server->setSslConfiguration(socket)" here,
         // if more control is needed (e.g. due to SNI)
-        if (!m_server->sslConfiguration().isNull()) {
-            socket->setSslConfiguration(m_server->sslConfiguration());
+        if (!settings->sslConfiguration.isNull()) {
+            socket->setSslConfiguration(settings->sslConfiguration);
+        }
+        if (settings->features & KDSoapServer::Http2) {
+            // ALPN: the clients which picked "h2" start with the HTTP/2 connection preface
+            QSslConfiguration sslConfiguration = socket->sslConfiguration();
+            sslConfiguration.setAllowedNextProtocols(QList<QByteArray>() << QByteArrayLiteral("h2") << QSslConfiguration::NextProtocolHttp1_1);
+            socket->setSslConfiguration(sslConfiguration);
         }
         socket->startServerEncryption();
     }
@@ -45,13 +72,80 @@ KDSoapServerSocket *KDSoapSocketList::handleIncomingConnection(int socketDescrip
     QObject::connect(socket, &KDSoapServerSocket::disconnected, socket, &KDSoapServerSocket::deleteLater);
     m_sockets.insert(socket);
     connect(socket, &KDSoapServerSocket::socketDeleted, this, &KDSoapSocketList::socketDeleted);
+    m_server->connectionOpened();
+    scheduleIdleTimeout(socket); // until the first request
     return socket;
 }
 
 void KDSoapSocketList::socketDeleted(KDSoapServerSocket *socket)
 {
     // qDebug() << Q_FUNC_INFO;
-    m_sockets.remove(socket);
+    // Emitted from the socket's destructor, its members are still valid
+    if (m_sockets.remove(socket)) {
+        m_server->connectionClosed();
+        m_idleTimeouts.cancel(socket);
+        m_queueTimeouts.cancel(socket);
+        if (socket->isRequestInFlight()) {
+            requestFinished();
+        }
+    }
+}
+
+void KDSoapSocketList::scheduleIdleTimeout(KDSoapServerSocket *socket)
+{
+    const int timeout = m_server->settings()->idleTimeout;
+    if (timeout >= 0) {
+        m_idleTimeouts.schedule(socket, timeout);
+    }
+}
+
+void KDSoapSocketList::slotIdleTimeout(KDSoapServerSocket *socket)
+{
+    const int timeout = m_server->settings()->idleTimeout;
+    if (timeout < 0 || !socket->isIdle()) {
+        return; // scheduled again when the current request is done
+    }
+    // Data received since then (e.g. an incomplete request) counts as activity
+    const qint64 idleTime = m_clock.elapsed() - socket->lastActivity();
+    if (idleTime < timeout) {
+        m_idleTimeouts.schedule(socket, int(timeout - idleTime));
+        return;
+    }
+    if (socket->m_doDebug) {
+        qDebug() << "Closing idle connection" << socket;
+    }
+    socket->disconnectFromHost();
+}
+
+void KDSoapSocketList::scheduleQueueTimeout(KDSoapServerSocket *socket)
+{
+    const int timeout = m_server->settings()->requestQueueTimeout;
+    if (timeout >= 0) {
+        m_queueTimeouts.schedule(socket, timeout);
+    }
+}
+
+void KDSoapSocketList::scheduleQueueTimeout(KDSoapServerSocket *socket, int msecs)
+{
+    m_queueTimeouts.schedule(socket, msecs);
+}
+
+void KDSoapSocketList::cancelQueueTimeout(KDSoapServerSocket *socket)
+{
+    m_queueTimeouts.cancel(socket);
+}
+
+void KDSoapSocketList::slotQueueTimeout(KDSoapServerSocket *socket)
+{
+    if (socket->m_doDebug) {
+        qDebug() << "Request waited too long in the admission queue" << socket;
+    }
+    socket->requestQueueTimedOut();
+}
+
+void KDSoapSocketList::log(const KDSoapLogRecord &record)
+{
+    m_logRing->push(record); // dropped if full, and counted
 }
 
 int KDSoapSocketList::socketCount() const
@@ -81,3 +175,97 @@ void KDSoapSocketList::resetTotalConnectionCount()
 {
     m_totalConnectionCount = 0;
 }
+
+void KDSoapSocketList::requestStarted()
+{
+    m_inFlightRequests.ref();
+}
+
+void KDSoapSocketList::requestFinished()
+{
+    m_inFlightRequests.deref();
+}
+
+int KDSoapSocketList::inFlightRequests() const
+{
+    return m_inFlightRequests.loadAcquire();
+}
+
+void KDSoapSocketList::addBusyTime(qint64 nsecs)
+{
+    QMutexLocker lock(&m_loadMutex);
+    if (!m_loadWindow.isValid()) {
+        m_loadWindow.start();
+    } else {
+        const qint64 elapsed = m_loadWindow.elapsed();
+        if (elapsed >= s_loadWindowMsecs) {
+            m_previousBusyTime = elapsed < 2 * s_loadWindowMsecs ? m_currentBusyTime : 0;
+            m_currentBusyTime = 0;
+            m_loadWindow.start();
+        }
+    }
+    m_currentBusyTime += nsecs / 1000;
+}
+
+qint64 KDSoapSocketList::recentBusyTime() const
+{
+    QMutexLocker lock(&m_loadMutex);
+    if (!m_loadWindow.isValid()) {
+        return 0;
+    }
+    // The windows are only rotated by addBusyTime, take into account that this thread might have been idle since
+    const qint64 elapsed = m_loadWindow.elapsed();
+    if (elapsed >= 2 * s_loadWindowMsecs) {
+        return 0;
+    }
+    if (elapsed >= s_loadWindowMsecs) {
+        return m_currentBusyTime;
+    }
+    return m_previousBusyTime + m_currentBusyTime;
+}
+
+// Moves an idle socket to a less loaded thread, if KDSoapThreadPool thinks it's worth it.
+// Called in the socket's thread, outside of any socket signal emission.
+bool KDSoapSocketList::migrateSocket(KDSoapServerSocket *socket)
+{
+    KDSoapThreadPool *threadPool = m_server->threadPool();
+    if (!threadPool || !threadPool->isIdleConnectionMigrationEnabled()) {
+        return false;
+    }
+    KDSoapServerThread *targetThread = threadPool->migrationTarget(QThread::currentThread());
+    if (!targetThread) {
+        return false;
+    }
+    m_sockets.remove(socket);
+    m_idleTimeouts.cancel(socket);
+    disconnect(socket, &KDSoapServerSocket::socketDeleted, this, &KDSoapSocketList::socketDeleted);
+    // Until the target thread adopts it, the socket must neither handle requests (it would use our server object)
+    // nor be deleted (the target thread would then use a dangling pointer)
+    socket->m_socketEnabled = false;
+    QObject::disconnect(socket, &KDSoapServerSocket::disconnected, socket, &KDSoapServerSocket::deleteLater);
+    socket->moveToThread(targetThread);
+    targetThread->adoptSocket(socket, m_server);
+    return true;
+}
+
+// Called in the target thread, see migrateSocket
+void KDSoapSocketList::adoptSocket(KDSoapServerSocket *socket)
+{
+    socket->m_owner = this;
+    socket->m_serverObject = m_serverObject;
+    m_sockets.insert(socket);
+    connect(socket, &KDSoapServerSocket::socketDeleted, this, &KDSoapSocketList::socketDeleted);
+    QObject::connect(socket, &KDSoapServerSocket::disconnected, socket, &KDSoapServerSocket::deleteLater);
+    if (socket->state() != QAbstractSocket::ConnectedState) {
+        socket->deleteLater(); // disconnected while in transit
+        return;
+    }
+    socket->m_socketEnabled = true;
+    // The clocks of the two lists don't have the same reference
+    socket->m_lastActivity = m_clock.elapsed();
+    scheduleIdleTimeout(socket);
+    if (socket->bytesAvailable() > 0) {
+        // Data arrived while in transit. Queued, since the caller holds the thread's socket list mutex.
+        QMetaObject::invokeMethod(socket, "slotReadyRead", Qt::QueuedConnection);
+    }
+}
@@ -10,14 +10,22 @@
 #ifndef KDSOAPSOCKETLIST_P_H
 #define KDSOAPSOCKETLIST_P_H
 
+#include <QElapsedTimer>
+#include <QMutex>
 #include <QObject>
 #include <QSet>
+#include <QSharedPointer>
+
+#include "KDSoapTimerWheel_p.h"
 QT_BEGIN_NAMESPACE
 class QTcpSocket;
 class QObject;
 QT_END_NAMESPACE
 class KDSoapServer;
 class KDSoapServerSocket;
+class KDSoapLogRing;
+class KDSoapThreadMetrics;
+struct KDSoapLogRecord;
 
 class KDSoapSocketList : public QObject
 {
@@ -35,6 +43,36 @@ public:
     void increaseConnectionCount();
     void resetTotalConnectionCount();
 
+    // Load statistics for KDSoapThreadPool: updated in this thread, read from other threads
+    void requestStarted();
+    void requestFinished();
+    void addBusyTime(qint64 nsecs);
+    int inFlightRequests() const;
+    qint64 recentBusyTime() const; // microseconds
+
+    bool migrateSocket(KDSoapServerSocket *socket);
+    void adoptSocket(KDSoapServerSocket *socket);
+
+    // Idle timeout (KDSoapServer::setIdleTimeout), for all the sockets of this list
+    void scheduleIdleTimeout(KDSoapServerSocket *socket);
+    // Deadline of requests waiting in the admission queue (KDSoapServer::setRequestQueueTimeout)
+    void scheduleQueueTimeout(KDSoapServerSocket *socket);
+    void scheduleQueueTimeout(KDSoapServerSocket *socket, int msecs); // for the remaining time of a request
+    void cancelQueueTimeout(KDSoapServerSocket *socket);
+
+    qint64 elapsedMsecs() const
+    {
+        return m_clock.elapsed();
+    }
+
+    // Queues a log entry for the server's logger thread, without locking
+    void log(const KDSoapLogRecord &record);
+    // For KDSoapServer::setMetricsPath
+    KDSoapThreadMetrics *metrics() const
+    {
+        return m_metrics.data();
+    }
+
     KDSoapServer *server() const
     {
         return m_server;
@@ -43,11 +81,26 @@ public:
 public Q_SLOTS:
     void socketDeleted(KDSoapServerSocket *socket);
 
+private Q_SLOTS:
+    void slotIdleTimeout(KDSoapServerSocket *socket);
+    void slotQueueTimeout(KDSoapServerSocket *socket);
+
 private:
     KDSoapServer *m_server;
     QObject *m_serverObject;
     QSet<KDSoapServerSocket *> m_sockets;
     QAtomicInt m_totalConnectionCount;
+    KDSoapTimerWheel m_idleTimeouts;
+    KDSoapTimerWheel m_queueTimeouts;
+    QSharedPointer<KDSoapLogRing> m_logRing; // shared with the logger, which might outlive us or not
+    QSharedPointer<KDSoapThreadMetrics> m_metrics; // same, with KDSoapServerMetrics
+    QElapsedTimer m_clock;
+
+    QAtomicInt m_inFlightRequests;
+    mutable QMutex m_loadMutex;
+    QElapsedTimer m_loadWindow;
+    qint64 m_currentBusyTime;
+    qint64 m_previousBusyTime;
 };
 
 #endif // KDSOAPSOCKETLIST_P_H
@@ -0,0 +1,186 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapStreamingResponse.h"
+#include "KDSoapServerSocket_p.h"
+#include <KDSoapClient/KDSoapMessage.h>
+#include <KDSoapClient/KDSoapMessageWriter_p.h>
+#include <QDebug>
+
+// Size of the chunks sent to the client (unless the response ends before)
+static const int s_chunkSize = 16 * 1024;
+// isBufferFull() above this, readyForMoreData() below the low mark
+static const qint64 s_highWaterMark = 256 * 1024;
+static const qint64 s_lowWaterMark = 64 * 1024;
+
+namespace {
+// Collects the output of the XML writer until it's sent as a chunk
+class ChunkBuffer : public QIODevice
+{
+public:
+    explicit ChunkBuffer(QByteArray *buffer)
+        : m_buffer(buffer)
+    {
+        open(QIODevice::WriteOnly);
+    }
+    bool isSequential() const override
+    {
+        return true;
+    }
+
+protected:
+    qint64 readData(char *, qint64) override
+    {
+        return -1;
+    }
+    qint64 writeData(const char *data, qint64 len) override
+    {
+        m_buffer->append(data, int(len));
+        return len;
+    }
+
+private:
+    QByteArray *m_buffer;
+};
+}
+
+class KDSoapStreamingResponse::Private
+{
+public:
+    Private(KDSoapServerSocket *socket, KDSoapServerObjectInterface *serverObjectInterface)
+        : m_socket(socket)
+        , m_serverObjectInterface(serverObjectInterface)
+        , m_device(&m_pending)
+        , m_writer(&m_device)
+        , m_started(false)
+        , m_finished(false)
+        , m_waitingForSpace(false)
+    {
+        m_pending.reserve(s_chunkSize + 1024);
+    }
+
+    KDSoapServerSocket *m_socket;
+    KDSoapServerObjectInterface *m_serverObjectInterface;
+    QByteArray m_pending;
+    ChunkBuffer m_device;
+    KDSoapMessageStreamWriter m_writer;
+    bool m_started;
+    bool m_finished;
+    bool m_waitingForSpace;
+};
+
+KDSoapStreamingResponse::KDSoapStreamingResponse(KDSoapServerSocket *socket, KDSoapServerObjectInterface *serverObjectInterface)
+    : QObject(socket)
+    , d(new Private(socket, serverObjectInterface))
+{
+    connect(socket, &QIODevice::bytesWritten, this, &KDSoapStreamingResponse::slotBytesWritten);
+    connect(socket, &QAbstractSocket::disconnected, this, &KDSoapStreamingResponse::slotDisconnected);
+}
+
+KDSoapStreamingResponse::~KDSoapStreamingResponse()
+{
+    delete d;
+}
+
+void KDSoapStreamingResponse::start(const KDSoapMessage &response)
+{
+    if (d->m_started || d->m_finished) {
+        qWarning("KDSoapStreamingResponse::start: already started");
+        return;
+    }
+    d->m_started = true;
+    d->m_socket->writeStreamingResponseHeaders();
+    KDSoapMessageWriter msgWriter;
+    QString responseName;
+    KDSoapHeaders responseHeaders;
+    d->m_socket->prepareMessageWriter(d->m_serverObjectInterface, response, &msgWriter, &responseName, &responseHeaders);
+    d->m_writer.writeStart(msgWriter, response, responseName, responseHeaders);
+    sendChunk();
+}
+
+void KDSoapStreamingResponse::writeElement(const KDSoapValue &value)
+{
+    if (!d->m_started || d->m_finished) {
+        qWarning("KDSoapStreamingResponse::writeElement: start() must be called first");
+        return;
+    }
+    d->m_writer.writeChild(value);
+    if (d->m_pending.size() >= s_chunkSize) {
+        sendChunk();
+    }
+}
+
+bool KDSoapStreamingResponse::isBufferFull() const
+{
+    if (d->m_socket->bytesToWrite() > s_highWaterMark) {
+        d->m_waitingForSpace = true;
+        return true;
+    }
+    return false;
+}
+
+void KDSoapStreamingResponse::finish()
+{
+    if (d->m_finished) {
+        return;
+    }
+    if (!d->m_started) {
+        start(KDSoapMessage());
+    }
+    d->m_writer.writeEnd();
+    sendChunk();
+    d->m_socket->write("0\r\n\r\n"); // last chunk, no trailers
+    d->m_finished = true;
+    d->m_socket->streamingResponseFinished();
+    deleteLater();
+}
+
+void KDSoapStreamingResponse::abort()
+{
+    if (d->m_finished) {
+        return;
+    }
+    d->m_finished = true;
+    // The socket is deleted once disconnected, and this object with it
+    d->m_socket->abort();
+}
+
+void KDSoapStreamingResponse::sendChunk()
+{
+    if (d->m_pending.isEmpty()) {
+        return;
+    }
+    // chunk-size CRLF chunk-data CRLF, in one write
+    QByteArray chunk;
+    chunk.reserve(d->m_pending.size() + 12);
+    chunk += QByteArray::number(d->m_pending.size(), 16);
+    chunk += "\r\n";
+    chunk += d->m_pending;
+    chunk += "\r\n";
+    d->m_socket->write(chunk);
+    d->m_pending.resize(0); // keeps the capacity
+}
+
+void KDSoapStreamingResponse::slotBytesWritten()
+{
+    if (d->m_waitingForSpace && !d->m_finished && d->m_socket->bytesToWrite() <= s_lowWaterMark) {
+        d->m_waitingForSpace = false;
+        emit readyForMoreData();
+    }
+}
+
+void KDSoapStreamingResponse::slotDisconnected()
+{
+    if (!d->m_finished) {
+        d->m_finished = true;
+        emit aborted();
+    }
+}
+
+#include "moc_KDSoapStreamingResponse.cpp"
@@ -0,0 +1,99 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPSTREAMINGRESPONSE_H
+#define KDSOAPSTREAMINGRESPONSE_H
+
+#include "KDSoapServerGlobal.h"
+#include <QtCore/QObject>
+
+class KDSoapMessage;
+class KDSoapValue;
+class KDSoapServerSocket;
+class KDSoapServerObjectInterface;
+
+/**
+ * A response which is sent to the client while it's being generated, for very large responses.
+ *
+ * Instead of filling the whole response message in processRequest(), call
+ * KDSoapServerObjectInterface::prepareStreamingResponse(), then start() and writeElement()
+ * for each child element of the response, and finally finish().
+ * The response is sent with "Transfer-Encoding: chunked", so its size doesn't need to be known in advance,
+ * and only the data which wasn't sent yet is kept in memory.
+ *
+ * When the client reads slower than the elements are written, isBufferFull() returns true:
+ * stop writing and continue once readyForMoreData() is emitted. This way, the response
+ * can be generated from the event loop (like a delayed response), without holding the whole response in memory.
+ *
+ * Since the HTTP status is sent at the start, it's not possible to send a fault after start().
+ * In case of errors, call abort().
+ *
+ * The object is owned by the connection: it's deleted after finish(), or when the connection is closed
+ * (then aborted() is emitted first). Use a QPointer if you keep it around.
+ * \since 2.2
+ */
+class KDSOAPSERVER_EXPORT KDSoapStreamingResponse : public QObject
+{
+    Q_OBJECT
+public:
+    ~KDSoapStreamingResponse();
+
+    /**
+     * Sends the HTTP headers, the SOAP envelope and the beginning of \p response:
+     * its name (the name of the method by default, as for normal responses), namespace, attributes
+     * and children. The elements written later with writeElement() come after its children.
+     */
+    void start(const KDSoapMessage &response);
+
+    /**
+     * Writes one more child element of the response.
+     */
+    void writeElement(const KDSoapValue &value);
+
+    /**
+     * Returns true when enough data is waiting to be sent to the client. Stop calling writeElement()
+     * until readyForMoreData() is emitted.
+     */
+    bool isBufferFull() const;
+
+    /**
+     * Ends the response. The object will be deleted.
+     */
+    void finish();
+
+    /**
+     * Closes the connection without completing the response, so that the client sees an error.
+     * The object will be deleted.
+     */
+    void abort();
+
+Q_SIGNALS:
+    /**
+     * Emitted when the data written so far was sent, after isBufferFull() returned true.
+     */
+    void readyForMoreData();
+
+    /**
+     * Emitted when the connection was closed before finish() was called.
+     */
+    void aborted();
+
+private Q_SLOTS:
+    void slotBytesWritten();
+    void slotDisconnected();
+
+private:
+    friend class KDSoapServerSocket;
+    KDSoapStreamingResponse(KDSoapServerSocket *socket, KDSoapServerObjectInterface *serverObjectInterface);
+    void sendChunk();
+    class Private;
+    Private *const d;
+};
+
+#endif // KDSOAPSTREAMINGRESPONSE_H
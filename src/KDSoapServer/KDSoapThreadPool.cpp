@@ -8,22 +8,37 @@
 **
 ****************************************************************************/
 #include "KDSoapThreadPool.h"
+#include "KDSoapReusePortSocket_p.h"
 #include "KDSoapServerThread_p.h"
 #include <QDebug>
 
+// A request in progress (or waiting for a delayed response) counts like this much recent processing time, in microseconds
+static const qint64 s_inFlightRequestCost = 50000;
+// Minimum load difference between two threads for moving a connection, so that connections don't move back and forth
+static const qint64 s_migrationThreshold = 2 * s_inFlightRequestCost;
+
+static qint64 threadLoad(const KDSoapServerThread *thread)
+{
+    return thread->inFlightRequests() * s_inFlightRequestCost + thread->recentBusyTime();
+}
+
 class KDSoapThreadPool::Private
 {
 public:
     Private()
         : m_maxThreadCount(QThread::idealThreadCount())
+        , m_idleConnectionMigration(0)
     {
     }
 
     KDSoapServerThread *chooseNextThread();
+    KDSoapServerThread *createThread();
 
     int m_maxThreadCount;
+    QAtomicInt m_idleConnectionMigration;
     typedef QList<KDSoapServerThread *> ThreadCollection;
-    ThreadCollection m_threads;
+    ThreadCollection m_threads; // only modified in the pool's thread, with m_threadsMutex locked
+    QMutex m_threadsMutex;
 };
 
 KDSoapThreadPool::KDSoapThreadPool(QObject *parent)
@@ -56,26 +71,37 @@ int KDSoapThreadPool::maxThreadCount() const
     return d->m_maxThreadCount;
 }
 
+void KDSoapThreadPool::setIdleConnectionMigrationEnabled(bool enabled)
+{
+    d->m_idleConnectionMigration.storeRelease(enabled ? 1 : 0);
+}
+
+bool KDSoapThreadPool::isIdleConnectionMigrationEnabled() const
+{
+    return d->m_idleConnectionMigration.loadAcquire() != 0;
+}
+
 KDSoapServerThread *KDSoapThreadPool::Private::chooseNextThread()
 {
     KDSoapServerThread *chosenThread = nullptr;
     // Try to pick an existing thread
+    qint64 minLoad = 0;
     int minSocketCount = 0;
     KDSoapServerThread *bestThread = nullptr;
     for (KDSoapServerThread *thr : qAsConst(m_threads)) {
-        // We look at the amount of sockets connected to each thread, and pick the less busy one.
-        // Note that this isn't fully accurate, due to Keep-Alive: it's possible for long-term
-        // idling clients to be all on one thread, and active clients on another one, and this
-        // wouldn't use CPU fully. But this is probably still better than no keep-alive (much more
-        // connection overhead). Maybe we have to look at sockets who made a request in the last
-        // N seconds... but the past is no indication of the future.
         const int sc = thr->socketCount();
         if (sc == 0) { // Perfect, an idling thread
             // qDebug() << "Picked" << thr << "since it was idling";
             chosenThread = thr;
             break;
         }
-        if (!bestThread || sc < minSocketCount) {
+        // The number of sockets alone isn't a good indication, due to Keep-Alive: long-term idling
+        // clients could all be on one thread, and active clients on another one.
+        // So we look at the requests in progress and the recent processing time of each thread,
+        // and only use the number of sockets when that doesn't make a difference.
+        const qint64 load = threadLoad(thr);
+        if (!bestThread || load < minLoad || (load == minLoad && sc < minSocketCount)) {
+            minLoad = load;
             minSocketCount = sc;
             bestThread = thr;
         }
@@ -88,14 +114,43 @@ KDSoapServerThread *KDSoapThreadPool::Private::chooseNextThread()
 
     // Create new thread
     if (!chosenThread) {
-        chosenThread = new KDSoapServerThread(nullptr);
-        // qDebug() << "Creating KDSoapServerThread" << chosenThread;
-        m_threads.append(chosenThread);
-        chosenThread->startThread();
+        chosenThread = createThread();
     }
     return chosenThread;
 }
 
+KDSoapServerThread *KDSoapThreadPool::Private::createThread()
+{
+    KDSoapServerThread *thread = new KDSoapServerThread(nullptr);
+    // qDebug() << "Creating KDSoapServerThread" << thread;
+    thread->startThread();
+    QMutexLocker lock(&m_threadsMutex);
+    m_threads.append(thread);
+    return thread;
+}
+
+// Called from a server thread, when one of its connections is idle
+KDSoapServerThread *KDSoapThreadPool::migrationTarget(QThread *currentThread)
+{
+    QMutexLocker lock(&d->m_threadsMutex);
+    qint64 currentLoad = -1;
+    qint64 minLoad = 0;
+    KDSoapServerThread *target = nullptr;
+    for (KDSoapServerThread *thr : qAsConst(d->m_threads)) {
+        const qint64 load = threadLoad(thr);
+        if (thr == currentThread) {
+            currentLoad = load;
+        } else if (!target || load < minLoad) {
+            minLoad = load;
+            target = thr;
+        }
+    }
+    if (target && currentLoad - minLoad > s_migrationThreshold) {
+        return target;
+    }
+    return nullptr;
+}
+
 void KDSoapThreadPool::handleIncomingConnection(int socketDescriptor, KDSoapServer *server)
 {
     // First, pick or create a thread.
@@ -105,6 +160,44 @@ void KDSoapThreadPool::handleIncomingConnection(int socketDescriptor, KDSoapServ
     chosenThread->handleIncomingConnection(socketDescriptor, server);
 }
 
+bool KDSoapThreadPool::startAcceptors(KDSoapServer *server, const QHostAddress &address, quint16 port)
+{
+    // One listening socket per thread, so all threads have to exist upfront
+    const int threadCount = qMax(1, d->m_maxThreadCount);
+    while (d->m_threads.count() < threadCount) {
+        d->createThread();
+    }
+    QSemaphore readyThreads;
+    QAtomicInt failures;
+    int started = 0;
+    for (KDSoapServerThread *thread : qAsConst(d->m_threads)) {
+        QString errorString;
+        const int socketDescriptor = KDSoapReusePortSocket::createListeningSocket(address, port, &errorString);
+        if (socketDescriptor == -1) {
+            qWarning("KDSoapServer: failed to listen on %s port %d: %s", qPrintable(address.toString()), port, qPrintable(errorString));
+            break;
+        }
+        thread->startAcceptor(server, socketDescriptor, readyThreads, failures);
+        ++started;
+    }
+    readyThreads.acquire(started);
+    // A thread that could not use its socket still releases the semaphore, so check the failure count too
+    if (started < d->m_threads.count() || failures.loadAcquire() > 0) {
+        stopAcceptors(server);
+        return false;
+    }
+    return true;
+}
+
+void KDSoapThreadPool::stopAcceptors(KDSoapServer *server)
+{
+    QSemaphore readyThreads;
+    for (KDSoapServerThread *thread : qAsConst(d->m_threads)) {
+        thread->stopAcceptor(server, readyThreads);
+    }
+    readyThreads.acquire(d->m_threads.count());
+}
+
 int KDSoapThreadPool::numConnectedSockets(const KDSoapServer *server) const
 {
     int sc = 0;
@@ -13,7 +13,12 @@
 #include "KDSoapServerGlobal.h"
 #include <QtCore/QHash>
 #include <QtCore/QObject>
+#include <QtNetwork/QHostAddress>
 class KDSoapServer;
+class KDSoapServerThread;
+QT_BEGIN_NAMESPACE
+class QThread;
+QT_END_NAMESPACE
 
 /**
  * Pool of threads that can be used to handle SOAP requests in a SOAP server.
@@ -22,6 +27,10 @@ class KDSoapServer;
  * In case the server application provides different services on different ports,
  * it can decide to use the same thread pool for both services, in order
  * to always respect the maximum number of threads globally.
+ *
+ * New connections go to an idle thread if there is one (or to a new thread, until
+ * the maximum number of threads is reached), otherwise to the least loaded thread,
+ * based on the requests in progress and on the recent processing time of each thread.
  */
 class KDSOAPSERVER_EXPORT KDSoapThreadPool : public QObject
 {
@@ -50,6 +59,24 @@ public:
      */
     int maxThreadCount() const;
 
+    /**
+     * Enables moving idle keep-alive connections from a busy thread to a less loaded one.
+     * Without this, a connection stays in the thread where it was accepted, so that with
+     * long-lived connections (e.g. from a load balancer) one thread can be saturated while
+     * others are idle.
+     * A connection is only moved between two requests, and only if it's not encrypted.
+     * The server object of the new thread handles the subsequent requests.
+     * This is disabled by default.
+     * \since 2.2
+     */
+    void setIdleConnectionMigrationEnabled(bool enabled);
+
+    /**
+     * Returns true if setIdleConnectionMigrationEnabled(true) was called.
+     * \since 2.2
+     */
+    bool isIdleConnectionMigrationEnabled() const;
+
     /**
      * Returns the number of connected sockets for a given server
      */
@@ -75,7 +102,11 @@ public:
 
 private:
     friend class KDSoapServer;
+    friend class KDSoapSocketList;
     void handleIncomingConnection(int socketDescriptor, KDSoapServer *server);
+    KDSoapServerThread *migrationTarget(QThread *currentThread);
+    bool startAcceptors(KDSoapServer *server, const QHostAddress &address, quint16 port);
+    void stopAcceptors(KDSoapServer *server);
     class Private;
     Private *const d;
 };
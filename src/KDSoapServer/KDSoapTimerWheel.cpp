@@ -0,0 +1,75 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#include "KDSoapTimerWheel_p.h"
+#include <QTimerEvent>
+
+static const int s_slotCount = 64;
+static const int s_tickMsecs = 100;
+
+KDSoapTimerWheel::KDSoapTimerWheel(QObject *parent)
+    : QObject(parent)
+    , m_slots(s_slotCount)
+    , m_currentSlot(0)
+{
+}
+
+void KDSoapTimerWheel::schedule(KDSoapServerSocket *socket, int msecs)
+{
+    cancel(socket);
+    const int ticks = qMax(1, (msecs + s_tickMsecs - 1) / s_tickMsecs);
+    Entry entry;
+    entry.slot = (m_currentSlot + ticks) % s_slotCount;
+    entry.rounds = (ticks - 1) / s_slotCount;
+    m_slots[entry.slot].insert(socket);
+    m_entries.insert(socket, entry);
+    if (!m_timer.isActive()) {
+        m_timer.start(s_tickMsecs, Qt::CoarseTimer, this);
+    }
+}
+
+void KDSoapTimerWheel::cancel(KDSoapServerSocket *socket)
+{
+    const auto it = m_entries.find(socket);
+    if (it != m_entries.end()) {
+        m_slots[it->slot].remove(socket);
+        m_entries.erase(it);
+    }
+}
+
+void KDSoapTimerWheel::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() != m_timer.timerId()) {
+        QObject::timerEvent(event);
+        return;
+    }
+    m_currentSlot = (m_currentSlot + 1) % s_slotCount;
+    QVector<KDSoapServerSocket *> expiredSockets;
+    QSet<KDSoapServerSocket *> &slot = m_slots[m_currentSlot];
+    for (auto it = slot.begin(); it != slot.end();) {
+        Entry &entry = m_entries[*it];
+        if (entry.rounds > 0) {
+            --entry.rounds;
+            ++it;
+        } else {
+            expiredSockets.append(*it);
+            m_entries.remove(*it);
+            it = slot.erase(it);
+        }
+    }
+    if (m_entries.isEmpty()) {
+        m_timer.stop();
+    }
+    // Emitted last, since the receiver can schedule or cancel timeouts
+    for (KDSoapServerSocket *socket : qAsConst(expiredSockets)) {
+        emit expired(socket);
+    }
+}
+
+#include "moc_KDSoapTimerWheel_p.cpp"
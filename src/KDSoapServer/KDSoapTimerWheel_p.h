@@ -0,0 +1,62 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+#ifndef KDSOAPTIMERWHEEL_P_H
+#define KDSOAPTIMERWHEEL_P_H
+
+#include <QBasicTimer>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QVector>
+
+class KDSoapServerSocket;
+
+/**
+ * \internal
+ * Timeouts for many sockets with a single timer: a hashed timer wheel.
+ * Each slot of the wheel holds the sockets expiring when the wheel gets there,
+ * so scheduling, rescheduling and cancelling are O(1), and so is each tick.
+ * The precision is one tick.
+ */
+class KDSoapTimerWheel : public QObject
+{
+    Q_OBJECT
+public:
+    explicit KDSoapTimerWheel(QObject *parent = nullptr);
+
+    /// Schedules (or reschedules) the timeout of \p socket, in \p msecs
+    void schedule(KDSoapServerSocket *socket, int msecs);
+    /// Cancels the timeout of \p socket, if any
+    void cancel(KDSoapServerSocket *socket);
+
+    bool isEmpty() const
+    {
+        return m_entries.isEmpty();
+    }
+
+Q_SIGNALS:
+    void expired(KDSoapServerSocket *socket);
+
+protected:
+    void timerEvent(QTimerEvent *event) override;
+
+private:
+    struct Entry
+    {
+        int slot;
+        int rounds; // full turns of the wheel left
+    };
+    QVector<QSet<KDSoapServerSocket *>> m_slots;
+    QHash<KDSoapServerSocket *, Entry> m_entries;
+    int m_currentSlot;
+    QBasicTimer m_timer;
+};
+
+#endif // KDSOAPTIMERWHEEL_P_H
@@ -11,6 +11,7 @@
 #include "KDSoapAuthentication.h"
 #include "KDSoapClientInterface.h"
 #include "KDSoapMessage.h"
+#include "KDSoapMessageStreamReader.h"
 #include "KDSoapNamespaceManager.h"
 #include "KDSoapPendingCallWatcher.h"
 #include "KDSoapServer.h"
@@ -363,6 +364,43 @@ private Q_SLOTS:
         Q_UNUSED(sessionId);
     }
 
+    // Test streaming a large reply, handling its items while it's being downloaded
+    void testStreamReader()
+    {
+        const int itemCount = 10000;
+        QByteArray response = QByteArray(xmlEnvBegin11()) + "><soap:Body><kdab:getItemsResponse xmlns:kdab=\"http://www.kdab.com/xml/MyWsdl/\">";
+        for (int i = 0; i < itemCount; ++i) {
+            response += "<kdab:item><kdab:id>" + QByteArray::number(i) + "</kdab:id></kdab:item>";
+        }
+        response += "<kdab:total>" + QByteArray::number(itemCount) + "</kdab:total></kdab:getItemsResponse></soap:Body>" + xmlEnvEnd();
+        HttpServerThread server(response, HttpServerThread::Public);
+        KDSoapClientInterface client(server.endPoint(), countryMessageNamespace());
+
+        KDSoapMessageStreamReader streamReader;
+        int count = 0;
+        bool inOrder = true;
+        QVERIFY(streamReader.addElementPath(QString::fromLatin1("Body/getItemsResponse/item"), [&](const KDSoapValue &item) {
+            inOrder = inOrder && item.childValues().child(QLatin1String("id")).value().toInt() == count;
+            ++count;
+        }));
+        KDSoapPendingCall call = client.asyncCall(QLatin1String("getItems"), countryMessage());
+        call.setStreamReader(&streamReader);
+        KDSoapPendingCallWatcher watcher(call);
+        QEventLoop eventLoop;
+        connect(&watcher, &KDSoapPendingCallWatcher::finished, &eventLoop, &QEventLoop::quit);
+        eventLoop.exec();
+
+        const KDSoapMessage message = watcher.returnMessage();
+        QVERIFY2(!message.isFault(), qPrintable(message.faultAsString()));
+        QCOMPARE(count, itemCount);
+        QVERIFY(inOrder);
+        QCOMPARE(streamReader.status(), KDSoapMessageStreamReader::Finished);
+        // The streamed items aren't kept in the message
+        QCOMPARE(message.name(), QString::fromLatin1("getItemsResponse"));
+        QCOMPARE(message.childValues().count(), 1);
+        QCOMPARE(watcher.returnValue().toInt(), itemCount);
+    }
+
     void testDocumentStyle()
     {
         HttpServerThread server(countryResponse(), HttpServerThread::Public);
@@ -0,0 +1,600 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2010-2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#include "KDSoapHpack_p.h"
+#include "KDSoapHttp2Connection_p.h"
+#include <QDebug>
+#include <QTest>
+
+// Frame types and flags, RFC 7540 section 6
+enum
+{
+    DataFrame = 0x0,
+    HeadersFrame = 0x1,
+    RstStreamFrame = 0x3,
+    SettingsFrame = 0x4,
+    PingFrame = 0x6,
+    GoAwayFrame = 0x7,
+    WindowUpdateFrame = 0x8,
+    ContinuationFrame = 0x9
+};
+static const quint8 s_endStream = 0x1;
+static const quint8 s_endHeaders = 0x4;
+
+struct Frame
+{
+    int type;
+    int flags;
+    quint32 streamId;
+    QByteArray payload;
+};
+
+static QByteArray uint32(quint32 value)
+{
+    QByteArray data;
+    data.append(char(value >> 24));
+    data.append(char(value >> 16));
+    data.append(char(value >> 8));
+    data.append(char(value));
+    return data;
+}
+
+static quint32 readUInt32(const QByteArray &data, int pos)
+{
+    return (quint32(quint8(data.at(pos))) << 24) | (quint32(quint8(data.at(pos + 1))) << 16) | (quint32(quint8(data.at(pos + 2))) << 8)
+        | quint32(quint8(data.at(pos + 3)));
+}
+
+static QByteArray frame(int type, quint8 flags, quint32 streamId, const QByteArray &payload = QByteArray())
+{
+    QByteArray data;
+    data.append(char(payload.size() >> 16));
+    data.append(char(payload.size() >> 8));
+    data.append(char(payload.size()));
+    data.append(char(type));
+    data.append(char(flags));
+    data += uint32(streamId);
+    return data + payload;
+}
+
+static QList<Frame> parseFrames(const QByteArray &data)
+{
+    QList<Frame> frames;
+    int pos = 0;
+    while (pos + 9 <= data.size()) {
+        const int length = (int(quint8(data.at(pos))) << 16) | (int(quint8(data.at(pos + 1))) << 8) | int(quint8(data.at(pos + 2)));
+        Frame frame;
+        frame.type = quint8(data.at(pos + 3));
+        frame.flags = quint8(data.at(pos + 4));
+        frame.streamId = readUInt32(data, pos + 5) & 0x7fffffff;
+        frame.payload = data.mid(pos + 9, length);
+        frames.append(frame);
+        pos += 9 + length;
+    }
+    Q_ASSERT(pos == data.size());
+    return frames;
+}
+
+static KDSoapHttpHeaderList requestHeaders(const QByteArray &method = "POST")
+{
+    return KDSoapHttpHeaderList {{":method", method}, {":scheme", "http"}, {":path", "/"}, {":authority", "localhost"}};
+}
+
+static KDSoapHttpHeaderList exampleRequest(int number)
+{
+    // RFC 7541 appendix C.3 and C.4
+    KDSoapHttpHeaderList headers {{":method", "GET"}, {":scheme", number == 3 ? "https" : "http"}, {":path", number == 3 ? "/index.html" : "/"},
+                                  {":authority", "www.example.com"}};
+    if (number == 2) {
+        headers.append(KDSoapHttpHeader("cache-control", "no-cache"));
+    } else if (number == 3) {
+        headers.append(KDSoapHttpHeader("custom-key", "custom-value"));
+    }
+    return headers;
+}
+
+static KDSoapHttpHeaderList exampleResponse(int number)
+{
+    // RFC 7541 appendix C.5 and C.6
+    KDSoapHttpHeaderList headers {{":status", number == 1 ? "302" : number == 2 ? "307" : "200"},
+                                  {"cache-control", "private"},
+                                  {"date", number == 3 ? "Mon, 21 Oct 2013 20:13:22 GMT" : "Mon, 21 Oct 2013 20:13:21 GMT"},
+                                  {"location", "https://www.example.com"}};
+    if (number == 3) {
+        headers.append(KDSoapHttpHeader("content-encoding", "gzip"));
+        headers.append(KDSoapHttpHeader("set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"));
+    }
+    return headers;
+}
+
+// The server side of a connection, and the client side of the header compression
+class Http2Client
+{
+public:
+    Http2Client()
+        : connection(KDSoapHttpRequestParser::Limits())
+    {
+        connection.start();
+        connection.receive("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" + frame(SettingsFrame, 0, 0));
+        connection.takeOutput(); // SETTINGS and SETTINGS ACK
+    }
+
+    QByteArray headers(quint32 streamId, const KDSoapHttpHeaderList &fields, bool endStream)
+    {
+        return frame(HeadersFrame, s_endHeaders | (endStream ? s_endStream : 0), streamId, encoder.encode(fields));
+    }
+    // A complete request with a body
+    bool sendRequest(quint32 streamId, const QByteArray &body = "<request/>")
+    {
+        return connection.receive(headers(streamId, requestHeaders(), false) + frame(DataFrame, s_endStream, streamId, body));
+    }
+    QList<Frame> output()
+    {
+        return parseFrames(connection.takeOutput());
+    }
+
+    KDSoapHttp2Connection connection;
+    KDSoapHpackEncoder encoder;
+};
+
+class Http2Test : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    // RFC 7541 appendix C.2
+    void testHpackLiterals_data()
+    {
+        QTest::addColumn<QByteArray>("block");
+        QTest::addColumn<KDSoapHttpHeaderList>("expectedHeaders");
+
+        QTest::newRow("C.2.1 indexing") << QByteArray::fromHex("400a637573746f6d2d6b65790d637573746f6d2d686561646572")
+                                        << KDSoapHttpHeaderList {{"custom-key", "custom-header"}};
+        QTest::newRow("C.2.2 without indexing") << QByteArray::fromHex("040c2f73616d706c652f70617468") << KDSoapHttpHeaderList {{":path", "/sample/path"}};
+        QTest::newRow("C.2.3 never indexed") << QByteArray::fromHex("100870617373776f726406736563726574") << KDSoapHttpHeaderList {{"password", "secret"}};
+        QTest::newRow("C.2.4 indexed") << QByteArray::fromHex("82") << KDSoapHttpHeaderList {{":method", "GET"}};
+    }
+
+    void testHpackLiterals()
+    {
+        QFETCH(QByteArray, block);
+        QFETCH(KDSoapHttpHeaderList, expectedHeaders);
+        KDSoapHpackDecoder decoder;
+        KDSoapHttpHeaderList headers;
+        QCOMPARE(decoder.decode(block, &headers), KDSoapHpackDecoder::Ok);
+        QCOMPARE(headers, expectedHeaders);
+    }
+
+    // RFC 7541 appendix C.3 (raw literals) and C.4 (Huffman): our encoder produces exactly the same blocks
+    void testHpackRequests_data()
+    {
+        QTest::addColumn<QList<QByteArray>>("blocks");
+
+        QTest::newRow("C.3 raw") << QList<QByteArray> {QByteArray::fromHex("828684410f7777772e6578616d706c652e636f6d"),
+                                                       QByteArray::fromHex("828684be58086e6f2d6361636865"),
+                                                       QByteArray::fromHex("828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565")};
+        QTest::newRow("C.4 huffman") << QList<QByteArray> {QByteArray::fromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff"),
+                                                           QByteArray::fromHex("828684be5886a8eb10649cbf"),
+                                                           QByteArray::fromHex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf")};
+    }
+
+    void testHpackRequests()
+    {
+        QFETCH(QList<QByteArray>, blocks);
+        KDSoapHpackDecoder decoder;
+        KDSoapHpackEncoder encoder;
+        for (int i = 0; i < blocks.count(); ++i) {
+            KDSoapHttpHeaderList headers;
+            QCOMPARE(decoder.decode(blocks.at(i), &headers), KDSoapHpackDecoder::Ok);
+            QCOMPARE(headers, exampleRequest(i + 1));
+            QCOMPARE(encoder.encode(exampleRequest(i + 1)).toHex(), blocks.at(i).toHex());
+        }
+    }
+
+    // RFC 7541 appendix C.5 (raw literals) and C.6 (Huffman), with a 256 bytes table: entries get evicted
+    void testHpackResponses_data()
+    {
+        QTest::addColumn<QList<QByteArray>>("blocks");
+
+        QTest::newRow("C.5 raw") << QList<QByteArray> {
+            QByteArray::fromHex("4803333032580770726976617465611d4d6f6e2c203231204f637420323031332032303a31333a323120474d546e176874747073"
+                                "3a2f2f7777772e6578616d706c652e636f6d"),
+            QByteArray::fromHex("4803333037c1c0bf"),
+            QByteArray::fromHex("88c1611d4d6f6e2c203231204f637420323031332032303a31333a323220474d54c05a04677a69707738666f6f3d4153444a4b48"
+                                "514b425a584f5157454f50495541585157454f49553b206d61782d6167653d333630303b2076657273696f6e3d31")};
+        QTest::newRow("C.6 huffman") << QList<QByteArray> {
+            QByteArray::fromHex("488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3"),
+            QByteArray::fromHex("4883640effc1c0bf"),
+            QByteArray::fromHex("88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672"
+                                "c1ab270fb5291f9587316065c003ed4ee5b1063d5007")};
+    }
+
+    void testHpackResponses()
+    {
+        QFETCH(QList<QByteArray>, blocks);
+        KDSoapHpackDecoder decoder;
+        for (int i = 0; i < blocks.count(); ++i) {
+            QByteArray block = blocks.at(i);
+            if (i == 0) {
+                // The examples assume SETTINGS_HEADER_TABLE_SIZE = 256, announced with a table size update
+                block.prepend(QByteArray::fromHex("3fe101"));
+            }
+            KDSoapHttpHeaderList headers;
+            QCOMPARE(decoder.decode(block, &headers), KDSoapHpackDecoder::Ok);
+            QCOMPARE(headers, exampleResponse(i + 1));
+        }
+        // The table has the 3 entries of C.5.3 / C.6.3 left, the older ones were evicted
+        KDSoapHttpHeaderList headers;
+        QCOMPARE(decoder.decode(QByteArray::fromHex("bebfc0"), &headers), KDSoapHpackDecoder::Ok);
+        const KDSoapHttpHeaderList expectedHeaders = exampleResponse(3).mid(2, 1) + exampleResponse(3).mid(4, 2);
+        QCOMPARE(headers.count(), 3);
+        QCOMPARE(headers.at(0), expectedHeaders.at(2));
+        QCOMPARE(headers.at(1), expectedHeaders.at(1));
+        QCOMPARE(headers.at(2), expectedHeaders.at(0));
+        QCOMPARE(decoder.decode(QByteArray::fromHex("c1"), &headers), KDSoapHpackDecoder::CompressionError);
+    }
+
+    void testHpackTableEviction()
+    {
+        // The table of RFC 7541 appendix C.5
+        KDSoapHpackTable table;
+        table.setMaxSize(256);
+        const KDSoapHttpHeaderList firstResponse = exampleResponse(1);
+        for (const KDSoapHttpHeader &header : firstResponse) {
+            table.add(header.first, header.second);
+        }
+        KDSoapHttpHeader header;
+        QVERIFY(table.lookup(62, &header));
+        QCOMPARE(header, firstResponse.at(3));
+        QVERIFY(table.lookup(65, &header));
+        QCOMPARE(header, firstResponse.at(0));
+        QVERIFY(!table.lookup(66, &header));
+
+        // 222 + 42 > 256: ":status: 302" goes
+        table.add(":status", "307");
+        QVERIFY(table.lookup(62, &header));
+        QCOMPARE(header, KDSoapHttpHeader(":status", "307"));
+        QVERIFY(table.lookup(65, &header));
+        QCOMPARE(header, firstResponse.at(1));
+        QVERIFY(!table.lookup(66, &header));
+        int nameIndex;
+        QCOMPARE(table.find(":status", "307", &nameIndex), 62);
+        QCOMPARE(nameIndex, 8); // the static table comes first
+        QCOMPARE(table.find(":status", "302", &nameIndex), 0);
+
+        // Shrinking the table evicts the oldest entries
+        table.setMaxSize(110);
+        QVERIFY(table.lookup(62, &header));
+        QCOMPARE(header, KDSoapHttpHeader(":status", "307"));
+        QVERIFY(table.lookup(63, &header));
+        QCOMPARE(header, firstResponse.at(3));
+        QVERIFY(!table.lookup(64, &header));
+
+        // An entry larger than the table empties it, RFC 7541 section 4.4
+        table.add("x-large", QByteArray(100, 'a')); // 139 bytes
+        QVERIFY(!table.lookup(62, &header));
+        QVERIFY(table.lookup(61, &header)); // the static table is still there
+        QCOMPARE(header, KDSoapHttpHeader("www-authenticate", QByteArray()));
+    }
+
+    void testHpackTableSizeUpdate()
+    {
+        KDSoapHttpHeaderList headers;
+        {
+            // Back to 0: the entry added by the first block is gone
+            KDSoapHpackDecoder decoder;
+            QCOMPARE(decoder.decode(QByteArray::fromHex("828684410f7777772e6578616d706c652e636f6d"), &headers), KDSoapHpackDecoder::Ok);
+            headers.clear();
+            QCOMPARE(decoder.decode(QByteArray::fromHex("be"), &headers), KDSoapHpackDecoder::Ok);
+            QCOMPARE(headers, exampleRequest(1).mid(3));
+            QCOMPARE(decoder.decode(QByteArray::fromHex("20be"), &headers), KDSoapHpackDecoder::CompressionError);
+        }
+        {
+            // Two updates in a row (the smallest size, then the final one) are fine
+            KDSoapHpackDecoder decoder;
+            headers.clear();
+            QCOMPARE(decoder.decode(QByteArray::fromHex("203fe10182"), &headers), KDSoapHpackDecoder::Ok);
+            QCOMPARE(headers, exampleRequest(1).mid(0, 1));
+        }
+        {
+            // Only at the beginning of a block
+            KDSoapHpackDecoder decoder;
+            QCOMPARE(decoder.decode(QByteArray::fromHex("8220"), &headers), KDSoapHpackDecoder::CompressionError);
+        }
+        {
+            // Not above SETTINGS_HEADER_TABLE_SIZE (4096)
+            KDSoapHpackDecoder decoder;
+            QCOMPARE(decoder.decode(QByteArray::fromHex("3fe21f"), &headers), KDSoapHpackDecoder::CompressionError);
+        }
+
+        // The encoder announces the smallest size it went through, then the final one
+        KDSoapHpackEncoder encoder;
+        KDSoapHpackDecoder decoder;
+        encoder.setMaxTableSize(0);
+        encoder.setMaxTableSize(256);
+        QByteArray block = encoder.encode(exampleRequest(1));
+        QCOMPARE(block.toHex(), QByteArray("203fe101828684410f7777772e6578616d706c652e636f6d"));
+        headers.clear();
+        QCOMPARE(decoder.decode(block, &headers), KDSoapHpackDecoder::Ok);
+        QCOMPARE(headers, exampleRequest(1));
+        // A larger table than the default isn't used
+        encoder.setMaxTableSize(8192);
+        block = encoder.encode(exampleRequest(2));
+        QCOMPARE(block.toHex(), QByteArray("3fe11f828684be58086e6f2d6361636865"));
+        headers.clear();
+        QCOMPARE(decoder.decode(block, &headers), KDSoapHpackDecoder::Ok);
+        QCOMPARE(headers, exampleRequest(2));
+        // No update when nothing changed
+        block = encoder.encode(exampleRequest(2));
+        QCOMPARE(block.toHex(), QByteArray("828684bfbe"));
+        headers.clear();
+        QCOMPARE(decoder.decode(block, &headers), KDSoapHpackDecoder::Ok);
+        QCOMPARE(headers, exampleRequest(2));
+    }
+
+    void testContinuation()
+    {
+        Http2Client client;
+        // A request header block in three frames
+        KDSoapHttpHeaderList headers = requestHeaders("GET");
+        headers.append(KDSoapHttpHeader("x-long", QByteArray(100, 'x')));
+        const QByteArray block = client.encoder.encode(headers);
+        QVERIFY(client.connection.receive(frame(HeadersFrame, s_endStream, 1, block.left(10))));
+        int streamId;
+        QByteArray requestHead;
+        QByteArray body;
+        QVERIFY(!client.connection.takeRequest(&streamId, &requestHead, &body));
+        QVERIFY(client.connection.receive(frame(ContinuationFrame, 0, 1, block.mid(10, 20)) + frame(ContinuationFrame, s_endHeaders, 1, block.mid(30))));
+        QVERIFY(client.connection.takeRequest(&streamId, &requestHead, &body));
+        QCOMPARE(streamId, 1);
+        QVERIFY(requestHead.startsWith("GET / HTTP/1.1\r\n"));
+        QVERIFY(requestHead.contains("\r\nx-long: " + QByteArray(100, 'x') + "\r\n"));
+        QVERIFY(body.isEmpty());
+
+        // A response header block larger than a frame (16 KB): HEADERS, then CONTINUATION
+        const QByteArray largeValue(20000, '~'); // longer with Huffman, sent raw
+        client.connection.sendResponse(1, "HTTP/1.1 200 OK\r\nX-Large: " + largeValue + "\r\nContent-Length: 0\r\n\r\n");
+        const QList<Frame> frames = client.output();
+        QCOMPARE(frames.count(), 2);
+        QCOMPARE(frames.at(0).type, int(HeadersFrame));
+        QCOMPARE(frames.at(0).flags, int(s_endStream));
+        QCOMPARE(frames.at(0).payload.size(), 16384);
+        QCOMPARE(frames.at(1).type, int(ContinuationFrame));
+        QCOMPARE(frames.at(1).flags, int(s_endHeaders));
+        QCOMPARE(frames.at(1).streamId, 1u);
+        KDSoapHpackDecoder decoder;
+        KDSoapHttpHeaderList responseHeaders;
+        QCOMPARE(decoder.decode(frames.at(0).payload + frames.at(1).payload, &responseHeaders), KDSoapHpackDecoder::Ok);
+        QCOMPARE(responseHeaders, (KDSoapHttpHeaderList {{":status", "200"}, {"x-large", largeValue}, {"content-length", "0"}}));
+        QCOMPARE(client.connection.streamCount(), 0);
+
+        // Nothing else may come between the frames of a header block
+        QVERIFY(client.connection.receive(frame(HeadersFrame, s_endStream, 3, block.left(10))));
+        QVERIFY(!client.connection.receive(frame(PingFrame, 0, 0, QByteArray(8, '\0'))));
+        const QList<Frame> errorFrames = client.output();
+        QCOMPARE(errorFrames.count(), 1);
+        QCOMPARE(errorFrames.at(0).type, int(GoAwayFrame));
+        QCOMPARE(readUInt32(errorFrames.at(0).payload, 4), quint32(KDSoapHttp2Connection::ProtocolError));
+    }
+
+    void testFlowControl()
+    {
+        Http2Client client;
+        QVERIFY(client.sendRequest(1));
+        int streamId;
+        QByteArray requestHead;
+        QByteArray body;
+        QVERIFY(client.connection.takeRequest(&streamId, &requestHead, &body));
+        QCOMPARE(body, QByteArray("<request/>"));
+        client.output(); // WINDOW_UPDATE frames, if any
+
+        // A response larger than the initial windows (65535): the data stalls until the client opens them
+        QByteArray responseBody;
+        for (int i = 0; responseBody.size() < 100000; ++i) {
+            responseBody += QByteArray::number(i) + ' ';
+        }
+        client.connection.sendResponse(1, "HTTP/1.1 200 OK\r\nContent-Type: text/xml\r\n\r\n" + responseBody);
+        QByteArray received;
+        QList<Frame> frames = client.output();
+        QCOMPARE(frames.first().type, int(HeadersFrame));
+        QCOMPARE(frames.first().flags, int(s_endHeaders));
+        for (const Frame &dataFrame : frames.mid(1)) {
+            QCOMPARE(dataFrame.type, int(DataFrame));
+            QCOMPARE(dataFrame.flags, 0);
+            QVERIFY(dataFrame.payload.size() <= 16384);
+            received += dataFrame.payload;
+        }
+        QCOMPARE(received.size(), 65535);
+        QCOMPARE(client.connection.pendingResponseData(1), qint64(responseBody.size() - 65535));
+
+        // The stream window alone isn't enough, the connection window is used up too
+        QVERIFY(client.connection.receive(frame(WindowUpdateFrame, 0, 1, uint32(50000))));
+        QVERIFY(client.output().isEmpty());
+
+        QVERIFY(client.connection.receive(frame(WindowUpdateFrame, 0, 0, uint32(20000))));
+        frames = client.output();
+        int size = 0;
+        for (const Frame &dataFrame : qAsConst(frames)) {
+            QCOMPARE(dataFrame.type, int(DataFrame));
+            QCOMPARE(dataFrame.flags, 0);
+            size += dataFrame.payload.size();
+            received += dataFrame.payload;
+        }
+        QCOMPARE(size, 20000);
+        QCOMPARE(client.connection.streamCount(), 1);
+
+        // Now the stream window (30000 left) is enough for the rest
+        QVERIFY(client.connection.receive(frame(WindowUpdateFrame, 0, 0, uint32(50000))));
+        frames = client.output();
+        QVERIFY(!frames.isEmpty());
+        for (const Frame &dataFrame : qAsConst(frames)) {
+            QCOMPARE(dataFrame.type, int(DataFrame));
+            received += dataFrame.payload;
+        }
+        QCOMPARE(frames.last().flags, int(s_endStream));
+        QCOMPARE(received, responseBody);
+        QCOMPARE(client.connection.streamCount(), 0);
+        QCOMPARE(client.connection.pendingResponseData(1), qint64(-1));
+
+        // A response body sent in parts (e.g. a file download): END_STREAM comes with the last one
+        QVERIFY(client.sendRequest(3));
+        QVERIFY(client.connection.takeRequest(&streamId, &requestHead, &body));
+        client.output();
+        client.connection.sendResponse(3, "HTTP/1.1 200 OK\r\nContent-Length: 6\r\n\r\n", false);
+        frames = client.output();
+        QCOMPARE(frames.count(), 1);
+        QCOMPARE(frames.at(0).type, int(HeadersFrame));
+        QCOMPARE(frames.at(0).flags, int(s_endHeaders));
+        client.connection.sendResponseData(3, "abc", false);
+        frames = client.output();
+        QCOMPARE(frames.count(), 1);
+        QCOMPARE(frames.at(0).type, int(DataFrame));
+        QCOMPARE(frames.at(0).flags, 0);
+        QCOMPARE(frames.at(0).payload, QByteArray("abc"));
+        QCOMPARE(client.connection.pendingResponseData(3), qint64(0));
+        client.connection.sendResponseData(3, "def", true);
+        frames = client.output();
+        QCOMPARE(frames.count(), 1);
+        QCOMPARE(frames.at(0).flags, int(s_endStream));
+        QCOMPARE(frames.at(0).payload, QByteArray("def"));
+        QCOMPARE(client.connection.streamCount(), 0);
+
+        // The connection window can't go beyond 2^31-1
+        QVERIFY(!client.connection.receive(frame(WindowUpdateFrame, 0, 0, uint32(0x7fffffff))));
+        frames = client.output();
+        QCOMPARE(frames.count(), 1);
+        QCOMPARE(frames.at(0).type, int(GoAwayFrame));
+        QCOMPARE(readUInt32(frames.at(0).payload, 4), quint32(KDSoapHttp2Connection::FlowControlError));
+    }
+
+    void testRstStream()
+    {
+        Http2Client client;
+        QVERIFY(client.sendRequest(1));
+        QVERIFY(client.sendRequest(3));
+        int streamId;
+        QByteArray requestHead;
+        QByteArray body;
+        QVERIFY(client.connection.takeRequest(&streamId, &requestHead, &body));
+        QVERIFY(client.connection.takeRequest(&streamId, &requestHead, &body));
+        client.output();
+
+        // Reset while the call is in progress: its response is dropped
+        QVERIFY(client.connection.receive(frame(RstStreamFrame, 0, 1, uint32(KDSoapHttp2Connection::Cancel))));
+        QCOMPARE(client.connection.streamCount(), 1);
+        QCOMPARE(client.connection.pendingResponseData(1), qint64(-1));
+        client.connection.sendResponse(1, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+        QVERIFY(client.output().isEmpty());
+
+        // Reset while the response is waiting for the flow control window: the rest is dropped
+        client.connection.sendResponse(3, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n" + QByteArray(100000, 'a'));
+        QVERIFY(!client.output().isEmpty());
+        QVERIFY(client.connection.pendingResponseData(3) > 0);
+        QVERIFY(client.connection.receive(frame(RstStreamFrame, 0, 3, uint32(KDSoapHttp2Connection::Cancel))));
+        QCOMPARE(client.connection.streamCount(), 0);
+        // The client can still send WINDOW_UPDATE frames for it, until it knows
+        QVERIFY(client.connection.receive(frame(WindowUpdateFrame, 0, 0, uint32(100000)) + frame(WindowUpdateFrame, 0, 3, uint32(100000))));
+        QVERIFY(client.output().isEmpty());
+
+        // The connection goes on
+        QVERIFY(client.sendRequest(5));
+        QVERIFY(client.connection.takeRequest(&streamId, &requestHead, &body));
+        QCOMPARE(streamId, 5);
+
+        // A stream which was never opened can't be reset
+        QVERIFY(!client.connection.receive(frame(RstStreamFrame, 0, 7, uint32(KDSoapHttp2Connection::Cancel))));
+    }
+
+    void testGoAway()
+    {
+        Http2Client client;
+        QVERIFY(client.sendRequest(1));
+        int streamId;
+        QByteArray requestHead;
+        QByteArray body;
+        QVERIFY(client.connection.takeRequest(&streamId, &requestHead, &body));
+        client.output();
+
+        // The client is done: the current streams are answered, no new one is accepted
+        QVERIFY(client.connection.receive(frame(GoAwayFrame, 0, 0, uint32(0) + uint32(KDSoapHttp2Connection::NoError))));
+        QVERIFY(client.connection.isGoingAway());
+        QList<Frame> frames = client.output();
+        QCOMPARE(frames.count(), 1);
+        QCOMPARE(frames.at(0).type, int(GoAwayFrame));
+        QCOMPARE(readUInt32(frames.at(0).payload, 0), 1u); // the last stream we handle
+        QCOMPARE(readUInt32(frames.at(0).payload, 4), quint32(KDSoapHttp2Connection::NoError));
+
+        QVERIFY(client.sendRequest(3));
+        QVERIFY(!client.connection.takeRequest(&streamId, &requestHead, &body));
+        QCOMPARE(client.connection.streamCount(), 1);
+        client.connection.sendResponse(1, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+        frames = client.output();
+        QCOMPARE(frames.count(), 2);
+        QCOMPARE(frames.at(1).payload, QByteArray("ok"));
+        QCOMPARE(frames.at(1).flags, int(s_endStream));
+        QCOMPARE(client.connection.streamCount(), 0);
+
+        // Our own GOAWAY (e.g. KDSoapServer::setMaxRequestsPerConnection) is only sent once
+        Http2Client other;
+        QVERIFY(other.sendRequest(1));
+        other.output();
+        other.connection.goAway(KDSoapHttp2Connection::NoError);
+        other.connection.goAway(KDSoapHttp2Connection::NoError);
+        frames = other.output();
+        QCOMPARE(frames.count(), 1);
+        QCOMPARE(frames.at(0).type, int(GoAwayFrame));
+        QCOMPARE(readUInt32(frames.at(0).payload, 0), 1u);
+        QVERIFY(other.connection.takeRequest(&streamId, &requestHead, &body));
+    }
+
+    void testMaxConcurrentStreams()
+    {
+        Http2Client client;
+        // Our SETTINGS frame announces the limit
+        KDSoapHttp2Connection connection {KDSoapHttpRequestParser::Limits()};
+        connection.start();
+        const QList<Frame> settingsFrames = parseFrames(connection.takeOutput());
+        QCOMPARE(settingsFrames.count(), 1);
+        QCOMPARE(settingsFrames.at(0).type, int(SettingsFrame));
+        QCOMPARE(settingsFrames.at(0).payload.left(6), QByteArray::fromHex("000300000064")); // SETTINGS_MAX_CONCURRENT_STREAMS = 100
+
+        // 100 requests waiting for their body
+        quint32 streamId = 1;
+        for (int i = 0; i < 100; ++i, streamId += 2) {
+            QVERIFY(client.connection.receive(client.headers(streamId, requestHeaders(), false)));
+        }
+        QCOMPARE(client.connection.streamCount(), 100);
+        QVERIFY(client.output().isEmpty());
+
+        // One more is refused, the client can retry it later
+        QVERIFY(client.connection.receive(client.headers(streamId, requestHeaders(), false)));
+        QList<Frame> frames = client.output();
+        QCOMPARE(frames.count(), 1);
+        QCOMPARE(frames.at(0).type, int(RstStreamFrame));
+        QCOMPARE(frames.at(0).streamId, streamId);
+        QCOMPARE(readUInt32(frames.at(0).payload, 0), quint32(KDSoapHttp2Connection::RefusedStream));
+        QCOMPARE(client.connection.streamCount(), 100);
+
+        // Once a stream is closed, there's room for a new one
+        QVERIFY(client.connection.receive(frame(RstStreamFrame, 0, 1, uint32(KDSoapHttp2Connection::Cancel))));
+        streamId += 2;
+        QVERIFY(client.connection.receive(client.headers(streamId, requestHeaders(), false) + frame(DataFrame, s_endStream, streamId, "<request/>")));
+        QVERIFY(client.output().isEmpty());
+        int takenStreamId;
+        QByteArray requestHead;
+        QByteArray body;
+        QVERIFY(client.connection.takeRequest(&takenStreamId, &requestHead, &body));
+        QCOMPARE(quint32(takenStreamId), streamId);
+    }
+};
+
+QTEST_MAIN(Http2Test)
+
+#include "test_http2.moc"
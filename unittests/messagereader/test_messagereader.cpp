@@ -8,8 +8,10 @@
 **
 ****************************************************************************/
 
+#include "KDQName.h"
 #include "KDSoapMessage.h"
 #include "KDSoapMessageReader_p.h"
+#include "KDSoapMessageStreamReader.h"
 #include <QDebug>
 #include <QTest>
 
@@ -99,6 +101,322 @@ private Q_SLOTS:
         QVERIFY(msg.isFault());
         QCOMPARE(msg.faultAsString(), QString::fromLatin1("Fault 4: XML error: [1:163] Premature end of document."));
     }
+
+    void testIncrementalReader()
+    {
+        const QByteArray xml = "<soapenv:Envelope xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+                               "xmlns:dat=\"http://www.27seconds.com/Holidays/US/Dates/\" "
+                               "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\">\n"
+                               "  <soapenv:Header>\n"
+                               "    <dat:Session>abc</dat:Session>\n"
+                               "  </soapenv:Header>\n"
+                               "  <soapenv:Body>\n"
+                               "    <dat:GetEaster kind=\"gregorian\">\n"
+                               "      <dat:year xsi:type=\"xsd:int\">2011</dat:year>\n"
+                               "      <dat:comment>Fish &amp; chips</dat:comment>\n"
+                               "    </dat:GetEaster>\n"
+                               "  </soapenv:Body>\n"
+                               "</soapenv:Envelope>\n";
+
+        const KDSoapMessageReader reader;
+        QString ns;
+        KDSoapMessage msg;
+        KDSoapHeaders headers;
+        QCOMPARE(reader.xmlToMessage(xml, &msg, &ns, &headers, KDSoap::SOAP1_1), KDSoapMessageReader::NoError);
+
+        // Feed the data one byte at a time, as if it came from a slow socket
+        KDSoapIncrementalMessageReader incrementalReader;
+        for (int i = 0; i < xml.size(); ++i) {
+            const KDSoapMessageReader::XmlError err = incrementalReader.addData(xml.mid(i, 1));
+            if (err == KDSoapMessageReader::NoError) {
+                break;
+            }
+            QCOMPARE(err, KDSoapMessageReader::PrematureEndOfDocumentError);
+        }
+        QString ns2;
+        KDSoapMessage msg2;
+        KDSoapHeaders headers2;
+        QCOMPARE(incrementalReader.result(&msg2, &ns2, &headers2, KDSoap::SOAP1_1), KDSoapMessageReader::NoError);
+        QVERIFY(!msg2.isFault());
+        QCOMPARE(ns2, ns);
+        QCOMPARE(msg2, msg);
+        QCOMPARE(msg2.childValues().child(QLatin1String("year")).value(), QVariant(2011));
+        QCOMPARE(msg2.childValues().child(QLatin1String("comment")).value().toString(), QString::fromLatin1("Fish & chips"));
+        QCOMPARE(headers2.count(), 1);
+        QCOMPARE(headers2.first(), headers.first());
+    }
+
+    void testIncrementalReaderErrors_data()
+    {
+        QTest::addColumn<QByteArray>("xml");
+        QTest::addColumn<int>("expectedError");
+        QTest::addColumn<QString>("expectedFault");
+
+        const QByteArray envelopeStart = "<soapenv:Envelope xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\">";
+        QTest::newRow("missing_end") << QByteArray(envelopeStart + "<soapenv:Body>") << int(KDSoapMessageReader::PrematureEndOfDocumentError)
+                                     << QString::fromLatin1("Premature end of document.");
+        QTest::newRow("no_envelope") << QByteArray("<foo/>") << int(KDSoapMessageReader::ParseError)
+                                     << QString::fromLatin1("Invalid SOAP Message, Envelope expected");
+        QTest::newRow("empty_envelope") << QByteArray(envelopeStart + "</soapenv:Envelope>") << int(KDSoapMessageReader::ParseError)
+                                        << QString::fromLatin1("Invalid SOAP Message, empty Envelope");
+    }
+
+    void testIncrementalReaderErrors()
+    {
+        QFETCH(QByteArray, xml);
+        QFETCH(int, expectedError);
+        QFETCH(QString, expectedFault);
+
+        KDSoapIncrementalMessageReader incrementalReader;
+        QCOMPARE(int(incrementalReader.addData(xml)), expectedError);
+        KDSoapMessage msg;
+        KDSoapHeaders headers;
+        QCOMPARE(int(incrementalReader.result(&msg, nullptr, &headers, KDSoap::SOAP1_1)), expectedError);
+        QVERIFY(msg.isFault());
+        QVERIFY2(msg.faultAsString().endsWith(expectedFault), qPrintable(msg.faultAsString()));
+
+        // Same error as with the non-incremental reader
+        const KDSoapMessageReader reader;
+        KDSoapMessage msg2;
+        QCOMPARE(int(reader.xmlToMessage(xml, &msg2, nullptr, &headers, KDSoap::SOAP1_1)), expectedError);
+        QCOMPARE(msg.faultAsString(), msg2.faultAsString());
+    }
+
+    void testMessageStreamReader()
+    {
+        const QByteArray xml = "<soapenv:Envelope xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\">"
+                               "<soapenv:Header><h:session xmlns:h=\"urn:header\">abc</h:session><h:trace xmlns:h=\"urn:header\">1</h:trace></soapenv:Header>"
+                               "<soapenv:Body>"
+                               "<m:Response xmlns:m=\"urn:message\">"
+                               "<m:item><m:name>one</m:name></m:item>"
+                               "<m:count>3</m:count>"
+                               "<m:item><m:name>two</m:name></m:item>"
+                               "<m:group><m:item><m:name>three</m:name></m:item></m:group>"
+                               "</m:Response>"
+                               "</soapenv:Body>"
+                               "</soapenv:Envelope>";
+
+        KDSoapMessageStreamReader streamReader;
+        QStringList handled;
+        QVERIFY(streamReader.addElementPath(QString::fromLatin1("Body/m:Response/item"), [&](const KDSoapValue &item) {
+            handled.append(item.childValues().child(QLatin1String("name")).value().toString());
+        }));
+        QVERIFY(streamReader.addElementPath(QString::fromLatin1("/Body/Response/*/item"))); // queued
+        QVERIFY(streamReader.addElementPath(QString::fromLatin1("Header/trace")));
+        QVERIFY(!streamReader.addElementPath(QString::fromLatin1("Response/item")));
+        QVERIFY(!streamReader.addElementPath(QString::fromLatin1("Body//item")));
+
+        // Feed the data one byte at a time, as if it came from a slow socket
+        const int countStart = xml.indexOf("<m:count>");
+        for (int i = 0; i < xml.size(); ++i) {
+            if (i == countStart) {
+                // Handled as soon as it's complete
+                QCOMPARE(handled, QStringList() << QString::fromLatin1("one"));
+            }
+            if (streamReader.addData(xml.mid(i, 1)) != KDSoapMessageStreamReader::NeedMoreData) {
+                break;
+            }
+        }
+        QCOMPARE(streamReader.status(), KDSoapMessageStreamReader::Finished);
+        QCOMPARE(handled, QStringList() << QString::fromLatin1("one") << QString::fromLatin1("two"));
+
+        // The queued elements, in document order
+        QVERIFY(streamReader.hasPendingElements());
+        QCOMPARE(streamReader.takeElement().name(), QString::fromLatin1("trace"));
+        const KDSoapValue three = streamReader.takeElement();
+        QCOMPARE(three.childValues().child(QLatin1String("name")).value().toString(), QString::fromLatin1("three"));
+        QCOMPARE(three.namespaceUri(), QString::fromLatin1("urn:message"));
+        QVERIFY(!streamReader.hasPendingElements());
+        QVERIFY(streamReader.takeElement().isNull());
+        QVERIFY(streamReader.takeElement().isNull());
+
+        // The streamed elements aren't in the message
+        const KDSoapMessage msg = streamReader.message();
+        QVERIFY(!msg.isFault());
+        QCOMPARE(msg.name(), QString::fromLatin1("Response"));
+        QCOMPARE(msg.childValues().count(), 2);
+        QCOMPARE(msg.childValues().at(0).name(), QString::fromLatin1("count"));
+        QVERIFY(msg.childValues().at(1).childValues().isEmpty());
+        const KDSoapHeaders headers = streamReader.headers();
+        QCOMPARE(headers.count(), 1);
+        QCOMPARE(headers.first().name(), QString::fromLatin1("session"));
+    }
+
+    void testMessageStreamReaderFault()
+    {
+        KDSoapMessageStreamReader streamReader;
+        QVERIFY(streamReader.addElementPath(QString::fromLatin1("Body/*")));
+        const QByteArray xml = "<soapenv:Envelope xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\"><soapenv:Body>"
+                               "<soapenv:Fault><faultcode>soapenv:Server</faultcode><faultstring>Boom</faultstring></soapenv:Fault>"
+                               "</soapenv:Body></soapenv:Envelope>";
+        QCOMPARE(streamReader.addData(xml), KDSoapMessageStreamReader::Finished);
+        QVERIFY(!streamReader.hasPendingElements());
+        const KDSoapMessage msg = streamReader.message();
+        QVERIFY(msg.isFault());
+        QCOMPARE(msg.faultAsString(), QString::fromLatin1("Fault code soapenv:Server: Boom"));
+
+        KDSoapMessageStreamReader invalidReader;
+        QCOMPARE(invalidReader.addData("<foo/>"), KDSoapMessageStreamReader::Error);
+        QVERIFY(invalidReader.message().isFault());
+    }
+
+    void testNamespaceScopes()
+    {
+        const QByteArray xml = "<soapenv:Envelope xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\" xmlns:a=\"urn:envelope\" "
+                               "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\">"
+                               "<soapenv:Body>"
+                               "<m:Response xmlns:m=\"urn:message\">"
+                               "<m:plain>a:one</m:plain>"
+                               "<m:inner xmlns:a=\"urn:inner\" xmlns:b=\"urn:b\"><m:qname>a:two</m:qname></m:inner>"
+                               "<m:typed xsi:type=\"xsd:int\">42</m:typed>"
+                               "</m:Response>"
+                               "</soapenv:Body>"
+                               "</soapenv:Envelope>";
+        const KDSoapMessageReader reader;
+        KDSoapMessage msg;
+        KDSoapHeaders headers;
+        QCOMPARE(reader.xmlToMessage(xml, &msg, nullptr, &headers, KDSoap::SOAP1_1), KDSoapMessageReader::NoError);
+
+        // The declarations in scope, outermost first, like when they were copied into each element
+        const KDSoapValue plain = msg.childValues().child(QLatin1String("plain"));
+        QStringList prefixes;
+        const QXmlStreamNamespaceDeclarations plainDecls = plain.environmentNamespaceDeclarations();
+        for (const QXmlStreamNamespaceDeclaration &decl : plainDecls) {
+            prefixes.append(decl.prefix().toString());
+        }
+        QCOMPARE(prefixes, QStringList() << QString::fromLatin1("soapenv") << QString::fromLatin1("a") << QString::fromLatin1("xsi")
+                                         << QString::fromLatin1("xsd") << QString::fromLatin1("m"));
+        QCOMPARE(KDQName::fromSoapValue(plain).nameSpace(), QString::fromLatin1("urn:envelope"));
+
+        // The innermost declaration wins
+        const KDSoapValue qname = msg.childValues().child(QLatin1String("inner")).childValues().child(QLatin1String("qname"));
+        QCOMPARE(qname.environmentNamespaceDeclarations().count(), 7);
+        QCOMPARE(KDQName::fromSoapValue(qname).nameSpace(), QString::fromLatin1("urn:inner"));
+
+        const KDSoapValue typed = msg.childValues().child(QLatin1String("typed"));
+        QCOMPARE(typed.type(), QString::fromLatin1("int"));
+        QCOMPARE(typed.typeNs(), QString::fromLatin1("http://www.w3.org/2001/XMLSchema"));
+        QCOMPARE(typed.value(), QVariant(42));
+
+        // Set explicitly, the declarations replace the parsed ones
+        KDSoapValue copy = plain;
+        copy.setEnvironmentNamespaceDeclarations(QXmlStreamNamespaceDeclarations());
+        QVERIFY(copy.environmentNamespaceDeclarations().isEmpty());
+        QCOMPARE(plain.environmentNamespaceDeclarations().count(), 5);
+    }
+
+    void testInternedNames()
+    {
+        const QByteArray xml = "<soapenv:Envelope xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\">"
+                               "<soapenv:Body>"
+                               "<m:Response xmlns:m=\"urn:message\">"
+                               "<m:item id=\"1\">one</m:item><m:item id=\"2\">two</m:item>"
+                               "</m:Response>"
+                               "</soapenv:Body>"
+                               "</soapenv:Envelope>";
+        const KDSoapMessageReader reader;
+        KDSoapMessage msg;
+        KDSoapMessage msg2;
+        KDSoapHeaders headers;
+        QCOMPARE(reader.xmlToMessage(xml, &msg, nullptr, &headers, KDSoap::SOAP1_1), KDSoapMessageReader::NoError);
+        QCOMPARE(reader.xmlToMessage(xml, &msg2, nullptr, &headers, KDSoap::SOAP1_1), KDSoapMessageReader::NoError);
+
+        // Names and namespaces share their data, within a message and across messages
+        const KDSoapValue first = msg.childValues().at(0);
+        const KDSoapValue second = msg.childValues().at(1);
+        QCOMPARE(first.name(), QString::fromLatin1("item"));
+        QCOMPARE(first.name().constData(), second.name().constData());
+        QCOMPARE(first.namespaceUri().constData(), msg.namespaceUri().constData());
+        QCOMPARE(first.childValues().attributes().first().name().constData(), second.childValues().attributes().first().name().constData());
+        QCOMPARE(msg2.childValues().at(0).name().constData(), first.name().constData());
+        // Unlike the contents
+        QCOMPARE(first.value().toString(), QString::fromLatin1("one"));
+        QCOMPARE(second.value().toString(), QString::fromLatin1("two"));
+    }
+
+    void testArenaAllocation()
+    {
+        QByteArray xml = "<soapenv:Envelope xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+                         "xmlns:dat=\"http://www.27seconds.com/Holidays/US/Dates/\">"
+                         "<soapenv:Body><dat:GetEasterResponse>";
+        for (int i = 0; i < 5000; ++i) {
+            xml += "<dat:item index=\"" + QByteArray::number(i) + "\"><dat:year>" + QByteArray::number(2000 + i) + "</dat:year></dat:item>";
+        }
+        xml += "</dat:GetEasterResponse></soapenv:Body></soapenv:Envelope>";
+
+        const KDSoapMessageReader reader;
+        KDSoapMessage msg;
+        KDSoapHeaders headers;
+        QCOMPARE(reader.xmlToMessage(xml, &msg, nullptr, &headers, KDSoap::SOAP1_1), KDSoapMessageReader::NoError);
+
+        KDSoapMessageReader arenaReader;
+        arenaReader.setArenaAllocation(true);
+        KDSoapValue lastItem;
+        {
+            KDSoapMessage arenaMsg;
+            QCOMPARE(arenaReader.xmlToMessage(xml, &arenaMsg, nullptr, &headers, KDSoap::SOAP1_1), KDSoapMessageReader::NoError);
+            QCOMPARE(arenaMsg.childValues().count(), 5000);
+            QCOMPARE(arenaMsg.toXml(), msg.toXml());
+            lastItem = arenaMsg.childValues().last();
+        }
+        // Still valid once the message is gone, and still modifiable
+        QCOMPARE(lastItem.childValues().attributes().first().value().toString(), QString::fromLatin1("4999"));
+        KDSoapValue copy = lastItem;
+        copy.setName(QString::fromLatin1("renamed"));
+        QCOMPARE(copy.name(), QString::fromLatin1("renamed"));
+        QCOMPARE(lastItem.name(), QString::fromLatin1("item"));
+        QCOMPARE(lastItem.childValues().child(QLatin1String("year")).value().toString(), QString::fromLatin1("6999"));
+    }
+
+    void testMessageIndex()
+    {
+        // Non-ASCII contents, including characters outside of the BMP, before the indexed elements
+        const QByteArray xml = "\xEF\xBB\xBF<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"
+                               "<soapenv:Envelope xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\">"
+                               "<soapenv:Header><h:session xmlns:h=\"urn:header\">\xC3\xA9t\xC3\xA9</h:session></soapenv:Header>"
+                               "<soapenv:Body xmlns:m=\"urn:message\">"
+                               "<m:Response>"
+                               "<m:item id=\"a&lt;b\">\xF0\x9F\x98\x80 one</m:item>"
+                               "<m:other/>"
+                               "<m:item><m:name>two</m:name><m:qname>m:three</m:qname></m:item>"
+                               "</m:Response>"
+                               "</soapenv:Body>"
+                               "</soapenv:Envelope>";
+        const KDSoapMessageReader reader;
+        KDSoapMessage msg;
+        KDSoapHeaders headers;
+        QCOMPARE(reader.xmlToMessage(xml, &msg, nullptr, &headers, KDSoap::SOAP1_1), KDSoapMessageReader::NoError);
+
+        KDSoapMessageIndex index;
+        QVERIFY(index.build(xml));
+        QVERIFY(!index.isFault());
+        QCOMPARE(index.name(index.header()), QString::fromLatin1("Header"));
+        QCOMPARE(index.name(index.body()), QString::fromLatin1("Body"));
+
+        const int first = index.find(QString::fromLatin1("Body/Response/item"));
+        QVERIFY(first >= 0);
+        QCOMPARE(index.value(first).toXml(), msg.childValues().at(0).toXml());
+        QCOMPARE(index.value(first).value().toString(), QString::fromUtf8("\xF0\x9F\x98\x80 one"));
+        const int second = index.find(QString::fromLatin1("/soapenv:Body/m:Response/item[2]"));
+        QCOMPARE(index.value(second).toXml(), msg.childValues().at(2).toXml());
+        QCOMPARE(index.namespaceUri(second), QString::fromLatin1("urn:message"));
+        // The prefixes declared by the ancestors are resolved
+        const KDSoapValue qname = index.value(index.find(QString::fromLatin1("Body/Response/item[2]/qname")));
+        QCOMPARE(KDQName::fromSoapValue(qname).nameSpace(), QString::fromLatin1("urn:message"));
+        QCOMPARE(index.value(index.find(QString::fromLatin1("Header/session"))).value().toString(), QString::fromUtf8("\xC3\xA9t\xC3\xA9"));
+
+        QCOMPARE(index.find(QString::fromLatin1("Body/Response/item[3]")), -1);
+        QCOMPARE(index.find(QString::fromLatin1("Body/Missing")), -1);
+        QCOMPARE(index.find(QString::fromLatin1("Body/Response/item[0]")), -1);
+
+        // Falls back to the full parsing for what it can't index
+        QVERIFY(!index.build(QByteArray("<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>") + xml.mid(xml.indexOf('<', 5))));
+        QVERIFY(!index.build(xml.left(xml.size() - 10)));
+        QVERIFY(!index.build("<foo/>"));
+        QVERIFY(index.build("<soapenv:Envelope xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\"><soapenv:Body>"
+                            "<soapenv:Fault><faultcode>soapenv:Server</faultcode></soapenv:Fault></soapenv:Body></soapenv:Envelope>"));
+        QVERIFY(index.isFault());
+    }
 };
 
 QTEST_MAIN(TestMessageReader)
@@ -0,0 +1,111 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#include "wsdl_sayhello.h"
+
+#include "httpserver_p.h"
+#include <KDSoapServer.h>
+#include <QSignalSpy>
+#include <QTest>
+#include <QTimer>
+
+using namespace KDSoapUnitTestHelpers;
+
+class HelloServerObject : public Hello_ServiceServerBase
+{
+public:
+    KDSoapServerTask<QString> sayHello(const QString &firstName, const QString &lastName) override
+    {
+        if (firstName.isEmpty()) {
+            co_return KDSoapServerFault(QStringLiteral("Client.Data"), QStringLiteral("Empty first name"));
+        }
+        if (lastName == QLatin1String("Later")) {
+            // Pretend we are waiting for I/O; the thread serves other connections meanwhile
+            QTimer *timer = new QTimer;
+            timer->setSingleShot(true);
+            timer->start(100);
+            co_await kdSoapAwaitSignal(timer, &QTimer::timeout);
+            timer->deleteLater(); // we are in its signal
+        }
+        co_return QString::fromLatin1("You said: ") + firstName + QLatin1Char(' ') + lastName + QLatin1String("!");
+    }
+};
+
+class HelloServer : public KDSoapServer
+{
+    Q_OBJECT
+public:
+    HelloServer()
+        : KDSoapServer()
+    {
+        setPath(QLatin1String("/hello"));
+    }
+    QObject *createServerObject() override
+    {
+        return new HelloServerObject;
+    }
+};
+
+class ServerCoroutinesTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testReadyCoroutine()
+    {
+        TestServerThread<HelloServer> serverThread;
+        HelloServer *server = serverThread.startThread();
+
+        Hello_Service service;
+        service.setEndPoint(server->endPoint());
+        QCOMPARE(service.sayHello(QStringLiteral("Hello"), QStringLiteral("World")), QString::fromLatin1("You said: Hello World!"));
+        QVERIFY(service.lastError().isEmpty());
+    }
+
+    void testSuspendedCoroutine()
+    {
+        TestServerThread<HelloServer> serverThread;
+        HelloServer *server = serverThread.startThread();
+
+        // Several suspended calls at the same time, in the single thread of the server
+        QList<Hello_Service *> services;
+        for (int i = 0; i < 5; ++i) {
+            Hello_Service *service = new Hello_Service(this);
+            service->setEndPoint(server->endPoint());
+            services.append(service);
+        }
+        QList<QSignalSpy *> spies;
+        for (Hello_Service *service : qAsConst(services)) {
+            spies.append(new QSignalSpy(service, SIGNAL(sayHelloDone(QString))));
+            service->asyncSayHello(QStringLiteral("Hello"), QStringLiteral("Later"));
+        }
+        for (QSignalSpy *spy : qAsConst(spies)) {
+            QVERIFY(spy->count() == 1 || spy->wait(5000));
+            QCOMPARE(spy->at(0).at(0).toString(), QString::fromLatin1("You said: Hello Later!"));
+        }
+        qDeleteAll(spies);
+        qDeleteAll(services);
+    }
+
+    void testFault()
+    {
+        TestServerThread<HelloServer> serverThread;
+        HelloServer *server = serverThread.startThread();
+
+        Hello_Service service;
+        service.setEndPoint(server->endPoint());
+        QCOMPARE(service.sayHello(QString(), QStringLiteral("World")), QString());
+        QCOMPARE(service.lastError(), QString::fromLatin1("Fault code Client.Data: Empty first name"));
+    }
+};
+
+QTEST_MAIN(ServerCoroutinesTest)
+
+#include "test_server_coroutines.moc"
@@ -10,6 +10,7 @@
 
 #include "KDSoapAuthentication.h"
 #include "KDSoapClientInterface.h"
+#include "KDSoapHpack_p.h"
 #include "KDSoapMessage.h"
 #include "KDSoapNamespaceManager.h"
 #include "KDSoapPendingCallWatcher.h"
@@ -18,20 +19,29 @@
 #include "KDSoapServerCustomVerbRequestInterface.h"
 #include "KDSoapServerObjectInterface.h"
 #include "KDSoapServerRawXMLInterface.h"
+#include "KDSoapStreamingResponse.h"
 #include "KDSoapThreadPool.h"
 #include "KDSoapValue.h"
 #include "httpserver_p.h" // KDSoapUnitTestHelpers
+#include <QAtomicInt>
 #include <QAuthenticator>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QTest>
 #ifndef QT_NO_OPENSSL
 #include <QSslConfiguration>
 #endif
+#include <QSharedPointer>
 #include <QSignalSpy>
 #include <QTimer>
+#include <QWaitCondition>
+#include <functional>
 using namespace KDSoapUnitTestHelpers;
 
 Q_DECLARE_METATYPE(QFile::Permissions)
@@ -43,6 +53,11 @@ typedef QMap<QThread *, CountryServerObject *> ServerObjectsMap;
 ServerObjectsMap s_serverObjects;
 QMutex s_serverObjectsMutex;
 
+// "Barrier" calls wait until two of them are running at the same time
+static QMutex s_barrierMutex;
+static QWaitCondition s_barrierCondition;
+static int s_barrierCount = 0;
+
 class PublicThread : public QThread
 {
 public:
@@ -50,6 +65,8 @@ public:
 };
 
 static const char s_longEmployeeName[] = "This is a long string in order to test chunking in this test";
+static const int s_streamedElementCount = 20000;
+
 static QByteArray rawCountryMessage(const QByteArray &employeeName = "David Ä Faure")
 {
     return "<?xml version=\"1.0\" encoding=\"UTF-8\"?><soap:Envelope xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\" "
@@ -67,6 +84,115 @@ static QByteArray expectedCountryResponse(const QByteArray &employeeName = "Davi
         + employeeName + " France</employeeCountry>getEmployeeCountryResponse</n1:getEmployeeCountry></soap:Body></soap:Envelope>\n";
 }
 
+// HTTP/2 frames, for the tests which speak it over a raw socket
+struct Http2Frame
+{
+    int type;
+    int flags;
+    quint32 streamId;
+    QByteArray payload;
+};
+enum
+{
+    Http2DataFrame = 0x0,
+    Http2HeadersFrame = 0x1,
+    Http2RstStreamFrame = 0x3,
+    Http2SettingsFrame = 0x4,
+    Http2PingFrame = 0x6
+};
+static const char s_http2Preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static QByteArray http2Frame(int type, int flags, quint32 streamId, const QByteArray &payload = QByteArray())
+{
+    QByteArray data;
+    data.append(char(payload.size() >> 16));
+    data.append(char(payload.size() >> 8));
+    data.append(char(payload.size()));
+    data.append(char(type));
+    data.append(char(flags));
+    data.append(char(streamId >> 24));
+    data.append(char(streamId >> 16));
+    data.append(char(streamId >> 8));
+    data.append(char(streamId));
+    return data + payload;
+}
+
+// A getEmployeeCountry call on \p streamId: HEADERS (END_HEADERS) and DATA (END_STREAM)
+static QByteArray http2CountryRequest(KDSoapHpackEncoder *encoder, quint32 streamId, const QByteArray &employeeName)
+{
+    const KDSoapHttpHeaderList headers {{":method", "POST"},
+                                        {":scheme", "http"},
+                                        {":path", "/"},
+                                        {":authority", "127.0.0.1"},
+                                        {"soapaction", "http://www.kdab.com/xml/MyWsdl/getEmployeeCountry"},
+                                        {"content-type", "text/xml;charset=utf-8"}};
+    return http2Frame(Http2HeadersFrame, 0x4, streamId, encoder->encode(headers)) + http2Frame(Http2DataFrame, 0x1, streamId, rawCountryMessage(employeeName));
+}
+
+// Reads frames until \p isLast returns true for one of them, or the server stops sending
+static QList<Http2Frame> readHttp2Frames(QTcpSocket &socket, QByteArray &buffer, const std::function<bool(const Http2Frame &)> &isLast)
+{
+    QList<Http2Frame> frames;
+    for (;;) {
+        while (buffer.size() >= 9) {
+            const int length = (int(quint8(buffer.at(0))) << 16) | (int(quint8(buffer.at(1))) << 8) | int(quint8(buffer.at(2)));
+            if (buffer.size() < 9 + length) {
+                break;
+            }
+            Http2Frame frame;
+            frame.type = quint8(buffer.at(3));
+            frame.flags = quint8(buffer.at(4));
+            frame.streamId = ((quint32(quint8(buffer.at(5))) << 24) | (quint32(quint8(buffer.at(6))) << 16) | (quint32(quint8(buffer.at(7))) << 8)
+                              | quint32(quint8(buffer.at(8))))
+                & 0x7fffffff;
+            frame.payload = buffer.mid(9, length);
+            buffer.remove(0, 9 + length);
+            frames.append(frame);
+            if (isLast(frame)) {
+                return frames;
+            }
+        }
+        if (!socket.waitForReadyRead(5000)) {
+            return frames;
+        }
+        buffer += socket.readAll();
+    }
+}
+
+// The response on \p streamId: its headers and body. Returns false if the stream wasn't answered.
+static bool readHttp2Response(QTcpSocket &socket, QByteArray &buffer, KDSoapHpackDecoder *decoder, quint32 streamId, KDSoapHttpHeaderList *headers,
+                              QByteArray *body, QList<quint32> *otherStreams = nullptr)
+{
+    const QList<Http2Frame> frames = readHttp2Frames(socket, buffer, [streamId](const Http2Frame &frame) {
+        const bool endStream = (frame.type == Http2HeadersFrame || frame.type == Http2DataFrame) && (frame.flags & 0x1);
+        return frame.streamId == streamId && (endStream || frame.type == Http2RstStreamFrame);
+    });
+    bool ended = false;
+    for (const Http2Frame &frame : frames) {
+        if (frame.type == Http2HeadersFrame) {
+            // Every header block goes through the decoder, to keep its table in sync
+            KDSoapHttpHeaderList blockHeaders;
+            if (decoder->decode(frame.payload, &blockHeaders) != KDSoapHpackDecoder::Ok) {
+                return false;
+            }
+            if (frame.streamId == streamId) {
+                *headers = blockHeaders;
+            }
+        }
+        if (frame.streamId != 0 && frame.streamId != streamId && otherStreams) {
+            otherStreams->append(frame.streamId);
+        }
+        if (frame.streamId != streamId) {
+            continue;
+        }
+        if (frame.type == Http2DataFrame) {
+            *body += frame.payload;
+        }
+        ended = frame.type != Http2RstStreamFrame && (frame.flags & 0x1);
+    }
+    return ended;
+}
+
 class CountryServerObject : public QObject,
                             public KDSoapServerObjectInterface,
                             public KDSoapServerAuthInterface,
@@ -181,6 +307,9 @@ public:
         static KDSoapServerObjectInterface::HttpResponseHeaderItems result = KDSoapServerObjectInterface::HttpResponseHeaderItems()
             << KDSoapServerObjectInterface::HttpResponseHeaderItem("Access-Control-Allow-Origin", "*")
             << KDSoapServerObjectInterface::HttpResponseHeaderItem("Access-Control-Allow-Headers", "Content-Type");
+        if (!m_employeeHeader.isEmpty()) { // items which change with each call
+            return HttpResponseHeaderItems(result) << HttpResponseHeaderItem("X-Employee", m_employeeHeader);
+        }
         return result;
     }
 
@@ -197,8 +326,21 @@ public: // SOAP-accessible methods
             return QString();
         }
         // qDebug() << "getEmployeeCountry(" << employeeName << ") called";
+        m_employeeHeader = employeeName.startsWith(QLatin1String("Header ")) ? employeeName.toLatin1() : QByteArray();
         if (employeeName == QLatin1String("Slow")) {
             PublicThread::msleep(100);
+        } else if (employeeName == QLatin1String("Very Slow")) {
+            PublicThread::msleep(1000);
+        } else if (employeeName == QLatin1String("Barrier")) {
+            QMutexLocker locker(&s_barrierMutex);
+            ++s_barrierCount;
+            s_barrierCondition.wakeAll();
+            while (s_barrierCount < 2) {
+                if (!s_barrierCondition.wait(&s_barrierMutex, 10000)) {
+                    setFault(QLatin1String("Server.Timeout"), QLatin1String("Barrier calls didn't run concurrently"));
+                    return QString();
+                }
+            }
         }
         return employeeName + QString::fromLatin1(" France");
     }
@@ -236,6 +378,7 @@ private:
     bool m_requireAuth;
     bool m_useRawXML;
     bool m_rawXMLValid;
+    QByteArray m_employeeHeader;
     QByteArray m_assembledXML;
 };
 
@@ -263,6 +406,11 @@ public:
     {
         m_useRawXML = b;
     }
+    // Connections accepted by the server's own socket, rather than by the sockets of listenPerThread
+    int ownSocketConnectionCount() const
+    {
+        return m_ownSocketConnectionCount.loadAcquire();
+    }
 
 Q_SIGNALS:
     void releaseSemaphore();
@@ -283,9 +431,17 @@ public Q_SLOTS:
         emit releaseSemaphore();
     }
 
+protected:
+    void incomingConnection(qintptr socketDescriptor) override
+    {
+        m_ownSocketConnectionCount.ref();
+        KDSoapServer::incomingConnection(socketDescriptor);
+    }
+
 private:
     bool m_requireAuth;
     bool m_useRawXML;
+    QAtomicInt m_ownSocketConnectionCount;
 };
 
 // We need to do the listening and socket handling in a separate thread,
@@ -296,8 +452,9 @@ class CountryServerThread : public QThread
 {
     Q_OBJECT
 public:
-    CountryServerThread(KDSoapThreadPool *pool = 0)
+    CountryServerThread(KDSoapThreadPool *pool = 0, bool listenPerThread = false)
         : m_threadPool(pool)
+        , m_listenPerThread(listenPerThread)
         , m_pServer(0)
     {
     }
@@ -333,7 +490,7 @@ protected:
         if (m_threadPool) {
             server.setThreadPool(m_threadPool);
         }
-        if (server.listen()) {
+        if (m_listenPerThread ? server.listenPerThread() : server.listen()) {
             m_pServer = &server;
         }
         connect(&server, &CountryServer::releaseSemaphore, this, &CountryServerThread::slotReleaseSemaphore, Qt::DirectConnection);
@@ -349,6 +506,7 @@ private Q_SLOTS:
 
 private:
     KDSoapThreadPool *m_threadPool;
+    bool m_listenPerThread;
     QSemaphore m_semaphore;
     CountryServer *m_pServer;
 };
@@ -768,6 +926,78 @@ private Q_SLOTS:
         serverThread.resume();
     }
 
+    void testIdleConnectionMigration()
+    {
+        {
+            KDSoapThreadPool threadPool;
+            threadPool.setMaxThreadCount(2);
+            threadPool.setIdleConnectionMigrationEnabled(true);
+            CountryServerThread serverThread(&threadPool);
+            CountryServer *server = serverThread.startThread();
+
+            // Two keep-alive connections, in two threads
+            KDSoapClientInterface client1(server->endPoint(), countryMessageNamespace());
+            KDSoapClientInterface client2(server->endPoint(), countryMessageNamespace());
+            KDSoapMessage response = client2.call(QLatin1String("getEmployeeCountry"), countryMessage());
+            QCOMPARE(response.childValues().first().value().toString(), expectedCountry());
+
+            // Slow requests make client1's thread busy, so its connection can move to the other thread between two requests
+            for (int i = 0; i < 4; ++i) {
+                response = client1.call(QLatin1String("getEmployeeCountry"), countryMessage(true));
+                QCOMPARE(response.childValues().first().value().toString(), QString::fromLatin1("Slow France"));
+            }
+            response = client1.call(QLatin1String("getEmployeeCountry"), countryMessage());
+            QCOMPARE(response.childValues().first().value().toString(), expectedCountry());
+            response = client2.call(QLatin1String("getEmployeeCountry"), countryMessage());
+            QCOMPARE(response.childValues().first().value().toString(), expectedCountry());
+            QCOMPARE(server->numConnectedSockets(), 2);
+            QCOMPARE(server->totalConnectionCount(), 7);
+        }
+        QCOMPARE(s_serverObjects.count(), 0);
+    }
+
+    void testListenPerThread()
+    {
+#ifndef Q_OS_LINUX
+        QSKIP("SO_REUSEPORT load balancing is only tested on Linux");
+#endif
+        {
+            KDSoapThreadPool threadPool;
+            threadPool.setMaxThreadCount(3);
+            CountryServerThread serverThread(&threadPool, true);
+            CountryServer *server = serverThread.startThread();
+            QVERIFY(server);
+            const QString endPoint = server->endPoint();
+            const int numClients = 12;
+            for (int i = 0; i < numClients; ++i) {
+                // A new connection each time, the kernel picks the listening socket
+                KDSoapClientInterface client(endPoint, countryMessageNamespace());
+                const KDSoapMessage response = client.call(QLatin1String("getEmployeeCountry"), countryMessage());
+                QCOMPARE(response.childValues().first().value().toString(), expectedCountry());
+            }
+            QTRY_COMPARE(server->totalConnectionCount(), numClients);
+            // The server's own socket only holds the port, all the connections went to the threads' sockets
+            QCOMPARE(server->ownSocketConnectionCount(), 0);
+            QMapIterator<QThread *, CountryServerObject *> it(s_serverObjects);
+            while (it.hasNext()) {
+                QThread *thread = it.next().key();
+                QVERIFY(thread != qApp->thread());
+                QVERIFY(thread != &serverThread);
+            }
+
+            // suspend and resume keep listening per thread, on the same port
+            const quint16 oldPort = server->serverPort();
+            serverThread.suspend();
+            QCOMPARE(server->endPoint(), QString());
+            serverThread.resume();
+            QCOMPARE(server->serverPort(), oldPort);
+            KDSoapClientInterface client(endPoint, countryMessageNamespace());
+            const KDSoapMessage response = client.call(QLatin1String("getEmployeeCountry"), countryMessage());
+            QCOMPARE(response.childValues().first().value().toString(), expectedCountry());
+        }
+        QCOMPARE(s_serverObjects.count(), 0);
+    }
+
     void testSuspendUnderLoad()
     {
 #ifdef Q_OS_MAC
@@ -880,6 +1110,90 @@ private Q_SLOTS:
         QFile::remove(fileName);
     }
 
+    void testJsonLogAndRotation()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+
+        const QString fileName = QString::fromLatin1("output.json.log");
+        const QString rotatedFileName = fileName + QLatin1String(".1");
+        QFile::remove(fileName);
+        QFile::remove(rotatedFileName);
+        server->setLogFileName(fileName);
+        server->setLogFormat(KDSoapServer::JsonLogFormat);
+        QCOMPARE(server->logFormat(), KDSoapServer::JsonLogFormat);
+        server->setLogLevel(KDSoapServer::LogEveryCall);
+
+        makeSimpleCall(server->endPoint());
+        makeFaultyCall(server->endPoint());
+        server->flushLogFile();
+
+        const QList<QByteArray> lines = readLines(fileName);
+        QCOMPARE(lines.count(), 2);
+        const QJsonObject call = QJsonDocument::fromJson(lines.at(0)).object();
+        QCOMPARE(call.value(QLatin1String("type")).toString(), QString::fromLatin1("CALL"));
+        QCOMPARE(call.value(QLatin1String("method")).toString(), QString::fromLatin1("getEmployeeCountry"));
+        QCOMPARE(call.value(QLatin1String("status")).toInt(), 200);
+        QVERIFY(call.value(QLatin1String("bytesIn")).toInt() > 0);
+        QVERIFY(call.value(QLatin1String("bytesOut")).toInt() > 0);
+        QVERIFY(call.value(QLatin1String("durationUs")).toDouble() >= 0);
+        QVERIFY(call.contains(QLatin1String("time")));
+        const QJsonObject fault = QJsonDocument::fromJson(lines.at(1)).object();
+        QCOMPARE(fault.value(QLatin1String("type")).toString(), QString::fromLatin1("FAULT"));
+        QCOMPARE(fault.value(QLatin1String("status")).toInt(), 500);
+        QVERIFY(fault.value(QLatin1String("fault")).toString().contains(QLatin1String("Empty employee name")));
+
+        // The file exceeds the maximum size with the next entries: it's rotated
+        server->setLogFileRotation(QFileInfo(fileName).size() + 10, 1);
+        QCOMPARE(server->logFileMaxSize(), QFileInfo(fileName).size() + 10);
+        makeSimpleCall(server->endPoint());
+        server->flushLogFile();
+        QCOMPARE(readLines(rotatedFileName).count(), 2);
+        QCOMPARE(readLines(fileName).count(), 1);
+
+        server->closeLogFile();
+        QFile::remove(fileName);
+        QFile::remove(rotatedFileName);
+    }
+
+    void testMetrics()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setMetricsPath(QString::fromLatin1("/metrics"));
+        QCOMPARE(server->metricsPath(), QString::fromLatin1("/metrics"));
+
+        makeSimpleCall(server->endPoint());
+        makeFaultyCall(server->endPoint());
+        {
+            // Names of unknown methods come from the client, they're not used as labels
+            KDSoapClientInterface client(server->endPoint(), countryMessageNamespace());
+            QVERIFY(client.call(QLatin1String("unknownMethod1"), KDSoapMessage()).isFault());
+            QVERIFY(client.call(QLatin1String("unknownMethod2"), KDSoapMessage()).isFault());
+        }
+        server->resetRejectedRequestCount();
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        socket.write("GET /metrics HTTP/1.1\r\n"
+                     "Host: 127.0.0.1\r\n"
+                     "\r\n");
+        QByteArray response;
+        while (!response.endsWith("kdsoap_rejected_requests_total 0\n") && socket.waitForReadyRead()) {
+            response += socket.readAll();
+        }
+        QVERIFY2(response.startsWith("HTTP/1.1 200 OK\r\n"), response.constData());
+        QVERIFY(response.contains("Content-Type: text/plain; version=0.0.4"));
+        QVERIFY(response.contains("kdsoap_requests_total{operation=\"getEmployeeCountry\"} 2\n"));
+        QVERIFY(response.contains("kdsoap_faults_total{operation=\"getEmployeeCountry\"} 1\n"));
+        QVERIFY(response.contains("kdsoap_request_duration_seconds_count{operation=\"getEmployeeCountry\"} 2\n"));
+        QVERIFY(response.contains("kdsoap_request_phase_seconds_count{operation=\"getEmployeeCountry\",phase=\"dispatch\"} 2\n"));
+        QVERIFY(response.contains("kdsoap_requests_total{operation=\"other\"} 2\n"));
+        QVERIFY(response.contains("kdsoap_faults_total{operation=\"other\"} 2\n"));
+        QVERIFY(!response.contains("unknownMethod"));
+        QVERIFY(response.contains("kdsoap_queued_requests 0\n"));
+    }
+
     void testWsdlFile()
     {
         CountryServerThread serverThread;
@@ -905,9 +1219,89 @@ private Q_SLOTS:
 
         QCOMPARE(( int )reply->error(), ( int )QNetworkReply::NoError);
         QCOMPARE(reply->readAll(), QByteArray("Hello world"));
+
+        // The contents are cached, but not when the file changes
+        QTest::qWait(10); // make sure the modification time changes
+        file.write(", again");
+        file.close();
+        reply = manager.get(request);
+        connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+        loop.exec();
+        QCOMPARE(( int )reply->error(), ( int )QNetworkReply::NoError);
+        QCOMPARE(reply->readAll(), QByteArray("Hello world, again"));
         QFile::remove(fileName);
     }
 
+    void testDownloadValidatorsAndRanges_data()
+    {
+        QTest::addColumn<QByteArray>("requestHeaders");
+        QTest::addColumn<QByteArray>("expectedHttpReply");
+        QTest::addColumn<QByteArray>("expectedContent");
+
+        // ETAG is replaced with the ETag from a first request
+        QTest::newRow("full") << QByteArray() << QByteArray("200 OK") << QByteArray("Hello world");
+        QTest::newRow("range") << QByteArray("Range: bytes=6-8\r\n") << QByteArray("206 Partial Content") << QByteArray("wor");
+        QTest::newRow("open_range") << QByteArray("Range: bytes=6-\r\n") << QByteArray("206 Partial Content") << QByteArray("world");
+        QTest::newRow("suffix_range") << QByteArray("Range: bytes=-3\r\n") << QByteArray("206 Partial Content") << QByteArray("rld");
+        QTest::newRow("unsatisfiable_range") << QByteArray("Range: bytes=20-\r\n") << QByteArray("416 Range Not Satisfiable") << QByteArray();
+        QTest::newRow("invalid_range") << QByteArray("Range: bytes=8-6\r\n") << QByteArray("200 OK") << QByteArray("Hello world");
+        QTest::newRow("if_range_match") << QByteArray("Range: bytes=6-8\r\nIf-Range: ETAG\r\n") << QByteArray("206 Partial Content") << QByteArray("wor");
+        QTest::newRow("if_range_mismatch") << QByteArray("Range: bytes=6-8\r\nIf-Range: \"foo\"\r\n") << QByteArray("200 OK") << QByteArray("Hello world");
+        QTest::newRow("if_none_match") << QByteArray("If-None-Match: ETAG\r\n") << QByteArray("304 Not Modified") << QByteArray();
+        QTest::newRow("if_none_match_other") << QByteArray("If-None-Match: \"foo\"\r\n") << QByteArray("200 OK") << QByteArray("Hello world");
+        QTest::newRow("if_modified_since") << QByteArray("If-Modified-Since: Fri, 01 Jan 2100 00:00:00 GMT\r\n") << QByteArray("304 Not Modified")
+                                           << QByteArray();
+        QTest::newRow("modified_since") << QByteArray("If-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n") << QByteArray("200 OK")
+                                        << QByteArray("Hello world");
+    }
+
+    void testDownloadValidatorsAndRanges()
+    {
+        QFETCH(QByteArray, requestHeaders);
+        QFETCH(QByteArray, expectedHttpReply);
+        QFETCH(QByteArray, expectedContent);
+
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setRequireAuth(false);
+
+        const QString fileName = QString::fromLatin1("file_download.txt");
+        QFile file(fileName);
+        QVERIFY2(file.open(QIODevice::WriteOnly), qPrintable(file.errorString()));
+        file.write("Hello world");
+        file.close();
+
+        auto download = [&](const QByteArray &headers) -> QByteArray {
+            ClientSocket socket(server);
+            if (!socket.waitForConnected()) {
+                return QByteArray();
+            }
+            socket.write("GET /path/to/file_download.txt HTTP/1.1\r\n" + headers + "\r\n");
+            socket.waitForBytesWritten(3000);
+            QByteArray reply;
+            while (socket.waitForReadyRead(reply.contains("\r\n\r\n") ? 200 : 3000)) {
+                reply += socket.readAll();
+            }
+            return reply;
+        };
+        const QByteArray first = download(QByteArray());
+        const int etagPos = first.indexOf("ETag: ");
+        QVERIFY2(etagPos > 0, first.constData());
+        const QByteArray etag = first.mid(etagPos + 6, first.indexOf("\r\n", etagPos) - etagPos - 6);
+        QVERIFY(first.contains("\r\nLast-Modified: "));
+        QVERIFY(first.contains("\r\nAccept-Ranges: bytes\r\n"));
+
+        const QByteArray reply = download(QByteArray(requestHeaders).replace("ETAG", etag));
+        QFile::remove(fileName);
+
+        const QByteArray firstLine = reply.left(reply.indexOf('\r'));
+        QCOMPARE(firstLine, "HTTP/1.1 " + expectedHttpReply);
+        QCOMPARE(reply.mid(reply.indexOf("\r\n\r\n") + 4), expectedContent);
+        if (expectedHttpReply.startsWith("206")) {
+            QVERIFY2(reply.contains("\r\nContent-Range: bytes "), reply.constData());
+        }
+    }
+
     void testFileDownload_data()
     {
         QTest::addColumn<QString>("fileToDownload"); // client
@@ -966,7 +1360,11 @@ private Q_SLOTS:
         socket.write(request);
         QVERIFY(socket.waitForBytesWritten(3000));
         QVERIFY(socket.bytesAvailable() || socket.waitForReadyRead(3000));
-        const QByteArray reply = socket.readAll();
+        QByteArray reply = socket.readAll();
+        // The file contents can come separately from the headers
+        while (reply.startsWith("HTTP/1.1 200") && !reply.endsWith("Hello world") && socket.waitForReadyRead(3000)) {
+            reply += socket.readAll();
+        }
 
         file.setPermissions(QFile::ReadOwner | QFile::ReadUser | QFile::WriteOwner | QFile::WriteUser);
         QFile::remove(fileName);
@@ -1116,14 +1514,20 @@ private Q_SLOTS:
     {
         QTest::addColumn<int>("chunkSize");
         QTest::addColumn<bool>("useRawXML");
+        QTest::addColumn<bool>("streamParsing");
+
+        QTest::newRow("no_chunks") << 1000 << false << false;
+        QTest::newRow("100") << 100 << false << false;
+        QTest::newRow("50") << 50 << false << false;
+        QTest::newRow("20") << 20 << false << false;
+        QTest::newRow("10") << 10 << false << false;
+        QTest::newRow("1") << 1 << false << false;
 
-        QTest::newRow("no_chunks") << 1000 << false;
-        QTest::newRow("100") << 100 << false;
-        QTest::newRow("50") << 50 << false;
-        QTest::newRow("20") << 20 << false;
-        QTest::newRow("10") << 10 << false;
+        QTest::newRow("rawXML") << 50 << true << false;
 
-        QTest::newRow("rawXML") << 50 << true;
+        QTest::newRow("streaming_no_chunks") << 1000 << false << true;
+        QTest::newRow("streaming_10") << 10 << false << true;
+        QTest::newRow("streaming_1") << 1 << false << true;
     }
 
     // Even more low-level, using a QTcpSocket to send the request
@@ -1132,9 +1536,13 @@ private Q_SLOTS:
     {
         QFETCH(int, chunkSize);
         QFETCH(bool, useRawXML);
+        QFETCH(bool, streamParsing);
         CountryServerThread serverThread;
         CountryServer *server = serverThread.startThread();
         server->setUseRawXML(useRawXML);
+        if (streamParsing) {
+            server->setFeatures(KDSoapServer::StreamRequestParsing);
+        }
 
         ClientSocket socket(server);
         QVERIFY(socket.waitForConnected());
@@ -1156,6 +1564,826 @@ private Q_SLOTS:
         verifySocketResponse(socket, s_longEmployeeName);
     }
 
+    void testMixedCaseHeaders()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        const QByteArray message = rawCountryMessage(s_longEmployeeName);
+        // Header names are case insensitive, values are trimmed, and LF-only line endings are tolerated
+        const QByteArray request = "\r\nPOST / HTTP/1.1\r\n"
+                                   "SOAPACTION:   http://www.kdab.com/xml/MyWsdl/getEmployeeCountry  \r\n"
+                                   "content-type:text/xml;charset=utf-8\n"
+                                   "Content-LENGTH: "
+            + QByteArray::number(message.size())
+            + "\r\n"
+              "\r\n"
+            + message;
+        socket.write(request);
+        QVERIFY(socket.waitForBytesWritten());
+        verifySocketResponse(socket, s_longEmployeeName);
+    }
+
+    void testPipelining()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        // All requests are sent at once, the response to the first one is delayed: the others must wait for it
+        const QList<QByteArray> employeeNames = {"Delayed", "David Ä Faure", "Slow"};
+        QByteArray requests;
+        for (const QByteArray &employeeName : employeeNames) {
+            const QByteArray message = rawCountryMessage(employeeName);
+            requests += "POST / HTTP/1.1\r\n"
+                        "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                        "Content-Type: text/xml;charset=utf-8\r\n"
+                        "Content-Length: "
+                + QByteArray::number(message.size())
+                + "\r\n"
+                  "\r\n"
+                + message;
+        }
+        socket.write(requests);
+        QVERIFY(socket.waitForBytesWritten());
+
+        QByteArray responses;
+        QElapsedTimer timer;
+        timer.start();
+        while (responses.count("HTTP/1.1 200 OK") < employeeNames.count() && timer.elapsed() < 10000) {
+            if (socket.waitForReadyRead(1000)) {
+                responses += socket.readAll();
+            }
+        }
+        QCOMPARE(responses.count("HTTP/1.1 200 OK"), employeeNames.count());
+        const int first = responses.indexOf("Delayed France");
+        const int second = responses.indexOf("David Ä Faure France");
+        const int third = responses.indexOf("Slow France");
+        QVERIFY2(first > 0, responses.constData());
+        QVERIFY(second > first);
+        QVERIFY(third > second);
+        QCOMPARE(server->totalConnectionCount(), employeeNames.count());
+    }
+
+    void testChangingHeaderItems()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        // Two calls on the same connection, the server object returns different header items for each of them
+        const QList<QByteArray> employeeNames = {"Header A", "Header B"};
+        for (const QByteArray &employeeName : employeeNames) {
+            const QByteArray message = rawCountryMessage(employeeName);
+            socket.write("POST / HTTP/1.1\r\n"
+                         "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                         "Content-Type: text/xml;charset=utf-8\r\n"
+                         "Content-Length: "
+                         + QByteArray::number(message.size())
+                         + "\r\n"
+                           "\r\n"
+                         + message);
+            QVERIFY(socket.waitForBytesWritten());
+
+            QByteArray response;
+            QElapsedTimer timer;
+            timer.start();
+            while (!response.contains(employeeName + " France") && timer.elapsed() < 10000) {
+                if (socket.waitForReadyRead(1000)) {
+                    response += socket.readAll();
+                }
+            }
+            QVERIFY2(response.startsWith("HTTP/1.1 200 OK\r\n"), response.constData());
+            QVERIFY(response.contains("\r\nAccess-Control-Allow-Origin: *\r\n"));
+            QVERIFY2(response.contains("\r\nX-Employee: " + employeeName + "\r\n"), response.constData());
+            QCOMPARE(response.count("X-Employee:"), 1);
+        }
+        QCOMPARE(server->totalConnectionCount(), 1);
+    }
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+    void testHttp2()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setFeatures(KDSoapServer::Http2);
+
+        // HTTP/2 with prior knowledge: the calls share one connection, the delayed one doesn't hold back the others
+        QNetworkAccessManager accessManager;
+        const QList<QByteArray> employeeNames = {"Delayed", "David Ä Faure", "Slow"};
+        QList<QNetworkReply *> replies;
+        QList<QNetworkReply *> finishedReplies;
+        QEventLoop loop;
+        for (const QByteArray &employeeName : employeeNames) {
+            QNetworkRequest request(QUrl(server->endPoint()));
+            request.setAttribute(QNetworkRequest::Http2DirectAttribute, true);
+            request.setRawHeader("SoapAction", "http://www.kdab.com/xml/MyWsdl/getEmployeeCountry");
+            request.setHeader(QNetworkRequest::ContentTypeHeader, QByteArray("text/xml;charset=utf-8"));
+            QNetworkReply *reply = accessManager.post(request, rawCountryMessage(employeeName));
+            connect(reply, &QNetworkReply::finished, &loop, [&, reply]() {
+                finishedReplies.append(reply);
+                if (finishedReplies.count() == employeeNames.count()) {
+                    loop.quit();
+                }
+            });
+            replies.append(reply);
+        }
+        QTimer::singleShot(10000, &loop, &QEventLoop::quit);
+        loop.exec();
+        QCOMPARE(finishedReplies.count(), employeeNames.count());
+        for (int i = 0; i < replies.count(); ++i) {
+            QNetworkReply *reply = replies.at(i);
+            QCOMPARE(reply->error(), QNetworkReply::NoError);
+            QVERIFY(reply->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool());
+            QVERIFY(reply->readAll().contains(employeeNames.at(i) + " France"));
+        }
+        QCOMPARE(finishedReplies.last(), replies.first());
+        QCOMPARE(server->totalConnectionCount(), 1);
+        qDeleteAll(replies);
+    }
+
+    void testHttp2FileDownload()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setFeatures(KDSoapServer::Http2);
+
+        // Much more than the initial flow control windows (64 KB): the rest is sent as the client opens them
+        const QString fileName = QString::fromLatin1("file_download.txt");
+        QByteArray content;
+        for (int i = 0; content.size() < 3 * 1024 * 1024; ++i) {
+            content += "Line " + QByteArray::number(i) + '\n';
+        }
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(content);
+        file.close();
+
+        QString url = server->endPoint();
+        url.chop(1) /*trailing slash*/;
+        url += QLatin1String("/path/to/file_download.txt");
+        QNetworkAccessManager manager;
+        QNetworkRequest request(QUrl {url});
+        request.setAttribute(QNetworkRequest::Http2DirectAttribute, true);
+        QNetworkReply *reply = manager.get(request);
+        QEventLoop loop;
+        connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+        QTimer::singleShot(10000, &loop, &QEventLoop::quit);
+        loop.exec();
+        QVERIFY(reply->isFinished());
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QVERIFY(reply->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool());
+        QCOMPARE(reply->readAll(), content);
+        delete reply;
+        QFile::remove(fileName);
+    }
+#endif
+
+    void testHttp2Upgrade()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setFeatures(KDSoapServer::Http2);
+
+        // "Upgrade: h2c": the request sent with HTTP/1.1 is answered on stream 1
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        const QByteArray message = rawCountryMessage();
+        socket.write("POST / HTTP/1.1\r\n"
+                     "Host: 127.0.0.1\r\n"
+                     "Connection: Upgrade, HTTP2-Settings\r\n"
+                     "Upgrade: h2c\r\n"
+                     "HTTP2-Settings: AAMAAABkAAQAAP__\r\n" // SETTINGS_MAX_CONCURRENT_STREAMS = 100, SETTINGS_INITIAL_WINDOW_SIZE = 65535
+                     "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                     "Content-Type: text/xml;charset=utf-8\r\n"
+                     "Content-Length: "
+                     + QByteArray::number(message.size()) + "\r\n\r\n" + message);
+        QByteArray buffer;
+        while (!buffer.contains("\r\n\r\n") && socket.waitForReadyRead(5000)) {
+            buffer += socket.readAll();
+        }
+        const int headEnd = buffer.indexOf("\r\n\r\n");
+        QVERIFY2(headEnd > 0, buffer.constData());
+        const QByteArray upgradeResponse = buffer.left(headEnd);
+        QVERIFY2(upgradeResponse.startsWith("HTTP/1.1 101 Switching Protocols\r\n"), upgradeResponse.constData());
+        QVERIFY(upgradeResponse.toLower().contains("\r\nupgrade: h2c"));
+        buffer.remove(0, headEnd + 4);
+
+        // The client sends its connection preface after the 101
+        socket.write(s_http2Preface + http2Frame(Http2SettingsFrame, 0, 0));
+        KDSoapHpackDecoder decoder;
+        KDSoapHttpHeaderList headers;
+        QByteArray body;
+        QVERIFY(readHttp2Response(socket, buffer, &decoder, 1, &headers, &body));
+        QCOMPARE(headers.value(0), KDSoapHttpHeader(":status", "200"));
+        QCOMPARE(body, expectedCountryResponse());
+
+        // Then the connection is used for the next calls
+        KDSoapHpackEncoder encoder;
+        socket.write(http2CountryRequest(&encoder, 3, "Slow"));
+        headers.clear();
+        body.clear();
+        QVERIFY(readHttp2Response(socket, buffer, &decoder, 3, &headers, &body));
+        QCOMPARE(headers.value(0), KDSoapHttpHeader(":status", "200"));
+        QVERIFY(body.contains("Slow France"));
+        QCOMPARE(server->totalConnectionCount(), 1);
+    }
+
+    void testHttp2ResetDelayedCall()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setFeatures(KDSoapServer::Http2);
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        KDSoapHpackEncoder encoder;
+        KDSoapHpackDecoder decoder;
+        QByteArray buffer;
+        // The PING is answered once the delayed call started, since the calls start as soon as their request is complete
+        socket.write(s_http2Preface + http2Frame(Http2SettingsFrame, 0, 0) + http2CountryRequest(&encoder, 1, "Delayed")
+                     + http2Frame(Http2PingFrame, 0, 0, QByteArray(8, 'p')));
+        QList<Http2Frame> frames = readHttp2Frames(socket, buffer, [](const Http2Frame &frame) {
+            return frame.type == Http2PingFrame && (frame.flags & 0x1);
+        });
+        QVERIFY(!frames.isEmpty());
+        QCOMPARE(frames.last().type, int(Http2PingFrame));
+
+        // The client gives up on it: the delayed response is dropped, the other streams go on
+        socket.write(http2Frame(Http2RstStreamFrame, 0, 1, QByteArray::fromHex("00000008")) + http2CountryRequest(&encoder, 3, "David Ä Faure"));
+        KDSoapHttpHeaderList headers;
+        QByteArray body;
+        QList<quint32> otherStreams;
+        QVERIFY(readHttp2Response(socket, buffer, &decoder, 3, &headers, &body, &otherStreams));
+        QCOMPARE(body, expectedCountryResponse());
+
+        // Long after the delayed response was sent (100 ms): nothing came on stream 1, and the header tables are still in sync
+        QTest::qWait(300);
+        socket.write(http2CountryRequest(&encoder, 5, "Slow"));
+        headers.clear();
+        body.clear();
+        QVERIFY(readHttp2Response(socket, buffer, &decoder, 5, &headers, &body, &otherStreams));
+        QCOMPARE(headers.value(0), KDSoapHttpHeader(":status", "200"));
+        QVERIFY(body.contains("Slow France"));
+        QVERIFY(!otherStreams.contains(1));
+        QCOMPARE(socket.state(), QAbstractSocket::ConnectedState);
+    }
+
+    // Each queued stream has its own deadline
+    void testHttp2QueueTimeout()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setFeatures(KDSoapServer::Http2);
+        server->setMaxConcurrentRequests(1);
+        server->setMaxQueuedRequests(2);
+        server->setRequestQueueTimeout(700);
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        KDSoapHpackEncoder encoder;
+        KDSoapHpackDecoder decoder;
+        QByteArray buffer;
+        // The delayed call keeps the only place for one second, the PING is answered once it started
+        socket.write(s_http2Preface + http2Frame(Http2SettingsFrame, 0, 0) + http2CountryRequest(&encoder, 1, "Very Delayed")
+                     + http2Frame(Http2PingFrame, 0, 0, QByteArray(8, 'p')));
+        const QList<Http2Frame> frames = readHttp2Frames(socket, buffer, [](const Http2Frame &frame) {
+            return frame.type == Http2PingFrame && (frame.flags & 0x1);
+        });
+        QVERIFY(!frames.isEmpty());
+        QCOMPARE(frames.last().type, int(Http2PingFrame));
+
+        // Queued at 0 ms, times out at 700 ms
+        socket.write(http2CountryRequest(&encoder, 3, "David Ä Faure"));
+        QVERIFY(socket.waitForBytesWritten());
+        QTRY_COMPARE(server->queuedRequestCount(), 1);
+        QTest::qWait(500);
+        // Queued at 500 ms, would time out at 1200 ms, but is admitted when the delayed call is done, at 1000 ms
+        socket.write(http2CountryRequest(&encoder, 5, "Slow"));
+        QVERIFY(socket.waitForBytesWritten());
+
+        KDSoapHttpHeaderList headers;
+        QByteArray body;
+        QVERIFY(readHttp2Response(socket, buffer, &decoder, 3, &headers, &body));
+        QCOMPARE(headers.value(0), KDSoapHttpHeader(":status", "503"));
+        headers.clear();
+        body.clear();
+        QVERIFY(readHttp2Response(socket, buffer, &decoder, 5, &headers, &body));
+        QCOMPARE(headers.value(0), KDSoapHttpHeader(":status", "200"));
+        QVERIFY(body.contains("Slow France"));
+        QCOMPARE(server->timedOutRequestCount(), 1);
+    }
+
+    void testHandlerThreads()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setHandlerThreadCount(2);
+        QCOMPARE(server->handlerThreadCount(), 2);
+
+        // Each barrier call only returns once the other one is running too,
+        // which requires them to run in two threads of the handler pool at the same time
+        s_barrierMutex.lock();
+        s_barrierCount = 0;
+        s_barrierMutex.unlock();
+        const QByteArray message = rawCountryMessage("Barrier");
+        const QByteArray request = "POST / HTTP/1.1\r\n"
+                                   "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                                   "Content-Type: text/xml;charset=utf-8\r\n"
+                                   "Content-Length: "
+            + QByteArray::number(message.size()) + "\r\n\r\n" + message;
+        ClientSocket firstSocket(server);
+        QVERIFY(firstSocket.waitForConnected());
+        firstSocket.write(request);
+        QVERIFY(firstSocket.waitForBytesWritten());
+        ClientSocket secondSocket(server);
+        QVERIFY(secondSocket.waitForConnected());
+        secondSocket.write(request);
+        QVERIFY(secondSocket.waitForBytesWritten());
+
+        // The server thread isn't blocked meanwhile
+        makeSimpleCall(server->endPoint());
+        makeFaultyCall(server->endPoint());
+
+        for (ClientSocket *socket : {&firstSocket, &secondSocket}) {
+            QVERIFY(socket->waitForReadyRead(20000));
+            const QByteArray response = socket->readAll();
+            QVERIFY2(response.startsWith("HTTP/1.1 200 OK\r\n"), response.constData());
+            // The header items of the server object of the handler thread are sent
+            QVERIFY(response.contains("\r\nAccess-Control-Allow-Origin: *\r\n"));
+            QVERIFY(xmlBufferCompare(response.mid(response.indexOf("\r\n\r\n") + 4), expectedCountryResponse("Barrier")));
+        }
+    }
+
+    void testIdleTimeout()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setIdleTimeout(300);
+
+        // A connection which doesn't send anything
+        ClientSocket idleSocket(server);
+        QVERIFY(idleSocket.waitForConnected());
+
+        // A keep-alive connection, after its first request
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        const QByteArray message = rawCountryMessage("David Ä Faure");
+        socket.write("POST / HTTP/1.1\r\n"
+                     "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                     "Content-Type: text/xml;charset=utf-8\r\n"
+                     "Content-Length: "
+                     + QByteArray::number(message.size()) + "\r\n\r\n" + message);
+        QVERIFY(socket.waitForBytesWritten());
+        QByteArray response;
+        while (!response.contains("David Ä Faure France") && socket.waitForReadyRead(5000)) {
+            response += socket.readAll();
+        }
+        QVERIFY2(response.startsWith("HTTP/1.1 200 OK"), response.constData());
+        QVERIFY(!response.contains("Connection: close"));
+
+        QVERIFY(idleSocket.state() == QAbstractSocket::UnconnectedState || idleSocket.waitForDisconnected(5000));
+        QVERIFY(socket.state() == QAbstractSocket::UnconnectedState || socket.waitForDisconnected(5000));
+        QTRY_COMPARE(server->numConnectedSockets(), 0);
+    }
+
+    void testMaxRequestsPerConnection()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setMaxRequestsPerConnection(2);
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        // Three pipelined requests: only two are answered, the second one with "Connection: close"
+        const QByteArray message = rawCountryMessage("David Ä Faure");
+        QByteArray requests;
+        for (int i = 0; i < 3; ++i) {
+            requests += "POST / HTTP/1.1\r\n"
+                        "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                        "Content-Type: text/xml;charset=utf-8\r\n"
+                        "Content-Length: "
+                + QByteArray::number(message.size()) + "\r\n\r\n" + message;
+        }
+        socket.write(requests);
+        QVERIFY(socket.waitForBytesWritten());
+
+        QByteArray responses;
+        while (socket.state() == QAbstractSocket::ConnectedState && socket.waitForReadyRead(5000)) {
+            responses += socket.readAll();
+        }
+        responses += socket.readAll();
+        QCOMPARE(responses.count("HTTP/1.1 200 OK"), 2);
+        QCOMPARE(responses.count("Connection: close\r\n"), 1);
+        QVERIFY(responses.indexOf("Connection: close") > responses.lastIndexOf("HTTP/1.1 200 OK"));
+        QVERIFY(socket.state() == QAbstractSocket::UnconnectedState || socket.waitForDisconnected(5000));
+    }
+
+    void testAdmissionControl()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setMaxConcurrentRequests(1);
+        server->setMaxQueuedRequests(1);
+        server->setRequestQueueTimeout(10000);
+
+        auto postRequest = [](ClientSocket &socket, const QByteArray &employeeName) {
+            const QByteArray message = rawCountryMessage(employeeName);
+            socket.write("POST / HTTP/1.1\r\n"
+                         "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                         "Content-Type: text/xml;charset=utf-8\r\n"
+                         "Content-Length: "
+                         + QByteArray::number(message.size()) + "\r\n\r\n" + message);
+            return socket.waitForBytesWritten();
+        };
+        auto readResponse = [](ClientSocket &socket, const QByteArray &expected) {
+            QByteArray response;
+            while (!response.contains(expected) && socket.waitForReadyRead(5000)) {
+                response += socket.readAll();
+            }
+            return response;
+        };
+
+        // The delayed response keeps the only place for one second
+        ClientSocket activeSocket(server);
+        QVERIFY(activeSocket.waitForConnected());
+        QVERIFY(postRequest(activeSocket, "Very Delayed"));
+        QTRY_COMPARE(server->activeRequestCount(), 1);
+
+        ClientSocket queuedSocket(server);
+        QVERIFY(queuedSocket.waitForConnected());
+        QVERIFY(postRequest(queuedSocket, "David Ä Faure"));
+        QTRY_COMPARE(server->queuedRequestCount(), 1);
+
+        // The queue is full: rejected, but the connection can still be used
+        ClientSocket rejectedSocket(server);
+        QVERIFY(rejectedSocket.waitForConnected());
+        QVERIFY(postRequest(rejectedSocket, "David Ä Faure"));
+        const QByteArray rejected = readResponse(rejectedSocket, "\r\n\r\n");
+        QVERIFY2(rejected.startsWith("HTTP/1.1 503 Service Unavailable\r\n"), rejected.constData());
+        QVERIFY(rejected.contains("\r\nRetry-After: 10\r\n"));
+        QCOMPARE(rejectedSocket.state(), QAbstractSocket::ConnectedState);
+        QCOMPARE(server->rejectedRequestCount(), 1);
+        QCOMPARE(server->timedOutRequestCount(), 0);
+
+        QVERIFY(readResponse(activeSocket, "Very Delayed France").startsWith("HTTP/1.1 200 OK"));
+        QVERIFY(readResponse(queuedSocket, "David Ä Faure France").startsWith("HTTP/1.1 200 OK"));
+        QTRY_COMPARE(server->activeRequestCount(), 0);
+        QCOMPARE(server->queuedRequestCount(), 0);
+
+        // Now that there's room again, the rejected client can retry on the same connection
+        QVERIFY(postRequest(rejectedSocket, "David Ä Faure"));
+        QVERIFY(readResponse(rejectedSocket, "David Ä Faure France").startsWith("HTTP/1.1 200 OK"));
+
+        server->resetRejectedRequestCount();
+        QCOMPARE(server->rejectedRequestCount(), 0);
+
+        // The exported counter isn't reset
+        server->setMetricsPath(QString::fromLatin1("/metrics"));
+        rejectedSocket.write("GET /metrics HTTP/1.1\r\n"
+                             "Host: 127.0.0.1\r\n"
+                             "\r\n");
+        const QByteArray expectedCounter = "\nkdsoap_rejected_requests_total 1\n";
+        QVERIFY(readResponse(rejectedSocket, expectedCounter).contains(expectedCounter));
+    }
+
+    void testCompression_data()
+    {
+        QTest::addColumn<bool>("streamParsing");
+
+        QTest::newRow("buffered") << false;
+        QTest::newRow("streaming") << true;
+    }
+
+    void testCompression()
+    {
+        QFETCH(bool, streamParsing);
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        if (streamParsing) {
+            server->setFeatures(KDSoapServer::StreamRequestParsing);
+        }
+        server->setResponseCompressionThreshold(0);
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        // qCompress prepends the uncompressed size to the zlib stream, which is what HTTP calls "deflate"
+        const QByteArray message = qCompress(rawCountryMessage("David Ä Faure")).mid(4);
+        socket.write("POST / HTTP/1.1\r\n"
+                     "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                     "Content-Type: text/xml;charset=utf-8\r\n"
+                     "Content-Encoding: deflate\r\n"
+                     "Accept-Encoding: gzip;q=0, deflate\r\n"
+                     "Content-Length: "
+                     + QByteArray::number(message.size()) + "\r\n\r\n" + message);
+        QVERIFY(socket.waitForBytesWritten());
+
+        QByteArray response;
+        int headerEnd = -1;
+        int contentLength = -1;
+        QElapsedTimer timer;
+        timer.start();
+        while (timer.elapsed() < 10000 && (contentLength < 0 || response.size() < headerEnd + 4 + contentLength)) {
+            if (socket.waitForReadyRead(1000)) {
+                response += socket.readAll();
+            }
+            headerEnd = response.indexOf("\r\n\r\n");
+            if (headerEnd >= 0 && contentLength < 0) {
+                const int pos = response.indexOf("Content-Length: ");
+                contentLength = response.mid(pos + 16, response.indexOf("\r\n", pos) - pos - 16).toInt();
+            }
+        }
+        if (response.startsWith("HTTP/1.1 415 ")) {
+            QSKIP("KDSoap was built without zlib");
+        }
+        QVERIFY2(response.startsWith("HTTP/1.1 200 OK\r\n"), response.constData());
+        const QByteArray headers = response.left(headerEnd);
+        QVERIFY2(headers.contains("\r\nContent-Encoding: deflate\r\n"), headers.constData());
+        QVERIFY(headers.contains("\r\nVary: Accept-Encoding"));
+        // qUncompress needs the size prefix back; it's only used as a hint for the buffer size
+        const QByteArray compressedBody = response.mid(headerEnd + 4, contentLength);
+        const QByteArray body = qUncompress(QByteArray("\x00\x01\x00\x00", 4) + compressedBody);
+        QVERIFY2(body.contains("David Ä Faure France"), body.constData());
+
+        // Unknown encodings are rejected
+        ClientSocket socket2(server);
+        QVERIFY(socket2.waitForConnected());
+        socket2.write("POST / HTTP/1.1\r\nContent-Encoding: br\r\nContent-Length: 4\r\n\r\nabcd");
+        QVERIFY(socket2.waitForBytesWritten());
+        QVERIFY(socket2.waitForReadyRead());
+        const QByteArray rejected = socket2.readAll();
+        QVERIFY2(rejected.startsWith("HTTP/1.1 415 Unsupported Media Type\r\n"), rejected.constData());
+    }
+
+    void testCompressedRequestBody_data()
+    {
+        QTest::addColumn<bool>("streamParsing");
+
+        QTest::newRow("buffered") << false;
+        QTest::newRow("streaming") << true;
+    }
+
+    void testCompressedRequestBody()
+    {
+        QFETCH(bool, streamParsing);
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        if (streamParsing) {
+            server->setFeatures(KDSoapServer::StreamRequestParsing);
+        }
+
+        // A single, small piece of compressed data inflating to much more than the inflater's output chunks (16 KB)
+        QByteArray uncompressed = rawCountryMessage("David Ä Faure");
+        uncompressed.insert(uncompressed.indexOf("?>") + 2, "<!--" + QByteArray(200 * 1024, 'x') + "-->");
+        const QByteArray message = qCompress(uncompressed).mid(4);
+        QVERIFY(message.size() < 4096);
+        auto postRequest = [&](ClientSocket &socket, const QByteArray &body) {
+            socket.write("POST / HTTP/1.1\r\n"
+                         "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                         "Content-Type: text/xml;charset=utf-8\r\n"
+                         "Content-Encoding: deflate\r\n"
+                         "Content-Length: "
+                         + QByteArray::number(body.size()) + "\r\n\r\n" + body);
+            QVERIFY(socket.waitForBytesWritten());
+        };
+        auto readResponse = [](ClientSocket &socket, const QByteArray &expected) {
+            QByteArray response;
+            while (!response.contains(expected) && socket.waitForReadyRead(5000)) {
+                response += socket.readAll();
+            }
+            return response;
+        };
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        postRequest(socket, message);
+        const QByteArray response = readResponse(socket, "France</employeeCountry>");
+        if (response.startsWith("HTTP/1.1 415 ")) {
+            QSKIP("KDSoap was built without zlib");
+        }
+        QVERIFY2(response.startsWith("HTTP/1.1 200 OK\r\n"), response.left(200).constData());
+        QVERIFY2(response.contains("David Ä Faure France"), response.constData());
+        // Compression isn't enabled on this server, so the response doesn't vary
+        QVERIFY(!response.contains("\r\nVary: "));
+
+        // A truncated compressed body is rejected, not handled as if it was complete
+        ClientSocket truncatedSocket(server);
+        QVERIFY(truncatedSocket.waitForConnected());
+        postRequest(truncatedSocket, message.left(message.size() - 8));
+        const QByteArray rejected = readResponse(truncatedSocket, "\r\n\r\n");
+        QVERIFY2(rejected.startsWith("HTTP/1.1 400 Bad Request\r\n"), rejected.constData());
+    }
+
+    void testVaryAcceptEncoding()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setResponseCompressionThreshold(100000); // larger than the response
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        // A compressed request, only to find out whether KDSoap was built with zlib
+        const QByteArray message = qCompress(rawCountryMessage("David Ä Faure")).mid(4);
+        socket.write("POST / HTTP/1.1\r\n"
+                     "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                     "Content-Type: text/xml;charset=utf-8\r\n"
+                     "Content-Encoding: deflate\r\n"
+                     "Accept-Encoding: gzip\r\n"
+                     "Content-Length: "
+                     + QByteArray::number(message.size()) + "\r\n\r\n" + message);
+        QVERIFY(socket.waitForBytesWritten());
+        QByteArray response;
+        while (!response.contains("France</employeeCountry>") && !response.startsWith("HTTP/1.1 415 ") && socket.waitForReadyRead(5000)) {
+            response += socket.readAll();
+        }
+        if (response.startsWith("HTTP/1.1 415 ")) {
+            QSKIP("KDSoap was built without zlib");
+        }
+        QVERIFY2(response.startsWith("HTTP/1.1 200 OK\r\n"), response.constData());
+        const QByteArray headers = response.left(response.indexOf("\r\n\r\n") + 2);
+        // Not compressed, but it would have been with another Accept-Encoding
+        QVERIFY(!headers.contains("Content-Encoding"));
+        QVERIFY2(headers.contains("\r\nVary: Accept-Encoding\r\n"), headers.constData());
+    }
+
+    void testStreamingResponse()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        const QByteArray message = rawCountryMessage("Streamed");
+        socket.write("POST / HTTP/1.1\r\n"
+                     "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                     "Content-Type: text/xml;charset=utf-8\r\n"
+                     "Content-Length: "
+                     + QByteArray::number(message.size()) + "\r\n\r\n" + message);
+        QVERIFY(socket.waitForBytesWritten());
+        // Don't read right away, so that the server has to wait for us
+        QTest::qWait(200);
+
+        QByteArray response;
+        QElapsedTimer timer;
+        timer.start();
+        while (!response.endsWith("\r\n0\r\n\r\n") && timer.elapsed() < 20000) {
+            if (socket.waitForReadyRead(1000)) {
+                response += socket.readAll();
+            }
+        }
+        const int headerEnd = response.indexOf("\r\n\r\n");
+        QVERIFY2(headerEnd > 0, response.left(200).constData());
+        const QByteArray headers = response.left(headerEnd + 2);
+        QVERIFY2(headers.startsWith("HTTP/1.1 200 OK\r\n"), headers.constData());
+        QVERIFY2(headers.contains("\r\nTransfer-Encoding: chunked\r\n"), headers.constData());
+        QVERIFY(!headers.contains("Content-Length"));
+
+        // Decode the chunks
+        QByteArray body;
+        int pos = headerEnd + 4;
+        for (;;) {
+            const int lineEnd = response.indexOf("\r\n", pos);
+            QVERIFY(lineEnd > 0);
+            bool ok;
+            const int chunkSize = response.mid(pos, lineEnd - pos).toInt(&ok, 16);
+            QVERIFY(ok);
+            if (chunkSize == 0) {
+                break;
+            }
+            body += response.mid(lineEnd + 2, chunkSize);
+            pos = lineEnd + 2 + chunkSize + 2;
+        }
+        QVERIFY(body.startsWith("<?xml"));
+        QVERIFY(body.contains(">Country 0</"));
+        QVERIFY(body.contains(QByteArray(">Country ") + QByteArray::number(s_streamedElementCount - 1) + "</"));
+        QCOMPARE(body.count("<employeeCountry>"), s_streamedElementCount);
+        QVERIFY2(body.endsWith("</soap:Body></soap:Envelope>\n"), body.right(100).constData());
+
+        // The connection can be used for the next request
+        const QByteArray message2 = rawCountryMessage();
+        socket.write("POST / HTTP/1.1\r\n"
+                     "SoapAction: http://www.kdab.com/xml/MyWsdl/getEmployeeCountry\r\n"
+                     "Content-Type: text/xml;charset=utf-8\r\n"
+                     "Content-Length: "
+                     + QByteArray::number(message2.size()) + "\r\n\r\n" + message2);
+        QVERIFY(socket.waitForBytesWritten());
+        QByteArray response2;
+        while (!response2.contains("</soap:Envelope>") && socket.waitForReadyRead(3000)) {
+            response2 += socket.readAll();
+        }
+        QVERIFY2(response2.contains("David Ä Faure France"), response2.constData());
+    }
+
+    void testBadRequest_data()
+    {
+        QTest::addColumn<QByteArray>("request");
+
+        QTest::newRow("no_path") << QByteArray("GARBAGE\r\n\r\n");
+        QTest::newRow("bad_content_length") << QByteArray("POST / HTTP/1.1\r\nContent-Length: 12abc\r\n\r\n");
+        QTest::newRow("bad_chunk_size") << QByteArray("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nxyz\r\n");
+    }
+
+    void testBadRequest()
+    {
+        QFETCH(QByteArray, request);
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        socket.write(request);
+        QVERIFY(socket.waitForBytesWritten());
+        QVERIFY(socket.waitForReadyRead());
+        const QByteArray response = socket.readAll();
+        QVERIFY2(response.startsWith("HTTP/1.1 400 Bad Request\r\n"), response.constData());
+    }
+
+    void testRequestLimits_data()
+    {
+        QTest::addColumn<QByteArray>("request");
+        QTest::addColumn<QByteArray>("expectedStatus");
+
+        // Only the headers are sent: the request is rejected before its body is received
+        QTest::newRow("content_length") << QByteArray("POST / HTTP/1.1\r\nContent-Length: 2000000000\r\n\r\n") << QByteArray("413 Payload Too Large");
+        QTest::newRow("chunk_size") << QByteArray("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n7fffffff\r\n") << QByteArray("413 Payload Too Large");
+        QTest::newRow("chunk_count") << QByteArray("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1\r\na\r\n1\r\nb\r\n1\r\nc\r\n1\r\nd\r\n")
+                                     << QByteArray("413 Payload Too Large");
+        QTest::newRow("header_count") << QByteArray("POST / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\nD: 4\r\nE: 5\r\n")
+                                      << QByteArray("431 Request Header Fields Too Large");
+        // Not even terminated
+        QTest::newRow("header_size") << "POST / HTTP/1.1\r\nX-Long: " + QByteArray(2000, 'x') << QByteArray("431 Request Header Fields Too Large");
+    }
+
+    void testRequestLimits()
+    {
+        QFETCH(QByteArray, request);
+        QFETCH(QByteArray, expectedStatus);
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setMaxRequestHeaderSize(1024);
+        server->setMaxRequestHeaderCount(4);
+        server->setMaxRequestBodySize(1000);
+        server->setMaxRequestChunkCount(3);
+        QCOMPARE(server->maxRequestBodySize(), qint64(1000));
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        socket.write(request);
+        QVERIFY(socket.waitForBytesWritten());
+        QVERIFY(socket.waitForReadyRead());
+        const QByteArray response = socket.readAll();
+        QVERIFY2(response.startsWith("HTTP/1.1 " + expectedStatus + "\r\n"), response.constData());
+        QVERIFY(response.contains("Connection: close"));
+        QVERIFY(socket.state() == QAbstractSocket::UnconnectedState || socket.waitForDisconnected());
+    }
+
+    void testDefaultBodySizeLimit()
+    {
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        QCOMPARE(server->maxRequestBodySize(), qint64(64 * 1024 * 1024));
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        socket.write("POST / HTTP/1.1\r\nContent-Length: 100000000\r\n\r\n");
+        QVERIFY(socket.waitForBytesWritten());
+        QVERIFY(socket.waitForReadyRead());
+        const QByteArray response = socket.readAll();
+        QVERIFY2(response.startsWith("HTTP/1.1 413 Payload Too Large\r\n"), response.constData());
+    }
+
+    void testBodyLargerThanBuffer_data()
+    {
+        QTest::addColumn<QByteArray>("request");
+
+        QTest::newRow("content_length") << QByteArray("POST / HTTP/1.1\r\nContent-Length: 3000000000\r\n\r\n");
+        QTest::newRow("content_length_max") << QByteArray("POST / HTTP/1.1\r\nContent-Length: 9223372036854775807\r\n\r\n");
+        QTest::newRow("chunk_size") << QByteArray("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n80000000\r\n");
+        QTest::newRow("chunk_sizes") << QByteArray("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1\r\na\r\n7fffffff\r\n");
+    }
+
+    // Even without a limit, a body which can't be buffered is rejected before it's received
+    void testBodyLargerThanBuffer()
+    {
+        QFETCH(QByteArray, request);
+        CountryServerThread serverThread;
+        CountryServer *server = serverThread.startThread();
+        server->setMaxRequestBodySize(-1);
+
+        ClientSocket socket(server);
+        QVERIFY(socket.waitForConnected());
+        socket.write(request);
+        QVERIFY(socket.waitForBytesWritten());
+        QVERIFY(socket.waitForReadyRead());
+        const QByteArray response = socket.readAll();
+        QVERIFY2(response.startsWith("HTTP/1.1 413 Payload Too Large\r\n"), response.constData());
+        QVERIFY(socket.state() == QAbstractSocket::UnconnectedState || socket.waitForDisconnected());
+    }
+
     void testChunkedTransferEncoding_data()
     {
         QTest::addColumn<int>("chunkSize");
@@ -1532,6 +2760,34 @@ void CountryServerObject::processRequest(const KDSoapMessage &request, KDSoapMes
             return;
         }
         const QString employeeName = request.childValues().child(QLatin1String("employeeName")).value().toString();
+        if (employeeName == QLatin1String("Delayed") || employeeName == QLatin1String("Very Delayed")) {
+            const KDSoapDelayedResponseHandle handle = prepareDelayedResponse();
+            const int delay = employeeName == QLatin1String("Delayed") ? 100 : 1000;
+            QTimer::singleShot(delay, this, [this, handle, employeeName]() {
+                KDSoapMessage delayedResponse;
+                delayedResponse.setValue(QLatin1String("getEmployeeCountryResponse"));
+                delayedResponse.addArgument(QLatin1String("employeeCountry"), employeeName + QLatin1String(" France"));
+                sendDelayedResponse(handle, delayedResponse);
+            });
+            return;
+        }
+        if (employeeName == QLatin1String("Streamed")) {
+            // Many elements, written as fast as the client reads them
+            KDSoapStreamingResponse *stream = prepareStreamingResponse();
+            stream->start(KDSoapMessage());
+            QSharedPointer<int> next(new int(0));
+            auto writeMore = [stream, next]() {
+                while (*next < s_streamedElementCount && !stream->isBufferFull()) {
+                    stream->writeElement(KDSoapValue(QLatin1String("employeeCountry"), QString::fromLatin1("Country %1").arg((*next)++)));
+                }
+                if (*next == s_streamedElementCount) {
+                    stream->finish();
+                }
+            };
+            connect(stream, &KDSoapStreamingResponse::readyForMoreData, stream, writeMore);
+            writeMore();
+            return;
+        }
         const QString ret = this->getEmployeeCountry(employeeName);
         if (!hasFault()) {
             response.setValue(QLatin1String("getEmployeeCountryResponse"));
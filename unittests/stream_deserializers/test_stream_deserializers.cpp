@@ -0,0 +1,165 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#include "httpserver_p.h"
+#include "wsdl_stream_deserializers.h"
+#include <QDebug>
+#include <QEventLoop>
+#include <QTest>
+#include <QXmlStreamReader>
+
+using namespace KDSoapUnitTestHelpers;
+
+static const char s_responseElement[] = "<tns:GetOrdersResponse xmlns:tns=\"http://www.kdab.com/stream-deserializers\" count=\"2\">"
+                                        "<tns:order>"
+                                        "<tns:id>1</tns:id>"
+                                        "<tns:status>Shipped</tns:status>"
+                                        "<tns:created>2022-03-04T10:20:30Z</tns:created>"
+                                        "<tns:data>aGVsbG8=</tns:data>"
+                                        "<tns:tag>fragile</tns:tag>"
+                                        "<tns:tag>express</tns:tag>"
+                                        "<tns:price currency=\"EUR\">12.5</tns:price>"
+                                        "</tns:order>"
+                                        "<tns:order>"
+                                        "<tns:id>2</tns:id>"
+                                        "<tns:status>Open</tns:status>"
+                                        "<tns:created>2022-03-05T08:00:00Z</tns:created>"
+                                        "<tns:data></tns:data>"
+                                        "<tns:unknown><tns:id>42</tns:id></tns:unknown>"
+                                        "<tns:price currency=\"USD\">30</tns:price>"
+                                        "</tns:order>"
+                                        "<tns:total>42.5</tns:total>"
+                                        "<tns:comment>two orders</tns:comment>"
+                                        "</tns:GetOrdersResponse>";
+
+static QByteArray getOrdersResponse()
+{
+    return QByteArray(xmlEnvBegin11()) + "><soap:Body>" + s_responseElement + "</soap:Body>" + xmlEnvEnd();
+}
+
+class StreamDeserializersTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    static void checkResponse(const TNS__GetOrdersResponse &response)
+    {
+        QCOMPARE(response.count(), 2);
+        QCOMPARE(response.total(), 42.5);
+        QCOMPARE(response.comment(), QString::fromLatin1("two orders"));
+
+        const QList<TNS__Order> orders = response.order();
+        QCOMPARE(orders.count(), 2);
+        QCOMPARE(orders.at(0).id(), 1);
+        QCOMPARE(orders.at(0).status().type(), TNS__Status::Shipped);
+        QCOMPARE(QDateTime(orders.at(0).created()), QDateTime(QDate(2022, 3, 4), QTime(10, 20, 30), Qt::UTC));
+        QCOMPARE(orders.at(0).data(), QByteArray("hello"));
+        QCOMPARE(orders.at(0).tag(), QList<QString>() << QString::fromLatin1("fragile") << QString::fromLatin1("express"));
+        QCOMPARE(orders.at(0).price().value(), 12.5);
+        QCOMPARE(orders.at(0).price().currency(), QString::fromLatin1("EUR"));
+
+        QCOMPARE(orders.at(1).id(), 2); // not overwritten by the unknown element
+        QCOMPARE(orders.at(1).status().type(), TNS__Status::Open);
+        QVERIFY(orders.at(1).data().isEmpty());
+        QVERIFY(orders.at(1).tag().isEmpty());
+        QCOMPARE(orders.at(1).price().value(), 30.0);
+        QCOMPARE(orders.at(1).price().currency(), QString::fromLatin1("USD"));
+    }
+
+private Q_SLOTS:
+    void testDeserializeFromStream()
+    {
+        QXmlStreamReader reader(QByteArray(s_responseElement));
+        QVERIFY(reader.readNextStartElement());
+        TNS__GetOrdersResponse response;
+        response.deserialize(reader);
+        QVERIFY(!reader.hasError());
+        QVERIFY(reader.isEndElement());
+        QCOMPARE(reader.name().toString(), QString::fromLatin1("GetOrdersResponse"));
+        checkResponse(response);
+
+        // Same result as with the KDSoapValue deserializer
+        QXmlStreamReader valueReader(QByteArray(s_responseElement));
+        QVERIFY(valueReader.readNextStartElement());
+        TNS__GetOrdersResponse fromValue;
+        fromValue.deserialize(KDSoapValue::fromXml(valueReader));
+        checkResponse(fromValue);
+        QCOMPARE(fromValue.serialize(QString::fromLatin1("GetOrdersResponse")), response.serialize(QString::fromLatin1("GetOrdersResponse")));
+    }
+
+    void testSyncCall()
+    {
+        HttpServerThread server(getOrdersResponse(), HttpServerThread::Public);
+        OrderService service;
+        service.setEndPoint(server.endPoint());
+
+        TNS__GetOrders request;
+        request.setCustomer(QString::fromLatin1("KDAB"));
+        const TNS__GetOrdersResponse response = service.getOrders(request);
+        QVERIFY2(service.lastError().isEmpty(), qPrintable(service.lastError()));
+        checkResponse(response);
+    }
+
+    void testSyncCallFault()
+    {
+        const QByteArray fault = QByteArray(xmlEnvBegin11())
+            + "><soap:Body><soap:Fault><faultcode>soap:Server</faultcode><faultstring>No such customer</faultstring></soap:Fault></soap:Body>"
+            + xmlEnvEnd();
+        HttpServerThread server(fault, HttpServerThread::Public);
+        OrderService service;
+        service.setEndPoint(server.endPoint());
+
+        const TNS__GetOrdersResponse response = service.getOrders(TNS__GetOrders());
+        QVERIFY(service.lastError().contains(QLatin1String("No such customer")));
+        QVERIFY(response.order().isEmpty());
+    }
+
+    void testQNames()
+    {
+        // The prefixes are declared on the Envelope and on the response element, not on the elements of the QNames
+        const QByteArray xml = QByteArray(xmlEnvBegin11())
+            + " xmlns:k=\"http://www.kdab.com/kinds\"><soap:Body>"
+              "<tns:GetKindResponse xmlns:tns=\"http://www.kdab.com/stream-deserializers\" xmlns:m=\"http://www.kdab.com/more-kinds\">"
+              "<tns:classification><tns:kind>k:Fruit</tns:kind><tns:related>m:Vegetable</tns:related></tns:classification>"
+              "</tns:GetKindResponse></soap:Body>"
+            + xmlEnvEnd();
+        HttpServerThread server(xml, HttpServerThread::Public);
+        OrderService service;
+        service.setEndPoint(server.endPoint());
+
+        const TNS__GetKindResponse response = service.getKind(TNS__GetKind());
+        QVERIFY2(service.lastError().isEmpty(), qPrintable(service.lastError()));
+        QCOMPARE(response.classification().kind().localName(), QString::fromLatin1("Fruit"));
+        QCOMPARE(response.classification().kind().nameSpace(), QString::fromLatin1("http://www.kdab.com/kinds"));
+        QCOMPARE(response.classification().related().localName(), QString::fromLatin1("Vegetable"));
+        QCOMPARE(response.classification().related().nameSpace(), QString::fromLatin1("http://www.kdab.com/more-kinds"));
+    }
+
+    void testJob()
+    {
+        HttpServerThread server(getOrdersResponse(), HttpServerThread::Public);
+        OrderService service;
+        service.setEndPoint(server.endPoint());
+
+        GetOrdersJob job(&service);
+        job.setAutoDelete(false);
+        QEventLoop eventLoop;
+        connect(&job, &GetOrdersJob::finished, &eventLoop, &QEventLoop::quit);
+        job.start();
+        eventLoop.exec();
+
+        QVERIFY2(!job.isFault(), qPrintable(job.faultAsString()));
+        checkResponse(job.response());
+    }
+};
+
+QTEST_MAIN(StreamDeserializersTest)
+
+#include "test_stream_deserializers.moc"
@@ -0,0 +1,364 @@
+/****************************************************************************
+**
+** This file is part of the KD Soap project.
+**
+** SPDX-FileCopyrightText: 2022 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+**
+** SPDX-License-Identifier: MIT
+**
+****************************************************************************/
+
+#include "httpserver_p.h"
+#include "wsdl_stream_serializers.h"
+#include <KDSoapServer.h>
+#include <QDebug>
+#include <QEventLoop>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTest>
+#include <QTimer>
+#include <QXmlStreamWriter>
+
+using namespace KDSoapUnitTestHelpers;
+
+static const char s_namespace[] = "http://www.kdab.com/stream-serializers";
+
+static TNS__Order makeOrder(int id, TNS__Status::Type status, const QByteArray &data, const QStringList &tags, double price, const QString &currency)
+{
+    TNS__Order order;
+    order.setId(id);
+    TNS__Status orderStatus;
+    orderStatus.setType(status);
+    order.setStatus(orderStatus);
+    order.setCreated(KDDateTime(QDateTime(QDate(2022, 3, 4), QTime(10, 20, 30), Qt::UTC)));
+    order.setData(data);
+    order.setTag(tags);
+    TNS__Price orderPrice;
+    orderPrice.setValue(price);
+    orderPrice.setCurrency(currency);
+    order.setPrice(orderPrice);
+    order.setPriority(id + 1);
+    return order;
+}
+
+static TNS__PlaceOrder placeOrderRequest()
+{
+    TNS__Order first = makeOrder(1, TNS__Status::Shipped, QByteArray("hello"), QStringList() << QString::fromLatin1("fragile") << QString::fromLatin1("express"), 12.5,
+                                 QString::fromLatin1("EUR"));
+    first.setNote(QString::fromLatin1("Handle with care"));
+    const TNS__Order second = makeOrder(2, TNS__Status::Open, QByteArray(), QStringList(), 30, QString::fromLatin1("USD"));
+
+    TNS__PlaceOrder request;
+    request.setCustomer(QString::fromLatin1("KDAB"));
+    request.setOrder(QList<TNS__Order>() << first << second);
+    return request;
+}
+
+static const char s_ordersElements[] = "<n1:order priority=\"2\">"
+                                       "<n1:id>1</n1:id>"
+                                       "<n1:status>Shipped</n1:status>"
+                                       "<n1:created>2022-03-04T10:20:30Z</n1:created>"
+                                       "<n1:data>aGVsbG8=</n1:data>"
+                                       "<n1:tag>fragile</n1:tag>"
+                                       "<n1:tag>express</n1:tag>"
+                                       "<n1:price currency=\"EUR\">12.5</n1:price>"
+                                       "<n1:note>Handle with care</n1:note>"
+                                       "</n1:order>"
+                                       "<n1:order priority=\"3\">"
+                                       "<n1:id>2</n1:id>"
+                                       "<n1:status>Open</n1:status>"
+                                       "<n1:created>2022-03-04T10:20:30Z</n1:created>"
+                                       "<n1:data/>"
+                                       "<n1:price currency=\"USD\">30</n1:price>"
+                                       "</n1:order>";
+
+static QByteArray requestElement()
+{
+    return QByteArray("<n1:PlaceOrder><n1:customer>KDAB</n1:customer>") + s_ordersElements + "</n1:PlaceOrder>";
+}
+
+// Requests from this customer, and for this order id, are answered with a delayed response
+static const char s_delayedCustomer[] = "delayed";
+static const int s_delayedOrderId = 42;
+
+// Returns the response like the server stubs do without -stream-serializers, from KDSoapValues
+static KDSoapMessage getOrdersValueResponse(const TNS__GetOrdersResponse &ret)
+{
+    KDSoapMessage response;
+    response = ret.serialize(QString::fromLatin1("GetOrdersResponse"));
+    response.setNamespaceUri(QString::fromLatin1(s_namespace));
+    response.setQualified(true);
+    return response;
+}
+
+static KDSoapMessage getOrderValueResponse(const TNS__Order &ret)
+{
+    KDSoapValue wrapper(QString::fromLatin1("GetOrderResponse"), QVariant(), QString::fromLatin1(s_namespace));
+    wrapper.childValues().append(ret.serialize(QString::fromLatin1("order")));
+    KDSoapMessage response;
+    response = wrapper;
+    return response;
+}
+
+// Answers with the generated code, which streams the responses
+class OrderServerObject : public OrderServiceServerBase
+{
+public:
+    TNS__PlaceOrderResponse placeOrder(const TNS__PlaceOrder &request) override
+    {
+        TNS__PlaceOrderResponse ret;
+        ret.setAccepted(request.order().count());
+        return ret;
+    }
+
+    TNS__GetOrdersResponse getOrders(const TNS__GetOrders &request) override
+    {
+        TNS__GetOrdersResponse ret;
+        ret.setOrder(placeOrderRequest().order());
+        if (request.customer() == QLatin1String(s_delayedCustomer)) {
+            const KDSoapDelayedResponseHandle handle = prepareDelayedResponse();
+            QTimer::singleShot(10, this, [this, handle, ret]() {
+                sendGetOrdersResponse(handle, ret);
+            });
+            return TNS__GetOrdersResponse();
+        }
+        m_lastResponse = ret;
+        return ret;
+    }
+
+protected:
+    virtual void sendGetOrdersResponse(const KDSoapDelayedResponseHandle &handle, const TNS__GetOrdersResponse &ret)
+    {
+        getOrdersResponse(handle, ret);
+    }
+
+    TNS__GetOrdersResponse m_lastResponse;
+};
+
+// Answers with the same orders, from KDSoapValues
+class OrderValueServerObject : public OrderServerObject
+{
+public:
+    void processRequest(const KDSoapMessage &request, KDSoapMessage &response, const QByteArray &soapAction) override
+    {
+        OrderServerObject::processRequest(request, response, soapAction);
+        if (request.name() == QLatin1String("GetOrders") && !hasFault() && !isDelayedResponse()) {
+            response = getOrdersValueResponse(m_lastResponse);
+        }
+    }
+
+protected:
+    void sendGetOrdersResponse(const KDSoapDelayedResponseHandle &handle, const TNS__GetOrdersResponse &ret) override
+    {
+        sendDelayedResponse(handle, getOrdersValueResponse(ret));
+    }
+};
+
+class OrderRpcServerObject : public OrderRpcServiceServerBase
+{
+public:
+    TNS__Order getOrder(int id) override
+    {
+        TNS__Order ret = placeOrderRequest().order().first();
+        ret.setId(id);
+        if (id == s_delayedOrderId) {
+            const KDSoapDelayedResponseHandle handle = prepareDelayedResponse();
+            QTimer::singleShot(10, this, [this, handle, ret]() {
+                sendGetOrderResponse(handle, ret);
+            });
+            return TNS__Order();
+        }
+        m_lastResponse = ret;
+        return ret;
+    }
+
+protected:
+    virtual void sendGetOrderResponse(const KDSoapDelayedResponseHandle &handle, const TNS__Order &ret)
+    {
+        getOrderResponse(handle, ret);
+    }
+
+    TNS__Order m_lastResponse;
+};
+
+class OrderRpcValueServerObject : public OrderRpcServerObject
+{
+public:
+    void processRequest(const KDSoapMessage &request, KDSoapMessage &response, const QByteArray &soapAction) override
+    {
+        OrderRpcServerObject::processRequest(request, response, soapAction);
+        if (request.name() == QLatin1String("GetOrder") && !hasFault() && !isDelayedResponse()) {
+            response = getOrderValueResponse(m_lastResponse);
+        }
+    }
+
+protected:
+    void sendGetOrderResponse(const KDSoapDelayedResponseHandle &handle, const TNS__Order &ret) override
+    {
+        sendDelayedResponse(handle, getOrderValueResponse(ret));
+    }
+};
+
+template<class ServerObjectType>
+class OrderServer : public KDSoapServer
+{
+public:
+    OrderServer()
+    {
+        setPath(QLatin1String("/orders"));
+    }
+    QObject *createServerObject() override
+    {
+        return new ServerObjectType;
+    }
+};
+
+// Posts a raw request to a server answering with ServerObjectType, returns the response
+template<class ServerObjectType>
+static QByteArray postToServer(const QByteArray &soapAction, const QByteArray &request)
+{
+    TestServerThread<OrderServer<ServerObjectType>> serverThread;
+    OrderServer<ServerObjectType> *server = serverThread.startThread();
+
+    QNetworkRequest networkRequest(QUrl(server->endPoint()));
+    networkRequest.setRawHeader("SoapAction", soapAction);
+    networkRequest.setHeader(QNetworkRequest::ContentTypeHeader, QByteArray("text/xml;charset=utf-8"));
+    QNetworkAccessManager accessManager;
+    QNetworkReply *reply = accessManager.post(networkRequest, request);
+    QEventLoop loop;
+    QObject::connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+    const QByteArray response = reply->readAll();
+    delete reply;
+    return response;
+}
+
+class StreamSerializersTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Writes the contents of the request in a PlaceOrder element, either with writeTo() or from serialize()
+    static QByteArray writeRequest(const TNS__PlaceOrder &request, bool stream)
+    {
+        const QString ns = QString::fromLatin1(s_namespace);
+        QByteArray data;
+        QXmlStreamWriter writer(&data);
+        writer.writeNamespace(ns, QString::fromLatin1("n1"));
+        writer.writeStartElement(ns, QString::fromLatin1("PlaceOrder"));
+        if (stream) {
+            request.writeTo(writer, ns);
+        } else {
+            request.serialize(QString::fromLatin1("PlaceOrder")).writeXmlContents(writer, ns);
+        }
+        writer.writeEndElement();
+        return data;
+    }
+
+private Q_SLOTS:
+    void testWriteTo()
+    {
+        const TNS__PlaceOrder request = placeOrderRequest();
+        const QByteArray streamed = writeRequest(request, true);
+        QVERIFY(xmlBufferCompare(streamed, writeRequest(request, false)));
+
+        QByteArray expected = requestElement();
+        expected.replace("<n1:PlaceOrder>", "<n1:PlaceOrder xmlns:n1=\"http://www.kdab.com/stream-serializers\">");
+        QVERIFY(xmlBufferCompare(streamed, expected));
+    }
+
+    void testSyncCall()
+    {
+        const QByteArray response = QByteArray(xmlEnvBegin11())
+            + "><soap:Body><tns:PlaceOrderResponse xmlns:tns=\"http://www.kdab.com/stream-serializers\"><tns:accepted>2</tns:accepted>"
+              "</tns:PlaceOrderResponse></soap:Body>"
+            + xmlEnvEnd();
+        HttpServerThread server(response, HttpServerThread::Public);
+        OrderService service;
+        service.setEndPoint(server.endPoint());
+
+        const TNS__PlaceOrderResponse ret = service.placeOrder(placeOrderRequest());
+        QVERIFY2(service.lastError().isEmpty(), qPrintable(service.lastError()));
+        QCOMPARE(ret.accepted(), 2);
+
+        const QByteArray expectedRequest = QByteArray(xmlEnvBegin11()) + " xmlns:n1=\"http://www.kdab.com/stream-serializers\"><soap:Body>"
+            + requestElement() + "</soap:Body>" + xmlEnvEnd() + '\n'; // added by QXmlStreamWriter::writeEndDocument
+        QVERIFY(xmlBufferCompare(server.receivedData(), expectedRequest));
+    }
+
+    void testServerResponse_data()
+    {
+        QTest::addColumn<bool>("rpc");
+        QTest::addColumn<bool>("delayed");
+
+        QTest::newRow("document") << false << false;
+        QTest::newRow("document_delayed") << false << true;
+        QTest::newRow("rpc") << true << false;
+        QTest::newRow("rpc_delayed") << true << true;
+    }
+
+    // The streamed responses of the server stubs are the same as the ones made of KDSoapValues
+    void testServerResponse()
+    {
+        QFETCH(bool, rpc);
+        QFETCH(bool, delayed);
+
+        QByteArray streamed;
+        QByteArray values;
+        if (rpc) {
+            const QByteArray id = QByteArray::number(delayed ? s_delayedOrderId : 1);
+            const QByteArray request = QByteArray(xmlEnvBegin11()) + "><soap:Body><n1:GetOrder xmlns:n1=\"http://www.kdab.com/stream-serializers\"><id>" + id
+                + "</id></n1:GetOrder></soap:Body>" + xmlEnvEnd();
+            const QByteArray soapAction = "http://www.kdab.com/stream-serializers/GetOrder";
+            streamed = postToServer<OrderRpcServerObject>(soapAction, request);
+            values = postToServer<OrderRpcValueServerObject>(soapAction, request);
+            QVERIFY2(streamed.contains("GetOrderResponse"), streamed.constData());
+        } else {
+            const QByteArray customer = delayed ? QByteArray(s_delayedCustomer) : QByteArray("KDAB");
+            const QByteArray request = QByteArray(xmlEnvBegin11()) + "><soap:Body><n1:GetOrders xmlns:n1=\"http://www.kdab.com/stream-serializers\">"
+                + "<n1:customer>" + customer + "</n1:customer></n1:GetOrders></soap:Body>" + xmlEnvEnd();
+            const QByteArray soapAction = "http://www.kdab.com/stream-serializers/GetOrders";
+            streamed = postToServer<OrderServerObject>(soapAction, request);
+            values = postToServer<OrderValueServerObject>(soapAction, request);
+
+            const QByteArray expected = QByteArray(xmlEnvBegin11()) + "><soap:Body><n1:GetOrdersResponse xmlns:n1=\"http://www.kdab.com/stream-serializers\">"
+                + s_ordersElements + "</n1:GetOrdersResponse></soap:Body>" + xmlEnvEnd() + '\n'; // added by QXmlStreamWriter::writeEndDocument
+            QVERIFY(xmlBufferCompare(streamed, expected));
+        }
+        QVERIFY(xmlBufferCompare(streamed, values));
+    }
+
+    // The generated client reads the streamed responses
+    void testServerCall()
+    {
+        TestServerThread<OrderServer<OrderServerObject>> serverThread;
+        OrderServer<OrderServerObject> *server = serverThread.startThread();
+        OrderService service;
+        service.setEndPoint(server->endPoint());
+
+        TNS__GetOrders request;
+        request.setCustomer(QString::fromLatin1(s_delayedCustomer));
+        const TNS__GetOrdersResponse ret = service.getOrders(request);
+        QVERIFY2(service.lastError().isEmpty(), qPrintable(service.lastError()));
+        QCOMPARE(ret.order().count(), 2);
+        QCOMPARE(ret.order().at(0).tag(), QStringList() << QString::fromLatin1("fragile") << QString::fromLatin1("express"));
+        QCOMPARE(ret.order().at(0).note(), QString::fromLatin1("Handle with care"));
+        QCOMPARE(ret.order().at(1).price().currency(), QString::fromLatin1("USD"));
+
+        TestServerThread<OrderServer<OrderRpcServerObject>> rpcServerThread;
+        OrderServer<OrderRpcServerObject> *rpcServer = rpcServerThread.startThread();
+        OrderRpcService rpcService;
+        rpcService.setEndPoint(rpcServer->endPoint());
+
+        const TNS__Order order = rpcService.getOrder(7);
+        QVERIFY2(rpcService.lastError().isEmpty(), qPrintable(rpcService.lastError()));
+        QCOMPARE(order.id(), 7);
+        QCOMPARE(order.data(), QByteArray("hello"));
+        QCOMPARE(order.price().value(), 12.5);
+    }
+};
+
+QTEST_MAIN(StreamSerializersTest)
+
+#include "test_stream_serializers.moc"